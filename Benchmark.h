@@ -0,0 +1,349 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_BENCHMARK_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_BENCHMARK_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PerfCounters.h"
+
+/**
+ * Keeps the compiler from discarding a computation whose result is otherwise unused.
+ */
+template<typename T>
+inline void doNotOptimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+/**
+ * Micro-benchmark harness for the isotope distribution estimators.
+ *
+ * Every call is timed on its own, so the result carries per-call statistics rather than one wall-clock number.
+ * A benchmark is run for a number of untimed warm-up passes over its inputs, followed by the timed trials.
+ * The cost of reading the clock is measured once and subtracted from every sample.
+ *
+ * With hardware counters enabled, every trial is followed by an untimed pass that is counted with
+ * PerfCounters, so the counts do not include the clock reads around each call.
+ *
+ * runScaling runs the same work on 1..N threads at once to measure throughput scaling.
+ */
+class Benchmark {
+
+public:
+
+    struct Result {
+        std::string method;
+        std::string comparison;
+        int isotope;
+        std::size_t calls;      // timed calls over all trials
+        double totalMs;         // median time of one trial, i.e. of one pass over the inputs
+        double meanNs;
+        double minNs;
+        double medianNs;
+        double p99Ns;
+        double maxNs;
+
+        // per call, NaN if not counted
+        double cycles;
+        double instructions;
+        double cacheMisses;
+        double branchMisses;
+
+        double ipc() const { return instructions / cycles; }
+    };
+
+    struct ScalingResult {
+        std::string method;
+        std::string comparison;
+        std::string inputs;     // "shared" if all threads read the same inputs, "disjoint" otherwise
+        int threads;
+        double callsPerSecond;  // over all threads
+        double efficiency;      // callsPerSecond / (threads * callsPerSecond of one thread)
+        double slowdown;        // mean time per call relative to one thread, > 1 points at contention
+        double imbalance;       // time of the slowest thread / time of the fastest thread
+    };
+
+    Benchmark(std::size_t warmupPasses, std::size_t trials)
+            : warmupPasses_(warmupPasses), trials_(trials), clockOverheadNs_(measureClockOverhead()), counters_(NULL)
+    {
+    }
+
+    double clockOverheadNs() const { return clockOverheadNs_; }
+
+    /**
+     * Counts hardware events for all following runs. Pass NULL to stop counting.
+     */
+    void setCounters(PerfCounters *counters) { counters_ = counters; }
+
+    /**
+     * Times call(i) for every i in [0, numInputs), trials times after the warm-up passes.
+     * The value returned by call is passed to doNotOptimize.
+     */
+    template<typename F>
+    Result run(const std::string &method, const std::string &comparison, int isotope, std::size_t numInputs, F call)
+    {
+        for (std::size_t pass = 0; pass < warmupPasses_; ++pass) {
+            for (std::size_t i = 0; i < numInputs; ++i) {
+                doNotOptimize(call(i));
+            }
+        }
+
+        std::vector<double> samples;
+        samples.reserve(numInputs * trials_);
+        std::vector<double> trialMs;
+        double counts[PerfCounters::NUM_EVENTS] = {0, 0, 0, 0};
+        bool counted[PerfCounters::NUM_EVENTS] = {false, false, false, false};
+
+        for (std::size_t trial = 0; trial < trials_; ++trial) {
+            double trialNs = 0;
+            for (std::size_t i = 0; i < numInputs; ++i) {
+                Clock::time_point start = Clock::now();
+                doNotOptimize(call(i));
+                Clock::time_point end = Clock::now();
+
+                double ns = std::max(0.0, std::chrono::duration<double, std::nano>(end - start).count()
+                                          - clockOverheadNs_);
+                samples.push_back(ns);
+                trialNs += ns;
+            }
+            trialMs.push_back(trialNs / 1e6);
+
+            if (counters_ != NULL && counters_->available()) {
+                counters_->start();
+                for (std::size_t i = 0; i < numInputs; ++i) {
+                    doNotOptimize(call(i));
+                }
+                PerfCounters::Values values = counters_->stop();
+
+                for (int e = 0; e < PerfCounters::NUM_EVENTS; ++e) {
+                    counts[e] += values.counts[e];
+                    counted[e] = values.valid[e];
+                }
+            }
+        }
+
+        Result result;
+        result.method = method;
+        result.comparison = comparison;
+        result.isotope = isotope;
+        result.calls = samples.size();
+        result.totalMs = percentile(trialMs, 0.5);
+        result.meanNs = 0;
+        for (double ns : samples) result.meanNs += ns;
+        result.meanNs = samples.empty() ? 0 : result.meanNs / samples.size();
+        result.minNs = percentile(samples, 0);
+        result.medianNs = percentile(samples, 0.5);
+        result.p99Ns = percentile(samples, 0.99);
+        result.maxNs = percentile(samples, 1);
+
+        double *perCall[PerfCounters::NUM_EVENTS] = {&result.cycles, &result.instructions,
+                                                     &result.cacheMisses, &result.branchMisses};
+        for (int e = 0; e < PerfCounters::NUM_EVENTS; ++e) {
+            *perCall[e] = counted[e] && !samples.empty() ? counts[e] / samples.size()
+                                                         : std::numeric_limits<double>::quiet_NaN();
+        }
+        return result;
+    }
+
+    /**
+     * Runs call(thread, i) for every i in [0, numInputs) on each of 1..maxThreads threads at once. Every thread does
+     * its warm-up passes first, then all threads start the timed pass together. Repeated for each trial; the
+     * median trial is reported.
+     */
+    template<typename F>
+    std::vector<ScalingResult> runScaling(const std::string &method, const std::string &comparison,
+                                          const std::string &inputs, int maxThreads, std::size_t numInputs, F call)
+    {
+        std::vector<ScalingResult> results;
+        double singleThroughput = 0;
+        double singleCallNs = 0;
+
+        for (int threads = 1; threads <= maxThreads; ++threads) {
+            std::vector<double> throughput, callNs, imbalance;
+
+            for (std::size_t trial = 0; trial < trials_; ++trial) {
+                std::vector<double> elapsedNs(threads);
+                std::atomic<int> ready(0);
+                std::atomic<bool> go(false);
+
+                std::vector<std::thread> pool;
+                for (int t = 0; t < threads; ++t) {
+                    pool.push_back(std::thread([&, t]() {
+                        for (std::size_t pass = 0; pass < warmupPasses_; ++pass) {
+                            for (std::size_t i = 0; i < numInputs; ++i) {
+                                doNotOptimize(call(t, i));
+                            }
+                        }
+
+                        ready.fetch_add(1);
+                        while (!go.load()) std::this_thread::yield();
+
+                        Clock::time_point start = Clock::now();
+                        for (std::size_t i = 0; i < numInputs; ++i) {
+                            doNotOptimize(call(t, i));
+                        }
+                        elapsedNs[t] = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+                    }));
+                }
+
+                while (ready.load() < threads) std::this_thread::yield();
+                go.store(true);
+                for (std::thread &thread : pool) thread.join();
+
+                double slowest = *std::max_element(elapsedNs.begin(), elapsedNs.end());
+                double fastest = *std::min_element(elapsedNs.begin(), elapsedNs.end());
+                double total = 0;
+                for (double ns : elapsedNs) total += ns;
+
+                throughput.push_back(threads * numInputs / (slowest / 1e9));
+                callNs.push_back(total / (threads * numInputs));
+                imbalance.push_back(slowest / fastest);
+            }
+
+            ScalingResult result;
+            result.method = method;
+            result.comparison = comparison;
+            result.inputs = inputs;
+            result.threads = threads;
+            result.callsPerSecond = percentile(throughput, 0.5);
+            result.imbalance = percentile(imbalance, 0.5);
+
+            double meanCallNs = percentile(callNs, 0.5);
+            if (threads == 1) {
+                singleThroughput = result.callsPerSecond;
+                singleCallNs = meanCallNs;
+            }
+            result.efficiency = result.callsPerSecond / (threads * singleThroughput);
+            result.slowdown = meanCallNs / singleCallNs;
+            results.push_back(result);
+        }
+        return results;
+    }
+
+    /**
+     * Tab-separated results as read by plotRuntimeComparisons.R. The time column is in milliseconds per pass.
+     * Counter columns are per call and only written if counters were requested.
+     */
+    static void writeTSVHeader(std::ostream &out, bool withCounters = false)
+    {
+        out << "method\t" << "time\t" << "isotope\t" << "comparison\t" << "median_ns\t" << "p99_ns";
+        if (withCounters) {
+            out << "\t" << "cycles\t" << "instructions\t" << "ipc\t" << "cache_misses\t" << "branch_misses";
+        }
+        out << std::endl;
+    }
+
+    static void writeTSV(std::ostream &out, const Result &r, bool withCounters = false)
+    {
+        out << r.method << "\t" << r.totalMs << "\t" << r.isotope << "\t" << r.comparison << "\t"
+            << r.medianNs << "\t" << r.p99Ns;
+        if (withCounters) {
+            out << "\t" << r.cycles << "\t" << r.instructions << "\t" << r.ipc() << "\t"
+                << r.cacheMisses << "\t" << r.branchMisses;
+        }
+        out << std::endl;
+    }
+
+    static void writeScalingTSVHeader(std::ostream &out)
+    {
+        out << "method\t" << "comparison\t" << "inputs\t" << "threads\t" << "calls_per_sec\t"
+            << "efficiency\t" << "slowdown\t" << "imbalance" << std::endl;
+    }
+
+    static void writeScalingTSV(std::ostream &out, const ScalingResult &r)
+    {
+        out << r.method << "\t" << r.comparison << "\t" << r.inputs << "\t" << r.threads << "\t"
+            << r.callsPerSecond << "\t" << r.efficiency << "\t" << r.slowdown << "\t" << r.imbalance << std::endl;
+    }
+
+    /**
+     * Writes all results and the run parameters as one JSON document, to be compared across builds.
+     */
+    void writeJSON(std::ostream &out, const std::vector<std::pair<std::string, std::string> > &parameters,
+                   const std::vector<Result> &results,
+                   const std::vector<ScalingResult> &scaling = std::vector<ScalingResult>()) const
+    {
+        out << "{\n  \"parameters\": {";
+        for (std::size_t i = 0; i < parameters.size(); ++i) {
+            out << (i > 0 ? ", " : "") << "\"" << parameters[i].first << "\": \"" << parameters[i].second << "\"";
+        }
+        out << "},\n";
+#if defined(__VERSION__)
+        out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+        out << "  \"warmup_passes\": " << warmupPasses_ << ",\n";
+        out << "  \"trials\": " << trials_ << ",\n";
+        out << "  \"clock_overhead_ns\": " << clockOverheadNs_ << ",\n";
+        out << "  \"results\": [\n";
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const Result &r = results[i];
+            out << "    {\"method\": \"" << r.method << "\", \"comparison\": \"" << r.comparison
+                << "\", \"isotope\": " << r.isotope << ", \"calls\": " << r.calls
+                << ", \"trial_ms\": " << r.totalMs << ", \"mean_ns\": " << r.meanNs
+                << ", \"min_ns\": " << r.minNs << ", \"median_ns\": " << r.medianNs
+                << ", \"p99_ns\": " << r.p99Ns << ", \"max_ns\": " << r.maxNs;
+            // JSON has no NaN, counters that were not collected are left out
+            if (r.cycles == r.cycles) out << ", \"cycles\": " << r.cycles;
+            if (r.instructions == r.instructions) out << ", \"instructions\": " << r.instructions;
+            if (r.ipc() == r.ipc()) out << ", \"ipc\": " << r.ipc();
+            if (r.cacheMisses == r.cacheMisses) out << ", \"cache_misses\": " << r.cacheMisses;
+            if (r.branchMisses == r.branchMisses) out << ", \"branch_misses\": " << r.branchMisses;
+            out << "}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ],\n";
+        out << "  \"scaling\": [\n";
+        for (std::size_t i = 0; i < scaling.size(); ++i) {
+            const ScalingResult &r = scaling[i];
+            out << "    {\"method\": \"" << r.method << "\", \"comparison\": \"" << r.comparison
+                << "\", \"inputs\": \"" << r.inputs << "\", \"threads\": " << r.threads
+                << ", \"calls_per_sec\": " << r.callsPerSecond << ", \"efficiency\": " << r.efficiency
+                << ", \"slowdown\": " << r.slowdown << ", \"imbalance\": " << r.imbalance << "}"
+                << (i + 1 < scaling.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}" << std::endl;
+    }
+
+private:
+
+    typedef std::chrono::steady_clock Clock;
+
+    static double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty()) return 0;
+        std::size_t k = std::min(values.size() - 1, (std::size_t) (p * (values.size() - 1) + 0.5));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+
+    static double measureClockOverhead()
+    {
+        std::vector<double> samples;
+        for (int i = 0; i < 10000; ++i) {
+            Clock::time_point start = Clock::now();
+            Clock::time_point end = Clock::now();
+            samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+        }
+        return percentile(samples, 0.5);
+    }
+
+    std::size_t warmupPasses_;
+    std::size_t trials_;
+    double clockOverheadNs_;
+    PerfCounters *counters_;
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_BENCHMARK_H
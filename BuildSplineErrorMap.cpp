@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <OpenMS/FORMAT/FASTAFile.h>
+#include <OpenMS/CHEMISTRY/AASequence.h>
+#include <OpenMS/CHEMISTRY/ElementDB.h>
+#include <OpenMS/CHEMISTRY/Residue.h>
+#include <OpenMS/CHEMISTRY/EnzymaticDigestion.h>
+
+#include "EstimatorDispatcher.h"
+#include "SplineErrorMap.h"
+
+using namespace OpenMS;
+
+static const ElementDB* elementDB = ElementDB::getInstance();
+
+static const Size MIN_PEPTIDE_LENGTH = 5;
+static const Size MAX_PEPTIDE_LENGTH = 80;
+
+bool isValidPeptide(const AASequence& pep) {
+    String p = pep.toString();
+    return !(p.hasSubstring("U") || p.hasSubstring("B") || p.hasSubstring("Z") || p.hasSubstring("J")
+             || p.hasSubstring("X"));
+}
+
+// Tryptic peptides of the proteome within the mass and sulfur limits, each once
+std::vector<AASequence> digestProteome(const std::string &fasta_path, double max_mass, int max_sulfur)
+{
+    std::vector<FASTAFile::FASTAEntry> proteins;
+    FASTAFile().load(fasta_path, proteins);
+
+    EnzymaticDigestion digestor; // default parameters are fully tryptic with 0 missed cleavages
+    std::set<AASequence> unique_peptides;
+    for (Size i = 0; i < proteins.size(); ++i)
+    {
+        std::vector<AASequence> peptides;
+        digestor.digest(AASequence::fromString(proteins[i].sequence), peptides);
+        for (Size j = 0; j < peptides.size(); ++j)
+        {
+            if (peptides[j].size() >= MIN_PEPTIDE_LENGTH && peptides[j].size() <= MAX_PEPTIDE_LENGTH
+                && peptides[j].getAverageWeight() < max_mass
+                && (int) peptides[j].getFormula().getNumberOf(elementDB->getElement("Sulfur")) <= max_sulfur
+                && isValidPeptide(peptides[j]))
+            {
+                unique_peptides.insert(peptides[j]);
+            }
+        }
+    }
+    return std::vector<AASequence>(unique_peptides.begin(), unique_peptides.end());
+}
+
+double maxAbsoluteError(const std::vector<double> &exact, const std::vector<double> &approx)
+{
+    double error = 0;
+    for (Size i = 0; i < std::max(exact.size(), approx.size()); ++i)
+    {
+        double e = i < exact.size() ? exact[i] : 0;
+        double a = i < approx.size() ? approx[i] : 0;
+        error = std::max(error, std::abs(e - a));
+    }
+    return error;
+}
+
+// Records the spline and averagine errors of one fragment in every isolation window
+void measureFragment(const EstimatorDispatcher &estimators, const EmpiricalFormula &precursor,
+                     const EmpiricalFormula &fragment, int max_isotope, SplineErrorMap &map)
+{
+    std::vector<double> exact, approx;
+    for (int start = 0; start <= max_isotope; ++start)
+    {
+        for (int i = start; i <= max_isotope; ++i)
+        {
+            IsolationMask isolated_precursor_isotopes = IsolationMask::range(start, i);
+            EstimatorDispatcher::Query query = estimators.makeQuery(precursor, fragment, isolated_precursor_isotopes);
+
+            EstimatorDispatcher::estimateExact(precursor, fragment, isolated_precursor_isotopes, exact);
+
+            // out of the spline's range the dispatcher never uses it
+            double spline_error = std::numeric_limits<double>::infinity();
+            if (estimators.estimateSpline(query, approx)) spline_error = maxAbsoluteError(exact, approx);
+            map.record(query, SplineErrorMap::SPLINE, spline_error);
+
+            estimators.estimateAveragine(query, approx);
+            map.record(query, SplineErrorMap::AVERAGINE, maxAbsoluteError(exact, approx));
+        }
+    }
+}
+
+void measurePeptides(const EstimatorDispatcher &estimators, const std::vector<AASequence> &peptides,
+                     Size first, Size step, int max_isotope, SplineErrorMap &map)
+{
+    for (Size p = first; p < peptides.size(); p += step)
+    {
+        const AASequence &pep = peptides[p];
+        EmpiricalFormula precursor = pep.getFormula();
+        for (Size i = 1; i < pep.size(); ++i)
+        {
+            measureFragment(estimators, precursor, pep.getPrefix(i).getFormula(Residue::BIon), max_isotope, map);
+            measureFragment(estimators, precursor, pep.getSuffix(pep.size() - i).getFormula(Residue::YIon),
+                            max_isotope, map);
+        }
+    }
+}
+
+void usage()
+{
+    std::cout << "usage: BuildSplineErrorMap fasta_path spline_model out_path [--sulfur] [--mass-step Da] "
+              << "[--max-mass Da] [--max-isotope n] [--max-sulfur n] [--threads n]" << std::endl;
+    std::cout << "\tspline_model: spline file used by the dispatcher, e.g. misc/IsotopeSplines_10kDa_21isotopes.xml" << std::endl;
+    std::cout << "\tsulfur: measure the sulfur-specific estimators instead of the average ones" << std::endl;
+    std::cout << "\tmass-step: width of the precursor and fragment mass bins (default 100)" << std::endl;
+    std::cout << "\tmax-mass: highest precursor average mass (default 9000)" << std::endl;
+    std::cout << "\tmax-isotope: highest isolated precursor isotope (default 4)" << std::endl;
+    std::cout << "\tmax-sulfur: peptides with more sulfur atoms are skipped (default 5)" << std::endl;
+    std::cout << "\tthreads: worker threads (default 1)" << std::endl;
+}
+
+int main(int argc, const char ** argv)
+{
+    if (argc < 4)
+    {
+        usage();
+        return 0;
+    }
+
+    bool sulfur = false;
+    double mass_step = 100;
+    double max_mass = 9000;
+    int max_isotope = 4;
+    int max_sulfur = 5;
+    int threads = 1;
+
+    for (int i = 4; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--sulfur") == 0)
+        {
+            sulfur = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--mass-step") == 0) mass_step = atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--max-mass") == 0) max_mass = atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--max-isotope") == 0) max_isotope = atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--max-sulfur") == 0) max_sulfur = atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--threads") == 0) threads = atoi(argv[++i]);
+        else
+        {
+            usage();
+            return 0;
+        }
+    }
+
+    if (!(mass_step > 0) || !(max_mass > 0) || max_isotope < 0 || max_isotope > 31 || max_sulfur < 0 || threads < 1)
+    {
+        usage();
+        return 0;
+    }
+
+    try
+    {
+        IsotopeSplineModel splines(argv[2]);
+        EstimatorDispatcher estimators(splines, 0, sulfur);
+
+        std::vector<AASequence> peptides = digestProteome(argv[1], max_mass, max_sulfur);
+        std::cout << "Measuring " << peptides.size() << " peptides" << std::endl;
+
+        // every thread fills its own map, they are merged at the end
+        std::vector<SplineErrorMap> maps(threads, SplineErrorMap(mass_step, max_mass, max_isotope, max_sulfur, sulfur));
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t)
+        {
+            pool.push_back(std::thread(measurePeptides, std::cref(estimators), std::cref(peptides), (Size) t,
+                                       (Size) threads, max_isotope, std::ref(maps[t])));
+        }
+        for (std::thread &thread : pool) thread.join();
+        for (int t = 1; t < threads; ++t) maps[0].merge(maps[t]);
+
+        maps[0].save(argv[3]);
+        std::cout << "Observed " << maps[0].observedCells() << " cells, written to: " << argv[3] << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "ColumnarFile.h"
+
+namespace ColumnarFile {
+
+    namespace {
+
+        // x86 and ARM hosts are little-endian, so values are copied as they are laid out in memory
+        template<typename T>
+        void put(std::string &out, T value)
+        {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        void putString(std::string &out, const std::string &value)
+        {
+            put<std::uint32_t>(out, (std::uint32_t) value.size());
+            out.append(value);
+        }
+
+        template<typename T>
+        T get(const std::string &in, std::size_t &pos)
+        {
+            if (pos + sizeof(T) > in.size()) {
+                throw std::runtime_error("Truncated columnar file");
+            }
+            T value;
+            std::memcpy(&value, in.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        // a fixed-width chunk must hold exactly one value per row of its row group
+        template<typename T>
+        void checkChunkSize(const std::string &bytes, std::uint64_t rows, const std::string &column)
+        {
+            if (bytes.size() / sizeof(T) != rows || bytes.size() % sizeof(T) != 0) {
+                throw std::runtime_error("Corrupt columnar file: chunk of column " + column + " holds "
+                                         + std::to_string(bytes.size()) + " bytes for "
+                                         + std::to_string(rows) + " rows");
+            }
+        }
+
+        std::string getString(const std::string &in, std::size_t &pos)
+        {
+            std::uint32_t length = get<std::uint32_t>(in, pos);
+            if (pos + length > in.size()) {
+                throw std::runtime_error("Truncated columnar file");
+            }
+            std::string value = in.substr(pos, length);
+            pos += length;
+            return value;
+        }
+    }
+
+    Encoder::Encoder(std::size_t rowGroupSize)
+            : rowGroupSize_(rowGroupSize), field_(0), rows_(0), offset_(0), typesKnown_(false)
+    {
+    }
+
+    void Encoder::setColumnNames(const std::vector<std::string> &names)
+    {
+        names_ = names;
+    }
+
+    Encoder::Column& Encoder::nextField(ColumnType type)
+    {
+        if (!typesKnown_) {
+            Column column;
+            column.type = type;
+            columns_.push_back(column);
+        } else if (field_ >= columns_.size()) {
+            throw std::logic_error("Columnar row has more fields than the first row");
+        }
+
+        Column &column = columns_[field_++];
+
+        // integers are allowed in a floating point column, everything else has to match the first row
+        if (column.type != type && !(column.type == FLOAT64 && type == INT64)) {
+            throw std::logic_error("Columnar field type differs from the first row in column " +
+                                   std::to_string(field_));
+        }
+        return column;
+    }
+
+    void Encoder::append(double value)
+    {
+        nextField(FLOAT64).doubles.push_back(value);
+    }
+
+    void Encoder::append(long long value)
+    {
+        Column &column = nextField(INT64);
+        if (column.type == FLOAT64) {
+            column.doubles.push_back((double) value);
+        } else {
+            column.ints.push_back(value);
+        }
+    }
+
+    void Encoder::append(const std::string &value)
+    {
+        Column &column = nextField(STRING);
+
+        std::unordered_map<std::string, std::uint32_t>::iterator it = column.dictionary.find(value);
+        if (it == column.dictionary.end()) {
+            it = column.dictionary.insert(std::make_pair(value, (std::uint32_t) column.entries.size())).first;
+            column.entries.push_back(value);
+        }
+        column.codes.push_back(it->second);
+    }
+
+    void Encoder::endRow()
+    {
+        if (!typesKnown_) {
+            typesKnown_ = true;
+            for (std::size_t i = 0; i < columns_.size(); ++i) {
+                columns_[i].name = i < names_.size() ? names_[i] : "V" + std::to_string(i + 1);
+            }
+        } else if (field_ != columns_.size()) {
+            throw std::logic_error("Columnar row has fewer fields than the first row");
+        }
+
+        field_ = 0;
+        ++rows_;
+    }
+
+    void Encoder::start(std::string &out)
+    {
+        out.append(MAGIC, sizeof(MAGIC));
+        offset_ = sizeof(MAGIC);
+    }
+
+    void Encoder::flushRowGroup(std::string &out)
+    {
+        if (rows_ == 0) return;
+
+        RowGroupInfo group;
+        group.numRows = rows_;
+
+        for (Column &column : columns_) {
+            ChunkInfo chunk;
+            chunk.offset = offset_;
+            chunk.stats.min = std::numeric_limits<double>::quiet_NaN();
+            chunk.stats.max = std::numeric_limits<double>::quiet_NaN();
+            chunk.stats.distinct = 0;
+
+            std::size_t before = out.size();
+
+            if (column.type == FLOAT64) {
+                out.append(reinterpret_cast<const char *>(column.doubles.data()),
+                           column.doubles.size() * sizeof(double));
+
+                // NaN scores (e.g. pearson of a flat distribution) do not take part in the statistics
+                for (double value : column.doubles) {
+                    if (value != value) continue;
+                    if (!(value >= chunk.stats.min)) chunk.stats.min = value;
+                    if (!(value <= chunk.stats.max)) chunk.stats.max = value;
+                }
+                column.doubles.clear();
+            } else if (column.type == INT64) {
+                out.append(reinterpret_cast<const char *>(column.ints.data()),
+                           column.ints.size() * sizeof(std::int64_t));
+
+                std::pair<std::vector<std::int64_t>::const_iterator, std::vector<std::int64_t>::const_iterator>
+                        range = std::minmax_element(column.ints.begin(), column.ints.end());
+                chunk.stats.min = (double) *range.first;
+                chunk.stats.max = (double) *range.second;
+                column.ints.clear();
+            } else {
+                put<std::uint32_t>(out, (std::uint32_t) column.entries.size());
+                for (const std::string &entry : column.entries) {
+                    putString(out, entry);
+                }
+                out.append(reinterpret_cast<const char *>(column.codes.data()),
+                           column.codes.size() * sizeof(std::uint32_t));
+
+                chunk.stats.distinct = column.entries.size();
+                column.codes.clear();
+                column.entries.clear();
+                column.dictionary.clear();
+            }
+
+            chunk.length = out.size() - before;
+            offset_ += chunk.length;
+            group.chunks.push_back(chunk);
+        }
+
+        rowGroups_.push_back(group);
+        rows_ = 0;
+    }
+
+    void Encoder::finish(std::string &out)
+    {
+        flushRowGroup(out);
+
+        std::string footer;
+        put<std::uint32_t>(footer, (std::uint32_t) columns_.size());
+        for (const Column &column : columns_) {
+            putString(footer, column.name);
+            put<std::uint8_t>(footer, (std::uint8_t) column.type);
+        }
+
+        put<std::uint32_t>(footer, (std::uint32_t) rowGroups_.size());
+        for (const RowGroupInfo &group : rowGroups_) {
+            put<std::uint64_t>(footer, group.numRows);
+            for (const ChunkInfo &chunk : group.chunks) {
+                put<std::uint64_t>(footer, chunk.offset);
+                put<std::uint64_t>(footer, chunk.length);
+                put<double>(footer, chunk.stats.min);
+                put<double>(footer, chunk.stats.max);
+                put<std::uint64_t>(footer, chunk.stats.distinct);
+            }
+        }
+
+        out.append(footer);
+        put<std::uint64_t>(out, (std::uint64_t) footer.size());
+        out.append(MAGIC, sizeof(MAGIC));
+    }
+
+
+    Reader::Reader(const std::string &path)
+            : in_(path.c_str(), std::ios::binary)
+    {
+        if (!in_) {
+            throw std::runtime_error("Unable to open columnar file: " + path);
+        }
+
+        const std::size_t trailerSize = sizeof(std::uint64_t) + sizeof(MAGIC);
+        in_.seekg(0, std::ios::end);
+        std::uint64_t fileSize = (std::uint64_t) in_.tellg();
+        if (fileSize < sizeof(MAGIC) + trailerSize) {
+            throw std::runtime_error("Not a columnar file: " + path);
+        }
+
+        std::string trailer(trailerSize, '\0');
+        in_.seekg(fileSize - trailerSize);
+        in_.read(&trailer[0], trailerSize);
+        if (std::memcmp(trailer.data() + sizeof(std::uint64_t), MAGIC, sizeof(MAGIC)) != 0) {
+            throw std::runtime_error("Not a columnar file: " + path);
+        }
+
+        std::size_t pos = 0;
+        std::uint64_t footerSize = get<std::uint64_t>(trailer, pos);
+        if (footerSize > fileSize - sizeof(MAGIC) - trailerSize) {
+            throw std::runtime_error("Corrupt columnar file: " + path);
+        }
+
+        std::string footer(footerSize, '\0');
+        in_.seekg(fileSize - trailerSize - footerSize);
+        in_.read(&footer[0], footerSize);
+
+        pos = 0;
+        std::uint32_t numColumns = get<std::uint32_t>(footer, pos);
+        for (std::uint32_t i = 0; i < numColumns; ++i) {
+            names_.push_back(getString(footer, pos));
+            types_.push_back((ColumnType) get<std::uint8_t>(footer, pos));
+        }
+
+        std::uint32_t numRowGroups = get<std::uint32_t>(footer, pos);
+        for (std::uint32_t g = 0; g < numRowGroups; ++g) {
+            RowGroupInfo group;
+            group.numRows = get<std::uint64_t>(footer, pos);
+            for (std::uint32_t i = 0; i < numColumns; ++i) {
+                ChunkInfo chunk;
+                chunk.offset = get<std::uint64_t>(footer, pos);
+                chunk.length = get<std::uint64_t>(footer, pos);
+                chunk.stats.min = get<double>(footer, pos);
+                chunk.stats.max = get<double>(footer, pos);
+                chunk.stats.distinct = get<std::uint64_t>(footer, pos);
+                group.chunks.push_back(chunk);
+            }
+            rowGroups_.push_back(group);
+        }
+    }
+
+    std::size_t Reader::columnIndex(const std::string &name) const
+    {
+        std::vector<std::string>::const_iterator it = std::find(names_.begin(), names_.end(), name);
+        if (it == names_.end()) {
+            throw std::out_of_range("No column named " + name);
+        }
+        return it - names_.begin();
+    }
+
+    std::uint64_t Reader::numRows() const
+    {
+        std::uint64_t rows = 0;
+        for (const RowGroupInfo &group : rowGroups_) {
+            rows += group.numRows;
+        }
+        return rows;
+    }
+
+    void Reader::readChunk(std::size_t column, std::size_t rowGroup, std::string &bytes)
+    {
+        const ChunkInfo &chunk = rowGroups_[rowGroup].chunks[column];
+        bytes.resize(chunk.length);
+        in_.clear();
+        in_.seekg(chunk.offset);
+        if (!in_.read(&bytes[0], chunk.length)) {
+            throw std::runtime_error("Truncated columnar file");
+        }
+    }
+
+    void Reader::readDoubles(std::size_t column, std::size_t rowGroup, std::vector<double> &values)
+    {
+        std::string bytes;
+        readChunk(column, rowGroup, bytes);
+        std::uint64_t rows = rowGroups_[rowGroup].numRows;
+
+        if (types_[column] == FLOAT64) {
+            checkChunkSize<double>(bytes, rows, names_[column]);
+            std::size_t first = values.size();
+            values.resize(first + rows);
+            std::memcpy(values.data() + first, bytes.data(), rows * sizeof(double));
+        } else if (types_[column] == INT64) {
+            checkChunkSize<std::int64_t>(bytes, rows, names_[column]);
+            std::size_t pos = 0;
+            for (std::uint64_t i = 0; i < rows; ++i) {
+                values.push_back((double) get<std::int64_t>(bytes, pos));
+            }
+        } else {
+            throw std::logic_error("Column " + names_[column] + " holds strings");
+        }
+    }
+
+    void Reader::readInts(std::size_t column, std::size_t rowGroup, std::vector<std::int64_t> &values)
+    {
+        if (types_[column] != INT64) {
+            throw std::logic_error("Column " + names_[column] + " does not hold integers");
+        }
+
+        std::string bytes;
+        readChunk(column, rowGroup, bytes);
+        std::uint64_t rows = rowGroups_[rowGroup].numRows;
+
+        checkChunkSize<std::int64_t>(bytes, rows, names_[column]);
+        std::size_t first = values.size();
+        values.resize(first + rows);
+        std::memcpy(values.data() + first, bytes.data(), rows * sizeof(std::int64_t));
+    }
+
+    void Reader::readStrings(std::size_t column, std::size_t rowGroup, std::vector<std::string> &values)
+    {
+        if (types_[column] != STRING) {
+            throw std::logic_error("Column " + names_[column] + " does not hold strings");
+        }
+
+        std::string bytes;
+        readChunk(column, rowGroup, bytes);
+        std::uint64_t rows = rowGroups_[rowGroup].numRows;
+
+        std::size_t pos = 0;
+        std::vector<std::string> dictionary(get<std::uint32_t>(bytes, pos));
+        for (std::string &entry : dictionary) {
+            entry = getString(bytes, pos);
+        }
+
+        for (std::uint64_t i = 0; i < rows; ++i) {
+            std::uint32_t code = get<std::uint32_t>(bytes, pos);
+            if (code >= dictionary.size()) {
+                throw std::runtime_error("Corrupt dictionary code in column " + names_[column]);
+            }
+            values.push_back(dictionary[code]);
+        }
+    }
+
+    std::vector<double> Reader::readDoubles(const std::string &name)
+    {
+        std::size_t column = columnIndex(name);
+        std::vector<double> values;
+        for (std::size_t g = 0; g < rowGroups_.size(); ++g) {
+            readDoubles(column, g, values);
+        }
+        return values;
+    }
+
+    std::vector<std::int64_t> Reader::readInts(const std::string &name)
+    {
+        std::size_t column = columnIndex(name);
+        std::vector<std::int64_t> values;
+        for (std::size_t g = 0; g < rowGroups_.size(); ++g) {
+            readInts(column, g, values);
+        }
+        return values;
+    }
+
+    std::vector<std::string> Reader::readStrings(const std::string &name)
+    {
+        std::size_t column = columnIndex(name);
+        std::vector<std::string> values;
+        for (std::size_t g = 0; g < rowGroups_.size(); ++g) {
+            readStrings(column, g, values);
+        }
+        return values;
+    }
+}
@@ -0,0 +1,163 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_COLUMNARFILE_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_COLUMNARFILE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * Binary columnar result files, an alternative to the tab-separated outputs for large runs.
+ *
+ * Rows are stored in row groups. Within a row group every column is one contiguous chunk, so a reader can load
+ * only the columns it needs. Columns are typed (64-bit float, 64-bit integer or string). String columns, such as
+ * scanDesc or method labels, are dictionary encoded per chunk. Every chunk records min/max statistics (dictionary
+ * size for strings) so whole row groups can be skipped.
+ *
+ * Layout, all values little-endian:
+ *     magic "FIDCOL01"
+ *     row group chunks
+ *     footer: column names and types, then per row group its row count and per column chunk
+ *             offset, length, min, max, distinct
+ *     uint64 footer length, magic "FIDCOL01"
+ *
+ * Chunk encodings:
+ *     FLOAT64, INT64: one 8-byte value per row
+ *     STRING:         uint32 dictionary size, per entry uint32 length and bytes, then one uint32 code per row
+ */
+namespace ColumnarFile {
+
+    enum ColumnType {
+        FLOAT64 = 1,
+        INT64 = 2,
+        STRING = 3
+    };
+
+    static const char MAGIC[8] = {'F', 'I', 'D', 'C', 'O', 'L', '0', '1'};
+
+    struct ColumnStats {
+        double min;             // numeric columns only
+        double max;             // numeric columns only
+        std::uint64_t distinct; // string columns only: dictionary size of the chunk
+    };
+
+    struct ChunkInfo {
+        std::uint64_t offset;
+        std::uint64_t length;
+        ColumnStats stats;
+    };
+
+    struct RowGroupInfo {
+        std::uint64_t numRows;
+        std::vector<ChunkInfo> chunks;
+    };
+
+    /**
+     * Collects typed fields row by row and encodes them into row groups. Column types are taken from the first row.
+     * Used by ResultWriter in columnar mode.
+     */
+    class Encoder {
+
+    public:
+        static const std::size_t DEFAULT_ROW_GROUP_SIZE = 1 << 16;
+
+        explicit Encoder(std::size_t rowGroupSize = DEFAULT_ROW_GROUP_SIZE);
+
+        // Columns without a name are called V1, V2, ... like R's read.table
+        void setColumnNames(const std::vector<std::string> &names);
+
+        void append(double value);
+        void append(long long value);
+        void append(const std::string &value);
+
+        /**
+         * Terminates the current row.
+         * @throws std::logic_error if the row has a different number of fields than the first row
+         */
+        void endRow();
+
+        bool rowGroupFull() const { return rows_ >= rowGroupSize_; }
+        bool empty() const { return rows_ == 0; }
+
+        // Appends the file magic to out
+        void start(std::string &out);
+        // Encodes the buffered rows as one row group and appends them to out
+        void flushRowGroup(std::string &out);
+        // Appends the footer to out. Flushes buffered rows first.
+        void finish(std::string &out);
+
+    private:
+        struct Column {
+            std::string name;
+            ColumnType type;
+            std::vector<double> doubles;
+            std::vector<std::int64_t> ints;
+            std::vector<std::uint32_t> codes;
+            std::unordered_map<std::string, std::uint32_t> dictionary;
+            std::vector<std::string> entries;
+        };
+
+        Column& nextField(ColumnType type);
+
+        std::size_t rowGroupSize_;
+        std::vector<std::string> names_;
+        std::vector<Column> columns_;
+        std::vector<RowGroupInfo> rowGroups_;
+        std::size_t field_;
+        std::size_t rows_;
+        std::uint64_t offset_;
+        bool typesKnown_;
+    };
+
+    /**
+     * Reads selected columns of a columnar result file.
+     */
+    class Reader {
+
+    public:
+        /**
+         * @throws std::runtime_error if path cannot be read or is not a columnar result file
+         */
+        explicit Reader(const std::string &path);
+
+        std::size_t numColumns() const { return names_.size(); }
+        const std::vector<std::string>& columnNames() const { return names_; }
+        ColumnType columnType(std::size_t column) const { return types_[column]; }
+
+        /**
+         * @return index of the named column
+         * @throws std::out_of_range if there is no such column
+         */
+        std::size_t columnIndex(const std::string &name) const;
+
+        std::uint64_t numRows() const;
+        std::size_t numRowGroups() const { return rowGroups_.size(); }
+        std::uint64_t numRows(std::size_t rowGroup) const { return rowGroups_[rowGroup].numRows; }
+        const ColumnStats& stats(std::size_t rowGroup, std::size_t column) const
+        {
+            return rowGroups_[rowGroup].chunks[column].stats;
+        }
+
+        // Append the values of one column chunk to values. Integer columns can be read as doubles.
+        void readDoubles(std::size_t column, std::size_t rowGroup, std::vector<double> &values);
+        void readInts(std::size_t column, std::size_t rowGroup, std::vector<std::int64_t> &values);
+        void readStrings(std::size_t column, std::size_t rowGroup, std::vector<std::string> &values);
+
+        // Whole column over all row groups
+        std::vector<double> readDoubles(const std::string &name);
+        std::vector<std::int64_t> readInts(const std::string &name);
+        std::vector<std::string> readStrings(const std::string &name);
+
+    private:
+        void readChunk(std::size_t column, std::size_t rowGroup, std::string &bytes);
+
+        std::ifstream in_;
+        std::vector<std::string> names_;
+        std::vector<ColumnType> types_;
+        std::vector<RowGroupInfo> rowGroups_;
+    };
+}
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_COLUMNARFILE_H
@@ -0,0 +1,77 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ColumnarFile.h"
+#include "ResultWriter.h"
+
+void usage()
+{
+    std::cout << "usage: ColumnarToTSV input_columnar_file [column ...]" << std::endl;
+    std::cout << "\tinput_columnar_file: .col file written with --columnar" << std::endl;
+    std::cout << "\tcolumn: columns to print, all columns if none are given" << std::endl;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2) {
+        usage();
+        return 0;
+    }
+
+    try {
+        ColumnarFile::Reader reader(argv[1]);
+
+        std::vector<std::size_t> columns;
+        for (int i = 2; i < argc; ++i) {
+            columns.push_back(reader.columnIndex(argv[i]));
+        }
+        if (columns.empty()) {
+            for (std::size_t i = 0; i < reader.numColumns(); ++i) columns.push_back(i);
+        }
+
+        std::string line;
+        for (std::size_t i = 0; i < columns.size(); ++i) {
+            if (i > 0) line.push_back('\t');
+            line.append(reader.columnNames()[columns[i]]);
+        }
+        std::cout << line << '\n';
+
+        // one row group at a time, only the selected column chunks are read
+        for (std::size_t g = 0; g < reader.numRowGroups(); ++g) {
+            std::vector<std::vector<std::string> > fields(columns.size());
+
+            for (std::size_t i = 0; i < columns.size(); ++i) {
+                std::size_t column = columns[i];
+                if (reader.columnType(column) == ColumnarFile::STRING) {
+                    reader.readStrings(column, g, fields[i]);
+                } else if (reader.columnType(column) == ColumnarFile::INT64) {
+                    std::vector<std::int64_t> values;
+                    reader.readInts(column, g, values);
+                    for (std::int64_t v : values) fields[i].push_back(std::to_string(v));
+                } else {
+                    std::vector<double> values;
+                    reader.readDoubles(column, g, values);
+                    char buf[32];
+                    for (double v : values) fields[i].push_back(std::string(buf, ResultWriter::formatDouble(v, buf)));
+                }
+            }
+
+            for (std::uint64_t row = 0; row < reader.numRows(g); ++row) {
+                line.clear();
+                for (std::size_t i = 0; i < columns.size(); ++i) {
+                    if (i > 0) line.push_back('\t');
+                    line.append(fields[i][row]);
+                }
+                std::cout << line << '\n';
+            }
+        }
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        usage();
+        return 1;
+    }
+
+    return 0;
+}
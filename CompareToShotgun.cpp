@@ -14,19 +14,63 @@
 #include "Stats.h"
 #include "SpectrumUtilities.h"
 #include "IsotopeDistributions.h"
+#include "ResultWriter.h"
+#include "Trace.h"
+#include "Metrics.h"
+#include "SplineModelRegistry.h"
 
 //global variables
 const double FDR_THRESHOLD = 0.01;          //False discovery rate threshold (%/100)
 const OpenMS::ElementDB* ELEMENTS = OpenMS::ElementDB::getInstance();   //element database
 static const OpenMS::IsotopeSplineDB* isotopeDB = OpenMS::IsotopeSplineDB::getInstance();
 
+//top-down mode, set by --top-down
+struct TopDownOptions {
+    std::vector<std::string> splinePaths;   //spline model files, queries go to the smallest covering one
+    double envelopeThreshold;               //smallest probability of an isotope in a fragment envelope
+    double minIntensity;                    //smallest peak at the most abundant isotope, relative to the base peak
+
+    TopDownOptions() : envelopeThreshold(1e-3), minIntensity(0.01) {}
+};
+
 void usage()
 {
-    std::cout << "usage: CompareToShotgun input_mzML_spectra_file input_idXML_PSM_file offset_mz output_directory" << std::endl;
+    std::cout << "usage: CompareToShotgun input_mzML_spectra_file input_idXML_PSM_file offset_mz output_directory [--columnar] [--trace path] [--metrics destination] [--metrics-interval seconds]" << std::endl;
     std::cout << "\tinput_mzML_spectra_file: path to input .mzML file " << std::endl;
     std::cout << "\tinput_idXML_PSM_file: path to input .idXML file" << std::endl;
     std::cout << "\toffset_mz: precursor ion isolation window offset" << std::endl;
     std::cout << "\toutput_directory: path to output files" << std::endl;
+    std::cout << "\t--columnar: write binary columnar .col files instead of tab-separated .out files" << std::endl;
+    std::cout << "\t--trace path: write a Chrome trace of the hot paths to path (needs -DENABLE_TRACING=ON)" << std::endl;
+    std::cout << "\t--metrics destination: write progress and throughput as JSON lines to a file, or - for stderr" << std::endl;
+    std::cout << "\t--metrics-interval seconds: time between progress lines (default: 10)" << std::endl;
+    std::cout << "\t--top-down spline_model: score intact proteins instead of peptides against the envelopes of "
+              << "spline_model, repeat to add models (e.g. the 10 kDa and 100 kDa files); needs a non-alternating MS2 "
+              << "experiment" << std::endl;
+    std::cout << "\t--envelope-threshold p: with --top-down, smallest isotope probability in a fragment envelope "
+              << "(default: 1e-3)" << std::endl;
+    std::cout << "\t--min-intensity x: with --top-down, skip charge states whose most abundant isotope has no peak "
+              << "of at least x times the base peak (default: 0.01)" << std::endl;
+}
+
+TopDownOptions topDownFromArgs(int &argc, char *argv[])
+{
+    TopDownOptions options;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--top-down" && i + 1 < argc) {
+            options.splinePaths.push_back(argv[++i]);
+        } else if (arg == "--envelope-threshold" && i + 1 < argc) {
+            options.envelopeThreshold = std::atof(argv[++i]);
+        } else if (arg == "--min-intensity" && i + 1 < argc) {
+            options.minIntensity = std::atof(argv[++i]);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    return options;
 }
 
 std::set<Ion> getCompleteFragmentIons(Ion &precursorIon, const OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrum,
@@ -37,6 +81,8 @@ std::set<Ion> getCompleteFragmentIons(Ion &precursorIon, const OpenMS::MSSpectru
     //create list of b and y ions
     std::vector<Ion> ionList = precursorIon.generateFragmentIons(minMz, maxMz);
     std::set<Ion> ionListComplete;
+    //precursor isotopes captured in isolation window, the same for every fragment
+    IsolationMask precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, offset);
 
 
     //loop through each ion
@@ -54,10 +100,6 @@ std::set<Ion> getCompleteFragmentIons(Ion &precursorIon, const OpenMS::MSSpectru
 
             //vector for observed isotope distribution <mz, intensity>
             std::vector<std::pair<double, double> > observedDist;
-            //vector for precursor isotopes captured in isolation window
-            std::set<OpenMS::UInt> precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo,
-                                                                                                 precursorIon,
-                                                                                                 offset);
 
             //fill exact conditional isotope distribution vector
             SpectrumUtilities::exactConditionalFragmentIsotopeDist(exactConditionalFragmentDist,
@@ -87,8 +129,8 @@ std::set<Ion> getCompleteFragmentIons(Ion &precursorIon, const OpenMS::MSSpectru
 }
 
 void calcDistributions(Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrum,
-                       OpenMS::Precursor &precursorInfo, double offset, std::ofstream &distributionScoreFile,
-                       std::ofstream &isotopeScoreFile, double minMz, double maxMz, std::string scanDesc)
+                       OpenMS::Precursor &precursorInfo, double offset, ResultWriter &distributionScoreFile,
+                       ResultWriter &isotopeScoreFile, double minMz, double maxMz, std::string scanDesc)
 {
     //if (precursorIon.charge != 3) return;
     /*static int num_sulfur_peptides = 0;
@@ -102,10 +144,20 @@ void calcDistributions(Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1D> &cu
 
     std::cout << num_sulfur_peptides << " " << total_peptides << std::endl;*/
 
+    static Metrics::Counter &psms = Metrics::counter("psms");
+    static Metrics::Counter &fragmentsGenerated = Metrics::counter("fragments_generated");
+    static Metrics::Counter &fragmentsUnmatched = Metrics::counter("fragments_unmatched");
+    static Metrics::Counter &fragmentsInvalid = Metrics::counter("fragments_invalid");
+    static Metrics::Counter &fragmentsScored = Metrics::counter("fragments_scored");
+    psms.add();
+
     int ionID = 0;
     //create list of b and y ions
     std::vector<Ion> ionList = precursorIon.generateFragmentIons(minMz, maxMz);
+    fragmentsGenerated.add(ionList.size());
     double width = precursorInfo.getIsolationWindowLowerOffset() + precursorInfo.getIsolationWindowUpperOffset();
+    //depends only on the precursor, so it is computed once for all fragments
+    IsolationMask precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, offset);
 
     //std::cout << precursorIon.charge << " " << precursorIon.sequence << std::endl;
 
@@ -121,90 +173,99 @@ void calcDistributions(Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1D> &cu
 
         if (peakIndex != -1) {
 
-            std::set<OpenMS::UInt> precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo,
-                                                                                                 precursorIon,
-                                                                                                 offset);
-
             IsotopeDistributions isotopeDistributions(precursorIsotopes, ionList[ionIndex], precursorIon, isotopeDB, currentSpectrum, precursorInfo, width);
 
-            //OpenMS::UInt max_isotope = *std::max_element(precursorIsotopes.begin(), precursorIsotopes.end());
+            //OpenMS::UInt max_isotope = precursorIsotopes.max();
             //double nextMass = (ionList[ionIndex].monoWeight + (max_isotope+1)*OpenMS::Constants::C13C12_MASSDIFF_U) / ionList[ionIndex].charge;
             //peakIndex = currentSpectrum.findNearest(nextMass , tol);
             //if (peakIndex != -1) continue;
 
-            if (!isotopeDistributions.isValid) continue;
+            if (!isotopeDistributions.isValid) {
+                fragmentsInvalid.add();
+                continue;
+            }
             //if (!isotopeDistributions.completeFlag) continue;
             if (isotopeDistributions.completeAtDepth >= 1 && isotopeDistributions.completeAtDepth <= 5)
             {
                 for (int i = 0; i < isotopeDistributions.scaledObservedDist.size(); ++i)
                 {
-                    double resExactFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.exactConditionalFragmentDist[i].second;
-                    double resAveragineFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxFragmentFromWeightDist[i].second;
-                    double resAveragineSulfurFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxFragmentFromWeightAndSulfurDist[i].second;
-                    double resExactPrecursor = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.exactPrecursorDist[i].second;
-                    double resAveraginePrecursor = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxPrecursorFromWeightDist[i].second;
-
-                    isotopeScoreFile << scanDesc << "\t" << isotopeDistributions.completeAtDepth << "\t" << i << "\t"
-                                     << ionList[ionIndex].monoMz << "\t" << isotopeDistributions.scaledObservedDist[i].first << "\t"
-                                     << precursorIon.monoWeight << "\t"
-                                     << isotopeDistributions.observedDist[i].second << "\t"
-                                     << resExactFragment << "\t" << resAveragineFragment << "\t"
-                                     << resAveragineSulfurFragment << "\t" << resExactPrecursor << "\t"
-                                     << resAveraginePrecursor << std::endl;
+                    double resExactFragment = isotopeDistributions.residual(i, IsotopeDistributions::EXACT_CONDITIONAL_FRAGMENT);
+                    double resAveragineFragment = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_FRAGMENT_FROM_WEIGHT);
+                    double resAveragineSulfurFragment = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_FRAGMENT_FROM_WEIGHT_AND_SULFUR);
+                    double resExactPrecursor = isotopeDistributions.residual(i, IsotopeDistributions::EXACT_PRECURSOR);
+                    double resAveraginePrecursor = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_PRECURSOR_FROM_WEIGHT);
+
+                    isotopeScoreFile << scanDesc << isotopeDistributions.completeAtDepth << i
+                                     << ionList[ionIndex].monoMz << isotopeDistributions.scaledObservedDist[i].first
+                                     << precursorIon.monoWeight
+                                     << isotopeDistributions.observedDist[i].second
+                                     << resExactFragment << resAveragineFragment
+                                     << resAveragineSulfurFragment << resExactPrecursor
+                                     << resAveraginePrecursor;
+                    isotopeScoreFile.endRow();
                 }
             }
 
             //write distribution results to file
-            distributionScoreFile << scanDesc << "\t";
-            distributionScoreFile << ionID << "\t";                           //ion ID
-            distributionScoreFile << isotopeDistributions.isValid << "\t"; //valid distribution flag
-            distributionScoreFile << precursorIon.monoWeight << "\t";    //ion dist. mono weight
-            distributionScoreFile << ionList[ionIndex].monoWeight << "\t";    //ion dist. mono weight
-            distributionScoreFile << ionList[ionIndex].charge << "\t";        //ion distribution charge
-            distributionScoreFile << isotopeDistributions.exactConditionalFragmentDist.size() << "\t";       //distribution search depth
-            distributionScoreFile << isotopeDistributions.completeFlag << "\t";                    //complete dist. found
-            distributionScoreFile << isotopeDistributions.completeAtDepth << "\t";                 //complete dist. up to depth
-
-            distributionScoreFile << precursorIsotopes.size() << "\t";
+            distributionScoreFile << scanDesc;
+            distributionScoreFile << ionID;                           //ion ID
+            distributionScoreFile << isotopeDistributions.isValid; //valid distribution flag
+            distributionScoreFile << precursorIon.monoWeight;    //ion dist. mono weight
+            distributionScoreFile << ionList[ionIndex].monoWeight;    //ion dist. mono weight
+            distributionScoreFile << ionList[ionIndex].charge;        //ion distribution charge
+            distributionScoreFile << isotopeDistributions.exactConditionalFragmentDist.size();       //distribution search depth
+            distributionScoreFile << isotopeDistributions.completeFlag;                    //complete dist. found
+            distributionScoreFile << isotopeDistributions.completeAtDepth;                 //complete dist. up to depth
+
+            distributionScoreFile << precursorIsotopes.size();
+            std::string isotopes;
             for (auto j : precursorIsotopes) {
-                distributionScoreFile << j << "|";
+                isotopes += std::to_string(j) + "|";
             }
-            distributionScoreFile << "\t";
+            distributionScoreFile << isotopes;
 
             distributionScoreFile << precursorIon.sequence.getFormula(OpenMS::Residue::Full, precursorIon.charge).
-                    getNumberOf(ELEMENTS->getElement("Sulfur")) << "\t";
+                    getNumberOf(ELEMENTS->getElement("Sulfur"));
             distributionScoreFile << ionList[ionIndex].sequence.getFormula(ionList[ionIndex].type,
                                                                            ionList[ionIndex].charge).
-                    getNumberOf(ELEMENTS->getElement("Sulfur")) << "\t";
+                    getNumberOf(ELEMENTS->getElement("Sulfur"));
 
             //Chi-squared for exact and approximate distributions
-            distributionScoreFile << isotopeDistributions.exactCondFragmentX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxFragmentFromWeightX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxFragmentFromWeightAndSulfurX2 << "\t";
-            distributionScoreFile << isotopeDistributions.exactPrecursorX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxPrecursorX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightAndSulfurX2 << "\n";
+            distributionScoreFile << isotopeDistributions.exactCondFragmentX2;
+            distributionScoreFile << isotopeDistributions.approxFragmentFromWeightX2;
+            distributionScoreFile << isotopeDistributions.approxFragmentFromWeightAndSulfurX2;
+            distributionScoreFile << isotopeDistributions.exactPrecursorX2;
+            distributionScoreFile << isotopeDistributions.approxPrecursorX2;
+            distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightX2;
+            distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightAndSulfurX2;
+            distributionScoreFile.endRow();
+            fragmentsScored.add();
+        } else {
+            fragmentsUnmatched.add();
         }
     }
 }
 
 void calcDistributions(Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrum,
-                       OpenMS::Precursor &precursorInfo, double offset, std::ofstream &distributionScoreFile,
-                       std::ofstream &isotopeScoreFile, std::string scanDesc, std::set<Ion> &ionList)
+                       OpenMS::Precursor &precursorInfo, double offset, ResultWriter &distributionScoreFile,
+                       ResultWriter &isotopeScoreFile, std::string scanDesc, std::set<Ion> &ionList)
 {
-    static int num_sulfur_peptides = 0;
-    static int total_peptides = 0;
+    static Metrics::Counter &psms = Metrics::counter("psms");
+    static Metrics::Counter &sulfurPSMs = Metrics::counter("psms_with_sulfur");
+    static Metrics::Counter &fragmentsGenerated = Metrics::counter("fragments_generated");
+    static Metrics::Counter &fragmentsUnmatched = Metrics::counter("fragments_unmatched");
+    static Metrics::Counter &fragmentsInvalid = Metrics::counter("fragments_invalid");
+    static Metrics::Counter &fragmentsScored = Metrics::counter("fragments_scored");
 
     if (precursorIon.sequence.getFormula(OpenMS::Residue::Full, precursorIon.charge).
             getNumberOf(ELEMENTS->getElement("Sulfur")) > 0) {
-        num_sulfur_peptides++;
+        sulfurPSMs.add();
     }
-    total_peptides++;
-
-    std::cout << num_sulfur_peptides << " " << total_peptides << std::endl;
+    psms.add();
+    fragmentsGenerated.add(ionList.size());
 
     double width = precursorInfo.getIsolationWindowLowerOffset() + precursorInfo.getIsolationWindowUpperOffset();
+    IsolationMask precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, offset);
     int ionID = 0;
     //loop through each ion
     for (Ion ion : ionList) {
@@ -216,70 +277,77 @@ void calcDistributions(Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1D> &cu
         OpenMS::Int peakIndex = currentSpectrum.findNearest(ion.monoMz, tol);
 
         if (peakIndex != -1) {
-            std::set<OpenMS::UInt> precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, offset);
-
             IsotopeDistributions isotopeDistributions(precursorIsotopes, ion, precursorIon, isotopeDB, currentSpectrum, precursorInfo, width);
 
 
-            //OpenMS::UInt max_isotope = *std::max_element(precursorIsotopes.begin(), precursorIsotopes.end());
+            //OpenMS::UInt max_isotope = precursorIsotopes.max();
             //double nextMass = (ion.monoWeight + (max_isotope+1)*OpenMS::Constants::C13C12_MASSDIFF_U) / ion.charge;
             //peakIndex = currentSpectrum.findNearest(nextMass , tol);
             //if (peakIndex != -1) continue;
 
 
-            if (!isotopeDistributions.isValid) continue;
+            if (!isotopeDistributions.isValid) {
+                fragmentsInvalid.add();
+                continue;
+            }
             //if (completeFlag && completeAtDepth > 1)
             if (isotopeDistributions.completeAtDepth >= 1)
             {
                 //for (int i = 0; i < observedDist.size(); ++i)
                 for (int i = 0; i < isotopeDistributions.completeAtDepth; ++i)
                 {
-                    double resExactFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.exactConditionalFragmentDist[i].second;
-                    double resAveragineFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxFragmentFromWeightDist[i].second;
-                    double resAveragineSulfurFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxFragmentFromWeightAndSulfurDist[i].second;
-                    double resExactPrecursor = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.exactPrecursorDist[i].second;
-                    double resAveraginePrecursor = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxPrecursorFromWeightDist[i].second;
-
-                    isotopeScoreFile << scanDesc << "\t" << isotopeDistributions.completeAtDepth << "\t" << i << "\t"
-                                     << ion.monoMz << "\t" << isotopeDistributions.scaledObservedDist[i].first << "\t"
-                                     << precursorIon.monoWeight << "\t"
-                                     << isotopeDistributions.observedDist[i].second << "\t"
-                                     << resExactFragment << "\t" << resAveragineFragment << "\t"
-                                     << resAveragineSulfurFragment << "\t" << resExactPrecursor << "\t"
-                                     << resAveraginePrecursor << std::endl;
+                    double resExactFragment = isotopeDistributions.residual(i, IsotopeDistributions::EXACT_CONDITIONAL_FRAGMENT);
+                    double resAveragineFragment = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_FRAGMENT_FROM_WEIGHT);
+                    double resAveragineSulfurFragment = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_FRAGMENT_FROM_WEIGHT_AND_SULFUR);
+                    double resExactPrecursor = isotopeDistributions.residual(i, IsotopeDistributions::EXACT_PRECURSOR);
+                    double resAveraginePrecursor = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_PRECURSOR_FROM_WEIGHT);
+
+                    isotopeScoreFile << scanDesc << isotopeDistributions.completeAtDepth << i
+                                     << ion.monoMz << isotopeDistributions.scaledObservedDist[i].first
+                                     << precursorIon.monoWeight
+                                     << isotopeDistributions.observedDist[i].second
+                                     << resExactFragment << resAveragineFragment
+                                     << resAveragineSulfurFragment << resExactPrecursor
+                                     << resAveraginePrecursor;
+                    isotopeScoreFile.endRow();
                 }
             }
 
             //write distribution results to file
-            distributionScoreFile << scanDesc << "\t";
-            distributionScoreFile << ionID << "\t";                           //ion ID
-            distributionScoreFile << isotopeDistributions.isValid << "\t"; //valid distribution flag
-            distributionScoreFile << precursorIon.monoWeight << "\t";
-            distributionScoreFile << ion.monoWeight << "\t";    //ion dist. mono weight
-            distributionScoreFile << ion.charge << "\t";        //ion distribution charge
-            distributionScoreFile << isotopeDistributions.exactConditionalFragmentDist.size() << "\t";       //distribution search depth
-            distributionScoreFile << isotopeDistributions.completeFlag << "\t";                    //complete dist. found
-            distributionScoreFile << isotopeDistributions.completeAtDepth << "\t";                 //complete dist. up to depth
-
-            distributionScoreFile << precursorIsotopes.size() << "\t";
+            distributionScoreFile << scanDesc;
+            distributionScoreFile << ionID;                           //ion ID
+            distributionScoreFile << isotopeDistributions.isValid; //valid distribution flag
+            distributionScoreFile << precursorIon.monoWeight;
+            distributionScoreFile << ion.monoWeight;    //ion dist. mono weight
+            distributionScoreFile << ion.charge;        //ion distribution charge
+            distributionScoreFile << isotopeDistributions.exactConditionalFragmentDist.size();       //distribution search depth
+            distributionScoreFile << isotopeDistributions.completeFlag;                    //complete dist. found
+            distributionScoreFile << isotopeDistributions.completeAtDepth;                 //complete dist. up to depth
+
+            distributionScoreFile << precursorIsotopes.size();
+            std::string isotopes;
             for (auto j : precursorIsotopes) {
-                distributionScoreFile << j << "|";
+                isotopes += std::to_string(j) + "|";
             }
-            distributionScoreFile << "\t";
+            distributionScoreFile << isotopes;
 
             distributionScoreFile << precursorIon.sequence.getFormula(OpenMS::Residue::Full, precursorIon.charge).
-                    getNumberOf(ELEMENTS->getElement("Sulfur")) << "\t";
+                    getNumberOf(ELEMENTS->getElement("Sulfur"));
             distributionScoreFile << ion.sequence.getFormula(ion.type,ion.charge).
-                    getNumberOf(ELEMENTS->getElement("Sulfur")) << "\t";
+                    getNumberOf(ELEMENTS->getElement("Sulfur"));
 
             //Chi-squared for exact and approximate distributions
-            distributionScoreFile << isotopeDistributions.exactCondFragmentX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxFragmentFromWeightX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxFragmentFromWeightAndSulfurX2 << "\t";
-            distributionScoreFile << isotopeDistributions.exactPrecursorX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxPrecursorX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightX2 << "\t";
-            distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightAndSulfurX2 << "\n";
+            distributionScoreFile << isotopeDistributions.exactCondFragmentX2;
+            distributionScoreFile << isotopeDistributions.approxFragmentFromWeightX2;
+            distributionScoreFile << isotopeDistributions.approxFragmentFromWeightAndSulfurX2;
+            distributionScoreFile << isotopeDistributions.exactPrecursorX2;
+            distributionScoreFile << isotopeDistributions.approxPrecursorX2;
+            distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightX2;
+            distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightAndSulfurX2;
+            distributionScoreFile.endRow();
+            fragmentsScored.add();
+        } else {
+            fragmentsUnmatched.add();
         }
     }
 }
@@ -387,8 +455,8 @@ std::map<int, std::string> analyzeAlternatingMS2IsoExperiment(OpenMS::MSExperime
 
 
 void analyzeMS2Experiment(OpenMS::MSExperiment<OpenMS::Peak1D> &msExperiment,
-                          double offset, std::ofstream &distributionScoreFile,
-                          std::ofstream &isotopeScoreFile, std::string expType)
+                          double offset, ResultWriter &distributionScoreFile,
+                          ResultWriter &isotopeScoreFile, std::string expType)
 {
     //reporting variables
     int numPeptideHits = 0;
@@ -398,7 +466,12 @@ void analyzeMS2Experiment(OpenMS::MSExperiment<OpenMS::Peak1D> &msExperiment,
 
 
     //Loop through all spectra
+    static Metrics::Counter &spectra = Metrics::counter("spectra");
+    static Metrics::Histogram &spectrumTime = Metrics::histogram("spectrum_us");
     for (int specIndex = 0; specIndex < msExperiment.getNrSpectra(); ++specIndex) {
+        TRACE_SCOPE_ID("spectrum", specIndex);
+        Metrics::ScopedTimer spectrumTimer(spectrumTime);
+        spectra.add();
         //get copy of current spectrum
         OpenMS::MSSpectrum<OpenMS::Peak1D> currentSpectrum = msExperiment.getSpectrum(specIndex);
 
@@ -439,10 +512,6 @@ void analyzeMS2Experiment(OpenMS::MSExperiment<OpenMS::Peak1D> &msExperiment,
 
                 //std::cout << precursorIon.charge << " " << precursorIon.sequence << std::endl;
 
-                precursorIon.generateFragmentIons(0, 3000);
-
-
-
                 //check for precursor matching PSM peptide information
                 if (precursorInfo.getCharge() != precursorIon.charge) {
                     //std::cout << "Warning: precursor target charge does not match PSM charge!" << std::endl;
@@ -459,8 +528,177 @@ void analyzeMS2Experiment(OpenMS::MSExperiment<OpenMS::Peak1D> &msExperiment,
     }//spectrum loop
 }
 
+//mz range the spectrum was acquired over, the range of its peaks if it has no scan window
+void scanRange(const OpenMS::MSSpectrum<OpenMS::Peak1D> &spectrum, double &minMz, double &maxMz)
+{
+    const std::vector<OpenMS::ScanWindow> &windows = spectrum.getInstrumentSettings().getScanWindows();
+    if (!windows.empty()) {
+        minMz = windows[0].begin;
+        maxMz = windows[0].end;
+        for (const OpenMS::ScanWindow &window : windows) {
+            minMz = std::min(minMz, window.begin);
+            maxMz = std::max(maxMz, window.end);
+        }
+    } else {
+        minMz = spectrum.front().getMZ();
+        maxMz = spectrum.back().getMZ();
+    }
+}
+
+/**
+ * Scores the b- and y-ions of an intact protein at high charge against the spline envelopes of the fragments.
+ * Every fragment is estimated once, its envelope serves all of its charge states. The envelopes are conditioned on
+ * the isolated precursor isotopes, all fragments of the spectrum in one batch. A charge state is only built and
+ * matched if its most abundant isotope falls into the spectrum's mz range on a peak of at least minIntensity times
+ * the base peak, so a precursor of charge 50 does not cost 49 full searches per fragment. The monoisotopic peak of
+ * a large fragment is not observed, so the most abundant isotope locates the envelope.
+ */
+void calcTopDownDistributions(Ion &precursorIon, const OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrum,
+                              const OpenMS::Precursor &precursorInfo, double offset,
+                              const SplineModelRegistry &splines, const TopDownOptions &options,
+                              ResultWriter &topDownScoreFile, const std::string &scanDesc)
+{
+    static Metrics::Counter &psms = Metrics::counter("psms");
+    static Metrics::Counter &fragmentsGenerated = Metrics::counter("fragments_generated");
+    static Metrics::Counter &fragmentsPruned = Metrics::counter("fragments_pruned");
+    static Metrics::Counter &fragmentsInvalid = Metrics::counter("fragments_invalid");
+    static Metrics::Counter &fragmentsScored = Metrics::counter("fragments_scored");
+    psms.add();
+    if (currentSpectrum.empty()) return;
+
+    double minMz, maxMz;
+    scanRange(currentSpectrum, minMz, maxMz);
+    double basePeak = 0;
+    for (const OpenMS::Peak1D &peak : currentSpectrum) basePeak = std::max(basePeak, (double) peak.getIntensity());
+    const double minIntensity = options.minIntensity * basePeak;
+    const double chargeMass = precursorIon.chargeMass();
+
+    //the isolation mask ends at M63, a window reaching it may have been cut off
+    const IsolationMask precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon,
+                                                                                      offset);
+    if (precursorIsotopes.empty() || precursorIsotopes.max() == IsolationMask::CAPACITY - 1) return;
+
+    //estimate all fragment envelopes of the spectrum in one batch, conditioned on the isolated precursor isotopes
+    std::vector<Ion::Fragment> fragments;
+    std::vector<IsotopeEnvelope> envelopes;
+    {
+        TRACE_SCOPE("fragmentEnvelopes");
+        fragments = precursorIon.generateFragments();
+        const std::size_t n = fragments.size(), width = precursorIsotopes.max() + 1;
+        std::vector<double> fragmentMasses(n), probabilities(n * width);
+        std::unique_ptr<bool[]> estimated(new bool[n]);
+        for (std::size_t i = 0; i < n; ++i) fragmentMasses[i] = fragments[i].averageWeight;
+        splines.estimateFragments(precursorIon.sequence.getAverageWeight(OpenMS::Residue::Full, 0),
+                                  SplineModelRegistry::AVERAGE, fragmentMasses.data(), NULL, n,
+                                  precursorIsotopes.bits(), probabilities.data(), estimated.get());
+
+        envelopes.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!estimated[i]) continue;
+            std::copy(probabilities.begin() + i * width, probabilities.begin() + (i + 1) * width,
+                      envelopes[i].reset(0, width));
+            envelopes[i].trim(options.envelopeThreshold);
+        }
+    }
+
+    std::vector<std::pair<double, double> > envelopeDist;
+    std::vector<std::pair<double, double> > observedDist;
+    int ionID = 0;
+    for (int i = 0; i < fragments.size(); ++i) {
+        if (envelopes[i].empty()) {
+            fragmentsInvalid.add();
+            continue;
+        }
+
+        //charge states that put the most abundant isotope into the mz range
+        const double modeWeight = fragments[i].monoWeight
+                                  + envelopes[i].mostAbundant() * OpenMS::Constants::C13C12_MASSDIFF_U;
+        int lowest, highest;
+        if (!Ion::chargeRange(modeWeight, chargeMass, minMz, maxMz, precursorIon.charge - 1, lowest, highest)) continue;
+
+        for (int z = lowest; z <= highest; ++z) {
+            fragmentsGenerated.add();
+
+            //skip charge states without a peak at the most abundant isotope
+            double modeMz = (modeWeight + z * chargeMass) / z;
+            double tol = OpenMS::Math::ppmToMass(SpectrumUtilities::ERROR_PPM, modeMz);
+            OpenMS::Int peakIndex = currentSpectrum.findNearest(modeMz, tol);
+            if (peakIndex == -1 || currentSpectrum[peakIndex].getIntensity() < minIntensity) {
+                fragmentsPruned.add();
+                continue;
+            }
+
+            ++ionID;
+            Ion ion = precursorIon.fragmentIon(fragments[i], z);
+            SpectrumUtilities::envelopeIsotopeDist(envelopeDist, envelopes[i], ion);
+            observedDist.clear();
+            SpectrumUtilities::observedDistribution(observedDist, envelopeDist, currentSpectrum);
+            std::vector<std::pair<double, double> > scaledObservedDist = SpectrumUtilities::scaleDistribution(observedDist);
+
+            int matched = 0;
+            for (const std::pair<double, double> &peak : observedDist) matched += peak.second > 0;
+
+            Stats::DistributionScores scores = Stats::scoreDistributions(scaledObservedDist.data(),
+                                                                         scaledObservedDist.size(),
+                                                                         envelopeDist.data(), envelopeDist.size());
+
+            topDownScoreFile << scanDesc;
+            topDownScoreFile << ionID;
+            topDownScoreFile << precursorIon.monoWeight;
+            topDownScoreFile << precursorIon.charge;
+            topDownScoreFile << ion.getIonType();
+            topDownScoreFile << ion.monoWeight;
+            topDownScoreFile << ion.charge;
+            topDownScoreFile << envelopes[i].start();
+            topDownScoreFile << envelopes[i].length();
+            topDownScoreFile << matched;
+            topDownScoreFile << scores.chiSquared;
+            topDownScoreFile << scores.totalVariation;
+            topDownScoreFile << scores.pearson;
+            topDownScoreFile.endRow();
+            fragmentsScored.add();
+        }
+    }
+}
+
+void analyzeTopDownExperiment(OpenMS::MSExperiment<OpenMS::Peak1D> &msExperiment, double offset,
+                              const SplineModelRegistry &splines, const TopDownOptions &options,
+                              ResultWriter &topDownScoreFile, std::string expType)
+{
+    static Metrics::Counter &spectra = Metrics::counter("spectra");
+    static Metrics::Histogram &spectrumTime = Metrics::histogram("spectrum_us");
+    for (int specIndex = 0; specIndex < msExperiment.getNrSpectra(); ++specIndex) {
+        TRACE_SCOPE_ID("spectrum", specIndex);
+        Metrics::ScopedTimer spectrumTimer(spectrumTime);
+        spectra.add();
+        //get copy of current spectrum
+        OpenMS::MSSpectrum<OpenMS::Peak1D> currentSpectrum = msExperiment.getSpectrum(specIndex);
+        if (currentSpectrum.getMSLevel() != 2 || currentSpectrum.getPrecursors().empty()) continue;
+
+        //sort spectrum by mz
+        currentSpectrum.sortByPosition();
+        const OpenMS::Precursor precursorInfo = currentSpectrum.getPrecursors()[0];
+
+        //score every proteoform identification below the FDR threshold
+        const std::vector<OpenMS::PeptideIdentification> pepIDs = currentSpectrum.getPeptideIdentifications();
+        for (int pepIDIndex = 0; pepIDIndex < pepIDs.size(); ++pepIDIndex) {
+            const std::vector<OpenMS::PeptideHit> pepHits = pepIDs[pepIDIndex].getHits();
+            for (int pepHitIndex = 0; pepHitIndex < pepHits.size(); ++pepHitIndex) {
+                if (pepHits[pepHitIndex].getScore() >= FDR_THRESHOLD) continue;
+
+                Ion precursorIon = Ion(pepHits[pepHitIndex].getSequence(),
+                                       OpenMS::Residue::Full,
+                                       pepHits[pepHitIndex].getCharge());
+
+                calcTopDownDistributions(precursorIon, currentSpectrum, precursorInfo, offset, splines, options,
+                                         topDownScoreFile, expType);
+            }
+        }
+    }
+}
+
 void analyzeAlternatingMS2Experiment(OpenMS::MSExperiment<OpenMS::Peak1D> &msExperiment,
-                                     double offset, std::ofstream &distributionScoreFile, std::ofstream &isotopeScoreFile,
+                                     double offset, ResultWriter &distributionScoreFile, ResultWriter &isotopeScoreFile,
                                      std::map<int, std::string> &scan2scanDesc, std::map<std::string, bool> &scanDesc2doSeq,
                                      double minMz, double maxMz)
 {
@@ -574,7 +812,12 @@ void analyzeAlternatingMS2Experiment(OpenMS::MSExperiment<OpenMS::Peak1D> &msExp
     std::cout << "Not Found: " << numnotFound << std::endl;
 
 
+    static Metrics::Counter &spectra = Metrics::counter("spectra");
+    static Metrics::Histogram &spectrumTime = Metrics::histogram("spectrum_us");
     for (int specIndex = 0; specIndex < msExperiment.getNrSpectra(); ++specIndex) {
+        TRACE_SCOPE_ID("spectrum", specIndex);
+        Metrics::ScopedTimer spectrumTimer(spectrumTime);
+        spectra.add();
         OpenMS::MSSpectrum<OpenMS::Peak1D> currentSpectrum = msExperiment.getSpectrum(specIndex);
 
         if (currentSpectrum.getMSLevel() == 2) {
@@ -610,8 +853,7 @@ void analyzeMS1Data(const Ion &precursorIon, const OpenMS::MSSpectrum<OpenMS::Pe
         std::vector<std::pair<double, double> > approxPrecursorAndSDist;
         std::vector<std::pair<double, double> > observedDist;
 
-        std::set<OpenMS::UInt> precursorIsotopes;
-        for (int i = 0; i < 5; ++i) precursorIsotopes.insert(i);
+        IsolationMask precursorIsotopes = IsolationMask::range(0, 4);
 
         SpectrumUtilities::exactPrecursorIsotopeDist(exactPrecursorDist, precursorIsotopes, precursorIon);
 
@@ -644,56 +886,92 @@ void countScanDesc(std::map<int, std::string> &scan2scanDesc)
     for (auto itr : scanDesc2count) std::cout << itr.first << "\t" << scanDesc2count[itr.first] << std::endl;
 }
 
-void writeFileHeaders(std::ofstream &distributionScoreFile, std::ofstream &isotopeScoreFile)
+void writeFileHeaders(ResultWriter &distributionScoreFile, ResultWriter &isotopeScoreFile)
 {
-    isotopeScoreFile << "scanDesc\t";
-    isotopeScoreFile << "searchDepth\t";
-    isotopeScoreFile << "isotope\t";
-    isotopeScoreFile << "monoMz\t";
-    isotopeScoreFile << "monoMass\t";
-    isotopeScoreFile << "precursorMass\t";
-    isotopeScoreFile << "intensity\t";
-    isotopeScoreFile << "residualExactFragment\t";
-    isotopeScoreFile << "residualAveragineFragment\t";
-    isotopeScoreFile << "residualAveragineSulfurFragment\t";
-    isotopeScoreFile << "residualExactPrecursor\t";
-    isotopeScoreFile << "residualAveraginePrecursor\n";
+    isotopeScoreFile.writeHeader({
+            "scanDesc",
+            "searchDepth",
+            "isotope",
+            "monoMz",
+            "monoMass",
+            "precursorMass",
+            "intensity",
+            "residualExactFragment",
+            "residualAveragineFragment",
+            "residualAveragineSulfurFragment",
+            "residualExactPrecursor",
+            "residualAveraginePrecursor"
+    });
 
 
     //headers for distribution score output file
-    distributionScoreFile << "scanDesc\t";
-    distributionScoreFile << "ionID\t";                       //ion ID of monoisotopic ion
-    distributionScoreFile << "distributionValid\t";           //check for valid distribution
-    distributionScoreFile << "precursorMonoWeight\t";
-    distributionScoreFile << "distributionMonoWeight\t";      //ion distribution monoisotopic weight
-    distributionScoreFile << "ionCharge\t";                   //ion distribtuion charge
-    distributionScoreFile << "searchDepth\t";                 //distribution search depth
-    distributionScoreFile << "completeFlag\t";                //full ion distribution identified in spectra
-    distributionScoreFile << "completeAtDepth\t";             //ion distribution complete up to depth
-
-    distributionScoreFile << "numPrecursorIsotopes\t";
-    distributionScoreFile << "precursorIsotopes\t";
-
-    distributionScoreFile << "precursorSulfurs\t";
-    distributionScoreFile << "fragmentSulfurs\t";
-
-    //Chi-squared statistics
-    distributionScoreFile << "exactCondFragmentX2\t";
-    distributionScoreFile << "approxFragmentFromWeightX2\t";
-    distributionScoreFile << "approxFragmentFromWeightAndSX2\t";
-    distributionScoreFile << "exactPrecursorX2\t";
-    distributionScoreFile << "approxPrecursorX2\t";
-    distributionScoreFile << "approxFragmentSplineFromWeightX2\t";
-    distributionScoreFile << "approxFragmentSplineFromWeightAndSulfurX2\n";
+    distributionScoreFile.writeHeader({
+            "scanDesc",
+            "ionID",                        //ion ID of monoisotopic ion
+            "distributionValid",            //check for valid distribution
+            "precursorMonoWeight",
+            "distributionMonoWeight",       //ion distribution monoisotopic weight
+            "ionCharge",                    //ion distribtuion charge
+            "searchDepth",                  //distribution search depth
+            "completeFlag",                 //full ion distribution identified in spectra
+            "completeAtDepth",              //ion distribution complete up to depth
+
+            "numPrecursorIsotopes",
+            "precursorIsotopes",
+
+            "precursorSulfurs",
+            "fragmentSulfurs",
+
+            //Chi-squared statistics
+            "exactCondFragmentX2",
+            "approxFragmentFromWeightX2",
+            "approxFragmentFromWeightAndSX2",
+            "exactPrecursorX2",
+            "approxPrecursorX2",
+            "approxFragmentSplineFromWeightX2",
+            "approxFragmentSplineFromWeightAndSulfurX2"
+    });
+}
+
+void writeTopDownHeader(ResultWriter &topDownScoreFile)
+{
+    topDownScoreFile.writeHeader({
+            "scanDesc",
+            "ionID",
+            "precursorMonoWeight",
+            "precursorCharge",
+            "ionType",
+            "ionMonoWeight",
+            "ionCharge",
+            "envelopeStart",                //first isotope of the fragment envelope
+            "envelopeLength",
+            "matchedIsotopes",              //envelope isotopes with an observed peak
+            "envelopeX2",
+            "envelopeTotalVariation",
+            "envelopePearson"
+    });
 }
 
 int main(int argc, char * argv[])
 {
+    const ResultWriter::Format format = ResultWriter::formatFromArgs(argc, argv);
+    const TopDownOptions topDown = topDownFromArgs(argc, argv);
+    const std::string tracePath = Trace::pathFromArgs(argc, argv);
+    double metricsInterval = 10;
+    const std::string metricsDestination = Metrics::destinationFromArgs(argc, argv, metricsInterval);
+
     //check for correct number of command line arguments
     if (argc != 6 && argc != 8) {
         usage();
         return 0;
     }
+    //top-down scoring only runs on plain MS2 experiments
+    if (!topDown.splinePaths.empty() && (argc != 8 || std::string(argv[5]) == "alternating"
+                                         || std::string(argv[6]) != "MS2")) {
+        std::cout << "--top-down needs a non-alternating MS2 experiment" << std::endl;
+        usage();
+        return 0;
+    }
 
     //report mzML file
     const std::string mzMLFilePath = argv[1];
@@ -710,12 +988,21 @@ int main(int argc, char * argv[])
 
 
     //output file for distribution comparison results
-    const std::string scoreFileName = "distributionScores.out";
-    const std::string isotopeFileName = "isotopesScores.out";
-    std::ofstream distributionScoreFile, isotopeScoreFile;
+    const std::string extension = format == ResultWriter::COLUMNAR ? ".col" : ".out";
+    const std::string scoreFileName = "distributionScores" + extension;
+    const std::string isotopeFileName = "isotopesScores" + extension;
+    const std::string topDownFileName = "topDownScores" + extension;
+    ResultWriter distributionScoreFile(format), isotopeScoreFile(format), topDownScoreFile(format);
+    SplineModelRegistry topDownSplines;
     try {
         distributionScoreFile.open(outDir + "/" + scoreFileName);
         isotopeScoreFile.open(outDir + "/" + isotopeFileName);
+        for (const std::string &path : topDown.splinePaths) {
+            std::cout << "Loading spline model " << path << "..." << std::endl;
+            topDownSplines.add(path);
+        }
+        if (topDownSplines.size() > 0) topDownScoreFile.open(outDir + "/" + topDownFileName);
+        if (!metricsDestination.empty()) Metrics::startReporting(metricsDestination, metricsInterval);
     } catch (std::exception& e) {
         std::cout << e.what() << std::endl;
         usage();
@@ -727,6 +1014,7 @@ int main(int argc, char * argv[])
     OpenMS::MSExperiment<OpenMS::Peak1D> msExperiment;
     std::cout << "Loading input mzML file " << mzMLFilePath << "..." << std::endl;
     try {
+        TRACE_SCOPE("loadMzML");
         mzMLDataFile.load(mzMLFilePath, msExperiment);
     } catch (std::exception& e) {
         std::cout << e.what() << std::endl;
@@ -817,7 +1105,14 @@ int main(int argc, char * argv[])
     }
     else
     {
-        if (msLevel == "MS2") {
+        if (msLevel == "MS2" && topDownSplines.size() > 0) {
+            writeTopDownHeader(topDownScoreFile);
+            analyzeTopDownExperiment(msExperiment, offset, topDownSplines, topDown, topDownScoreFile, expType);
+            for (std::size_t i = 0; i < topDownSplines.size(); ++i) {
+                std::cout << "Envelopes from " << topDownSplines.path(i) << ": " << topDownSplines.hits(i) << std::endl;
+            }
+            std::cout << "Envelopes no model covered: " << topDownSplines.misses() << std::endl;
+        } else if (msLevel == "MS2") {
             analyzeMS2Experiment(msExperiment, offset, distributionScoreFile, isotopeScoreFile, expType);
         } else {
 
@@ -834,6 +1129,18 @@ int main(int argc, char * argv[])
     std::cout << "Distribution comparison scorefile written to: " + scoreFileName << std::endl;
     distributionScoreFile.close();
     isotopeScoreFile.close();
+    if (topDownScoreFile.is_open()) {
+        std::cout << "Top-down scorefile written to: " + topDownFileName << std::endl;
+        topDownScoreFile.close();
+    }
+
+    Metrics::stopReporting();
+    std::cout << "Run summary:" << std::endl;
+    Metrics::printSummary(std::cout);
+
+    if (!tracePath.empty() && Trace::writeChromeTrace(tracePath)) {
+        std::cout << "Trace written to: " << tracePath << std::endl;
+    }
 
     return 0;
 }
@@ -13,6 +13,9 @@
 #include "SpectrumUtilities.h"
 #include "Stats.h"
 #include "IsotopeDistributions.h"
+#include "ResultWriter.h"
+#include "Trace.h"
+#include "Metrics.h"
 
 static const OpenMS::IsotopeSplineDB* isotopeDB = OpenMS::IsotopeSplineDB::getInstance();
 const OpenMS::ElementDB* ELEMENTS = OpenMS::ElementDB::getInstance();   //element database
@@ -30,19 +33,21 @@ void normalizeDist(std::vector<std::pair<double, double> > &dist)
     }
 }
 
-void outputDist(std::ofstream &out, std::vector<std::pair<double, double> > &dist, std::string ion_name,
+void outputDist(ResultWriter &out, std::vector<std::pair<double, double> > &dist, std::string ion_name,
                 std::string isotope_range, std::string name)
 {
     for (int i = 0; i < dist.size(); ++i)
     {
-        out << isotope_range << "\t" << ion_name << "\t" << dist[i].first << "\t"
-                 << dist[i].second << "\t" << name << std::endl;
+        out << isotope_range << ion_name << dist[i].first
+                 << dist[i].second << name;
+        out.endRow();
     }
 }
 
-void outputScores(std::ofstream &out, std::string ion_name, std::string isotope_range, std::string name, double score, double x, double y)
+void outputScores(ResultWriter &out, std::string ion_name, std::string isotope_range, std::string name, double score, double x, double y)
 {
-    out << isotope_range << "\t" << ion_name << "\t" << name << "\t" << score << "\t" << x << "\t" << y << std::endl;
+    out << isotope_range << ion_name << name << score << x << y;
+    out.endRow();
 }
 
 
@@ -51,89 +56,102 @@ void usage()
     std::cout << "Usage: " << std::endl;
 }
 
-void writeFileHeaders(std::ofstream &out, std::ofstream &calc_out, std::ofstream &scores_out,
-                      std::ofstream &distributionScoreFile, std::ofstream &isotopeScoreFile)
+void writeFileHeaders(ResultWriter &out, ResultWriter &calc_out, ResultWriter &scores_out,
+                      ResultWriter &distributionScoreFile, ResultWriter &isotopeScoreFile)
 {
-    out << "isotope.range" << "\t";
-    out << "ion.name" << "\t";
-    out << "mz" << "\t";
-    out << "int" << std::endl;
-
-    calc_out << "isotope.range" << "\t";
-    calc_out << "ion.name" << "\t";
-    calc_out << "mz" << "\t";
-    calc_out << "int" << "\t";
-    calc_out << "method" << std::endl;
-
-    scores_out << "isotope.range" << "\t";
-    scores_out << "ion.name" << "\t";
-    scores_out << "method" << "\t";
-    scores_out << "label" << "\t";
-    scores_out << "x" << "\t";
-    scores_out << "y" << std::endl;
-
-    isotopeScoreFile << "scanDesc\t";
-    isotopeScoreFile << "searchDepth\t";
-    isotopeScoreFile << "isotope\t";
-    isotopeScoreFile << "monoMz\t";
-    isotopeScoreFile << "monoMass\t";
-    isotopeScoreFile << "precursorMass\t";
-    isotopeScoreFile << "intensity\t";
-    isotopeScoreFile << "residualExactFragment\t";
-    isotopeScoreFile << "residualAveragineFragment\t";
-    isotopeScoreFile << "residualAveragineSulfurFragment\t";
-    isotopeScoreFile << "residualExactPrecursor\t";
-    isotopeScoreFile << "residualSplineFragment\t";
-    isotopeScoreFile << "residualApproxPrecursor\t";
-    isotopeScoreFile << "residualSplineSulfurFragment\n";
+    out.writeHeader({
+            "isotope.range",
+            "ion.name",
+            "mz",
+            "int"
+    });
+
+    calc_out.writeHeader({
+            "isotope.range",
+            "ion.name",
+            "mz",
+            "int",
+            "method"
+    });
+
+    scores_out.writeHeader({
+            "isotope.range",
+            "ion.name",
+            "method",
+            "label",
+            "x",
+            "y"
+    });
+
+    isotopeScoreFile.writeHeader({
+            "scanDesc",
+            "searchDepth",
+            "isotope",
+            "monoMz",
+            "monoMass",
+            "precursorMass",
+            "intensity",
+            "residualExactFragment",
+            "residualAveragineFragment",
+            "residualAveragineSulfurFragment",
+            "residualExactPrecursor",
+            "residualSplineFragment",
+            "residualApproxPrecursor",
+            "residualSplineSulfurFragment"
+    });
 
 
     //headers for distribution score output file
-    distributionScoreFile << "scanDesc\t";
-    distributionScoreFile << "ionID\t";                       //ion ID of monoisotopic ion
-    distributionScoreFile << "distributionValid\t";           //check for valid distribution
-    distributionScoreFile << "precursorMonoWeight\t";
-    distributionScoreFile << "distributionMonoWeight\t";      //ion distribution monoisotopic weight
-    distributionScoreFile << "ionCharge\t";                   //ion distribtuion charge
-    distributionScoreFile << "searchDepth\t";                 //distribution search depth
-    distributionScoreFile << "completeFlag\t";                //full ion distribution identified in spectra
-    distributionScoreFile << "completeAtDepth\t";             //ion distribution complete up to depth
-
-    distributionScoreFile << "numPrecursorIsotopes\t";
-    distributionScoreFile << "precursorIsotopes\t";
-
-    distributionScoreFile << "precursorSulfurs\t";
-    distributionScoreFile << "fragmentSulfurs\t";
-
-    //Chi-squared statistics
-    distributionScoreFile << "exactCondFragmentX2\t";
-    distributionScoreFile << "approxFragmentFromWeightX2\t";
-    distributionScoreFile << "approxFragmentFromWeightAndSX2\t";
-    distributionScoreFile << "exactPrecursorX2\t";
-    distributionScoreFile << "approxPrecursorX2\t";
-    distributionScoreFile << "splineFragmentX2\t";
-    distributionScoreFile << "approxPrecursorX2\t";
-    distributionScoreFile << "splineSulfurFragmentX2\n";
+    distributionScoreFile.writeHeader({
+            "scanDesc",
+            "ionID",                        //ion ID of monoisotopic ion
+            "distributionValid",            //check for valid distribution
+            "precursorMonoWeight",
+            "distributionMonoWeight",       //ion distribution monoisotopic weight
+            "ionCharge",                    //ion distribtuion charge
+            "searchDepth",                  //distribution search depth
+            "completeFlag",                 //full ion distribution identified in spectra
+            "completeAtDepth",              //ion distribution complete up to depth
+
+            "numPrecursorIsotopes",
+            "precursorIsotopes",
+
+            "precursorSulfurs",
+            "fragmentSulfurs",
+
+            //Chi-squared statistics
+            "exactCondFragmentX2",
+            "approxFragmentFromWeightX2",
+            "approxFragmentFromWeightAndSX2",
+            "exactPrecursorX2",
+            "splineFragmentX2",
+            "approxPrecursorX2",
+            "splineSulfurFragmentX2"
+    });
 }
 
 
 void calcDistributions(const Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrumCentroid,
                        OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrumProfile,
                        OpenMS::Precursor &precursorInfo,
-                       std::ofstream &distributionScoreFile, std::ofstream &isotopeScoreFile, std::string scanDesc,
+                       ResultWriter &distributionScoreFile, ResultWriter &isotopeScoreFile, std::string scanDesc,
                        std::vector<Ion> &ionList)
 {
     double isotopeStep = OpenMS::Constants::C13C12_MASSDIFF_U / precursorIon.charge;
 
-    std::set<OpenMS::UInt> precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, 0);
+    IsolationMask precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, 0);
 
-    OpenMS::UInt minIsotope = *std::min_element(precursorIsotopes.begin(), precursorIsotopes.end());
-    OpenMS::UInt maxIsotope = *std::max_element(precursorIsotopes.begin(), precursorIsotopes.end());
+    OpenMS::UInt minIsotope = precursorIsotopes.min();
+    OpenMS::UInt maxIsotope = precursorIsotopes.max();
 
     if (maxIsotope > 4) return;
 
     double width = precursorInfo.getIsolationWindowLowerOffset() + precursorInfo.getIsolationWindowUpperOffset();
 
+    static Metrics::Counter &fragmentsUnmatched = Metrics::counter("fragments_unmatched");
+    static Metrics::Counter &fragmentsInvalid = Metrics::counter("fragments_invalid");
+    static Metrics::Counter &fragmentsScored = Metrics::counter("fragments_scored");
+
     //loop through each fragment ion
     for (auto ion : ionList) {
         //compute search peak matching tolerance
@@ -147,7 +165,10 @@ void calcDistributions(const Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1
         }
 
         // peak not found
-        if (peakIndex == -1) continue;
+        if (peakIndex == -1) {
+            fragmentsUnmatched.add();
+            continue;
+        }
 
         IsotopeDistributions isotopeDistributions(precursorIsotopes, ion, precursorIon, isotopeDB, currentSpectrumCentroid, precursorInfo, width);
 
@@ -159,62 +180,68 @@ void calcDistributions(const Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1
         std::string ion_name = ion.getIonName();
 
 
-        if (!isotopeDistributions.isValid) continue;
+        if (!isotopeDistributions.isValid) {
+            fragmentsInvalid.add();
+            continue;
+        }
 
         //for (int i = 0; i < observedDist.size(); ++i)
         for (int i = 0; i < isotopeDistributions.completeAtDepth; ++i)
         {
-            double resExactFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.exactConditionalFragmentDist[i].second;
-            double resAveragineFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxFragmentFromWeightDist[i].second;
-            double resAveragineSulfurFragment =
-                    isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxFragmentFromWeightAndSulfurDist[i].second;
-            double resExactPrecursor = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.exactPrecursorDist[i].second;
-            double resSplineFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxFragmentSplineFromWeightDist[i].second;
-            double resSplineSulfurFragment = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxFragmentSplineFromWeightAndSulfurDist[i].second;
-            double resApproxPrecursor = isotopeDistributions.scaledObservedDist[i].second - isotopeDistributions.approxPrecursorFromWeightDist[i].second;
-
-
-            isotopeScoreFile << scanDesc << "\t" << isotopeDistributions.completeAtDepth << "\t" << i << "\t"
-                             << ion.monoMz << "\t" << isotopeDistributions.observedDist[i].first << "\t"
-                             << precursorIon.monoWeight << "\t"
-                             << isotopeDistributions.observedDist[i].second << "\t"
-                             << resExactFragment << "\t" << resAveragineFragment << "\t"
-                             << resAveragineSulfurFragment << "\t" << resExactPrecursor << "\t"
-                             << resSplineFragment << "\t" << resApproxPrecursor << "\t"
-                             << resSplineSulfurFragment << std::endl;
+            double resExactFragment = isotopeDistributions.residual(i, IsotopeDistributions::EXACT_CONDITIONAL_FRAGMENT);
+            double resAveragineFragment = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_FRAGMENT_FROM_WEIGHT);
+            double resAveragineSulfurFragment = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_FRAGMENT_FROM_WEIGHT_AND_SULFUR);
+            double resExactPrecursor = isotopeDistributions.residual(i, IsotopeDistributions::EXACT_PRECURSOR);
+            double resSplineFragment = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_FRAGMENT_SPLINE_FROM_WEIGHT);
+            double resSplineSulfurFragment = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_FRAGMENT_SPLINE_FROM_WEIGHT_AND_SULFUR);
+            double resApproxPrecursor = isotopeDistributions.residual(i, IsotopeDistributions::APPROX_PRECURSOR_FROM_WEIGHT);
+
+
+            isotopeScoreFile << scanDesc << isotopeDistributions.completeAtDepth << i
+                             << ion.monoMz << isotopeDistributions.observedDist[i].first
+                             << precursorIon.monoWeight
+                             << isotopeDistributions.observedDist[i].second
+                             << resExactFragment << resAveragineFragment
+                             << resAveragineSulfurFragment << resExactPrecursor
+                             << resSplineFragment << resApproxPrecursor
+                             << resSplineSulfurFragment;
+            isotopeScoreFile.endRow();
         }
 
 
         //write distribution results to file
-        distributionScoreFile << scanDesc << "\t";
-        distributionScoreFile << ion_type << "\t";                           //ion ID
-        distributionScoreFile << isotopeDistributions.isValid << "\t"; //valid distribution flag
-        distributionScoreFile << precursorIon.monoWeight << "\t";
-        distributionScoreFile << ion.monoWeight << "\t";    //ion dist. mono weight
-        distributionScoreFile << ion.charge << "\t";        //ion distribution charge
-        distributionScoreFile << isotopeDistributions.exactConditionalFragmentDist.size() << "\t";       //distribution search depth
-        distributionScoreFile << isotopeDistributions.completeFlag << "\t";                    //complete dist. found
-        distributionScoreFile << isotopeDistributions.completeAtDepth << "\t";                 //complete dist. up to depth
-
-        distributionScoreFile << precursorIsotopes.size() << "\t";
+        distributionScoreFile << scanDesc;
+        distributionScoreFile << ion_type;                           //ion ID
+        distributionScoreFile << isotopeDistributions.isValid; //valid distribution flag
+        distributionScoreFile << precursorIon.monoWeight;
+        distributionScoreFile << ion.monoWeight;    //ion dist. mono weight
+        distributionScoreFile << ion.charge;        //ion distribution charge
+        distributionScoreFile << isotopeDistributions.exactConditionalFragmentDist.size();       //distribution search depth
+        distributionScoreFile << isotopeDistributions.completeFlag;                    //complete dist. found
+        distributionScoreFile << isotopeDistributions.completeAtDepth;                 //complete dist. up to depth
+
+        distributionScoreFile << precursorIsotopes.size();
+        std::string isotopes;
         for (auto j : precursorIsotopes) {
-            distributionScoreFile << j << "|";
+            isotopes += std::to_string(j) + "|";
         }
-        distributionScoreFile << "\t";
+        distributionScoreFile << isotopes;
 
         distributionScoreFile << precursorIon.sequence.getFormula(OpenMS::Residue::Full, precursorIon.charge).
-                getNumberOf(ELEMENTS->getElement("Sulfur")) << "\t";
+                getNumberOf(ELEMENTS->getElement("Sulfur"));
         distributionScoreFile << ion.sequence.getFormula(ion.type,ion.charge).
-                getNumberOf(ELEMENTS->getElement("Sulfur")) << "\t";
+                getNumberOf(ELEMENTS->getElement("Sulfur"));
 
         //Chi-squared for exact and approximate distributions
-        distributionScoreFile << isotopeDistributions.exactCondFragmentX2 << "\t";
-        distributionScoreFile << isotopeDistributions.approxFragmentFromWeightX2 << "\t";
-        distributionScoreFile << isotopeDistributions.approxFragmentFromWeightAndSulfurX2 << "\t";
-        distributionScoreFile << isotopeDistributions.exactPrecursorX2 << "\t";
-        distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightX2 << "\t";
-        distributionScoreFile << isotopeDistributions.approxPrecursorX2 << "\t";
-        distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightAndSulfurX2 << "\n";
+        distributionScoreFile << isotopeDistributions.exactCondFragmentX2;
+        distributionScoreFile << isotopeDistributions.approxFragmentFromWeightX2;
+        distributionScoreFile << isotopeDistributions.approxFragmentFromWeightAndSulfurX2;
+        distributionScoreFile << isotopeDistributions.exactPrecursorX2;
+        distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightX2;
+        distributionScoreFile << isotopeDistributions.approxPrecursorX2;
+        distributionScoreFile << isotopeDistributions.approxFragmentSplineFromWeightAndSulfurX2;
+        distributionScoreFile.endRow();
+        fragmentsScored.add();
     }
 }
 
@@ -223,15 +250,15 @@ void calcDistributions(const Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1
 void calcSpectrumIonDistribution(Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrumCentroid,
                                  OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrumProfile,
                                  OpenMS::Precursor &precursorInfo,
-                                 std::ofstream &exp_out, std::ofstream &theo_out,
-                                 std::ofstream &scores_out, std::vector<Ion> ionsToPlot)
+                                 ResultWriter &exp_out, ResultWriter &theo_out,
+                                 ResultWriter &scores_out, std::vector<Ion> ionsToPlot)
 {
     double isotopeStep = OpenMS::Constants::C13C12_MASSDIFF_U / precursorIon.charge;
 
-    std::set<OpenMS::UInt> precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, 0.0);
+    IsolationMask precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, 0.0);
 
-    OpenMS::UInt minIsotope = *std::min_element(precursorIsotopes.begin(), precursorIsotopes.end());
-    OpenMS::UInt maxIsotope = *std::max_element(precursorIsotopes.begin(), precursorIsotopes.end());
+    OpenMS::UInt minIsotope = precursorIsotopes.min();
+    OpenMS::UInt maxIsotope = precursorIsotopes.max();
 
     double width = precursorInfo.getIsolationWindowLowerOffset() + precursorInfo.getIsolationWindowUpperOffset();
 
@@ -269,14 +296,17 @@ void calcSpectrumIonDistribution(Ion &precursorIon, OpenMS::MSSpectrum<OpenMS::P
 
 
         // Output data for low-throughput visualization
-        exp_out << isotope_range << "\t" << ion_name << "\t" << minMz - 0.61 << "\t" << 0 << std::endl;
+        exp_out << isotope_range << ion_name << minMz - 0.61 << 0;
+        exp_out.endRow();
         for (auto itr = currentSpectrumProfile.begin(); itr != currentSpectrumProfile.end(); ++itr) {
             if (itr->getMZ() >= minMz && itr->getMZ() <= maxMz) {
-                exp_out << isotope_range << "\t" << ion_name << "\t" << itr->getMZ() << "\t"
-                        << itr->getIntensity() / maxIntensity << std::endl;
+                exp_out << isotope_range << ion_name << itr->getMZ()
+                        << itr->getIntensity() / maxIntensity;
+                exp_out.endRow();
             }
         }
-        exp_out << isotope_range << "\t" << ion_name << "\t" << maxMz + 0.61 << "\t" << 0 << std::endl;
+        exp_out << isotope_range << ion_name << maxMz + 0.61 << 0;
+        exp_out.endRow();
 
 
         normalizeDist(isotopeDistributions.observedDist);
@@ -333,18 +363,32 @@ std::set<int> getRepresentativeScanIndexes()
 
 int main(int argc, char * argv[])
 {
+    const std::string tracePath = Trace::pathFromArgs(argc, argv);
+    double metricsInterval = 10;
+    const std::string metricsDestination = Metrics::destinationFromArgs(argc, argv, metricsInterval);
+    if (!metricsDestination.empty()) {
+        try {
+            Metrics::startReporting(metricsDestination, metricsInterval);
+        } catch (std::exception& e) {
+            std::cout << e.what() << std::endl;
+            return 0;
+        }
+    }
 
     OpenMS::MzMLFile mzMLDataFileProfile, mzMLDataFileCentroid;
     OpenMS::MSExperiment<OpenMS::Peak1D> msExperimentProfile, msExperimentCentroid;
 
-    mzMLDataFileProfile.load(argv[1], msExperimentProfile);
-    mzMLDataFileCentroid.load(argv[2], msExperimentCentroid);
+    {
+        TRACE_SCOPE("loadMzML");
+        mzMLDataFileProfile.load(argv[1], msExperimentProfile);
+        mzMLDataFileCentroid.load(argv[2], msExperimentCentroid);
+    }
     // MS2
-    std::ofstream exp_out(argv[3]);
-    std::ofstream theo_out(argv[4]);
-    std::ofstream scores_out(argv[5]);
-    std::ofstream distributionScoreFile(argv[6]);
-    std::ofstream isotopeScoreFile(argv[7]);
+    ResultWriter exp_out(argv[3]);
+    ResultWriter theo_out(argv[4]);
+    ResultWriter scores_out(argv[5]);
+    ResultWriter distributionScoreFile(argv[6]);
+    ResultWriter isotopeScoreFile(argv[7]);
 
     writeFileHeaders(exp_out, theo_out, scores_out, distributionScoreFile, isotopeScoreFile);
 
@@ -362,8 +406,13 @@ int main(int argc, char * argv[])
 
     std::set<int> representativeScanIndexes = getRepresentativeScanIndexes();
 
+    Metrics::Counter &spectra = Metrics::counter("spectra");
+    Metrics::Histogram &spectrumTime = Metrics::histogram("spectrum_us");
     for (int specIndex = 0; specIndex < msExperimentCentroid.getNrSpectra(); ++specIndex)
     {
+        TRACE_SCOPE_ID("spectrum", specIndex);
+        Metrics::ScopedTimer spectrumTimer(spectrumTime);
+        spectra.add();
         OpenMS::MSSpectrum<OpenMS::Peak1D> currentSpectrumCentroid = msExperimentCentroid.getSpectrum(specIndex);
         OpenMS::MSSpectrum<OpenMS::Peak1D> currentSpectrumProfile = msExperimentProfile.getSpectrum(specIndex);
 
@@ -402,5 +451,13 @@ int main(int argc, char * argv[])
     distributionScoreFile.close();
     isotopeScoreFile.close();
 
+    Metrics::stopReporting();
+    std::cout << "Run summary:" << std::endl;
+    Metrics::printSummary(std::cout);
+
+    if (!tracePath.empty() && Trace::writeChromeTrace(tracePath)) {
+        std::cout << "Trace written to: " << tracePath << std::endl;
+    }
+
     return 0;
 }
\ No newline at end of file
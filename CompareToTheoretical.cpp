@@ -4,6 +4,7 @@
 #include <numeric>
 #include <string>
 #include <set>
+#include <memory>
 #include <functional>
 #include <string>
 
@@ -17,6 +18,10 @@
 #include <OpenMS/MATH/STATISTICS/StatisticFunctions.h>
 
 #include "Stats.h"
+#include "ResultWriter.h"
+#include "Trace.h"
+#include "IsotopeSplineModel.h"
+#include "IsolationMask.h"
 
 using namespace OpenMS;
 
@@ -34,6 +39,16 @@ std::set<AASequence> uniquePeptides;
 std::map<std::string, std::pair<std::vector<double>, std::vector<double> > > precursor_method2val;
 std::map<std::string, std::map<std::string, std::pair<std::vector<double>, std::vector<double> > > > fragment_method2iso2val;
 
+// --float-report: the float spline estimates against the double ones, per isolation window
+struct FloatAccuracy {
+    long count = 0, numProbabilities = 0;
+    double maxProbabilityDiff = 0, sumProbabilityDiff = 0;
+    double maxChiDiff = 0, sumChiDouble = 0, sumChiFloat = 0;
+};
+
+static const IsotopeSplineModel* floatModel = NULL;
+std::map<std::string, FloatAccuracy> float_iso2accuracy;
+
 
 bool isValidPeptide(AASequence& pep) {
     String p = pep.toString();
@@ -96,10 +111,12 @@ std::vector<double> fillProbabilities(IsotopeDistribution& dist, UInt length)
 
 std::vector<double> calculateScores(std::vector<double>& l, std::vector<double>& r)
 {
+    Stats::DistributionScores scores = Stats::scoreDistributions(l.data(), l.size(), r.data(), r.size());
+
     std::vector<double> result;
-    result.push_back(Math::pearsonCorrelationCoefficient(l.begin(), l.end(), r.begin(), r.end()));
-    result.push_back(Stats::totalVariationDistance(l.begin(), l.end(), r.begin(), r.end()));
-    result.push_back(Stats::chiSquared(l.begin(), l.end(), r.begin(), r.end()));
+    result.push_back(scores.pearson);
+    result.push_back(scores.totalVariation);
+    result.push_back(scores.chiSquared);
     return result;
 }
 
@@ -113,6 +130,38 @@ std::vector<double> calculateResiduals(std::vector<double>& l, std::vector<doubl
     return result;
 }
 
+void compareFloatEstimate(std::vector<double>& exact_fragment_prob, std::set<UInt>& isolated_precursor_isotopes,
+                          double pep_mass, double frag_mass, int num_s_prec, int num_s_frag, UInt depth, std::string label)
+{
+    const std::uint64_t isolated = IsolationMask::fromIsotopes(isolated_precursor_isotopes).bits();
+    double approx_double[IsolationMask::CAPACITY];
+    float approx_float[IsolationMask::CAPACITY];
+    if (!floatModel->estimateFragment(pep_mass, frag_mass, isolated, num_s_prec, num_s_frag, approx_double)
+        || !floatModel->estimateFragment(pep_mass, frag_mass, isolated, num_s_prec, num_s_frag, approx_float))
+    {
+        return;
+    }
+
+    FloatAccuracy& accuracy = float_iso2accuracy[label];
+    float exact_float[IsolationMask::CAPACITY];
+    for (UInt i = 0; i < depth; ++i)
+    {
+        const double diff = std::abs(approx_double[i] - approx_float[i]);
+        accuracy.maxProbabilityDiff = std::max(accuracy.maxProbabilityDiff, diff);
+        accuracy.sumProbabilityDiff += diff;
+        exact_float[i] = exact_fragment_prob[i];
+    }
+    accuracy.numProbabilities += depth;
+
+    // scored the way each path would score, double against double and float against float
+    const double chi_double = Stats::chiSquared(exact_fragment_prob.data(), depth, approx_double, depth);
+    const double chi_float = Stats::chiSquared(exact_float, depth, approx_float, depth);
+    accuracy.maxChiDiff = std::max(accuracy.maxChiDiff, std::abs(chi_double - chi_float));
+    accuracy.sumChiDouble += chi_double;
+    accuracy.sumChiFloat += chi_float;
+    ++accuracy.count;
+}
+
 void testTheoreticalIsolation(EmpiricalFormula& precursor, EmpiricalFormula& fragment, std::set<UInt>& isolated_precursor_isotopes,
                               double pep_mass, double frag_mass, int num_s_prec, int num_s_frag, UInt depth, std::string label)
 {
@@ -186,6 +235,11 @@ void testTheoreticalIsolation(EmpiricalFormula& precursor, EmpiricalFormula& fra
     scores = calculateResiduals(exact_fragment_prob, approx_precursor_prob);
     for (int i = 0; i < scores.size(); ++i) fragment_method2iso2val["Averagine precursor"][label].second.push_back(scores[i]);
 
+    if (floatModel != NULL)
+    {
+        compareFloatEstimate(exact_fragment_prob, isolated_precursor_isotopes, pep_mass, frag_mass, num_s_prec,
+                             num_s_frag, depth, label);
+    }
 }
 
 void testTheoreticalIon(AASequence& pep, AASequence& frag, EmpiricalFormula& precursor, EmpiricalFormula& fragment)
@@ -278,6 +332,7 @@ void testTheoreticalPeptideDistribution(EmpiricalFormula &p)
 
 void testTheoreticalPeptide(AASequence& pep, bool doFragments)
 {
+    TRACE_SCOPE("peptide");
     EmpiricalFormula precursor = pep.getFormula();
     EmpiricalFormula fragment;
 
@@ -323,7 +378,10 @@ void testTheoreticalProtein(FASTAFile::FASTAEntry& protein, EnzymaticDigestion&
 void testTheoreticalPeptides(std::string fasta_path, int job_id, int num_jobs, bool doFragments)
 {
     std::vector<FASTAFile::FASTAEntry> proteins;
-    FASTAFile().load(fasta_path, proteins);
+    {
+        TRACE_SCOPE("loadFASTA");
+        FASTAFile().load(fasta_path, proteins);
+    }
 
     EnzymaticDigestion digestor; // default parameters are fully tryptic with 0 missed cleavages
 
@@ -357,11 +415,31 @@ std::vector<double> getStats(std::vector<double> &vals)
     return results;
 }
 
-void writeResults(std::string path_residual, std::string path_chisquared, std::string path_stats, bool doFragments, double bin_size_chi, double bin_size_res)
+void writeResults(std::string path_residual, std::string path_chisquared, std::string path_stats, bool doFragments, double bin_size_chi, double bin_size_res,
+                  ResultWriter::Format format)
 {
-    std::ofstream out_residual(path_residual);
-    std::ofstream out_scores(path_chisquared);
-    std::ofstream out_stats(path_stats);
+    ResultWriter out_residual(format), out_scores(format), out_stats(format);
+    try {
+        out_residual.open(path_residual);
+        out_scores.open(path_chisquared);
+        out_stats.open(path_stats);
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return;
+    }
+
+    // the text outputs have no header row, the names are only used by the columnar format
+    if (doFragments)
+    {
+        out_stats.nameColumns({"count", "mean", "min", "q1", "median", "q3", "max", "iso", "method", "score"});
+        out_scores.nameColumns({"method", "iso", "bin", "count"});
+        out_residual.nameColumns({"method", "iso", "bin", "count"});
+    } else
+    {
+        out_stats.nameColumns({"count", "mean", "min", "q1", "median", "q3", "max", "method", "score"});
+        out_scores.nameColumns({"method", "bin", "count"});
+        out_residual.nameColumns({"method", "bin", "count"});
+    }
 
     if (doFragments)
     {
@@ -381,13 +459,15 @@ void writeResults(std::string path_residual, std::string path_chisquared, std::s
                 std::vector<double> results_res = getStats(res);
 
 
-                out_stats << results_chi[0] << "\t" << results_chi[1] << "\t" << results_chi[2] << "\t"
-                          << results_chi[3] << "\t" << results_chi[4] << "\t" << results_chi[5] << "\t"
-                          << results_chi[6] << "\t" << iso << "\t" << key << "\t" << "chi" << std::endl;
+                out_stats << results_chi[0] << results_chi[1] << results_chi[2]
+                          << results_chi[3] << results_chi[4] << results_chi[5]
+                          << results_chi[6] << iso << key << "chi";
+                out_stats.endRow();
 
-                out_stats << results_res[0] << "\t" << results_res[1] << "\t" << results_res[2] << "\t"
-                          << results_res[3] << "\t" << results_res[4] << "\t" << results_res[5] << "\t"
-                          << results_chi[6] << "\t" << iso << "\t" << key << "\t" << "res" << std::endl;
+                out_stats << results_res[0] << results_res[1] << results_res[2]
+                          << results_res[3] << results_res[4] << results_res[5]
+                          << results_chi[6] << iso << key << "res";
+                out_stats.endRow();
 
                 for (int i = 0; i < chi.size(); ++i)
                 {
@@ -411,7 +491,8 @@ void writeResults(std::string path_residual, std::string path_chisquared, std::s
             {
                 for (auto const &bin_itr : fragment_method2iso2bin2count_chi[method_itr.first][iso_itr.first])
                 {
-                    out_scores << method_itr.first << "\t" << iso_itr.first << "\t" << bin_itr.first << "\t" << bin_itr.second << std::endl;
+                    out_scores << method_itr.first << iso_itr.first << bin_itr.first << bin_itr.second;
+                    out_scores.endRow();
                 }
             }
         }
@@ -422,7 +503,8 @@ void writeResults(std::string path_residual, std::string path_chisquared, std::s
             {
                 for (auto const &bin_itr : fragment_method2iso2bin2count_res[method_itr.first][iso_itr.first])
                 {
-                    out_residual << method_itr.first << "\t" << iso_itr.first << "\t" << bin_itr.first << "\t" << bin_itr.second << std::endl;
+                    out_residual << method_itr.first << iso_itr.first << bin_itr.first << bin_itr.second;
+                    out_residual.endRow();
                 }
             }
         }
@@ -443,12 +525,14 @@ void writeResults(std::string path_residual, std::string path_chisquared, std::s
             std::vector<double> results_chi = getStats(chi);
             std::vector<double> results_res = getStats(res);
 
-            out_stats << results_chi[0] << "\t" << results_chi[1] << "\t" << results_chi[2] << "\t"
-                      << results_chi[3] << "\t" << results_chi[4] << "\t" << results_chi[5] << "\t"
-                      << results_chi[6] << "\t" << key << "\t" << "chi" << std::endl;
-            out_stats << results_res[0] << "\t" << results_res[1] << "\t" << results_res[2] << "\t"
-                      << results_res[3] << "\t" << results_res[4] << "\t" << results_res[5] << "\t"
-                      << results_chi[6] << "\t" << key << "\t" << "res" << std::endl;
+            out_stats << results_chi[0] << results_chi[1] << results_chi[2]
+                      << results_chi[3] << results_chi[4] << results_chi[5]
+                      << results_chi[6] << key << "chi";
+            out_stats.endRow();
+            out_stats << results_res[0] << results_res[1] << results_res[2]
+                      << results_res[3] << results_res[4] << results_res[5]
+                      << results_chi[6] << key << "res";
+            out_stats.endRow();
 
             for (int i = 0; i < chi.size(); ++i)
             {
@@ -468,7 +552,8 @@ void writeResults(std::string path_residual, std::string path_chisquared, std::s
         {
             for (auto const &bin_itr : precursor_method2bin2count_chi[method_itr.first])
             {
-                out_scores << method_itr.first << "\t" << bin_itr.first << "\t" << bin_itr.second << std::endl;
+                out_scores << method_itr.first << bin_itr.first << bin_itr.second;
+                out_scores.endRow();
             }
         }
 
@@ -476,7 +561,8 @@ void writeResults(std::string path_residual, std::string path_chisquared, std::s
         {
             for (auto const &bin_itr : precursor_method2bin2count_res[method_itr.first])
             {
-                out_residual << method_itr.first << "\t" << bin_itr.first << "\t" << bin_itr.second << std::endl;
+                out_residual << method_itr.first << bin_itr.first << bin_itr.second;
+                out_residual.endRow();
             }
         }
 
@@ -488,6 +574,46 @@ void writeResults(std::string path_residual, std::string path_chisquared, std::s
     out_stats.close();
 }
 
+void writeFloatReport(std::string path, ResultWriter::Format format)
+{
+    ResultWriter out(format);
+    try {
+        out.open(path);
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return;
+    }
+
+    out.writeHeader({"iso", "count", "maxProbabilityDiff", "meanProbabilityDiff", "maxChiDiff", "meanChiDouble",
+                     "meanChiFloat"});
+    for (auto const &iso_itr : float_iso2accuracy)
+    {
+        const FloatAccuracy& accuracy = iso_itr.second;
+        out << iso_itr.first << accuracy.count << accuracy.maxProbabilityDiff
+            << accuracy.sumProbabilityDiff / accuracy.numProbabilities << accuracy.maxChiDiff
+            << accuracy.sumChiDouble / accuracy.count << accuracy.sumChiFloat / accuracy.count;
+        out.endRow();
+    }
+    out.close();
+}
+
+// removes "--float-report spline_model path" from the command line, returns path or "" if not given
+std::string floatReportFromArgs(int &argc, char *argv[], std::string &modelPath)
+{
+    std::string path;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--float-report" && i + 2 < argc) {
+            modelPath = argv[++i];
+            path = argv[++i];
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    return path;
+}
+
 void init(bool doFragments)
 {
 
@@ -523,22 +649,49 @@ void init(bool doFragments)
 
 void usage()
 {
-    std::cout << "CompareToTheoretical fasta_path job_id num_jobs do_frag residual_file score_file stats_file bin_size_chi bin_size_res" << std::endl;
+    std::cout << "CompareToTheoretical fasta_path job_id num_jobs do_frag residual_file score_file stats_file bin_size_chi bin_size_res [--columnar] [--trace path] [--float-report spline_model report_file]" << std::endl;
+    std::cout << "--float-report compares the float spline estimates of spline_model to the double ones (needs do_frag)" << std::endl;
 }
 
 int main(int argc, char * argv[])
 {
+    const ResultWriter::Format format = ResultWriter::formatFromArgs(argc, argv);
+    const std::string tracePath = Trace::pathFromArgs(argc, argv);
+    std::string floatModelPath;
+    const std::string floatReportPath = floatReportFromArgs(argc, argv, floatModelPath);
+
     if (argc != 10)
     {
         usage();
         return 0;
     }
 
+    std::unique_ptr<IsotopeSplineModel> splineModel;
+    if (!floatReportPath.empty())
+    {
+        try {
+            splineModel.reset(new IsotopeSplineModel(floatModelPath));
+        } catch (std::exception& e) {
+            std::cout << e.what() << std::endl;
+            return 1;
+        }
+        floatModel = splineModel.get();
+    }
+
     init(atoi(argv[4]));
 
     testTheoreticalPeptides(argv[1], atoi(argv[2])-1, atoi(argv[3]), atoi(argv[4]));
 
-    writeResults(argv[5], argv[6], argv[7], atoi(argv[4]), atof(argv[8]), atof(argv[9]));
+    writeResults(argv[5], argv[6], argv[7], atoi(argv[4]), atof(argv[8]), atof(argv[9]), format);
+
+    if (floatModel != NULL)
+    {
+        writeFloatReport(floatReportPath, format);
+    }
+
+    if (!tracePath.empty() && Trace::writeChromeTrace(tracePath)) {
+        std::cout << "Trace written to: " << tracePath << std::endl;
+    }
 
     return 0;
 }
@@ -0,0 +1,64 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "CompressedSplineModel.h"
+
+void usage()
+{
+    std::cout << "usage: CompressSplineModel in_path out_path [--max-error x] [--float16]" << std::endl;
+    std::cout << "\tin_path: spline model file, e.g. misc/IsotopeSplines_100kDa_101isotopes.xml" << std::endl;
+    std::cout << "\tout_path: compressed model, read by CompressedSplineModel" << std::endl;
+    std::cout << "\tmax-error: largest accepted isotope probability error of a merged piece (default 1e-5)" << std::endl;
+    std::cout << "\tfloat16: store 16 bit coefficients with an exponent per piece and isotope instead of floats, "
+              << "needs a max-error above about 3e-5" << std::endl;
+}
+
+int main(int argc, const char ** argv)
+{
+    if (argc < 3) {
+        usage();
+        return 0;
+    }
+
+    double maxError = 1e-5;
+    CompressedSplineModel::Precision precision = CompressedSplineModel::FLOAT32;
+    for (int i = 3; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--float16") == 0) {
+            precision = CompressedSplineModel::FLOAT16;
+        } else if (std::strcmp(argv[i], "--max-error") == 0 && i + 1 < argc) {
+            maxError = atof(argv[++i]);
+        } else {
+            usage();
+            return 0;
+        }
+    }
+
+    try {
+        // the fit evaluates every isotope at many masses, which the shared grid does in one lookup
+        IsotopeSplineModel splines(argv[1], IsotopeSplineModel::SHARED);
+        CompressedSplineModel compressed(splines, maxError, precision);
+        compressed.save(argv[2]);
+
+        const std::size_t numIsotopes = splines.maxIsotope() + 1;
+        std::size_t sharedBytes = 0;
+        std::cout << "sulfur\tpieces\tcompressed pieces" << std::endl;
+        for (int numSulfur = CompressedSplineModel::AVERAGE; numSulfur <= splines.maxSulfur(); ++numSulfur) {
+            std::size_t numKnots = splines.knots(numSulfur).size();
+            if (numKnots == 0) continue;
+            // knots and double coefficients of the shared layout, up to the common highest isotope
+            sharedBytes += numKnots * sizeof(double) + (numKnots - 1) * numIsotopes * 4 * sizeof(double);
+            std::cout << (numSulfur == CompressedSplineModel::AVERAGE ? "average" : std::to_string(numSulfur))
+                      << "\t" << numKnots - 1 << "\t" << compressed.numPieces(numSulfur) << std::endl;
+        }
+        std::cout << "Coefficients: " << sharedBytes / 1024 << " KiB as doubles, "
+                  << compressed.coefficientBytes() / 1024 << " KiB compressed" << std::endl;
+        std::cout << "Largest error: " << compressed.measuredError() << std::endl;
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Compressed model written to: " << argv[2] << std::endl;
+    return 0;
+}
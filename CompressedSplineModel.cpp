@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "CompressedSplineModel.h"
+#include "FragmentIsotopes.h"
+
+namespace {
+
+    const std::uint32_t MAGIC = 0x53434946;     // "FICS"
+    const std::uint32_t VERSION = 1;
+
+    // x86 and ARM hosts are little-endian, so values are copied as they are laid out in memory
+    template<typename T>
+    void put(std::ostream &out, T value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    void putArray(std::ostream &out, const std::vector<T> &values)
+    {
+        out.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+    template<typename T>
+    T get(std::istream &in)
+    {
+        T value;
+        if (!in.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+            throw std::runtime_error("Invalid compressed spline model: truncated file");
+        }
+        return value;
+    }
+
+    // size is checked against the rest of the file first, so a corrupt header cannot size a huge array
+    template<typename T>
+    void getArray(std::istream &in, std::size_t size, std::vector<T> &values)
+    {
+        const std::streamoff position = in.tellg();
+        in.seekg(0, std::ios::end);
+        const std::streamoff end = in.tellg();
+        in.seekg(position);
+        if (position < 0 || end < position || size > std::uint64_t(end - position) / sizeof(T)) {
+            throw std::runtime_error("Invalid compressed spline model: truncated file");
+        }
+        values.resize(size);
+        if (!in.read(reinterpret_cast<char *>(values.data()), size * sizeof(T))) {
+            throw std::runtime_error("Invalid compressed spline model: truncated file");
+        }
+    }
+
+    // isotopes 0 to n - 1 are defined at x, the ranges of isotopes 0 to i are nested
+    int numDefined(const std::vector<double> &lower, const std::vector<double> &upper, double x)
+    {
+        int n = 0;
+        while (n < (int) lower.size() && x >= lower[n] && x <= upper[n]) ++n;
+        return n;
+    }
+
+    // Chebyshev nodes of a cubic on [0, 1]
+    const double NODES[4] = {
+            (1 + std::cos(0.5 * M_PI / 4)) / 2, (1 + std::cos(1.5 * M_PI / 4)) / 2,
+            (1 + std::cos(2.5 * M_PI / 4)) / 2, (1 + std::cos(3.5 * M_PI / 4)) / 2
+    };
+
+    // coefficients of 1, t, t^2, t^3 of the cubic through (NODES[k], values[k])
+    void interpolate(const double *values, double *cubic)
+    {
+        // Newton's divided differences, then the Newton form multiplied out
+        double d[4] = {values[0], values[1], values[2], values[3]};
+        for (int level = 1; level < 4; ++level) {
+            for (int k = 3; k >= level; --k) d[k] = (d[k] - d[k - 1]) / (NODES[k] - NODES[k - level]);
+        }
+        cubic[0] = d[3];
+        cubic[1] = cubic[2] = cubic[3] = 0;
+        for (int k = 2; k >= 0; --k) {
+            // cubic = cubic * (t - NODES[k]) + d[k]
+            for (int power = 3; power > 0; --power) cubic[power] = cubic[power - 1] - NODES[k] * cubic[power];
+            cubic[0] = d[k] - NODES[k] * cubic[0];
+        }
+    }
+}
+
+CompressedSplineModel::CompressedSplineModel(const IsotopeSplineModel &splines, double maxError, Precision precision)
+        : precision_(precision), maxIsotope_(splines.maxIsotope()), measuredError_(0)
+{
+    if (!(maxError > 0)) throw std::invalid_argument("The compression error has to be positive");
+    initializeScales();
+
+    models_.resize(splines.maxSulfur() + 2);
+    for (int numSulfur = AVERAGE; numSulfur <= splines.maxSulfur(); ++numSulfur) {
+        if (splines.knots(numSulfur).empty()) continue;
+        measuredError_ = std::max(measuredError_, compress(splines, numSulfur, maxError, models_[numSulfur + 1]));
+        models_[numSulfur + 1].index();
+    }
+}
+
+double CompressedSplineModel::compress(const IsotopeSplineModel &splines, int numSulfur, double maxError,
+                                       Model &model)
+{
+    const std::vector<double> &original = splines.knots(numSulfur);
+    const std::size_t numOriginal = original.size() - 1;
+    const int numIsotopes = maxIsotope_ + 1;
+
+    model.numIsotopes = numIsotopes;
+    model.lower.assign(numIsotopes, std::numeric_limits<double>::infinity());
+    model.upper.assign(numIsotopes, -std::numeric_limits<double>::infinity());
+    for (int isotope = 0; isotope < numIsotopes; ++isotope) {
+        if (!splines.range(numSulfur, isotope, model.lower[isotope], model.upper[isotope])) break;
+    }
+
+    // pieces are not merged over the end of an isotope's range
+    std::vector<bool> rangeEnd(original.size(), false);
+    for (std::size_t k = 0; k < original.size(); ++k) {
+        for (int isotope = 0; isotope < numIsotopes; ++isotope) {
+            if (original[k] == model.lower[isotope] || original[k] == model.upper[isotope]) rangeEnd[k] = true;
+        }
+    }
+
+    // the splines at the checks of every original piece
+    const std::size_t checksPerPiece = CHECKS_PER_PIECE + 1;
+    std::vector<double> checkValues(numOriginal * checksPerPiece * numIsotopes, 0);
+    std::vector<int> checkDefined(numOriginal * checksPerPiece);
+    for (std::size_t piece = 0; piece < numOriginal; ++piece) {
+        for (std::size_t check = 0; check < checksPerPiece; ++check) {
+            const std::size_t i = piece * checksPerPiece + check;
+            double x = original[piece] + check * (original[piece + 1] - original[piece]) / CHECKS_PER_PIECE;
+            checkDefined[i] = numDefined(model.lower, model.upper, x);
+            if (checkDefined[i] > 0) splines.estimate(x, checkDefined[i] - 1, numSulfur, &checkValues[i * numIsotopes]);
+        }
+    }
+
+    // fits original pieces from to to - 1 with one cubic per isotope into trial, returns the error at the checks
+    Model trial;
+    trial.numIsotopes = numIsotopes;
+    std::vector<double> cubics(numIsotopes * 4);
+    std::vector<double> values(4 * numIsotopes), estimated(numIsotopes);
+    auto fit = [&](std::size_t from, std::size_t to) {
+        const double start = original[from], width = original[to] - start;
+        const int defined = numDefined(model.lower, model.upper, start + width / 2);
+        std::fill(values.begin(), values.end(), 0.0);
+        for (int k = 0; k < 4; ++k) {
+            if (defined > 0) splines.estimate(start + NODES[k] * width, defined - 1, numSulfur, &values[k * numIsotopes]);
+        }
+        for (int isotope = 0; isotope < numIsotopes; ++isotope) {
+            double nodeValues[4];
+            for (int k = 0; k < 4; ++k) nodeValues[k] = values[k * numIsotopes + isotope];
+            interpolate(nodeValues, &cubics[isotope * 4]);
+        }
+
+        trial.coefficients.clear();
+        trial.mantissas.clear();
+        trial.exponents.clear();
+        store(cubics.data(), trial);
+
+        double error = 0;
+        for (std::size_t i = from * checksPerPiece; i < to * checksPerPiece; ++i) {
+            if (checkDefined[i] == 0) continue;
+            const std::size_t piece = i / checksPerPiece;
+            double x = original[piece] + (i % checksPerPiece) * (original[piece + 1] - original[piece]) / CHECKS_PER_PIECE;
+            evaluate(trial, 0, (x - start) / width, checkDefined[i] - 1, estimated.data());
+            for (int isotope = 0; isotope < checkDefined[i]; ++isotope) {
+                error = std::max(error, std::abs(estimated[isotope] - checkValues[i * numIsotopes + isotope]));
+            }
+        }
+        return error;
+    };
+
+    // greedily extends each piece as far as the error allows: doubling its length, then bisecting
+    double modelError = 0;
+    model.knots.assign(1, original[0]);
+    for (std::size_t from = 0; from < numOriginal; ) {
+        std::size_t limit = from + 1;
+        while (limit < numOriginal && !rangeEnd[limit]) ++limit;
+
+        std::size_t best = from + 1, failed = limit + 1;
+        for (std::size_t length = 2; from + length <= limit; length *= 2) {
+            if (fit(from, from + length) > maxError) {
+                failed = from + length;
+                break;
+            }
+            best = from + length;
+        }
+        if (failed > limit && best < limit) {
+            if (fit(from, limit) <= maxError) best = limit;
+            else failed = limit;
+        }
+        while (failed - best > 1 && failed <= limit) {
+            std::size_t middle = best + (failed - best) / 2;
+            if (fit(from, middle) <= maxError) best = middle;
+            else failed = middle;
+        }
+
+        modelError = std::max(modelError, fit(from, best));
+        model.coefficients.insert(model.coefficients.end(), trial.coefficients.begin(), trial.coefficients.end());
+        model.mantissas.insert(model.mantissas.end(), trial.mantissas.begin(), trial.mantissas.end());
+        model.exponents.insert(model.exponents.end(), trial.exponents.begin(), trial.exponents.end());
+        model.knots.push_back(original[best]);
+        from = best;
+    }
+    return modelError;
+}
+
+void CompressedSplineModel::store(const double *cubics, Model &model) const
+{
+    for (int isotope = 0; isotope < model.numIsotopes; ++isotope) {
+        const double *cubic = cubics + isotope * 4;
+        if (precision_ == FLOAT32) {
+            model.coefficients.insert(model.coefficients.end(), cubic, cubic + 4);
+            continue;
+        }
+
+        // the largest coefficient sets the exponent, its mantissa uses 15 bits
+        double largest = 0;
+        for (int power = 0; power < 4; ++power) largest = std::max(largest, std::abs(cubic[power]));
+        int exponent = 0;
+        if (largest > 0) std::frexp(largest, &exponent);
+        if (exponent < -127 || largest == 0) exponent = -128;   // below 2^-128, stored as 0
+
+        model.exponents.push_back((std::int8_t) exponent);
+        for (int power = 0; power < 4; ++power) {
+            double mantissa = exponent == -128 ? 0 : std::round(std::ldexp(cubic[power], 15 - exponent));
+            model.mantissas.push_back((std::int16_t) std::max(-32767.0, std::min(32767.0, mantissa)));
+        }
+    }
+}
+
+void CompressedSplineModel::Model::index()
+{
+    inverseWidths.resize(knots.size() - 1);
+    for (std::size_t piece = 0; piece + 1 < knots.size(); ++piece) {
+        inverseWidths[piece] = 1 / (knots[piece + 1] - knots[piece]);
+    }
+    knotIndex = KnotIndex(knots);
+}
+
+void CompressedSplineModel::initializeScales()
+{
+    for (int exponent = -128; exponent < 128; ++exponent) {
+        scales_[exponent + 128] = exponent == -128 ? 0 : std::ldexp(1.0, exponent - 15);
+    }
+}
+
+CompressedSplineModel::CompressedSplineModel(const std::string &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) throw std::runtime_error("Could not open compressed spline model " + path);
+
+    if (get<std::uint32_t>(in) != MAGIC) throw std::runtime_error(path + " is not a compressed spline model");
+    if (get<std::uint32_t>(in) != VERSION) {
+        throw std::runtime_error("Unsupported compressed spline model version in " + path);
+    }
+    std::uint32_t precision = get<std::uint32_t>(in);
+    maxIsotope_ = get<std::int32_t>(in);
+    measuredError_ = get<double>(in);
+    std::uint32_t numModels = get<std::uint32_t>(in);
+    if (precision > FLOAT16 || maxIsotope_ < 0 || maxIsotope_ > 1000 || numModels < 1 || numModels > 1000) {
+        throw std::runtime_error("Invalid compressed spline model dimensions in " + path);
+    }
+    precision_ = (Precision) precision;
+    initializeScales();
+
+    models_.resize(numModels);
+    for (Model &model : models_) {
+        std::uint64_t numKnots = get<std::uint64_t>(in);
+        if (numKnots == 0) continue;
+        if (numKnots < 2 || numKnots > 100000000) {
+            throw std::runtime_error("Invalid compressed spline model dimensions in " + path);
+        }
+
+        model.numIsotopes = maxIsotope_ + 1;
+        const std::size_t numCoefficients = (numKnots - 1) * model.numIsotopes * 4;
+        getArray(in, numKnots, model.knots);
+        getArray(in, model.numIsotopes, model.lower);
+        getArray(in, model.numIsotopes, model.upper);
+        if (precision_ == FLOAT32) {
+            getArray(in, numCoefficients, model.coefficients);
+        } else {
+            getArray(in, numCoefficients, model.mantissas);
+            getArray(in, numCoefficients / 4, model.exponents);
+        }
+        for (std::size_t k = 1; k < model.knots.size(); ++k) {
+            if (!(model.knots[k - 1] < model.knots[k])) {
+                throw std::runtime_error("Invalid compressed spline model: knots are not increasing in " + path);
+            }
+        }
+        model.index();
+    }
+}
+
+void CompressedSplineModel::save(const std::string &path) const
+{
+    std::ofstream out(path.c_str(), std::ios::binary);
+    if (!out) throw std::runtime_error("Could not open compressed spline model " + path + " for writing");
+
+    put<std::uint32_t>(out, MAGIC);
+    put<std::uint32_t>(out, VERSION);
+    put<std::uint32_t>(out, precision_);
+    put<std::int32_t>(out, maxIsotope_);
+    put<double>(out, measuredError_);
+    put<std::uint32_t>(out, (std::uint32_t) models_.size());
+    for (const Model &model : models_) {
+        put<std::uint64_t>(out, model.knots.size());
+        if (model.knots.empty()) continue;
+        putArray(out, model.knots);
+        putArray(out, model.lower);
+        putArray(out, model.upper);
+        putArray(out, model.coefficients);
+        putArray(out, model.mantissas);
+        putArray(out, model.exponents);
+    }
+    if (!out) throw std::runtime_error("Could not write compressed spline model " + path);
+}
+
+const CompressedSplineModel::Model* CompressedSplineModel::model(int numSulfur, int maxIsotope) const
+{
+    if (numSulfur < AVERAGE || numSulfur + 1 >= (int) models_.size()) return NULL;
+    const Model &model = models_[numSulfur + 1];
+    return maxIsotope >= 0 && maxIsotope < model.numIsotopes ? &model : NULL;
+}
+
+std::size_t CompressedSplineModel::numPieces(int numSulfur) const
+{
+    const Model *m = model(numSulfur, 0);
+    return m == NULL ? 0 : m->knots.size() - 1;
+}
+
+std::size_t CompressedSplineModel::coefficientBytes() const
+{
+    std::size_t bytes = 0;
+    for (const Model &model : models_) {
+        bytes += (model.knots.size() + model.inverseWidths.size()) * sizeof(double)
+                 + model.coefficients.size() * sizeof(float) + model.mantissas.size() * sizeof(std::int16_t)
+                 + model.exponents.size() * sizeof(std::int8_t);
+    }
+    return bytes;
+}
+
+bool CompressedSplineModel::inBounds(double mass, int maxIsotope, int numSulfur) const
+{
+    const Model *m = model(numSulfur, maxIsotope);
+    return m != NULL && mass >= m->lower[maxIsotope] && mass <= m->upper[maxIsotope];
+}
+
+bool CompressedSplineModel::estimate(double mass, int maxIsotope, int numSulfur, double *probabilities) const
+{
+    const Model *m = model(numSulfur, maxIsotope);
+    if (m == NULL || !(mass >= m->lower[maxIsotope] && mass <= m->upper[maxIsotope])) return false;
+
+    std::size_t piece = m->knotIndex.piece(m->knots, mass);
+    evaluate(*m, piece, (mass - m->knots[piece]) * m->inverseWidths[piece], maxIsotope, probabilities);
+    return true;
+}
+
+void CompressedSplineModel::evaluate(const Model &model, std::size_t piece, double t, int maxIsotope,
+                                     double *probabilities) const
+{
+    const double t2 = t * t;
+    const double t3 = t2 * t;
+    const std::size_t first = piece * model.numIsotopes;
+    if (precision_ == FLOAT32) {
+        const float *c = &model.coefficients[first * 4];
+        for (int isotope = 0; isotope <= maxIsotope; ++isotope, c += 4) {
+            probabilities[isotope] = c[0] + c[1] * t + c[2] * t2 + c[3] * t3;
+        }
+    } else {
+        const std::int16_t *q = &model.mantissas[first * 4];
+        const std::int8_t *exponents = &model.exponents[first];
+        for (int isotope = 0; isotope <= maxIsotope; ++isotope, q += 4) {
+            probabilities[isotope] = (q[0] + q[1] * t + q[2] * t2 + q[3] * t3) * scales_[exponents[isotope] + 128];
+        }
+    }
+}
+
+bool CompressedSplineModel::estimateFragment(double precursorMass, double fragmentMass,
+                                             std::uint64_t isolatedIsotopes, int precursorSulfurs,
+                                             int fragmentSulfurs, double *probabilities) const
+{
+    int maxIsolated, complementSulfurs;
+    if (!FragmentIsotopes::prepare(precursorMass, fragmentMass, isolatedIsotopes, precursorSulfurs, fragmentSulfurs,
+                                   maxIsolated, complementSulfurs)) {
+        return false;
+    }
+
+    double fragment[64], complement[64];
+    if (!estimate(fragmentMass, maxIsolated, fragmentSulfurs, fragment)
+        || !estimate(precursorMass - fragmentMass, maxIsolated, complementSulfurs, complement)) {
+        return false;
+    }
+
+    FragmentIsotopes::condition(fragment, complement, isolatedIsotopes, maxIsolated, probabilities);
+    return true;
+}
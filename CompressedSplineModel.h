@@ -0,0 +1,118 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_COMPRESSEDSPLINEMODEL_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_COMPRESSEDSPLINEMODEL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "IsotopeSplineModel.h"
+#include "KnotIndex.h"
+
+/**
+ * The spline models with fewer knots and smaller coefficients, so the working set of a query over many isotopes
+ * stays in cache. Built by CompressSplineModel from an IsotopeSplineModel and saved to a binary file.
+ *
+ * Compressing walks the shared knot grid of each sulfur count and merges consecutive pieces while one cubic per
+ * isotope, interpolated at the Chebyshev nodes of the merged piece, stays within maxError of every isotope's
+ * spline. The ends of the isotopes' ranges are never merged over. A cubic is stored in powers of
+ * t = (x - knot) / (piece width), so all four coefficients are on the scale of the probabilities, either
+ *  - FLOAT32: as floats, 16 bytes per piece and isotope, or
+ *  - FLOAT16: as 16 bit integers sharing one exponent per piece and isotope, 9 bytes. Their rounding error is up
+ *    to 2^-14 times the largest coefficient, about 3e-5 for the most abundant isotope, so FLOAT16 needs a
+ *    maxError above that.
+ * The error is checked with the stored coefficients at CHECKS_PER_PIECE + 1 points in every original piece. A
+ * piece that misses maxError on its own is kept as it is, measuredError() reports the largest error found.
+ *
+ * A model is immutable, so it can be shared by any number of threads.
+ */
+class CompressedSplineModel {
+
+public:
+
+    static const int AVERAGE = IsotopeSplineModel::AVERAGE;
+    static const int CHECKS_PER_PIECE = 8;
+
+    enum Precision {
+        FLOAT32,
+        FLOAT16
+    };
+
+    CompressedSplineModel(const IsotopeSplineModel &splines, double maxError, Precision precision);
+
+    /**
+     * @throws std::runtime_error if path cannot be read or is not a compressed spline model
+     */
+    explicit CompressedSplineModel(const std::string &path);
+
+    /**
+     * @throws std::runtime_error if path cannot be written
+     */
+    void save(const std::string &path) const;
+
+    Precision precision() const { return precision_; }
+
+    int maxIsotope() const { return maxIsotope_; }
+
+    int maxSulfur() const { return (int) models_.size() - 2; }
+
+    // largest difference to the splines found while compressing, NaN for a loaded model
+    double measuredError() const { return measuredError_; }
+
+    // number of pieces of the model for numSulfur (or AVERAGE), 0 if there is none
+    std::size_t numPieces(int numSulfur) const;
+
+    // memory of the knots and coefficients of all models
+    std::size_t coefficientBytes() const;
+
+    // same queries and results as IsotopeSplineModel
+
+    bool inBounds(double mass, int maxIsotope, int numSulfur) const;
+
+    bool estimate(double mass, int maxIsotope, int numSulfur, double *probabilities) const;
+
+    bool estimateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                          int precursorSulfurs, int fragmentSulfurs, double *probabilities) const;
+
+private:
+
+    struct Model {
+        int numIsotopes;
+        std::vector<double> knots;
+        std::vector<double> lower;              // range of isotopes 0 to i together
+        std::vector<double> upper;
+        std::vector<float> coefficients;        // FLOAT32: [piece][isotope][power of t]
+        std::vector<std::int16_t> mantissas;    // FLOAT16: [piece][isotope][power of t]
+        std::vector<std::int8_t> exponents;     // FLOAT16: [piece][isotope], the mantissas' scale is 2^(exponent - 15)
+
+        // derived when the model is built or loaded
+        std::vector<double> inverseWidths;      // 1 / (knot[piece + 1] - knot[piece])
+        KnotIndex knotIndex;
+
+        Model() : numIsotopes(0) {}
+
+        void index();
+    };
+
+    // model of numSulfur (or AVERAGE) if it covers maxIsotope, NULL otherwise
+    const Model* model(int numSulfur, int maxIsotope) const;
+
+    // merges the pieces of one model of splines, returns the largest error to the splines
+    double compress(const IsotopeSplineModel &splines, int numSulfur, double maxError, Model &model);
+
+    // stores the cubics of one piece, coefficients in powers of t by isotope
+    void store(const double *cubics, Model &model) const;
+
+    // isotopes 0 to maxIsotope of piece at t
+    void evaluate(const Model &model, std::size_t piece, double t, int maxIsotope, double *probabilities) const;
+
+    void initializeScales();
+
+    Precision precision_;
+    int maxIsotope_;
+    double measuredError_;
+    std::vector<Model> models_;     // by sulfur count + 1, AVERAGE first
+    double scales_[256];            // 2^(exponent - 15) by exponent + 128
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_COMPRESSEDSPLINEMODEL_H
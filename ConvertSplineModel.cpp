@@ -0,0 +1,29 @@
+#include <iostream>
+
+#include "IsotopeSplineModel.h"
+
+void usage()
+{
+    std::cout << "usage: ConvertSplineModel in_path out_path" << std::endl;
+    std::cout << "\tin_path: spline model file with separate splines per isotope, e.g. misc/IsotopeSplines_10kDa_21isotopes.xml" << std::endl;
+    std::cout << "\tout_path: the same models with all isotopes of a sulfur count on one knot grid" << std::endl;
+}
+
+int main(int argc, const char ** argv)
+{
+    if (argc != 3) {
+        usage();
+        return 0;
+    }
+
+    try {
+        IsotopeSplineModel model(argv[1], IsotopeSplineModel::SHARED);
+        model.saveShared(argv[2]);
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Shared knot model written to: " << argv[2] << std::endl;
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "EstimationProtocol.h"
+
+namespace EstimationProtocol {
+
+    namespace {
+
+        // x86 and ARM hosts are little-endian, so values are copied as they are laid out in memory
+        template<typename T>
+        void put(std::string &out, T value)
+        {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        template<typename T>
+        T get(const std::string &in, std::size_t &pos)
+        {
+            T value;
+            std::memcpy(&value, in.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        void putHeader(std::string &out, std::uint32_t magic, std::uint16_t code, std::uint32_t requestId,
+                       std::uint32_t count)
+        {
+            put<std::uint32_t>(out, magic);
+            put<std::uint16_t>(out, VERSION);
+            put<std::uint16_t>(out, code);
+            put<std::uint32_t>(out, requestId);
+            put<std::uint32_t>(out, count);
+        }
+    }
+
+    const char* methodName(Method method)
+    {
+        static const char *names[NUM_METHODS] = {"spline_weight", "spline_weight_sulfur",
+                                                 "averagine_weight", "averagine_weight_sulfur"};
+        return method < NUM_METHODS ? names[method] : "unknown";
+    }
+
+    const char* statusName(Status status)
+    {
+        switch (status) {
+            case OK: return "ok";
+            case BAD_VERSION: return "unsupported protocol version";
+            case BAD_METHOD: return "unknown method";
+            case TOO_MANY_QUERIES: return "too many queries";
+            case BAD_QUERY: return "malformed query";
+            case ESTIMATION_FAILED: return "estimation failed";
+        }
+        return "unknown status";
+    }
+
+    bool readHeader(const std::string &in, std::size_t pos, Header &header)
+    {
+        if (in.size() < pos + HEADER_SIZE) return false;
+
+        header.magic = get<std::uint32_t>(in, pos);
+        header.version = get<std::uint16_t>(in, pos);
+        header.code = get<std::uint16_t>(in, pos);
+        header.requestId = get<std::uint32_t>(in, pos);
+        header.count = get<std::uint32_t>(in, pos);
+        return true;
+    }
+
+    void appendRequest(std::string &out, std::uint32_t requestId, Method method, const std::vector<Query> &queries)
+    {
+        putHeader(out, REQUEST_MAGIC, (std::uint16_t) method, requestId, (std::uint32_t) queries.size());
+        for (const Query &q : queries) {
+            put<double>(out, q.precursorAverageMass);
+            put<double>(out, q.fragmentAverageMass);
+            put<std::uint8_t>(out, q.precursorSulfurs);
+            put<std::uint8_t>(out, q.fragmentSulfurs);
+            put<std::uint16_t>(out, 0);
+            put<std::uint64_t>(out, q.isolatedIsotopes);
+        }
+    }
+
+    void readQueries(const std::string &in, std::size_t bodyPos, std::uint32_t count, std::vector<Query> &queries)
+    {
+        queries.resize(count);
+        std::size_t pos = bodyPos;
+        for (Query &q : queries) {
+            q.precursorAverageMass = get<double>(in, pos);
+            q.fragmentAverageMass = get<double>(in, pos);
+            q.precursorSulfurs = get<std::uint8_t>(in, pos);
+            q.fragmentSulfurs = get<std::uint8_t>(in, pos);
+            pos += sizeof(std::uint16_t);
+            q.isolatedIsotopes = get<std::uint64_t>(in, pos);
+
+            if (q.isolatedIsotopes == 0 || q.fragmentAverageMass <= 0
+                || q.fragmentAverageMass > q.precursorAverageMass || q.fragmentSulfurs > q.precursorSulfurs) {
+                throw std::runtime_error("Malformed query");
+            }
+        }
+    }
+
+    void appendResponse(std::string &out, std::uint32_t requestId, Status status,
+                        const std::vector<std::vector<double> > &distributions)
+    {
+        std::uint32_t count = status == OK ? (std::uint32_t) distributions.size() : 0;
+        putHeader(out, RESPONSE_MAGIC, (std::uint16_t) status, requestId, count);
+        for (std::uint32_t i = 0; i < count; ++i) {
+            put<std::uint32_t>(out, (std::uint32_t) distributions[i].size());
+            for (double p : distributions[i]) put<double>(out, p);
+        }
+    }
+
+    bool readResponse(const std::string &in, std::size_t &pos, Response &response)
+    {
+        Header header;
+        if (!readHeader(in, pos, header)) return false;
+        if (header.magic != RESPONSE_MAGIC) {
+            throw std::runtime_error("Not an isotope server response");
+        }
+
+        // walk the distributions first so nothing is consumed from an incomplete frame
+        std::size_t end = pos + HEADER_SIZE;
+        for (std::uint32_t i = 0; i < header.count; ++i) {
+            if (in.size() < end + sizeof(std::uint32_t)) return false;
+            std::uint32_t n;
+            std::memcpy(&n, in.data() + end, sizeof(n));
+            end += sizeof(std::uint32_t) + (std::size_t) n * sizeof(double);
+        }
+        if (in.size() < end) return false;
+
+        std::size_t p = pos + HEADER_SIZE;
+        response.requestId = header.requestId;
+        response.status = (Status) header.code;
+        response.distributions.assign(header.count, std::vector<double>());
+        for (std::uint32_t i = 0; i < header.count; ++i) {
+            std::uint32_t n = get<std::uint32_t>(in, p);
+            response.distributions[i].resize(n);
+            for (std::uint32_t j = 0; j < n; ++j) response.distributions[i][j] = get<double>(in, p);
+        }
+        pos = end;
+        return true;
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ESTIMATIONPROTOCOL_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ESTIMATIONPROTOCOL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Binary protocol spoken by IsotopeServer over a Unix domain socket.
+ *
+ * Every message is a frame: a 16 byte header followed by a body. All values are little-endian.
+ *
+ *     header:   uint32 magic, uint16 version, uint16 code, uint32 request id, uint32 count
+ *
+ * A request has the REQUEST_MAGIC, the estimation Method as code, and count queries of 28 bytes each:
+ *
+ *     query:    float64 precursor average mass, float64 fragment average mass,
+ *               uint8 precursor sulfurs, uint8 fragment sulfurs, uint16 reserved (0),
+ *               uint64 isolated precursor isotopes (bit i set if isotope Mi was isolated, as in IsolationMask)
+ *
+ * A response has the RESPONSE_MAGIC, a Status as code, the id of its request and, if the status is OK, count
+ * distributions:
+ *
+ *     distribution: uint32 n, float64 probability[n]    (fragment isotopes M0 ... Mn-1)
+ *
+ * Clients may send any number of requests without waiting (pipelining). Requests are processed concurrently, so
+ * responses can arrive in a different order and are matched to requests by id.
+ */
+namespace EstimationProtocol {
+
+    static const std::uint32_t REQUEST_MAGIC = 0x51444946;   // "FIDQ"
+    static const std::uint32_t RESPONSE_MAGIC = 0x52444946;  // "FIDR"
+    static const std::uint16_t VERSION = 2;                  // 2: 64-bit isolated isotopes
+
+    static const std::size_t HEADER_SIZE = 16;
+    static const std::size_t QUERY_SIZE = 28;
+    static const std::uint32_t MAX_QUERIES = 1 << 20;        // per request
+    static const int MAX_ISOTOPE = 63;
+
+    enum Method {
+        SPLINE_FROM_WEIGHT,
+        SPLINE_FROM_WEIGHT_AND_SULFUR,
+        AVERAGINE_FROM_WEIGHT,
+        AVERAGINE_FROM_WEIGHT_AND_SULFUR,
+        NUM_METHODS
+    };
+
+    enum Status {
+        OK,
+        BAD_VERSION,
+        BAD_METHOD,
+        TOO_MANY_QUERIES,
+        BAD_QUERY,
+        ESTIMATION_FAILED
+    };
+
+    struct Header {
+        std::uint32_t magic;
+        std::uint16_t version;
+        std::uint16_t code;
+        std::uint32_t requestId;
+        std::uint32_t count;
+    };
+
+    struct Query {
+        double precursorAverageMass;
+        double fragmentAverageMass;
+        std::uint8_t precursorSulfurs;
+        std::uint8_t fragmentSulfurs;
+        std::uint64_t isolatedIsotopes;
+    };
+
+    struct Response {
+        std::uint32_t requestId;
+        Status status;
+        std::vector<std::vector<double> > distributions;
+    };
+
+    const char* methodName(Method method);
+
+    const char* statusName(Status status);
+
+    /**
+     * Reads a frame header at pos.
+     * @return false if fewer than HEADER_SIZE bytes are available
+     */
+    bool readHeader(const std::string &in, std::size_t pos, Header &header);
+
+    void appendRequest(std::string &out, std::uint32_t requestId, Method method, const std::vector<Query> &queries);
+
+    /**
+     * Reads the queries of a request whose header has been read and whose body is complete.
+     * @throws std::runtime_error if a query is malformed
+     */
+    void readQueries(const std::string &in, std::size_t bodyPos, std::uint32_t count, std::vector<Query> &queries);
+
+    void appendResponse(std::string &out, std::uint32_t requestId, Status status,
+                        const std::vector<std::vector<double> > &distributions);
+
+    /**
+     * Reads one complete response at pos and advances pos past it.
+     * @return false if the response is not complete yet, pos is unchanged
+     * @throws std::runtime_error if the data is not a response frame
+     */
+    bool readResponse(const std::string &in, std::size_t &pos, Response &response);
+}
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ESTIMATIONPROTOCOL_H
@@ -0,0 +1,124 @@
+#include <stdexcept>
+
+#include <OpenMS/CHEMISTRY/ElementDB.h>
+#include <OpenMS/CHEMISTRY/IsotopeDistribution.h>
+
+#include "EstimatorDispatcher.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+namespace {
+
+    void renormalize(std::vector<double> &probabilities)
+    {
+        double total = 0;
+        for (double p : probabilities) total += p;
+        if (total > 0) {
+            for (double &p : probabilities) p /= total;
+        }
+    }
+}
+
+EstimatorDispatcher::EstimatorDispatcher(const IsotopeSplineModel &splines, double tolerance, bool useSulfur)
+        : splines_(splines), bounds_(NULL), tolerance_(tolerance), useSulfur_(useSulfur)
+{
+    for (int path = 0; path < NUM_PATHS; ++path) counts_[path].store(0);
+}
+
+const char* EstimatorDispatcher::pathName(Path path)
+{
+    switch (path) {
+        case SPLINE: return "spline";
+        case AVERAGINE_FFT: return "averagine";
+        case EXACT: return "exact";
+        default: return "unknown";
+    }
+}
+
+EstimatorDispatcher::Query EstimatorDispatcher::makeQuery(const OpenMS::EmpiricalFormula &precursor,
+                                                          const OpenMS::EmpiricalFormula &fragment,
+                                                          const IsolationMask &precursorIsotopes) const
+{
+    static const OpenMS::Element* SULFUR = OpenMS::ElementDB::getInstance()->getElement("Sulfur");
+
+    Query query;
+    query.precursorAverageMass = precursor.getAverageWeight();
+    query.fragmentAverageMass = fragment.getAverageWeight();
+    query.precursorSulfurs = useSulfur_ ? (int) precursor.getNumberOf(SULFUR) : IsotopeSplineModel::AVERAGE;
+    query.fragmentSulfurs = useSulfur_ ? (int) fragment.getNumberOf(SULFUR) : IsotopeSplineModel::AVERAGE;
+    query.precursorIsotopes = precursorIsotopes;
+    return query;
+}
+
+EstimatorDispatcher::Path EstimatorDispatcher::estimate(const OpenMS::EmpiricalFormula &precursor,
+                                                        const OpenMS::EmpiricalFormula &fragment,
+                                                        const IsolationMask &precursorIsotopes,
+                                                        std::vector<double> &probabilities) const
+{
+    if (precursorIsotopes.empty()) throw std::invalid_argument("No isolated precursor isotopes");
+
+    const Query query = makeQuery(precursor, fragment, precursorIsotopes);
+
+    Path path = EXACT;
+    if ((bounds_ == NULL || bounds_->splineError(query) <= tolerance_) && estimateSpline(query, probabilities)) {
+        path = SPLINE;
+    } else if (bounds_ == NULL || bounds_->averagineError(query) <= tolerance_) {
+        estimateAveragine(query, probabilities);
+        path = AVERAGINE_FFT;
+    } else {
+        TRACE_SCOPE("EstimatorDispatcher::exact");
+        estimateExact(precursor, fragment, precursorIsotopes, probabilities);
+    }
+
+    counts_[path].fetch_add(1, std::memory_order_relaxed);
+    static Metrics::Counter* counters[NUM_PATHS] = {&Metrics::counter("dispatch_spline"),
+                                                    &Metrics::counter("dispatch_averagine"),
+                                                    &Metrics::counter("dispatch_exact")};
+    counters[path]->add();
+    return path;
+}
+
+bool EstimatorDispatcher::estimateSpline(const Query &query, std::vector<double> &probabilities) const
+{
+    const IsolationMask &isotopes = query.precursorIsotopes;
+    if (isotopes.empty()) return false;
+
+    double buffer[IsolationMask::CAPACITY];
+    if (!splines_.estimateFragment(query.precursorAverageMass, query.fragmentAverageMass, isotopes.bits(),
+                                   query.precursorSulfurs, query.fragmentSulfurs, buffer)) {
+        return false;
+    }
+    probabilities.assign(buffer, buffer + isotopes.max() + 1);
+    return true;
+}
+
+void EstimatorDispatcher::estimateAveragine(const Query &query, std::vector<double> &probabilities) const
+{
+    const std::set<OpenMS::UInt> &isotopes = query.precursorIsotopes.cachedSet();
+    OpenMS::IsotopeDistribution fragmentDist(query.precursorIsotopes.max() + 1);
+    if (query.precursorSulfurs == IsotopeSplineModel::AVERAGE) {
+        fragmentDist.estimateForFragmentFromPeptideWeight(query.precursorAverageMass, query.fragmentAverageMass,
+                                                          isotopes);
+    } else {
+        fragmentDist.estimateForFragmentFromPeptideWeightAndS(query.precursorAverageMass, query.precursorSulfurs,
+                                                              query.fragmentAverageMass, query.fragmentSulfurs,
+                                                              isotopes);
+    }
+    fragmentDist.renormalize();
+
+    const std::vector<std::pair<OpenMS::Size, double> > &peaks = fragmentDist.getContainer();
+    probabilities.resize(peaks.size());
+    for (std::size_t i = 0; i < peaks.size(); ++i) probabilities[i] = peaks[i].second;
+}
+
+void EstimatorDispatcher::estimateExact(const OpenMS::EmpiricalFormula &precursor,
+                                        const OpenMS::EmpiricalFormula &fragment,
+                                        const IsolationMask &precursorIsotopes,
+                                        std::vector<double> &probabilities)
+{
+    std::vector<std::pair<OpenMS::Size, double> > peaks =
+            fragment.getConditionalFragmentIsotopeDist(precursor, precursorIsotopes.cachedSet()).getContainer();
+    probabilities.resize(peaks.size());
+    for (std::size_t i = 0; i < peaks.size(); ++i) probabilities[i] = peaks[i].second;
+    renormalize(probabilities);
+}
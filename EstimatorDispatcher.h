@@ -0,0 +1,103 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ESTIMATORDISPATCHER_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ESTIMATORDISPATCHER_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <OpenMS/CHEMISTRY/EmpiricalFormula.h>
+
+#include "IsolationMask.h"
+#include "IsotopeSplineModel.h"
+
+/**
+ * Picks the cheapest fragment isotope estimator whose answer is good enough for a query:
+ *
+ *   1. the spline model, if the query is inside its training range and its expected error is within tolerance
+ *   2. the averagine FFT, if its expected error is within tolerance
+ *   3. the exact conditional calculation otherwise
+ *
+ * Expected errors come from an ErrorBounds object, in the same unit as the tolerance: the largest absolute
+ * difference of any isotope probability to the exact distribution. Without one, the spline is trusted inside its
+ * training range and the averagine FFT outside of it, so the exact path is never taken.
+ *
+ * All distributions are renormalized to sum to 1. estimate() is thread-safe; the path each query took is counted
+ * per dispatcher and in the "dispatch_*" Metrics counters.
+ */
+class EstimatorDispatcher {
+
+public:
+
+    enum Path {
+        SPLINE,
+        AVERAGINE_FFT,
+        EXACT,
+        NUM_PATHS
+    };
+
+    struct Query {
+        double precursorAverageMass;
+        double fragmentAverageMass;
+        int precursorSulfurs;           // IsotopeSplineModel::AVERAGE if sulfur is not used
+        int fragmentSulfurs;
+        IsolationMask precursorIsotopes;
+    };
+
+    class ErrorBounds {
+
+    public:
+
+        virtual ~ErrorBounds() {}
+
+        virtual double splineError(const Query &query) const = 0;
+
+        virtual double averagineError(const Query &query) const = 0;
+    };
+
+    /**
+     * @param splines model for the spline path, must outlive the dispatcher
+     * @param useSulfur estimate with the sulfur-specific spline and averagine models
+     */
+    EstimatorDispatcher(const IsotopeSplineModel &splines, double tolerance, bool useSulfur);
+
+    // bounds must outlive the dispatcher, NULL trusts the approximations inside their ranges
+    void setErrorBounds(const ErrorBounds *bounds) { bounds_ = bounds; }
+
+    /**
+     * Fills probabilities with fragment isotopes 0 to the highest isolated precursor isotope.
+     * @return the path that produced them
+     * @throws std::invalid_argument if precursorIsotopes is empty
+     */
+    Path estimate(const OpenMS::EmpiricalFormula &precursor, const OpenMS::EmpiricalFormula &fragment,
+                  const IsolationMask &precursorIsotopes, std::vector<double> &probabilities) const;
+
+    /**
+     * The query estimate() dispatches on: average masses, and sulfur counts if the dispatcher uses sulfur.
+     */
+    Query makeQuery(const OpenMS::EmpiricalFormula &precursor, const OpenMS::EmpiricalFormula &fragment,
+                    const IsolationMask &precursorIsotopes) const;
+
+    // the individual paths, without dispatching or counting
+    bool estimateSpline(const Query &query, std::vector<double> &probabilities) const;
+
+    void estimateAveragine(const Query &query, std::vector<double> &probabilities) const;
+
+    static void estimateExact(const OpenMS::EmpiricalFormula &precursor, const OpenMS::EmpiricalFormula &fragment,
+                              const IsolationMask &precursorIsotopes, std::vector<double> &probabilities);
+
+    // queries answered by path so far
+    std::uint64_t count(Path path) const { return counts_[path].load(std::memory_order_relaxed); }
+
+    static const char* pathName(Path path);
+
+private:
+
+    const IsotopeSplineModel &splines_;
+    const ErrorBounds *bounds_;
+    double tolerance_;
+    bool useSulfur_;
+    mutable std::atomic<std::uint64_t> counts_[NUM_PATHS];
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ESTIMATORDISPATCHER_H
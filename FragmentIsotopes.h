@@ -0,0 +1,186 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_FRAGMENTISOTOPES_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_FRAGMENTISOTOPES_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The step shared by the model-based fragment estimators (IsotopeSplineModel, IsotopeLookupTable): a fragment
+ * distribution conditioned on the isolated precursor isotopes, from the isotope distributions of the fragment and
+ * of its complementary fragment.
+ */
+namespace FragmentIsotopes {
+
+    static const int AVERAGE = -1;  // sulfur count that selects the average model
+
+    /**
+     * Checks a fragment query and derives what the estimators need from it.
+     * @param maxIsolated set to the highest isolated precursor isotope
+     * @param complementSulfurs set to the sulfur count of the complementary fragment, AVERAGE if both are AVERAGE
+     * @return false if the query is invalid
+     */
+    static bool prepare(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                        int precursorSulfurs, int fragmentSulfurs, int &maxIsolated, int &complementSulfurs)
+    {
+        if (isolatedIsotopes == 0 || fragmentMass <= 0 || fragmentMass >= precursorMass) return false;
+
+        maxIsolated = 63;
+        while (!(isolatedIsotopes & (std::uint64_t(1) << maxIsolated))) --maxIsolated;
+
+        complementSulfurs = AVERAGE;
+        if (precursorSulfurs != AVERAGE || fragmentSulfurs != AVERAGE) {
+            if (fragmentSulfurs < 0 || fragmentSulfurs > precursorSulfurs) return false;
+            complementSulfurs = precursorSulfurs - fragmentSulfurs;
+        }
+        return true;
+    }
+
+    /**
+     * Splits the isolated precursor isotopes into runs of consecutive isotopes, first[r] to last[r] in ascending
+     * order. A window like M1-M3 is one run.
+     * @return the number of runs, at most 32
+     */
+    static int isolationRuns(std::uint64_t isolatedIsotopes, int maxIsolated, int *first, int *last)
+    {
+        int numRuns = 0;
+        for (int k = 0; k <= maxIsolated; ++k) {
+            if (!(isolatedIsotopes & (std::uint64_t(1) << k))) continue;
+            if (numRuns == 0 || last[numRuns - 1] != k - 1) first[numRuns++] = k;
+            last[numRuns - 1] = k;
+        }
+        return numRuns;
+    }
+
+    /**
+     * Sums of complement isotopes 0 to maxIsolated from both ends, in double for float estimates as well:
+     * below[k] holds isotopes 0 to k - 1, above[k] isotopes k to maxIsolated.
+     */
+    template <typename Real>
+    static void complementSums(const Real *complement, int maxIsolated, double *below, double *above)
+    {
+        below[0] = 0;
+        for (int k = 0; k <= maxIsolated; ++k) below[k + 1] = below[k] + complement[k];
+        above[maxIsolated + 1] = 0;
+        for (int k = maxIsolated; k >= 0; --k) above[k] = above[k + 1] + complement[k];
+    }
+
+    /**
+     * Sum of complement isotopes a to b from complementSums. It is the difference of the two sums on the side with
+     * less mass, so a range in either tail never comes from subtracting two sums near 1.
+     */
+    static double rangeSum(const double *below, const double *above, int a, int b)
+    {
+        return below[b + 1] <= above[a] ? below[b + 1] - below[a] : above[a] - above[b + 1];
+    }
+
+    /**
+     * Writes isotopes 0 to maxIsolated of the conditional fragment distribution, renormalized to sum to 1.
+     * fragment and complement hold isotopes 0 to maxIsolated. Real is double, or float for the float estimates.
+     */
+    template <typename Real>
+    static void condition(const Real *fragment, const Real *complement, std::uint64_t isolatedIsotopes,
+                          int maxIsolated, Real *probabilities)
+    {
+        // P(fragment has i extra neutrons | precursor isotope k isolated) ~ fragment[i] * complement[k - i], summed
+        // over the isolated k >= i. Each run of isolated isotopes first..last adds a range of complement isotopes,
+        // which the complement sums give in O(1): O(depth) for a window, O(depth * runs) for any isolation set.
+        double below[65], above[65];
+        complementSums(complement, maxIsolated, below, above);
+
+        int lowest = 0;
+        while (!(isolatedIsotopes & (std::uint64_t(1) << lowest))) ++lowest;
+        const std::uint64_t window = isolatedIsotopes >> lowest;
+
+        double conditioned[64];
+        double total = 0;
+        if ((window & (window + 1)) == 0) {
+            // one run, lowest to maxIsolated
+            for (int i = 0; i <= maxIsolated; ++i) {
+                conditioned[i] = fragment[i] * rangeSum(below, above, lowest > i ? lowest - i : 0, maxIsolated - i);
+                total += conditioned[i];
+            }
+        } else {
+            int first[32], last[32];
+            const int numRuns = isolationRuns(isolatedIsotopes, maxIsolated, first, last);
+            int lowestRun = 0;
+            for (int i = 0; i <= maxIsolated; ++i) {
+                while (last[lowestRun] < i) ++lowestRun;    // runs entirely below i add nothing
+                double sum = 0;
+                for (int r = lowestRun; r < numRuns; ++r) {
+                    sum += rangeSum(below, above, (first[r] > i ? first[r] : i) - i, last[r] - i);
+                }
+                conditioned[i] = fragment[i] * sum;
+                total += conditioned[i];
+            }
+        }
+        const double scale = total > 0 ? 1 / total : 1;
+        for (int i = 0; i <= maxIsolated; ++i) probabilities[i] = Real(conditioned[i] * scale);
+    }
+
+    static const std::size_t BATCH_BLOCK = 32;    // fragments conditioned together by conditionBatch
+
+    /**
+     * condition() for n fragments of the same precursor isolation. The arrays are isotope-major: isotope i of
+     * fragment q is at [i * stride + q], for fragment, complement and probabilities alike. The inner loops run
+     * over fragments, so the compiler can vectorize them.
+     */
+    template <typename Real>
+    static void conditionBatch(const Real *fragment, const Real *complement, std::size_t n, std::size_t stride,
+                               std::uint64_t isolatedIsotopes, int maxIsolated, Real *probabilities)
+    {
+        int first[32], last[32];
+        const int numRuns = isolationRuns(isolatedIsotopes, maxIsolated, first, last);
+
+        // complementSums and rangeSum per fragment
+        double below[65][BATCH_BLOCK], above[65][BATCH_BLOCK];
+        double conditioned[64][BATCH_BLOCK];
+        double total[BATCH_BLOCK];
+        for (std::size_t begin = 0; begin < n; begin += BATCH_BLOCK) {
+            const std::size_t size = n - begin < BATCH_BLOCK ? n - begin : BATCH_BLOCK;
+
+            for (std::size_t q = 0; q < size; ++q) {
+                below[0][q] = 0;
+                above[maxIsolated + 1][q] = 0;
+                total[q] = 0;
+            }
+            for (int k = 0; k <= maxIsolated; ++k) {
+                const Real *c = complement + k * stride + begin;
+                for (std::size_t q = 0; q < size; ++q) below[k + 1][q] = below[k][q] + c[q];
+            }
+            for (int k = maxIsolated; k >= 0; --k) {
+                const Real *c = complement + k * stride + begin;
+                for (std::size_t q = 0; q < size; ++q) above[k][q] = above[k + 1][q] + c[q];
+            }
+
+            int lowestRun = 0;
+            for (int i = 0; i <= maxIsolated; ++i) {
+                while (last[lowestRun] < i) ++lowestRun;
+                const Real *f = fragment + i * stride + begin;
+                double *p = conditioned[i];
+                for (std::size_t q = 0; q < size; ++q) p[q] = 0;
+                for (int r = lowestRun; r < numRuns; ++r) {
+                    const int a = (first[r] > i ? first[r] : i) - i, b = last[r] - i;
+                    const double *belowA = below[a], *belowB = below[b + 1];
+                    const double *aboveA = above[a], *aboveB = above[b + 1];
+                    for (std::size_t q = 0; q < size; ++q) {
+                        const double lowSide = belowB[q] - belowA[q], highSide = aboveA[q] - aboveB[q];
+                        p[q] += belowB[q] <= aboveA[q] ? lowSide : highSide;
+                    }
+                }
+                for (std::size_t q = 0; q < size; ++q) {
+                    p[q] *= f[q];
+                    total[q] += p[q];
+                }
+            }
+
+            for (std::size_t q = 0; q < size; ++q) total[q] = total[q] > 0 ? 1 / total[q] : 1;
+            for (int i = 0; i <= maxIsolated; ++i) {
+                Real *p = probabilities + i * stride + begin;
+                for (std::size_t q = 0; q < size; ++q) p[q] = Real(conditioned[i][q] * total[q]);
+            }
+        }
+    }
+}
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_FRAGMENTISOTOPES_H
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "IsotopeSplineModel.h"
+#include "FragmentIsotopes.h"
+#include "IsolationMask.h"
+
+void usage()
+{
+    std::cout << "usage: FragmentIsotopesTest spline_path" << std::endl;
+    std::cout << "\tspline_path: spline model file, e.g. misc/IsotopeSplines_10kDa_21isotopes.xml" << std::endl;
+    std::cout << "Compares FragmentIsotopes::condition and conditionBatch to the nested sum over isolated isotopes, "
+              << "for single isolated isotopes in the tail of small precursors, and for windows past M31 if the model "
+              << "has those isotopes." << std::endl;
+}
+
+namespace {
+
+    // the conditional distribution summed isotope by isotope, in long double
+    template <typename Real>
+    void nestedCondition(const Real *fragment, const Real *complement, std::uint64_t isolatedIsotopes,
+                         int maxIsolated, long double *probabilities)
+    {
+        long double total = 0;
+        for (int i = 0; i <= maxIsolated; ++i) {
+            long double sum = 0;
+            for (int k = i; k <= maxIsolated; ++k) {
+                if (isolatedIsotopes & (std::uint64_t(1) << k)) sum += complement[k - i];
+            }
+            probabilities[i] = fragment[i] * sum;
+            total += probabilities[i];
+        }
+        for (int i = 0; i <= maxIsolated; ++i) probabilities[i] /= total;
+    }
+
+    template <typename Real>
+    double maxDifference(const Real *probabilities, const long double *expected, int maxIsolated)
+    {
+        double difference = 0;
+        for (int i = 0; i <= maxIsolated; ++i) {
+            difference = std::max(difference, (double) std::fabs(probabilities[i] - expected[i]));
+        }
+        return difference;
+    }
+
+    /**
+     * Conditions NUM_FRAGMENTS fragments of one precursor, from the lowest mass the model covers up, with condition,
+     * conditionBatch and the float condition, and prints their largest differences to the nested sum.
+     * @return false if one is above its tolerance
+     */
+    bool checkIsolation(const IsotopeSplineModel &model, double precursorMass, std::uint64_t isolatedIsotopes,
+                        int maxIsolated, const std::string &label)
+    {
+        // the float tolerance is the rounding of the result to float
+        const double DOUBLE_TOLERANCE = 1e-14, FLOAT_TOLERANCE = 1e-7;
+        const int NUM_FRAGMENTS = 100;
+
+        double fragments[64 * NUM_FRAGMENTS], complements[64 * NUM_FRAGMENTS];
+        double batch[64 * NUM_FRAGMENTS];
+        long double expected[NUM_FRAGMENTS][64];
+        double doubleError = 0, floatError = 0;
+
+        double minMass, maxMass;
+        if (!model.range(IsotopeSplineModel::AVERAGE, maxIsolated, minMass, maxMass)
+            || !(2 * minMass < precursorMass)) {
+            throw std::runtime_error("The spline model does not cover M" + std::to_string(maxIsolated) + " of "
+                                     + std::to_string(precursorMass) + " Da precursors");
+        }
+
+        for (int q = 0; q < NUM_FRAGMENTS; ++q) {
+            const double fragmentMass = minMass + (precursorMass - 2 * minMass) * (q + 0.5) / NUM_FRAGMENTS;
+            double fragment[64], complement[64], probabilities[64];
+            float fragment32[64], complement32[64], probabilities32[64];
+            if (!model.estimate(fragmentMass, maxIsolated, IsotopeSplineModel::AVERAGE, fragment)
+                || !model.estimate(precursorMass - fragmentMass, maxIsolated, IsotopeSplineModel::AVERAGE,
+                                   complement)) {
+                throw std::runtime_error("The spline model does not cover " + std::to_string(fragmentMass));
+            }
+            model.estimate(fragmentMass, maxIsolated, IsotopeSplineModel::AVERAGE, fragment32);
+            model.estimate(precursorMass - fragmentMass, maxIsolated, IsotopeSplineModel::AVERAGE, complement32);
+
+            nestedCondition(fragment, complement, isolatedIsotopes, maxIsolated, expected[q]);
+            FragmentIsotopes::condition(fragment, complement, isolatedIsotopes, maxIsolated, probabilities);
+            doubleError = std::max(doubleError, maxDifference(probabilities, expected[q], maxIsolated));
+
+            long double expected32[64];
+            nestedCondition(fragment32, complement32, isolatedIsotopes, maxIsolated, expected32);
+            FragmentIsotopes::condition(fragment32, complement32, isolatedIsotopes, maxIsolated, probabilities32);
+            floatError = std::max(floatError, maxDifference(probabilities32, expected32, maxIsolated));
+
+            for (int i = 0; i <= maxIsolated; ++i) {
+                fragments[i * NUM_FRAGMENTS + q] = fragment[i];
+                complements[i * NUM_FRAGMENTS + q] = complement[i];
+            }
+        }
+
+        FragmentIsotopes::conditionBatch(fragments, complements, NUM_FRAGMENTS, NUM_FRAGMENTS, isolatedIsotopes,
+                                         maxIsolated, batch);
+        double batchError = 0;
+        for (int q = 0; q < NUM_FRAGMENTS; ++q) {
+            for (int i = 0; i <= maxIsolated; ++i) {
+                batchError = std::max(batchError, (double) std::fabs(batch[i * NUM_FRAGMENTS + q] - expected[q][i]));
+            }
+        }
+
+        const bool passed = doubleError <= DOUBLE_TOLERANCE && batchError <= DOUBLE_TOLERANCE
+                            && floatError <= FLOAT_TOLERANCE;
+        std::cout << (passed ? "ok     " : "FAILED ") << "precursor " << precursorMass << " Da, " << label
+                  << " isolated: condition " << doubleError << ", conditionBatch " << batchError
+                  << ", float condition " << floatError << std::endl;
+        return passed;
+    }
+}
+
+int main(int argc, const char ** argv)
+{
+    if (argc != 2) {
+        usage();
+        return 0;
+    }
+
+    const double PRECURSOR_MASSES[] = {500, 800, 2000};
+    const int ISOLATED[] = {4, 6};
+    // windows past M31 in the 100 kDa model, around and below the most abundant isotope
+    const double LARGE_PRECURSOR_MASSES[] = {50000, 80000};
+    const int WINDOW_FIRST = 30, WINDOW_LAST = 40;
+
+    int numFailed = 0;
+    try {
+        IsotopeSplineModel model(argv[1]);
+
+        for (double precursorMass : PRECURSOR_MASSES) {
+            for (int isolated : ISOLATED) {
+                numFailed += !checkIsolation(model, precursorMass, std::uint64_t(1) << isolated, isolated,
+                                             "M" + std::to_string(isolated));
+            }
+        }
+
+        if (model.maxIsotope() >= WINDOW_LAST) {
+            const std::uint64_t window = IsolationMask::range(WINDOW_FIRST, WINDOW_LAST).bits();
+            const std::string label = "M" + std::to_string(WINDOW_FIRST) + "-M" + std::to_string(WINDOW_LAST);
+            for (double precursorMass : LARGE_PRECURSOR_MASSES) {
+                numFailed += !checkIsolation(model, precursorMass, window, WINDOW_LAST, label);
+            }
+        }
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    return numFailed == 0 ? 0 : 1;
+}
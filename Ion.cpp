@@ -2,9 +2,12 @@
 // Created by Mike Lafferty on 9/16/16.
 //
 
+#include <algorithm>
+#include <cmath>
 #include <ostream>
 #include <iomanip>
 #include "Ion.h"
+#include "Trace.h"
 
 Ion::Ion(OpenMS::AASequence seq, OpenMS::Residue::ResidueType type, OpenMS::Int charge) {
     this->sequence = seq;
@@ -16,29 +19,16 @@ Ion::Ion(OpenMS::AASequence seq, OpenMS::Residue::ResidueType type, OpenMS::Int
 }
 
 std::vector<Ion> Ion::generateFragmentIons(double minMz, double maxMz) {
+    TRACE_SCOPE("generateFragmentIons");
     std::vector<Ion> ionList;
-    //generate b-ions
-    //loop through each b-ion
-    for (int i = 1; i <= sequence.size(); ++i) {
-        //loop through each charge
-        for (int z = 1; z < charge; ++z) {
-            //add b-ion to list
-            double mz = sequence.getPrefix(i).getMonoWeight(OpenMS::Residue::BIon, z) / z;
-            if (mz >= minMz && mz <= maxMz) {
-                ionList.push_back(Ion(sequence.getPrefix(i), OpenMS::Residue::BIon, z));
-            }
-        }
-    }
-    //generate y-ions
-    //loop through each y-ion
-    for (int i = 1; i <= sequence.size() - 1; ++i) {
-        //loop through each charge
-        for (int z = 1; z < charge; ++z) {
-            //add y-ion to list
-            double mz = sequence.getSuffix(i).getMonoWeight(OpenMS::Residue::YIon, z) / z;
-            if (mz >= minMz && mz <= maxMz) {
-                ionList.push_back(Ion(sequence.getSuffix(i), OpenMS::Residue::YIon, z));
-            }
+    const double perCharge = chargeMass();
+
+    //generate b-ions, then y-ions, at every charge below the precursor charge that lands in the mz range
+    for (const Fragment &fragment : generateFragments()) {
+        int lowest, highest;
+        if (!chargeRange(fragment.monoWeight, perCharge, minMz, maxMz, charge - 1, lowest, highest)) continue;
+        for (int z = lowest; z <= highest; ++z) {
+            ionList.push_back(fragmentIon(fragment, z));
         }
     }
     //generate precursor ion
@@ -50,6 +40,68 @@ std::vector<Ion> Ion::generateFragmentIons(double minMz, double maxMz) {
     return ionList;
 }
 
+std::vector<Ion::Fragment> Ion::generateFragments() const {
+    std::vector<Fragment> fragments;
+    const OpenMS::Size n = sequence.size();
+    if (n == 0) return fragments;
+    fragments.reserve(2 * n - 1);
+
+    //the first residue carries the terminal groups, every further one adds its internal weight
+    Fragment fragment;
+    fragment.type = OpenMS::Residue::BIon;
+    for (OpenMS::Size i = 1; i <= n; ++i) {
+        if (i == 1) {
+            fragment.monoWeight = sequence.getPrefix(1).getMonoWeight(OpenMS::Residue::BIon, 0);
+            fragment.averageWeight = sequence.getPrefix(1).getAverageWeight(OpenMS::Residue::BIon, 0);
+        } else {
+            fragment.monoWeight += sequence[i - 1].getMonoWeight(OpenMS::Residue::Internal);
+            fragment.averageWeight += sequence[i - 1].getAverageWeight(OpenMS::Residue::Internal);
+        }
+        fragment.length = i;
+        fragments.push_back(fragment);
+    }
+
+    fragment.type = OpenMS::Residue::YIon;
+    for (OpenMS::Size i = 1; i < n; ++i) {
+        if (i == 1) {
+            fragment.monoWeight = sequence.getSuffix(1).getMonoWeight(OpenMS::Residue::YIon, 0);
+            fragment.averageWeight = sequence.getSuffix(1).getAverageWeight(OpenMS::Residue::YIon, 0);
+        } else {
+            fragment.monoWeight += sequence[n - i].getMonoWeight(OpenMS::Residue::Internal);
+            fragment.averageWeight += sequence[n - i].getAverageWeight(OpenMS::Residue::Internal);
+        }
+        fragment.length = i;
+        fragments.push_back(fragment);
+    }
+    return fragments;
+}
+
+bool Ion::chargeRange(double weight, double chargeMass, double minMz, double maxMz, int maxCharge,
+                      int &lowest, int &highest) {
+    //mz = weight / z + chargeMass falls with z, so z >= weight / (maxMz - chargeMass), z <= weight / (minMz - chargeMass)
+    if (maxCharge < 1 || maxMz <= chargeMass) return false;
+    lowest = (int) std::max(1.0, std::min<double>(maxCharge + 1, std::ceil(weight / (maxMz - chargeMass))));
+    highest = minMz <= chargeMass ? maxCharge
+                                  : (int) std::min<double>(maxCharge, std::floor(weight / (minMz - chargeMass)));
+
+    //the division rounds, settle the ends on the mz test generateFragmentIons has always used
+    while (lowest <= highest && (weight + lowest * chargeMass) / lowest > maxMz) ++lowest;
+    while (lowest > 1 && (weight + (lowest - 1) * chargeMass) / (lowest - 1) <= maxMz) --lowest;
+    while (highest >= lowest && (weight + highest * chargeMass) / highest < minMz) --highest;
+    while (highest < maxCharge && (weight + (highest + 1) * chargeMass) / (highest + 1) >= minMz) ++highest;
+    return lowest <= highest;
+}
+
+double Ion::chargeMass() const {
+    return sequence.getMonoWeight(OpenMS::Residue::Full, 1) - sequence.getMonoWeight(OpenMS::Residue::Full, 0);
+}
+
+Ion Ion::fragmentIon(const Fragment &fragment, OpenMS::Int charge) const {
+    OpenMS::AASequence fragmentSequence = fragment.type == OpenMS::Residue::BIon ? sequence.getPrefix(fragment.length)
+                                                                                  : sequence.getSuffix(fragment.length);
+    return Ion(fragmentSequence, fragment.type, charge);
+}
+
 std::string Ion::getIonType() {
     std::string ion_type = (type == OpenMS::Residue::ResidueType::BIon) ? "B" : "Y";
     ion_type += std::to_string(sequence.size());
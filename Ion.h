@@ -11,6 +11,17 @@
 
 class Ion {
 public:
+    /**
+     * A b- or y-ion of the sequence before a charge is chosen: its length from the N-terminus (b) or C-terminus (y)
+     * and its neutral weights.
+     */
+    struct Fragment {
+        OpenMS::Residue::ResidueType type;
+        OpenMS::Size length;
+        double monoWeight;
+        double averageWeight;
+    };
+
     OpenMS::Residue::ResidueType type;
     OpenMS::AASequence sequence;
     OpenMS::Int charge;
@@ -43,6 +54,28 @@ public:
      */
     std::vector<Ion> generateFragmentIons(double minMz, double maxMz);
 
+    /**
+     * Lists every b- and y-ion of the sequence, uncharged. The weights are summed residue by residue, so a protein
+     * of n residues takes O(n) instead of O(n^2) for weighing every prefix and suffix on its own.
+     * @return b-ions by length, then y-ions by length, as generateFragmentIons orders them
+     */
+    std::vector<Fragment> generateFragments() const;
+
+    /**
+     * The charges from 1 to maxCharge at which a peak of neutral weight lies within [minMz, maxMz], a range
+     * because the mz falls with the charge. For high charge states only these are built and searched.
+     * @param chargeMass weight added per charge, see chargeMass()
+     * @return false if there are none, lowest and highest are undefined
+     */
+    static bool chargeRange(double weight, double chargeMass, double minMz, double maxMz, int maxCharge,
+                            int &lowest, int &highest);
+
+    // weight added to the sequence per charge, as getMonoWeight(type, charge) adds it
+    double chargeMass() const;
+
+    // the ion of a fragment from generateFragments at a charge
+    Ion fragmentIon(const Fragment &fragment, OpenMS::Int charge) const;
+
     /**
      * Function to send an ion to standard output stream. All ion members reported in addition
      * to the ion mz.
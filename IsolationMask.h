@@ -0,0 +1,143 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOLATIONMASK_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOLATIONMASK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <set>
+
+/**
+ * The precursor isotopes isolated for a MS2 scan, bit i set if Mi was isolated. A value type that replaces
+ * std::set<UInt> in the estimators: it is copied in a register, and min, max and size take one instruction.
+ * Iterating visits the isolated isotopes in ascending order, like the set did.
+ *
+ * OpenMS takes std::set<UInt>, so toSet() and cachedSet() convert at that boundary (UInt is unsigned int).
+ */
+class IsolationMask {
+
+public:
+
+    static const unsigned CAPACITY = 64;   // isotopes M0 to M63
+
+    // visits the set bits from lowest to highest
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef unsigned value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const unsigned* pointer;
+        typedef unsigned reference;
+
+        explicit const_iterator(std::uint64_t bits) : bits_(bits) {}
+        unsigned operator*() const { return lowestBit(bits_); }
+        const_iterator& operator++() { bits_ &= bits_ - 1; return *this; }
+        const_iterator operator++(int) { const_iterator old = *this; ++*this; return old; }
+        bool operator==(const const_iterator &other) const { return bits_ == other.bits_; }
+        bool operator!=(const const_iterator &other) const { return bits_ != other.bits_; }
+    private:
+        std::uint64_t bits_;
+    };
+
+    IsolationMask() : bits_(0) {}
+
+    explicit IsolationMask(std::uint64_t bits) : bits_(bits) {}
+
+    // isotopes first to last, empty if first > last
+    static IsolationMask range(unsigned first, unsigned last)
+    {
+        if (first > last || first >= CAPACITY) return IsolationMask();
+        std::uint64_t upTo = last >= CAPACITY - 1 ? ~std::uint64_t(0) : (std::uint64_t(1) << (last + 1)) - 1;
+        return IsolationMask(upTo & ~((std::uint64_t(1) << first) - 1));
+    }
+
+    template <typename Container>
+    static IsolationMask fromIsotopes(const Container &isotopes)
+    {
+        IsolationMask mask;
+        for (unsigned isotope : isotopes) mask.insert(isotope);
+        return mask;
+    }
+
+    // isotopes beyond CAPACITY are ignored
+    void insert(unsigned isotope) { if (isotope < CAPACITY) bits_ |= std::uint64_t(1) << isotope; }
+
+    bool contains(unsigned isotope) const { return isotope < CAPACITY && (bits_ >> isotope & 1); }
+
+    bool empty() const { return bits_ == 0; }
+
+    unsigned size() const { return popCount(bits_); }
+
+    // lowest and highest isolated isotope, the mask must not be empty
+    unsigned min() const { return lowestBit(bits_); }
+
+    unsigned max() const { return highestBit(bits_); }
+
+    // true if the isolated isotopes are consecutive, as for an isolation window
+    bool isWindow() const
+    {
+        if (empty()) return false;
+        std::uint64_t shifted = bits_ >> min();
+        return (shifted & (shifted + 1)) == 0;
+    }
+
+    std::uint64_t bits() const { return bits_; }
+
+    std::set<unsigned> toSet() const { return std::set<unsigned>(begin(), end()); }
+
+    /**
+     * toSet(), kept for the last mask converted on the calling thread. Consecutive OpenMS calls for the fragments of
+     * one precursor share one set instead of building a tree each. Valid until the thread converts another mask.
+     */
+    const std::set<unsigned>& cachedSet() const
+    {
+        static thread_local IsolationMask cachedMask;
+        static thread_local std::set<unsigned> cached;
+        if (bits_ != cachedMask.bits_) {
+            cached = toSet();
+            cachedMask = *this;
+        }
+        return cached;
+    }
+
+    const_iterator begin() const { return const_iterator(bits_); }
+
+    const_iterator end() const { return const_iterator(0); }
+
+    bool operator==(const IsolationMask &other) const { return bits_ == other.bits_; }
+
+    bool operator!=(const IsolationMask &other) const { return bits_ != other.bits_; }
+
+    bool operator<(const IsolationMask &other) const { return bits_ < other.bits_; }
+
+private:
+
+#if defined(__GNUC__)
+    static unsigned popCount(std::uint64_t bits) { return __builtin_popcountll(bits); }
+    static unsigned lowestBit(std::uint64_t bits) { return __builtin_ctzll(bits); }
+    static unsigned highestBit(std::uint64_t bits) { return 63 - __builtin_clzll(bits); }
+#else
+    static unsigned popCount(std::uint64_t bits)
+    {
+        unsigned count = 0;
+        for (; bits; bits &= bits - 1) ++count;
+        return count;
+    }
+    static unsigned lowestBit(std::uint64_t bits)
+    {
+        unsigned bit = 0;
+        while (!(bits >> bit & 1)) ++bit;
+        return bit;
+    }
+    static unsigned highestBit(std::uint64_t bits)
+    {
+        unsigned bit = 63;
+        while (!(bits >> bit & 1)) --bit;
+        return bit;
+    }
+#endif
+
+    std::uint64_t bits_;
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOLATIONMASK_H
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "IsotopeChebyshevModel.h"
+#include "FragmentIsotopes.h"
+
+namespace {
+
+// Horner's scheme unrolled for a fixed degree. A loop over a degree known only at run time is not unrolled and
+// costs more than the whole spline evaluation.
+template <int Power>
+struct Horner {
+    static inline double evaluate(const double *c, std::size_t width, double t)
+    {
+        return c[0] + t * Horner<Power - 1>::evaluate(c + width, width, t);
+    }
+};
+
+template <>
+struct Horner<0> {
+    static inline double evaluate(const double *c, std::size_t, double) { return c[0]; }
+};
+
+// c holds the coefficients of the segment, power by power with width isotopes each
+template <int Degree>
+void evaluateDegree(const double *c, std::size_t width, double t, int maxIsotope, double *probabilities)
+{
+    for (int isotope = 0; isotope <= maxIsotope; ++isotope) {
+        probabilities[isotope] = Horner<Degree>::evaluate(c + isotope, width, t);
+    }
+}
+
+typedef void (*Evaluator)(const double *c, std::size_t width, double t, int maxIsotope, double *probabilities);
+
+// by degree, up to MAX_DEGREE
+const Evaluator EVALUATORS[] = {
+        evaluateDegree<0>, evaluateDegree<1>, evaluateDegree<2>, evaluateDegree<3>, evaluateDegree<4>,
+        evaluateDegree<5>, evaluateDegree<6>, evaluateDegree<7>, evaluateDegree<8>
+};
+
+}
+
+IsotopeChebyshevModel::IsotopeChebyshevModel(const IsotopeSplineModel &splines, int maxIsotope, double minMass,
+                                             double maxMass, double maxError, int degree)
+        : maxIsotope_(maxIsotope), degree_(degree), measuredError_(0)
+{
+    if (maxIsotope < 0 || maxIsotope > splines.maxIsotope() || maxIsotope >= 32) {
+        throw std::invalid_argument("The spline models do not cover the Chebyshev model isotopes");
+    }
+    if (degree < 0 || degree > MAX_DEGREE) throw std::invalid_argument("The Chebyshev degree is out of range");
+    if (!(minMass < maxMass) || !(maxError > 0)) {
+        throw std::invalid_argument("The Chebyshev model needs a mass range and a positive error");
+    }
+
+    segments_.resize(splines.maxSulfur() + 2);
+    for (int numSulfur = AVERAGE; numSulfur <= splines.maxSulfur(); ++numSulfur) {
+        Segments &s = segments_[numSulfur + 1];
+        s.numSegments = 0;
+
+        double splineMin, splineMax;
+        if (!splines.range(numSulfur, maxIsotope, splineMin, splineMax)) continue;
+        s.minMass = std::max(minMass, splineMin);
+        s.maxMass = std::min(maxMass, splineMax);
+        if (!(s.minMass < s.maxMass)) continue;
+
+        double error = 0;
+        for (s.numSegments = 1; ; s.numSegments *= 2) {
+            if (s.numSegments > MAX_SEGMENTS) {
+                throw std::invalid_argument("The Chebyshev model needs more than " + std::to_string(MAX_SEGMENTS)
+                                            + " segments for sulfur count " + std::to_string(numSulfur));
+            }
+            error = fit(splines, numSulfur, s);
+            if (error <= maxError) break;
+        }
+        measuredError_ = std::max(measuredError_, error);
+    }
+}
+
+double IsotopeChebyshevModel::fit(const IsotopeSplineModel &splines, int numSulfur, Segments &s) const
+{
+    const int order = degree_ + 1;
+    const std::size_t width = (maxIsotope_ + 1) * order;
+    const double length = (s.maxMass - s.minMass) / s.numSegments;
+    s.scale = 1 / length;
+    s.coefficients.assign(s.numSegments * width, 0);
+
+    // power[j][p]: coefficient of t^p in the Chebyshev polynomial T(j), from T(j) = 2t T(j-1) - T(j-2)
+    double power[MAX_DEGREE + 1][MAX_DEGREE + 1] = {};
+    power[0][0] = 1;
+    if (degree_ > 0) power[1][1] = 1;
+    for (int j = 2; j <= degree_; ++j) {
+        for (int p = 0; p <= j; ++p) {
+            power[j][p] = (p > 0 ? 2 * power[j - 1][p - 1] : 0) - power[j - 2][p];
+        }
+    }
+
+    double values[MAX_DEGREE + 1][32];
+    for (std::size_t segment = 0; segment < s.numSegments; ++segment) {
+        const double center = s.minMass + (segment + 0.5) * length;
+        const double halfLength = length / 2;
+
+        // interpolate at the Chebyshev nodes, cos((k + 1/2) pi / order) mapped onto the segment
+        for (int k = 0; k < order; ++k) {
+            double mass = center + halfLength * std::cos((k + 0.5) * M_PI / order);
+            mass = std::min(std::max(mass, s.minMass), s.maxMass);
+            splines.estimate(mass, maxIsotope_, numSulfur, values[k]);
+        }
+
+        // Chebyshev coefficients of each isotope
+        double chebyshev[32][MAX_DEGREE + 1];
+        for (int isotope = 0; isotope <= maxIsotope_; ++isotope) {
+            for (int j = 0; j < order; ++j) {
+                double sum = 0;
+                for (int k = 0; k < order; ++k) sum += values[k][isotope] * std::cos(j * (k + 0.5) * M_PI / order);
+                chebyshev[isotope][j] = sum * (j == 0 ? 1.0 : 2.0) / order;
+            }
+        }
+
+        // expanded to powers of t for Horner's scheme, stored power by power
+        double *c = &s.coefficients[segment * width];
+        for (int p = 0; p < order; ++p) {
+            for (int isotope = 0; isotope <= maxIsotope_; ++isotope) {
+                double sum = 0;
+                for (int j = p; j < order; ++j) sum += chebyshev[isotope][j] * power[j][p];
+                c[p * (maxIsotope_ + 1) + isotope] = sum;
+            }
+        }
+    }
+
+    // compare to the splines once every segment is set, a check on a segment's end evaluates the next one
+    double spline[32], compiled[32];
+    double error = 0;
+    const std::size_t numChecks = s.numSegments * CHECKS_PER_SEGMENT;
+    for (std::size_t check = 0; check <= numChecks; ++check) {
+        double mass = std::min(s.minMass + check * length / CHECKS_PER_SEGMENT, s.maxMass);
+        splines.estimate(mass, maxIsotope_, numSulfur, spline);
+        evaluate(mass, maxIsotope_, s, compiled);
+        for (int isotope = 0; isotope <= maxIsotope_; ++isotope) {
+            error = std::max(error, std::abs(spline[isotope] - compiled[isotope]));
+        }
+    }
+    return error;
+}
+
+const IsotopeChebyshevModel::Segments* IsotopeChebyshevModel::segments(int numSulfur) const
+{
+    if (numSulfur < AVERAGE || numSulfur + 1 >= (int) segments_.size()) return NULL;
+    const Segments &s = segments_[numSulfur + 1];
+    return s.numSegments == 0 ? NULL : &s;
+}
+
+std::size_t IsotopeChebyshevModel::numSegments(int numSulfur) const
+{
+    const Segments *s = segments(numSulfur);
+    return s == NULL ? 0 : s->numSegments;
+}
+
+bool IsotopeChebyshevModel::inBounds(double mass, int maxIsotope, int numSulfur) const
+{
+    const Segments *s = segments(numSulfur);
+    return s != NULL && maxIsotope >= 0 && maxIsotope <= maxIsotope_ && mass >= s->minMass && mass <= s->maxMass;
+}
+
+bool IsotopeChebyshevModel::estimate(double mass, int maxIsotope, int numSulfur, double *probabilities) const
+{
+    if (!inBounds(mass, maxIsotope, numSulfur)) return false;
+    evaluate(mass, maxIsotope, *segments(numSulfur), probabilities);
+    return true;
+}
+
+void IsotopeChebyshevModel::evaluate(double mass, int maxIsotope, const Segments &s, double *probabilities) const
+{
+    // the segment and the position in it, mapped to [-1, 1]; the end of the range belongs to the last segment
+    const double position = (mass - s.minMass) * s.scale;
+    const std::size_t segment = std::min((std::size_t) position, s.numSegments - 1);
+    const double t = 2 * (position - segment) - 1;
+
+    const std::size_t width = maxIsotope_ + 1;
+    EVALUATORS[degree_](&s.coefficients[segment * (degree_ + 1) * width], width, t, maxIsotope, probabilities);
+}
+
+bool IsotopeChebyshevModel::estimateFragment(double precursorMass, double fragmentMass,
+                                             std::uint64_t isolatedIsotopes, int precursorSulfurs,
+                                             int fragmentSulfurs, double *probabilities) const
+{
+    int maxIsolated, complementSulfurs;
+    if (!FragmentIsotopes::prepare(precursorMass, fragmentMass, isolatedIsotopes, precursorSulfurs, fragmentSulfurs,
+                                   maxIsolated, complementSulfurs)) {
+        return false;
+    }
+
+    double fragment[64], complement[64];
+    if (!estimate(fragmentMass, maxIsolated, fragmentSulfurs, fragment)
+        || !estimate(precursorMass - fragmentMass, maxIsolated, complementSulfurs, complement)) {
+        return false;
+    }
+
+    FragmentIsotopes::condition(fragment, complement, isolatedIsotopes, maxIsolated, probabilities);
+    return true;
+}
@@ -10,20 +10,34 @@
 #include <OpenMS/KERNEL/MSSpectrum.h>
 #include "SpectrumUtilities.h"
 #include "Stats.h"
+#include "Trace.h"
 
 class IsotopeDistributions {
 
 public :
 
+    // Fragment models, in the order their residuals are stored
+    enum Model {
+        EXACT_CONDITIONAL_FRAGMENT,
+        APPROX_FRAGMENT_FROM_WEIGHT,
+        APPROX_FRAGMENT_FROM_WEIGHT_AND_SULFUR,
+        APPROX_FRAGMENT_SPLINE_FROM_WEIGHT,
+        APPROX_FRAGMENT_SPLINE_FROM_WEIGHT_AND_SULFUR,
+        EXACT_PRECURSOR,
+        APPROX_PRECURSOR_FROM_WEIGHT,
+        NUM_MODELS
+    };
+
     // Precursor distributions
-    IsotopeDistributions(std::set<OpenMS::UInt> precursorIsotopes, Ion precursorIon,
+    IsotopeDistributions(const IsolationMask &precursorIsotopes, Ion precursorIon,
                          const OpenMS::IsotopeSplineDB* isotopeDB,
                          OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrumCentroid,
                          double width, OpenMS::Precursor &precursorInfo)
     {
-        if (precursorIsotopes.size() > 0) {
-            OpenMS::UInt minIsotope = *std::min_element(precursorIsotopes.begin(), precursorIsotopes.end());
-            OpenMS::UInt searchDepth = *std::max_element(precursorIsotopes.begin(), precursorIsotopes.end()) + 1;
+        TRACE_SCOPE("IsotopeDistributions::precursor");
+        if (!precursorIsotopes.empty()) {
+            OpenMS::UInt minIsotope = precursorIsotopes.min();
+            OpenMS::UInt searchDepth = precursorIsotopes.max() + 1;
 
             OpenMS::IsotopeDistribution id = precursorIon.formula.getIsotopeDistribution(searchDepth);
             double ionMZ = precursorIon.monoWeight / precursorIon.charge;
@@ -43,10 +57,11 @@ public :
 
 
     // Fragment distributions
-    IsotopeDistributions(std::set<OpenMS::UInt> precursorIsotopes, Ion ion, Ion precursorIon,
+    IsotopeDistributions(const IsolationMask &precursorIsotopes, Ion ion, Ion precursorIon,
                          const OpenMS::IsotopeSplineDB* isotopeDB, OpenMS::MSSpectrum<OpenMS::Peak1D> &currentSpectrumCentroid,
                          OpenMS::Precursor &precursorInfo, double width)
     {
+        TRACE_SCOPE("IsotopeDistributions::fragment");
 
         SpectrumUtilities::exactConditionalFragmentIsotopeDist(exactConditionalFragmentDist,
                                                                precursorIsotopes,
@@ -92,29 +107,28 @@ public :
         scaledObservedDist = SpectrumUtilities::scaleDistribution(observedDist);
 
 
-        //report on matched ion distribution depth
-        completeFlag = true;
-        completeAtDepth = 0;
-        for (int i = 0; i < observedDist.size(); ++i) {
-            if (observedDist[i].second != 0) {
-                if (completeFlag) {
-                    ++completeAtDepth;
-                }
-            } else {
-                completeFlag = false;
-            }
-        }
-
         isValid = true; //SpectrumUtilities::scaledDistributionValid(scaledObservedDist) && completeAtDepth > 1;
 
-        //compute chi-squared with observed to Conditional
-        exactCondFragmentX2 = Stats::computeX2(scaledObservedDist, exactConditionalFragmentDist);
-        approxFragmentFromWeightX2 = Stats::computeX2(scaledObservedDist, approxFragmentFromWeightDist);
-        approxFragmentFromWeightAndSulfurX2 = Stats::computeX2(scaledObservedDist, approxFragmentFromWeightAndSulfurDist);
-        approxFragmentSplineFromWeightX2 = Stats::computeX2(scaledObservedDist, approxFragmentSplineFromWeightDist);
-        approxFragmentSplineFromWeightAndSulfurX2 = Stats::computeX2(scaledObservedDist, approxFragmentSplineFromWeightAndSulfurDist);
-        exactPrecursorX2 = Stats::computeX2(scaledObservedDist, exactPrecursorDist);
-        approxPrecursorX2 = Stats::computeX2(scaledObservedDist, approxPrecursorFromWeightDist);
+        //compare observed to every model in one pass: chi-squared, residuals and matched ion distribution depth
+        const std::vector<std::pair<double, double> >* models[NUM_MODELS] = {
+                &exactConditionalFragmentDist,
+                &approxFragmentFromWeightDist,
+                &approxFragmentFromWeightAndSulfurDist,
+                &approxFragmentSplineFromWeightDist,
+                &approxFragmentSplineFromWeightAndSulfurDist,
+                &exactPrecursorDist,
+                &approxPrecursorFromWeightDist
+        };
+        double* const x2[NUM_MODELS] = {
+                &exactCondFragmentX2,
+                &approxFragmentFromWeightX2,
+                &approxFragmentFromWeightAndSulfurX2,
+                &approxFragmentSplineFromWeightX2,
+                &approxFragmentSplineFromWeightAndSulfurX2,
+                &exactPrecursorX2,
+                &approxPrecursorX2
+        };
+        Stats::scoreAgainstModels(scaledObservedDist, models, x2, residuals, completeFlag, completeAtDepth);
 
     }
 
@@ -159,6 +173,14 @@ public :
 
     bool isValid;
 
+    // Fragment: scaled observed minus model proportion, NUM_MODELS values per observed isotope
+    std::vector<double> residuals;
+
+    double residual(int isotope, Model model) const
+    {
+        return residuals[isotope * NUM_MODELS + model];
+    }
+
 
 private:
 
@@ -0,0 +1,92 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOTOPEENVELOPE_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOTOPEENVELOPE_H
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * The isotopes start to start + length - 1 of a distribution, the others taken as 0. Above 10 kDa the isotopes that
+ * matter sit in a window around the most abundant one, about M40 to M85 at 100 kDa, so estimators, peak matching
+ * and scores that work on the envelope scale with its width instead of with the mass.
+ */
+class IsotopeEnvelope {
+
+public:
+
+    IsotopeEnvelope() : start_(0) {}
+
+    IsotopeEnvelope(int start, const std::vector<double> &probabilities)
+            : start_(start), probabilities_(probabilities) {}
+
+    /**
+     * The isotopes of a dense distribution from the first to the last with a probability of at least threshold.
+     * Isotopes between them are kept whatever their probability, the envelope is empty if none reaches threshold.
+     */
+    static IsotopeEnvelope trim(const double *probabilities, int n, double threshold)
+    {
+        IsotopeEnvelope envelope(0, std::vector<double>(probabilities, probabilities + n));
+        envelope.trim(threshold);
+        return envelope;
+    }
+
+    // makes this the isotopes start to start + length - 1 and returns their probabilities to be filled in. Reuses
+    // the memory of the previous probabilities, so an estimator can refill one envelope without allocating.
+    double* reset(int start, int length)
+    {
+        start_ = start;
+        probabilities_.resize(length);
+        return probabilities_.data();
+    }
+
+    int start() const { return start_; }
+
+    // one past the last isotope
+    int end() const { return start_ + length(); }
+
+    int length() const { return (int) probabilities_.size(); }
+
+    bool empty() const { return probabilities_.empty(); }
+
+    bool contains(int isotope) const { return isotope >= start_ && isotope < end(); }
+
+    // probability of isotope Mi, 0 outside the envelope
+    double probability(int isotope) const { return contains(isotope) ? probabilities_[isotope - start_] : 0; }
+
+    // by isotope - start()
+    const std::vector<double>& probabilities() const { return probabilities_; }
+
+    // the envelope must not be empty
+    int mostAbundant() const
+    {
+        return start_ + int(std::max_element(probabilities_.begin(), probabilities_.end()) - probabilities_.begin());
+    }
+
+    // drops the isotopes below threshold at both ends
+    void trim(double threshold)
+    {
+        std::size_t first = 0;
+        while (first < probabilities_.size() && !(probabilities_[first] >= threshold)) ++first;
+        std::size_t end = probabilities_.size();
+        while (end > first && !(probabilities_[end - 1] >= threshold)) --end;
+
+        probabilities_.erase(probabilities_.begin() + end, probabilities_.end());
+        probabilities_.erase(probabilities_.begin(), probabilities_.begin() + first);
+        start_ += (int) first;
+    }
+
+    // scales the probabilities to sum to 1
+    void normalize()
+    {
+        double sum = 0;
+        for (double p : probabilities_) sum += p;
+        if (sum > 0) for (double &p : probabilities_) p /= sum;
+    }
+
+private:
+
+    int start_;
+    std::vector<double> probabilities_;
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOTOPEENVELOPE_H
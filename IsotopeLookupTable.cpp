@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "IsotopeLookupTable.h"
+#include "FragmentIsotopes.h"
+
+IsotopeLookupTable::IsotopeLookupTable(const IsotopeSplineModel &splines, double massStep, int maxIsotope)
+        : massStep_(massStep), maxIsotope_(maxIsotope)
+{
+    if (!(massStep > 0)) throw std::invalid_argument("The lookup table mass step has to be positive");
+    if (maxIsotope < 0 || maxIsotope > splines.maxIsotope()) {
+        throw std::invalid_argument("The spline models do not cover the lookup table isotopes");
+    }
+
+    const std::size_t width = maxIsotope + 1;
+    tables_.resize(splines.maxSulfur() + 2);
+    for (int numSulfur = AVERAGE; numSulfur <= splines.maxSulfur(); ++numSulfur) {
+        Table &table = tables_[numSulfur + 1];
+        table.numSamples = 0;
+
+        double minMass, maxMass;
+        if (!splines.range(numSulfur, maxIsotope, minMass, maxMass)) continue;
+
+        table.minMass = minMass;
+        table.numSamples = (std::size_t) std::floor((maxMass - minMass) / massStep) + 1;
+        table.values.resize(table.numSamples * width);
+        for (std::size_t sample = 0; sample < table.numSamples; ++sample) {
+            splines.estimate(minMass + sample * massStep, maxIsotope, numSulfur, &table.values[sample * width]);
+        }
+    }
+}
+
+const IsotopeLookupTable::Table* IsotopeLookupTable::table(int numSulfur) const
+{
+    if (numSulfur < AVERAGE || numSulfur + 1 >= (int) tables_.size()) return NULL;
+    const Table &table = tables_[numSulfur + 1];
+    return table.numSamples < 2 ? NULL : &table;
+}
+
+bool IsotopeLookupTable::inBounds(double mass, int maxIsotope, int numSulfur) const
+{
+    const Table *t = table(numSulfur);
+    if (t == NULL || maxIsotope < 0 || maxIsotope > maxIsotope_) return false;
+
+    double position = (mass - t->minMass) / massStep_;
+    return position >= 0 && position <= t->numSamples - 1;
+}
+
+bool IsotopeLookupTable::estimate(double mass, int maxIsotope, int numSulfur, double *probabilities) const
+{
+    if (!inBounds(mass, maxIsotope, numSulfur)) return false;
+    const Table &t = *table(numSulfur);
+
+    // the last sample is interpolated from the piece before it
+    double position = (mass - t.minMass) / massStep_;
+    std::size_t sample = std::min((std::size_t) position, t.numSamples - 2);
+    double weight = position - sample;
+
+    const std::size_t width = maxIsotope_ + 1;
+    const double *left = &t.values[sample * width];
+    const double *right = left + width;
+    for (int isotope = 0; isotope <= maxIsotope; ++isotope) {
+        probabilities[isotope] = left[isotope] + weight * (right[isotope] - left[isotope]);
+    }
+    return true;
+}
+
+bool IsotopeLookupTable::estimateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                                          int precursorSulfurs, int fragmentSulfurs, double *probabilities) const
+{
+    int maxIsolated, complementSulfurs;
+    if (!FragmentIsotopes::prepare(precursorMass, fragmentMass, isolatedIsotopes, precursorSulfurs, fragmentSulfurs,
+                                   maxIsolated, complementSulfurs)) {
+        return false;
+    }
+
+    double fragment[64], complement[64];
+    if (!estimate(fragmentMass, maxIsolated, fragmentSulfurs, fragment)
+        || !estimate(precursorMass - fragmentMass, maxIsolated, complementSulfurs, complement)) {
+        return false;
+    }
+
+    FragmentIsotopes::condition(fragment, complement, isolatedIsotopes, maxIsolated, probabilities);
+    return true;
+}
@@ -0,0 +1,453 @@
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <OpenMS/CHEMISTRY/IsotopeDistribution.h>
+#include <OpenMS/CHEMISTRY/IsotopeSplineDB.h>
+
+#include "EstimationProtocol.h"
+#include "IsolationMask.h"
+
+using namespace EstimationProtocol;
+
+static const OpenMS::IsotopeSplineDB* isotopeDB = OpenMS::IsotopeSplineDB::getInstance();
+
+static int wakeFD = -1;
+static volatile std::sig_atomic_t stopRequested = 0;
+
+struct Connection {
+    int fd;
+    std::string in;
+
+    std::mutex outMutex;    // guards the members below, which the workers update
+    std::string out;        // responses not yet written to the socket
+    std::size_t pending = 0;  // requests queued or being estimated
+    bool closing = false;   // close once every pending request is answered and out is flushed
+    bool broken = false;    // close now, the peer cannot receive anything
+
+    explicit Connection(int fd) : fd(fd) {}
+};
+
+struct Job {
+    std::shared_ptr<Connection> connection;
+    Header header;
+    std::vector<Query> queries;
+};
+
+// Requests waiting for a worker, and connections with responses waiting to be written by the event loop
+static std::mutex queueMutex;
+static std::condition_variable queueNotEmpty;
+static std::deque<Job> jobs;
+static bool shuttingDown = false;
+
+static std::mutex readyMutex;
+static std::vector<std::shared_ptr<Connection> > readyConnections;
+
+void usage()
+{
+    std::cout << "usage: IsotopeServer socket_path [--threads n]" << std::endl;
+    std::cout << "\tsocket_path: Unix domain socket to listen on, removed on shutdown" << std::endl;
+    std::cout << "\t--threads n: estimation worker threads (default: number of cores)" << std::endl;
+}
+
+std::vector<double> estimate(const Query &query, Method method)
+{
+    // a worker keeps the set of the last isolation, queries of one precursor come in a row
+    const IsolationMask isolated(query.isolatedIsotopes);
+    const std::set<OpenMS::UInt> &precursorIsotopes = isolated.cachedSet();
+
+    OpenMS::IsotopeDistribution fragmentDist(isolated.max() + 1);
+    switch (method) {
+        case SPLINE_FROM_WEIGHT:
+            fragmentDist = isotopeDB->estimateForFragmentFromPeptideWeight(query.precursorAverageMass,
+                                                                          query.fragmentAverageMass,
+                                                                          precursorIsotopes);
+            break;
+        case SPLINE_FROM_WEIGHT_AND_SULFUR:
+            fragmentDist = isotopeDB->estimateForFragmentFromPeptideWeightAndS(query.precursorAverageMass,
+                                                                              query.precursorSulfurs,
+                                                                              query.fragmentAverageMass,
+                                                                              query.fragmentSulfurs,
+                                                                              precursorIsotopes);
+            break;
+        case AVERAGINE_FROM_WEIGHT:
+            fragmentDist.estimateForFragmentFromPeptideWeight(query.precursorAverageMass,
+                                                              query.fragmentAverageMass,
+                                                              precursorIsotopes);
+            break;
+        default:
+            fragmentDist.estimateForFragmentFromPeptideWeightAndS(query.precursorAverageMass,
+                                                                  query.precursorSulfurs,
+                                                                  query.fragmentAverageMass,
+                                                                  query.fragmentSulfurs,
+                                                                  precursorIsotopes);
+            break;
+    }
+    fragmentDist.renormalize();
+
+    std::vector<double> probabilities;
+    probabilities.reserve(fragmentDist.size());
+    for (const std::pair<OpenMS::Size, double> &peak : fragmentDist.getContainer()) {
+        probabilities.push_back(peak.second);
+    }
+    return probabilities;
+}
+
+void wakeEventLoop()
+{
+    std::uint64_t one = 1;
+    ssize_t ignored = write(wakeFD, &one, sizeof(one));
+    (void) ignored;
+}
+
+void queueResponse(const std::shared_ptr<Connection> &connection, const std::string &response, bool answersJob)
+{
+    {
+        std::lock_guard<std::mutex> lock(connection->outMutex);
+        connection->out += response;
+        if (answersJob) --connection->pending;
+    }
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        readyConnections.push_back(connection);
+    }
+    wakeEventLoop();
+}
+
+void worker()
+{
+    std::vector<std::vector<double> > distributions;
+    std::string response;
+
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueNotEmpty.wait(lock, [] { return shuttingDown || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        Status status = OK;
+        distributions.resize(job.queries.size());
+        try {
+            for (std::size_t i = 0; i < job.queries.size(); ++i) {
+                distributions[i] = estimate(job.queries[i], (Method) job.header.code);
+            }
+        } catch (std::exception& e) {
+            status = ESTIMATION_FAILED;
+        }
+
+        response.clear();
+        appendResponse(response, job.header.requestId, status, distributions);
+        queueResponse(job.connection, response, true);
+    }
+}
+
+/**
+ * Cuts all complete requests out of the connection's input and queues them.
+ * @return false if the stream is corrupt and the connection has to be closed
+ */
+bool parseRequests(const std::shared_ptr<Connection> &connection)
+{
+    std::size_t pos = 0;
+    Header header;
+    std::vector<Job> parsed;
+    bool valid = true;
+
+    while (readHeader(connection->in, pos, header)) {
+        if (header.magic != REQUEST_MAGIC) {
+            valid = false;
+            break;
+        }
+
+        Status status = OK;
+        if (header.version != VERSION) status = BAD_VERSION;
+        else if (header.code >= NUM_METHODS) status = BAD_METHOD;
+        else if (header.count > MAX_QUERIES) status = TOO_MANY_QUERIES;
+
+        if (status != OK) {
+            // the body length cannot be trusted, answer and drop the connection
+            std::string response;
+            appendResponse(response, header.requestId, status, std::vector<std::vector<double> >());
+            queueResponse(connection, response, false);
+            valid = false;
+            break;
+        }
+
+        std::size_t frameSize = HEADER_SIZE + (std::size_t) header.count * QUERY_SIZE;
+        if (connection->in.size() < pos + frameSize) break;
+
+        Job job;
+        job.connection = connection;
+        job.header = header;
+        try {
+            readQueries(connection->in, pos + HEADER_SIZE, header.count, job.queries);
+            parsed.push_back(std::move(job));
+        } catch (std::exception& e) {
+            std::string response;
+            appendResponse(response, header.requestId, BAD_QUERY, std::vector<std::vector<double> >());
+            queueResponse(connection, response, false);
+        }
+        pos += frameSize;
+    }
+    connection->in.erase(0, pos);
+
+    if (!parsed.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(connection->outMutex);
+            connection->pending += parsed.size();
+        }
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            for (Job &job : parsed) jobs.push_back(std::move(job));
+        }
+        queueNotEmpty.notify_all();
+    }
+    return valid;
+}
+
+/**
+ * Writes as much pending output as the socket takes.
+ * @return true if everything was written
+ */
+bool flush(Connection &connection)
+{
+    std::lock_guard<std::mutex> lock(connection.outMutex);
+    std::size_t written = 0;
+    while (written < connection.out.size()) {
+        ssize_t n = send(connection.fd, connection.out.data() + written, connection.out.size() - written,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) connection.broken = true;
+            break;
+        }
+        written += n;
+    }
+    connection.out.erase(0, written);
+    return connection.out.empty();
+}
+
+void handleStop(int)
+{
+    stopRequested = 1;
+    wakeEventLoop();
+}
+
+int createListenSocket(const std::string &path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cout << "Socket path too long: " << path << std::endl;
+        return -1;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr *) &address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char * argv[])
+{
+    unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::string socketPath;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = std::max(1, std::atoi(argv[++i]));
+        } else if (socketPath.empty()) {
+            socketPath = argv[i];
+        } else {
+            usage();
+            return 0;
+        }
+    }
+    if (socketPath.empty()) {
+        usage();
+        return 0;
+    }
+
+    // the spline models are loaded once, here, and shared by all workers
+    std::cout << "Loading spline models..." << std::endl;
+    std::set<OpenMS::UInt> warmup;
+    warmup.insert(0);
+    isotopeDB->estimateForFragmentFromPeptideWeight(2000, 1000, warmup);
+
+    int listenFD = createListenSocket(socketPath);
+    if (listenFD < 0) {
+        std::cout << "Could not listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int epollFD = epoll_create1(EPOLL_CLOEXEC);
+
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = listenFD;
+    epoll_ctl(epollFD, EPOLL_CTL_ADD, listenFD, &event);
+    event.data.fd = wakeFD;
+    epoll_ctl(epollFD, EPOLL_CTL_ADD, wakeFD, &event);
+
+    std::signal(SIGINT, handleStop);
+    std::signal(SIGTERM, handleStop);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < numThreads; ++t) workers.push_back(std::thread(worker));
+    std::cout << "Listening on " << socketPath << " with " << numThreads << " worker threads" << std::endl;
+
+    std::map<int, std::shared_ptr<Connection> > connections;
+    std::vector<epoll_event> events(64);
+    std::vector<char> readBuffer(1 << 16);
+
+    auto closeConnection = [&](int fd) {
+        epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        connections.erase(fd);
+    };
+
+    // write what is pending and only watch for writability while something is left
+    auto flushConnection = [&](const std::shared_ptr<Connection> &connection) {
+        bool done = flush(*connection);
+        bool closing, finished;
+        {
+            std::lock_guard<std::mutex> lock(connection->outMutex);
+            closing = connection->closing;
+            finished = connection->broken || (closing && connection->pending == 0 && connection->out.empty());
+        }
+        if (finished) {
+            closeConnection(connection->fd);
+            return;
+        }
+        epoll_event e;
+        std::memset(&e, 0, sizeof(e));
+        e.events = (closing ? 0 : EPOLLIN) | (done ? 0 : EPOLLOUT);
+        e.data.fd = connection->fd;
+        epoll_ctl(epollFD, EPOLL_CTL_MOD, connection->fd, &e);
+    };
+
+    while (!stopRequested) {
+        int n = epoll_wait(epollFD, events.data(), (int) events.size(), -1);
+        if (n < 0 && errno != EINTR) break;
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == listenFD) {
+                int client;
+                while ((client = accept4(listenFD, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    connections[client] = std::make_shared<Connection>(client);
+                    epoll_event e;
+                    std::memset(&e, 0, sizeof(e));
+                    e.events = EPOLLIN;
+                    e.data.fd = client;
+                    epoll_ctl(epollFD, EPOLL_CTL_ADD, client, &e);
+                }
+            } else if (fd == wakeFD) {
+                std::uint64_t count;
+                while (read(wakeFD, &count, sizeof(count)) > 0) {}
+
+                std::vector<std::shared_ptr<Connection> > ready;
+                {
+                    std::lock_guard<std::mutex> lock(readyMutex);
+                    ready.swap(readyConnections);
+                }
+                for (const std::shared_ptr<Connection> &connection : ready) {
+                    // skip connections that were closed while their requests were being processed
+                    auto itr = connections.find(connection->fd);
+                    if (itr != connections.end() && itr->second == connection) flushConnection(connection);
+                }
+            } else {
+                auto itr = connections.find(fd);
+                if (itr == connections.end()) continue;
+                std::shared_ptr<Connection> connection = itr->second;
+
+                // the peer is gone in both directions, responses still being estimated are dropped
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    closeConnection(fd);
+                    continue;
+                }
+
+                if (events[i].events & EPOLLOUT) {
+                    flushConnection(connection);
+                    if (connections.find(fd) == connections.end()) continue;
+                }
+
+                if (events[i].events & EPOLLIN) {
+                    bool endOfInput = false, failed = false;
+                    while (true) {
+                        ssize_t r = read(fd, readBuffer.data(), readBuffer.size());
+                        if (r > 0) {
+                            connection->in.append(readBuffer.data(), r);
+                        } else if (r < 0 && errno == EINTR) {
+                            continue;
+                        } else {
+                            endOfInput = r == 0;
+                            failed = r < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+                            break;
+                        }
+                    }
+                    if (failed) {
+                        closeConnection(fd);
+                        continue;
+                    }
+
+                    // a client that shuts down its sending side still gets the answers to its requests
+                    if (!parseRequests(connection) || endOfInput) {
+                        {
+                            std::lock_guard<std::mutex> lock(connection->outMutex);
+                            connection->closing = true;
+                        }
+                        flushConnection(connection);
+                    }
+                }
+            }
+        }
+    }
+
+    std::cout << "Shutting down..." << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        shuttingDown = true;
+    }
+    queueNotEmpty.notify_all();
+    for (std::thread &t : workers) t.join();
+
+    for (auto &c : connections) close(c.first);
+    close(listenFD);
+    close(epollFD);
+    close(wakeFD);
+    unlink(socketPath.c_str());
+
+    return 0;
+}
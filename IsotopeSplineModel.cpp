@@ -0,0 +1,587 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "IsotopeSplineModel.h"
+#include "FragmentIsotopes.h"
+
+namespace {
+
+    // extra neutrons per Da of averagine, the center of the window estimateEnvelope evaluates first
+    const double AVERAGINE_NEUTRONS_PER_DA = 6.2e-4;
+
+    std::runtime_error formatError(const std::string &message)
+    {
+        return std::runtime_error("Invalid isotope spline file: " + message);
+    }
+
+    // the values are little-endian float64, which x86 and ARM hosts use in memory as well
+    std::vector<double> decodeDoubles(const std::string &text)
+    {
+        static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        static const std::vector<int> values = [] {
+            std::vector<int> v(256, -1);
+            for (std::size_t i = 0; i < alphabet.size(); ++i) v[(unsigned char) alphabet[i]] = (int) i;
+            return v;
+        }();
+
+        std::string bytes;
+        bytes.reserve(text.size() / 4 * 3);
+        std::uint32_t buffer = 0;
+        int bits = 0;
+        for (char ch : text) {
+            if (ch == '=') break;
+            int value = values[(unsigned char) ch];
+            if (value < 0) {
+                if (std::isspace((unsigned char) ch)) continue;
+                throw formatError("bad base64 character");
+            }
+            buffer = (buffer << 6) | (std::uint32_t) value;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                bytes.push_back((char) ((buffer >> bits) & 0xFF));
+            }
+        }
+        if (bytes.size() % sizeof(double) != 0) throw formatError("truncated value list");
+
+        std::vector<double> decoded(bytes.size() / sizeof(double));
+        std::memcpy(decoded.data(), bytes.data(), bytes.size());
+        return decoded;
+    }
+
+    // value of attribute name in tag, empty if the tag has none
+    std::string attribute(const std::string &tag, const std::string &name)
+    {
+        std::size_t pos = 0;
+        while ((pos = tag.find(name + "=", pos)) != std::string::npos) {
+            bool wordStart = pos > 0 && std::isspace((unsigned char) tag[pos - 1]);
+            pos += name.size() + 1;
+            if (!wordStart || pos >= tag.size()) continue;
+
+            char quote = tag[pos];
+            std::size_t end = tag.find(quote, pos + 1);
+            if (end == std::string::npos) throw formatError("unterminated attribute");
+            return tag.substr(pos + 1, end - pos - 1);
+        }
+        return "";
+    }
+
+    std::string encodeDoubles(const std::vector<double> &values)
+    {
+        static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        std::string bytes(values.size() * sizeof(double), '\0');
+        std::memcpy(&bytes[0], values.data(), bytes.size());
+
+        std::string text;
+        for (std::size_t i = 0; i < bytes.size(); i += 3) {
+            std::uint32_t block = (std::uint32_t) (unsigned char) bytes[i] << 16;
+            if (i + 1 < bytes.size()) block |= (std::uint32_t) (unsigned char) bytes[i + 1] << 8;
+            if (i + 2 < bytes.size()) block |= (std::uint32_t) (unsigned char) bytes[i + 2];
+            text.push_back(alphabet[(block >> 18) & 0x3F]);
+            text.push_back(alphabet[(block >> 12) & 0x3F]);
+            text.push_back(i + 1 < bytes.size() ? alphabet[(block >> 6) & 0x3F] : '=');
+            text.push_back(i + 2 < bytes.size() ? alphabet[block & 0x3F] : '=');
+        }
+        return text;
+    }
+
+    // start of the next <name ...> tag at or after pos, npos if there is none
+    std::size_t findTag(const std::string &xml, const std::string &name, std::size_t pos)
+    {
+        while ((pos = xml.find("<" + name, pos)) != std::string::npos) {
+            char next = pos + name.size() + 1 < xml.size() ? xml[pos + name.size() + 1] : '\0';
+            if (next == '>' || std::isspace((unsigned char) next)) return pos;
+            pos += name.size() + 1;
+        }
+        return std::string::npos;
+    }
+
+    // text between <name ...> and </name> inside [begin, end)
+    std::string elementText(const std::string &xml, std::size_t begin, std::size_t end, const std::string &name)
+    {
+        std::size_t open = xml.find("<" + name, begin);
+        if (open == std::string::npos || open >= end) throw formatError("model without " + name);
+        std::size_t textStart = xml.find('>', open);
+        std::size_t close = xml.find("</" + name + ">", open);
+        if (textStart == std::string::npos || close == std::string::npos || close > end) {
+            throw formatError("unterminated " + name);
+        }
+        return xml.substr(textStart + 1, close - textStart - 1);
+    }
+
+    // one spline as stored in a <model> element
+    struct Spline {
+        std::vector<double> knots;
+        std::vector<double> coefficients;   // a, b, c, d per piece
+    };
+
+    // polynomial of the spline piece containing [x, next knot) re-expanded at x, written to out
+    void expand(const std::vector<double> &knots, const double *coefficients, double x, double next, double *out)
+    {
+        // the middle of the shared piece is inside exactly one of the spline's pieces
+        double middle = 0.5 * (x + next);
+        std::size_t piece = std::upper_bound(knots.begin(), knots.end(), middle) - knots.begin();
+        piece = std::min(std::max<std::size_t>(piece, 1), knots.size() - 1) - 1;
+
+        const double *c = &coefficients[4 * piece];
+        double h = x - knots[piece];
+        out[0] = ((c[3] * h + c[2]) * h + c[1]) * h + c[0];
+        out[1] = (3 * c[3] * h + 2 * c[2]) * h + c[1];
+        out[2] = 3 * c[3] * h + c[2];
+        out[3] = c[3];
+    }
+
+    void checkKnots(const std::vector<double> &knots)
+    {
+        if (knots.size() < 2) throw formatError("fewer than two knots");
+        for (std::size_t i = 1; i < knots.size(); ++i) {
+            if (!(knots[i] > knots[i - 1])) throw formatError("knots are not increasing");
+        }
+    }
+
+    void writeArray(std::ostream &out, const std::string &name, const std::vector<double> &values)
+    {
+        out << "        <" << name << " precision='64' endian='little' length='" << values.size() << "'>"
+            << encodeDoubles(values) << "</" << name << ">\n";
+    }
+}
+
+std::vector<double> IsotopeSplineModel::Model::gridCoefficients() const
+{
+    if (shared()) return coefficients;
+
+    const std::size_t numPieces = knots.size() - 1;
+    std::vector<double> grid(numPieces * numIsotopes * 4);
+    for (std::size_t piece = 0; piece < numPieces; ++piece) {
+        for (int isotope = 0; isotope < numIsotopes; ++isotope) {
+            expand(isotopeKnots[isotope], &coefficients[firstPiece[isotope] * 4], knots[piece], knots[piece + 1],
+                   &grid[(piece * numIsotopes + isotope) * 4]);
+        }
+    }
+    return grid;
+}
+
+void IsotopeSplineModel::Model::share()
+{
+    if (shared()) return;
+    coefficients = gridCoefficients();
+    isotopeKnots.clear();
+    firstPiece.clear();
+}
+
+void IsotopeSplineModel::Model::separate()
+{
+    if (!shared()) return;
+
+    // each isotope keeps the pieces of the grid between its own first and last knot
+    std::vector<double> separated;
+    isotopeKnots.resize(numIsotopes);
+    firstPiece.resize(numIsotopes);
+    for (int isotope = 0; isotope < numIsotopes; ++isotope) {
+        auto begin = std::lower_bound(knots.begin(), knots.end(), bounds[2 * isotope]);
+        auto end = std::upper_bound(begin, knots.end(), bounds[2 * isotope + 1]);
+        if (end - begin < 2 || *begin != bounds[2 * isotope] || *(end - 1) != bounds[2 * isotope + 1]) {
+            throw formatError("isotope bounds are not knots of the shared grid");
+        }
+
+        isotopeKnots[isotope].assign(begin, end);
+        firstPiece[isotope] = separated.size() / 4;
+        const std::size_t from = begin - knots.begin(), to = end - knots.begin() - 1;
+        for (std::size_t piece = from; piece < to; ++piece) {
+            const double *c = &coefficients[(piece * numIsotopes + isotope) * 4];
+            separated.insert(separated.end(), c, c + 4);
+        }
+    }
+    coefficients.swap(separated);
+}
+
+void IsotopeSplineModel::Model::index()
+{
+    lower.resize(numIsotopes);
+    upper.resize(numIsotopes);
+    for (int isotope = 0; isotope < numIsotopes; ++isotope) {
+        lower[isotope] = isotope == 0 ? bounds[0] : std::max(lower[isotope - 1], bounds[2 * isotope]);
+        upper[isotope] = isotope == 0 ? bounds[1] : std::min(upper[isotope - 1], bounds[2 * isotope + 1]);
+    }
+
+    knotIndex = KnotIndex();
+    isotopeIndex.clear();
+    if (shared()) {
+        knotIndex = KnotIndex(knots);
+    } else {
+        for (const std::vector<double> &own : isotopeKnots) isotopeIndex.push_back(KnotIndex(own));
+    }
+}
+
+std::size_t IsotopeSplineModel::Model::piece(double mass) const
+{
+    return shared() ? knotIndex.piece(knots, mass) : 0;
+}
+
+template <>
+const double* IsotopeSplineModel::Model::coefficientData<double>() const
+{
+    return coefficients.data();
+}
+
+template <>
+const float* IsotopeSplineModel::Model::coefficientData<float>() const
+{
+    std::call_once(*coefficients32Built, [this] { coefficients32.assign(coefficients.begin(), coefficients.end()); });
+    return coefficients32.data();
+}
+
+template <typename Real>
+void IsotopeSplineModel::Model::evaluate(double mass, std::size_t piece, int first, int last,
+                                         Real *probabilities) const
+{
+    // per isotope a [1, x, x^2, x^3] product with the coefficients of its piece. The offset from the knot is taken
+    // in double, it is small enough for float.
+    const Real *data = coefficientData<Real>();
+    if (shared()) {
+        // one lookup for all isotopes
+        const Real x1 = Real(mass - knots[piece]);
+        const Real x2 = x1 * x1;
+        const Real x3 = x2 * x1;
+        const Real *c = data + (piece * numIsotopes + first) * 4;
+        for (int isotope = first; isotope <= last; ++isotope, c += 4) {
+            probabilities[isotope - first] = c[0] + c[1] * x1 + c[2] * x2 + c[3] * x3;
+        }
+        return;
+    }
+
+    for (int isotope = first; isotope <= last; ++isotope) {
+        const std::vector<double> &own = isotopeKnots[isotope];
+        const std::size_t ownPiece = isotopeIndex[isotope].piece(own, mass);
+        const Real x1 = Real(mass - own[ownPiece]);
+        const Real x2 = x1 * x1;
+        const Real x3 = x2 * x1;
+        const Real *c = data + (firstPiece[isotope] + ownPiece) * 4;
+        probabilities[isotope - first] = c[0] + c[1] * x1 + c[2] * x2 + c[3] * x3;
+    }
+}
+
+IsotopeSplineModel::IsotopeSplineModel(const std::string &path, Layout layout)
+        : layout_(layout), maxIsotope_(-1), maxSulfur_(-1)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) throw std::runtime_error("Could not open isotope spline file " + path);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    const std::string xml = contents.str();
+
+    // separate splines by sulfur count and isotope
+    std::map<int, std::vector<Spline> > separate;
+    std::size_t pos = 0;
+    while ((pos = findTag(xml, "model", pos)) != std::string::npos) {
+        std::size_t tagEnd = xml.find('>', pos);
+        if (tagEnd == std::string::npos) throw formatError("unterminated model tag");
+
+        std::string tag = xml.substr(pos, tagEnd - pos);
+        std::string sulfur = attribute(tag, "S");
+        std::string isotopeText = attribute(tag, "isotope");
+        if (isotopeText.empty()) throw formatError("model without isotope");
+        int numSulfur = sulfur.empty() ? AVERAGE : std::atoi(sulfur.c_str());
+        int isotope = std::atoi(isotopeText.c_str());
+        if (isotope < 0 || numSulfur < AVERAGE) throw formatError("negative isotope or sulfur count");
+
+        std::size_t modelEnd = xml.find("</model>", tagEnd);
+        if (modelEnd == std::string::npos) throw formatError("unterminated model");
+
+        Spline spline;
+        spline.knots = decodeDoubles(elementText(xml, tagEnd, modelEnd, "knots"));
+        spline.coefficients = decodeDoubles(elementText(xml, tagEnd, modelEnd, "coefficients"));
+        checkKnots(spline.knots);
+        if (spline.coefficients.size() != 4 * (spline.knots.size() - 1)) {
+            throw formatError("knot and coefficient counts do not match");
+        }
+
+        std::vector<Spline> &splines = separate[numSulfur];
+        if (splines.size() <= (std::size_t) isotope) splines.resize(isotope + 1);
+        splines[isotope] = spline;
+
+        pos = modelEnd;
+    }
+
+    std::map<int, Model> models;
+    for (auto itr = separate.begin(); itr != separate.end(); ++itr) {
+        const std::vector<Spline> &splines = itr->second;
+        Model &model = models[itr->first];
+        model.numIsotopes = (int) splines.size();
+
+        for (const Spline &spline : splines) {
+            if (spline.knots.empty()) throw formatError("missing isotope model");
+            model.knots.insert(model.knots.end(), spline.knots.begin(), spline.knots.end());
+            model.bounds.push_back(spline.knots.front());
+            model.bounds.push_back(spline.knots.back());
+            model.isotopeKnots.push_back(spline.knots);
+            model.firstPiece.push_back(model.coefficients.size() / 4);
+            model.coefficients.insert(model.coefficients.end(), spline.coefficients.begin(),
+                                      spline.coefficients.end());
+        }
+        std::sort(model.knots.begin(), model.knots.end());
+        model.knots.erase(std::unique(model.knots.begin(), model.knots.end()), model.knots.end());
+    }
+
+    pos = 0;
+    while ((pos = findTag(xml, "sharedModel", pos)) != std::string::npos) {
+        std::size_t tagEnd = xml.find('>', pos);
+        if (tagEnd == std::string::npos) throw formatError("unterminated sharedModel tag");
+
+        std::string tag = xml.substr(pos, tagEnd - pos);
+        std::string sulfur = attribute(tag, "S");
+        int numSulfur = sulfur.empty() ? AVERAGE : std::atoi(sulfur.c_str());
+        if (numSulfur < AVERAGE) throw formatError("negative sulfur count");
+        if (models.count(numSulfur)) throw formatError("more than one model for a sulfur count");
+
+        std::size_t modelEnd = xml.find("</sharedModel>", tagEnd);
+        if (modelEnd == std::string::npos) throw formatError("unterminated sharedModel");
+
+        Model &model = models[numSulfur];
+        model.numIsotopes = std::atoi(attribute(tag, "isotopes").c_str());
+        model.knots = decodeDoubles(elementText(xml, tagEnd, modelEnd, "knots"));
+        model.bounds = decodeDoubles(elementText(xml, tagEnd, modelEnd, "bounds"));
+        model.coefficients = decodeDoubles(elementText(xml, tagEnd, modelEnd, "coefficients"));
+        checkKnots(model.knots);
+        if (model.numIsotopes < 1 || model.bounds.size() != 2 * (std::size_t) model.numIsotopes
+            || model.coefficients.size() != 4 * (std::size_t) model.numIsotopes * (model.knots.size() - 1)) {
+            throw formatError("knot, bound and coefficient counts do not match");
+        }
+
+        pos = modelEnd;
+    }
+
+    if (models.empty()) throw formatError(path + " contains no models");
+
+    models_.resize(models.rbegin()->first + 2);
+    for (auto itr = models.begin(); itr != models.end(); ++itr) {
+        if (layout == SHARED) itr->second.share();
+        else itr->second.separate();
+        itr->second.index();
+        maxIsotope_ = maxIsotope_ == -1 ? itr->second.numIsotopes - 1
+                                        : std::min(maxIsotope_, itr->second.numIsotopes - 1);
+        maxSulfur_ = std::max(maxSulfur_, itr->first);
+        std::swap(models_[itr->first + 1], itr->second);
+    }
+}
+
+void IsotopeSplineModel::saveShared(const std::string &path) const
+{
+    std::ofstream out(path.c_str());
+    if (!out) throw std::runtime_error("Could not open " + path + " for writing");
+
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    out << "<models maxIsotopeDepth=\"" << maxIsotope_ + 1 << "\" maxSulfur=\"" << maxSulfur_
+        << "\" layout=\"shared\">\n";
+    for (std::size_t i = 0; i < models_.size(); ++i) {
+        const Model &model = models_[i];
+        if (model.numIsotopes == 0) continue;
+
+        out << "    <sharedModel";
+        if ((int) i - 1 != AVERAGE) out << " S='" << (int) i - 1 << "'";
+        out << " isotopes='" << model.numIsotopes << "' order='4'>\n";
+        writeArray(out, "knots", model.knots);
+        writeArray(out, "bounds", model.bounds);
+        writeArray(out, "coefficients", model.gridCoefficients());
+        out << "    </sharedModel>\n";
+    }
+    out << "</models>\n";
+    if (!out) throw std::runtime_error("Could not write " + path);
+}
+
+const IsotopeSplineModel::Model* IsotopeSplineModel::model(int numSulfur, int maxIsotope) const
+{
+    if (numSulfur < AVERAGE || numSulfur + 1 >= (int) models_.size()) return NULL;
+    const Model &model = models_[numSulfur + 1];
+    return maxIsotope >= 0 && maxIsotope < model.numIsotopes ? &model : NULL;
+}
+
+const std::vector<double>& IsotopeSplineModel::knots(int numSulfur) const
+{
+    static const std::vector<double> none;
+    const Model *m = model(numSulfur, 0);
+    return m == NULL ? none : m->knots;
+}
+
+std::size_t IsotopeSplineModel::coefficientBytes() const
+{
+    std::size_t bytes = 0;
+    for (const Model &model : models_) {
+        bytes += (model.knots.size() + model.coefficients.size()) * sizeof(double);
+        for (const std::vector<double> &own : model.isotopeKnots) bytes += own.size() * sizeof(double);
+    }
+    return bytes;
+}
+
+bool IsotopeSplineModel::range(int numSulfur, int maxIsotope, double &minMass, double &maxMass) const
+{
+    const Model *m = model(numSulfur, maxIsotope);
+    if (m == NULL) return false;
+
+    minMass = m->lower[maxIsotope];
+    maxMass = m->upper[maxIsotope];
+    return minMass <= maxMass;
+}
+
+bool IsotopeSplineModel::inBounds(double mass, int maxIsotope, int numSulfur) const
+{
+    const Model *m = model(numSulfur, maxIsotope);
+    return m != NULL && mass >= m->lower[maxIsotope] && mass <= m->upper[maxIsotope];
+}
+
+template <typename Real>
+bool IsotopeSplineModel::evaluate(double mass, int maxIsotope, int numSulfur, Real *probabilities) const
+{
+    const Model *m = model(numSulfur, maxIsotope);
+    if (m == NULL || !(mass >= m->lower[maxIsotope] && mass <= m->upper[maxIsotope])) return false;
+
+    m->evaluate(mass, m->piece(mass), 0, maxIsotope, probabilities);
+    return true;
+}
+
+template <typename Real>
+bool IsotopeSplineModel::evaluateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                                          int precursorSulfurs, int fragmentSulfurs, Real *probabilities) const
+{
+    int maxIsolated, complementSulfurs;
+    if (!FragmentIsotopes::prepare(precursorMass, fragmentMass, isolatedIsotopes, precursorSulfurs, fragmentSulfurs,
+                                   maxIsolated, complementSulfurs)) {
+        return false;
+    }
+
+    Real fragment[64], complement[64];
+    if (!evaluate(fragmentMass, maxIsolated, fragmentSulfurs, fragment)
+        || !evaluate(precursorMass - fragmentMass, maxIsolated, complementSulfurs, complement)) {
+        return false;
+    }
+
+    FragmentIsotopes::condition(fragment, complement, isolatedIsotopes, maxIsolated, probabilities);
+    return true;
+}
+
+bool IsotopeSplineModel::estimate(double mass, int maxIsotope, int numSulfur, double *probabilities) const
+{
+    return evaluate(mass, maxIsotope, numSulfur, probabilities);
+}
+
+bool IsotopeSplineModel::estimate(double mass, int maxIsotope, int numSulfur, float *probabilities) const
+{
+    return evaluate(mass, maxIsotope, numSulfur, probabilities);
+}
+
+bool IsotopeSplineModel::estimateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                                          int precursorSulfurs, int fragmentSulfurs, double *probabilities) const
+{
+    return evaluateFragment(precursorMass, fragmentMass, isolatedIsotopes, precursorSulfurs, fragmentSulfurs,
+                            probabilities);
+}
+
+bool IsotopeSplineModel::estimateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                                          int precursorSulfurs, int fragmentSulfurs, float *probabilities) const
+{
+    return evaluateFragment(precursorMass, fragmentMass, isolatedIsotopes, precursorSulfurs, fragmentSulfurs,
+                            probabilities);
+}
+
+bool IsotopeSplineModel::estimateEnvelope(double mass, int numSulfur, double threshold,
+                                          IsotopeEnvelope &envelope) const
+{
+    const Model *m = model(numSulfur, 0);
+    if (m == NULL || !(threshold > 0) || !(mass >= m->lower[0] && mass <= m->upper[0])) return false;
+
+    const std::size_t piece = m->piece(mass);
+
+    // For a normal distribution around the averagine mean with the mean as variance, the isotopes above threshold
+    // lie within sqrt(2 mean ln(p(mean) / threshold)) of it. The isotope distributions have the longer tail above
+    // the mean, up to 1.5 times that for thresholds down to 1e-5. Start there and widen while an end of the window
+    // still reaches threshold.
+    const double mean = mass * AVERAGINE_NEUTRONS_PER_DA;
+    const double variance = std::max(mean, 1.0);
+    const double logRatio = std::log(1 / (threshold * std::sqrt(2 * M_PI * variance)));
+    int first, last;
+    for (double halfWidth = std::sqrt(2 * variance * std::max(logRatio, 0.0)); ; halfWidth *= 1.5) {
+        first = std::max(0, (int) (mean - halfWidth) - 1);
+        last = (int) (mean + 1.5 * halfWidth) + 2;
+
+        // Isotopes 0 to last must cover mass. Above the isotopes whose splines start at larger masses, which are
+        // negligible, the envelope ends; above the model's last isotope or one that ends below mass, it is unknown.
+        bool clipped = last >= m->numIsotopes;
+        bool unknown = clipped;
+        last = std::min(last, m->numIsotopes - 1);
+        while (!(mass >= m->lower[last] && mass <= m->upper[last])) {
+            clipped = true;
+            unknown = mass > m->upper[last];
+            --last;
+        }
+        first = std::min(first, last);
+
+        // past an unknown end the distribution only falls if its mean lies below it
+        double pLast, pFirst = 0;
+        m->evaluate(mass, piece, last, last, &pLast);
+        if (unknown && (mean + 1 > last || pLast >= threshold)) return false;
+
+        // only the ends decide whether to widen, the envelope is written once the window is settled
+        if (first > 0) m->evaluate(mass, piece, first, first, &pFirst);
+        bool openBelow = first > 0 && pFirst >= threshold;
+        bool openAbove = !clipped && pLast >= threshold;
+        if (!openBelow && !openAbove) break;
+    }
+
+    m->evaluate(mass, piece, first, last, envelope.reset(first, last - first + 1));
+    envelope.trim(threshold);
+    return true;
+}
+
+std::size_t IsotopeSplineModel::estimateFragments(double precursorMass, int precursorSulfurs,
+                                                  const double *fragmentMasses, const int *fragmentSulfurs,
+                                                  std::size_t n, std::uint64_t isolatedIsotopes,
+                                                  double *probabilities, bool *estimated) const
+{
+    const std::size_t block = FragmentIsotopes::BATCH_BLOCK;
+    double fragments[64 * block], complements[64 * block], conditioned[64 * block];
+    std::size_t members[block];
+    double fragment[64], complement[64];
+
+    std::size_t numEstimated = 0;
+    for (std::size_t begin = 0; begin < n; begin += block) {
+        const std::size_t end = std::min(n, begin + block);
+
+        // gather the fragments in bounds, isotope-major
+        std::size_t size = 0;
+        int maxIsolated = 0;
+        for (std::size_t q = begin; q < end; ++q) {
+            int fragmentSulfur = fragmentSulfurs == NULL ? AVERAGE : fragmentSulfurs[q];
+            int complementSulfurs;
+            estimated[q] = FragmentIsotopes::prepare(precursorMass, fragmentMasses[q], isolatedIsotopes,
+                                                     precursorSulfurs, fragmentSulfur, maxIsolated, complementSulfurs)
+                           && estimate(fragmentMasses[q], maxIsolated, fragmentSulfur, fragment)
+                           && estimate(precursorMass - fragmentMasses[q], maxIsolated, complementSulfurs, complement);
+            if (!estimated[q]) continue;
+
+            for (int i = 0; i <= maxIsolated; ++i) {
+                fragments[i * block + size] = fragment[i];
+                complements[i * block + size] = complement[i];
+            }
+            members[size++] = q;
+        }
+        if (size == 0) continue;
+
+        FragmentIsotopes::conditionBatch(fragments, complements, size, block, isolatedIsotopes, maxIsolated,
+                                         conditioned);
+        const std::size_t width = maxIsolated + 1;
+        for (std::size_t m = 0; m < size; ++m) {
+            double *out = probabilities + members[m] * width;
+            for (int i = 0; i <= maxIsolated; ++i) out[i] = conditioned[i * block + m];
+        }
+        numEstimated += size;
+    }
+    return numEstimated;
+}
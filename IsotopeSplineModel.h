@@ -0,0 +1,193 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOTOPESPLINEMODEL_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOTOPESPLINEMODEL_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "IsotopeEnvelope.h"
+#include "KnotIndex.h"
+
+/**
+ * The isotope spline models (misc/IsotopeSplines_*.xml) without OpenMS. This mirrors IsotopeSplineDB from the
+ * OpenMS fork and JavaSplineUsageExample.
+ *
+ * The file has one cubic spline per isotope for the average (sulfur-unaware) model, and one per isotope and
+ * sulfur count for the sulfur-specific models. Each spline maps mass to the probability of that isotope.
+ *
+ * By default each isotope keeps its own spline, and an estimate looks up the piece of every isotope. With the
+ * SHARED layout, all isotopes of one sulfur count share a knot grid instead: the union of their knots, with each
+ * spline's polynomials re-expanded at the extra knots. This is exact up to rounding. One knot lookup then finds
+ * the coefficients of every isotope in one contiguous block, stored as [piece][isotope][power], which makes
+ * estimates of 21 or more isotopes about 3 times faster. The shared grid costs memory: about 30 MB for the
+ * 100 kDa, 101 isotope models, against 3 MB as separate splines, so it is opt-in at load time. ConvertSplineModel
+ * writes the shared layout to a file (<sharedModel> elements) for readers that want the blocks as they are.
+ *
+ * The estimates have float overloads. They read a float copy of the coefficients, so they move half the bytes
+ * of the double path, and evaluate in float with twice the SIMD lanes. Against the splines and the conditioning
+ * evaluated in long double, float estimates were off by at most 1.3e-7 and float fragment estimates by at most
+ * 2.4e-7, far below the models' own error (see CompareToTheoretical --float-report). The first float estimate of
+ * a sulfur count builds its copy, which adds half of that model's coefficient memory.
+ *
+ * A loaded model is immutable apart from the float copies, which are built once under std::call_once, so it can
+ * be shared by any number of threads.
+ */
+class IsotopeSplineModel {
+
+public:
+
+    static const int AVERAGE = -1;  // sulfur count that selects the average model
+
+    // how the splines of a sulfur count are kept in memory
+    enum Layout {
+        SEPARATE,   // one spline per isotope, as the model files have them
+        SHARED      // all isotopes on one knot grid
+    };
+
+    /**
+     * Reads a file with separate splines per isotope (<model> elements), in the shared layout (<sharedModel>
+     * elements), or both for different sulfur counts. Either is converted to layout.
+     * @throws std::runtime_error if path cannot be read or is not a spline model file
+     */
+    explicit IsotopeSplineModel(const std::string &path, Layout layout = SEPARATE);
+
+    /**
+     * Writes the model in the shared knot layout, whatever its layout in memory.
+     * @throws std::runtime_error if path cannot be written
+     */
+    void saveShared(const std::string &path) const;
+
+    Layout layout() const { return layout_; }
+
+    // highest isotope every model covers
+    int maxIsotope() const { return maxIsotope_; }
+
+    // highest sulfur count with a sulfur-specific model, -1 if there are none
+    int maxSulfur() const { return maxSulfur_; }
+
+    // memory of the knots and double coefficients of all models, without the float copy
+    std::size_t coefficientBytes() const;
+
+    // union of the knots of all isotopes of numSulfur (or AVERAGE), the shared grid; empty if there is no such model
+    const std::vector<double>& knots(int numSulfur) const;
+
+    /**
+     * Mass range in which isotopes 0 to maxIsotope of the model for numSulfur (or AVERAGE) are all defined.
+     * @return false if there is no such model or the range is empty
+     */
+    bool range(int numSulfur, int maxIsotope, double &minMass, double &maxMass) const;
+
+    /**
+     * @return true if isotopes 0 to maxIsotope of the model for numSulfur (or AVERAGE) cover mass
+     */
+    bool inBounds(double mass, int maxIsotope, int numSulfur) const;
+
+    /**
+     * Probabilities of isotopes 0 to maxIsotope of a molecule of the given mass.
+     * @return false if the query is out of bounds, probabilities is unchanged
+     */
+    bool estimate(double mass, int maxIsotope, int numSulfur, double *probabilities) const;
+
+    bool estimate(double mass, int maxIsotope, int numSulfur, float *probabilities) const;
+
+    /**
+     * The envelope of isotopes with a probability of at least threshold (> 0) of a molecule of the given mass. Only
+     * a window around the averagine mean is evaluated, so the cost grows with the envelope's width and not with the
+     * mass. Isotopes the model starts above mass count as below threshold.
+     * @return false if the envelope reaches past the model's isotopes at mass, envelope is unchanged: the window is
+     *         settled before envelope is written
+     */
+    bool estimateEnvelope(double mass, int numSulfur, double threshold, IsotopeEnvelope &envelope) const;
+
+    /**
+     * Fragment isotope distribution conditioned on the isolated precursor isotopes (bit i of isolatedIsotopes set
+     * if Mi was isolated). Writes isotopes 0 to the highest isolated isotope, renormalized to sum to 1. The
+     * fragment model uses fragmentSulfurs and the complementary fragment precursorSulfurs - fragmentSulfurs. Pass
+     * AVERAGE for both to use the average model.
+     * @return false if the query is out of bounds or invalid, probabilities is unchanged
+     */
+    bool estimateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                          int precursorSulfurs, int fragmentSulfurs, double *probabilities) const;
+
+    bool estimateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                          int precursorSulfurs, int fragmentSulfurs, float *probabilities) const;
+
+    /**
+     * estimateFragment for n fragments of one precursor and isolation, conditioned together (see
+     * FragmentIsotopes::conditionBatch). Fragment q gets isotopes 0 to the highest isolated isotope at
+     * probabilities[q * (highest isolated isotope + 1)]. fragmentSulfurs may be NULL with precursorSulfurs AVERAGE.
+     * estimated[q] is set to whether fragment q was estimated; rows of the others are unchanged.
+     * @return the number of fragments estimated
+     */
+    std::size_t estimateFragments(double precursorMass, int precursorSulfurs, const double *fragmentMasses,
+                                  const int *fragmentSulfurs, std::size_t n, std::uint64_t isolatedIsotopes,
+                                  double *probabilities, bool *estimated) const;
+
+private:
+
+    // every isotope of one sulfur count, on one knot grid or as separate splines
+    struct Model {
+        int numIsotopes;
+        std::vector<double> knots;          // union of the knots of all isotopes
+        std::vector<double> coefficients;   // a, b, c, d per isotope per piece of knots, or with separate splines
+                                            // per piece of each isotope's own knots, isotope after isotope
+        mutable std::vector<float> coefficients32;  // the same rounded to float, built by the first float estimate
+        std::vector<double> bounds;         // lower and upper mass of each isotope's own spline
+        std::vector<double> lower;          // range of isotopes 0 to i together
+        std::vector<double> upper;
+
+        // separate splines only: each isotope's own knots and the index of its first piece in coefficients
+        std::vector<std::vector<double> > isotopeKnots;
+        std::vector<std::size_t> firstPiece;
+
+        KnotIndex knotIndex;                    // of knots, on the shared grid
+        std::vector<KnotIndex> isotopeIndex;    // of isotopeKnots, with separate splines
+        std::unique_ptr<std::once_flag> coefficients32Built;
+
+        Model() : numIsotopes(0), coefficients32Built(new std::once_flag) {}
+
+        bool shared() const { return isotopeKnots.empty(); }
+
+        // coefficients of every isotope on the grid of knots, re-expanded from the separate splines if needed
+        std::vector<double> gridCoefficients() const;
+
+        // converts separate splines to the shared grid, or the other way round
+        void share();
+        void separate();
+
+        // builds the ranges and knot indices once knots, coefficients and bounds are set
+        void index();
+
+        // piece of the shared grid that holds mass, 0 with separate splines
+        std::size_t piece(double mass) const;
+
+        // probabilities of isotopes first to last at mass, which all of them cover; piece is piece(mass)
+        template <typename Real>
+        void evaluate(double mass, std::size_t piece, int first, int last, Real *probabilities) const;
+
+        // all coefficients in double or float
+        template <typename Real>
+        const Real* coefficientData() const;
+    };
+
+    // model of numSulfur (or AVERAGE) if it covers maxIsotope, NULL otherwise
+    const Model* model(int numSulfur, int maxIsotope) const;
+
+    // estimate and estimateFragment in double or float
+    template <typename Real>
+    bool evaluate(double mass, int maxIsotope, int numSulfur, Real *probabilities) const;
+
+    template <typename Real>
+    bool evaluateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                          int precursorSulfurs, int fragmentSulfurs, Real *probabilities) const;
+
+    std::vector<Model> models_;     // by sulfur count + 1, AVERAGE first
+    Layout layout_;
+    int maxIsotope_;
+    int maxSulfur_;
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_ISOTOPESPLINEMODEL_H
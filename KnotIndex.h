@@ -0,0 +1,68 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_KNOTINDEX_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_KNOTINDEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Finds the piece of a sorted knot vector that holds x in constant time, for IsotopeSplineModel and
+ * CompressedSplineModel. Uniform buckets over the knot range each hold the piece their start falls into.
+ *
+ * At half the smallest knot spacing, the piece of any x is its bucket's piece or the next one. Rounding can put x
+ * into the bucket before or after its own, so the lookup steps back as well as forward. Closely spaced knots fall
+ * back to a short scan.
+ */
+class KnotIndex {
+
+public:
+
+    KnotIndex() : bucketScale_(0) {}
+
+    // knots has to hold at least two knots and outlive the index's use with it
+    explicit KnotIndex(const std::vector<double> &knots)
+    {
+        const std::size_t numPieces = knots.size() - 1;
+        double range = knots.back() - knots.front();
+        double minSpacing = range;
+        for (std::size_t i = 0; i < numPieces; ++i) minSpacing = std::min(minSpacing, knots[i + 1] - knots[i]);
+
+        std::size_t numBuckets = minSpacing > 0 ? (std::size_t) std::ceil(2 * range / minSpacing) : 1;
+        numBuckets = std::max<std::size_t>(1, std::min<std::size_t>(numBuckets, 64 * numPieces));
+        bucketScale_ = range > 0 ? numBuckets / range : 0;
+
+        buckets_.resize(numBuckets);
+        std::size_t piece = 0;
+        for (std::size_t b = 0; b < numBuckets; ++b) {
+            double start = knots.front() + b / bucketScale_;
+            while (piece + 1 < numPieces && knots[piece + 1] <= start) ++piece;
+            buckets_[b] = (std::uint32_t) piece;
+        }
+    }
+
+    // piece whose left knot is the last one <= x, the last knot belongs to the last piece
+    std::size_t piece(const std::vector<double> &knots, double x) const
+    {
+        const std::size_t lastPiece = knots.size() - 2;
+        double position = std::min(std::max(0.0, (x - knots.front()) * bucketScale_), double(buckets_.size() - 1));
+        std::size_t bucket = (std::size_t) position;
+
+        std::size_t piece = buckets_[bucket];
+        piece = std::min(piece + (knots[piece + 1] <= x), lastPiece);
+        while (piece < lastPiece && knots[piece + 1] <= x) ++piece;
+        // rounded into the following bucket, whose piece starts right above x
+        while (piece > 0 && knots[piece] > x) --piece;
+        return piece;
+    }
+
+    std::size_t numBuckets() const { return buckets_.size(); }
+
+private:
+
+    double bucketScale_;
+    std::vector<std::uint32_t> buckets_;
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_KNOTINDEX_H
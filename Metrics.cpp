@@ -0,0 +1,253 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+    struct Registry {
+        std::mutex mutex;
+        std::map<std::string, std::unique_ptr<Metrics::Counter> > counters;
+        std::map<std::string, std::unique_ptr<Metrics::Histogram> > histograms;
+    };
+
+    Registry &registry()
+    {
+        static Registry r;
+        return r;
+    }
+
+    struct Reporter {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool running = false;
+        bool stop = false;
+
+        std::ostream *out = nullptr;
+        std::unique_ptr<std::ofstream> file;
+        std::chrono::steady_clock::duration interval;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point lastReport;
+        std::map<std::string, std::uint64_t> lastValues;
+
+        // a tool that returns early without stopReporting() must not exit with the thread still running
+        ~Reporter()
+        {
+            if (!thread.joinable()) return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_one();
+            thread.join();
+        }
+    };
+
+    Reporter &reporter()
+    {
+        static Reporter r;
+        return r;
+    }
+
+    double secondsBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+    {
+        return std::chrono::duration<double>(to - from).count();
+    }
+
+    // One JSON object per line. Progress lines give rates over the last interval, the summary over the whole run.
+    void writeLine(Reporter &rep, bool summary)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double elapsed = secondsBetween(rep.start, now);
+        double interval = summary ? elapsed : secondsBetween(rep.lastReport, now);
+
+        std::ostringstream line;
+        line << std::setprecision(6);
+        line << "{\"type\":\"" << (summary ? "summary" : "progress") << "\",\"elapsed_s\":" << elapsed
+             << ",\"counters\":{";
+
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+
+        bool first = true;
+        for (auto itr = reg.counters.begin(); itr != reg.counters.end(); ++itr) {
+            std::uint64_t value = itr->second->value();
+            std::uint64_t previous = summary ? 0 : rep.lastValues[itr->first];
+            rep.lastValues[itr->first] = value;
+
+            line << (first ? "" : ",") << "\"" << itr->first << "\":{\"total\":" << value
+                 << ",\"per_s\":" << (interval > 0 ? (value - previous) / interval : 0) << "}";
+            first = false;
+        }
+
+        line << "},\"histograms\":{";
+        first = true;
+        for (auto itr = reg.histograms.begin(); itr != reg.histograms.end(); ++itr) {
+            const Metrics::Histogram &h = *itr->second;
+            line << (first ? "" : ",") << "\"" << itr->first << "\":{\"count\":" << h.count()
+                 << ",\"mean\":" << h.mean() << ",\"p50\":" << h.percentile(0.5)
+                 << ",\"p99\":" << h.percentile(0.99) << ",\"max\":" << h.max() << "}";
+            first = false;
+        }
+        line << "}}";
+
+        rep.lastReport = now;
+        *rep.out << line.str() << std::endl;
+    }
+
+    void reportLoop()
+    {
+        Reporter &rep = reporter();
+        std::unique_lock<std::mutex> lock(rep.mutex);
+        while (!rep.wake.wait_until(lock, rep.lastReport + rep.interval, [&rep] { return rep.stop; })) {
+            writeLine(rep, false);
+        }
+    }
+}
+
+Metrics::Histogram::Histogram() : count_(0), sum_(0), max_(0)
+{
+    for (int b = 0; b < NUM_BUCKETS; ++b) buckets_[b].store(0, std::memory_order_relaxed);
+}
+
+void Metrics::Histogram::record(std::uint64_t value)
+{
+    int bucket = 0;
+    for (std::uint64_t v = value; v != 0 && bucket < NUM_BUCKETS - 1; v >>= 1) ++bucket;
+
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    std::uint64_t currentMax = max_.load(std::memory_order_relaxed);
+    while (value > currentMax && !max_.compare_exchange_weak(currentMax, value, std::memory_order_relaxed)) {}
+}
+
+double Metrics::Histogram::mean() const
+{
+    std::uint64_t n = count();
+    return n == 0 ? 0 : (double) sum_.load(std::memory_order_relaxed) / n;
+}
+
+std::uint64_t Metrics::Histogram::percentile(double q) const
+{
+    std::uint64_t n = count();
+    if (n == 0) return 0;
+
+    std::uint64_t rank = (std::uint64_t) (q * (n - 1)) + 1;
+    std::uint64_t seen = 0;
+    for (int b = 0; b < NUM_BUCKETS; ++b) {
+        seen += buckets_[b].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(b == 0 ? 0 : (std::uint64_t(1) << b) - 1, max());
+        }
+    }
+    return max();
+}
+
+Metrics::Counter& Metrics::counter(const std::string &name)
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    std::unique_ptr<Counter> &c = reg.counters[name];
+    if (!c) c.reset(new Counter());
+    return *c;
+}
+
+Metrics::Histogram& Metrics::histogram(const std::string &name)
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    std::unique_ptr<Histogram> &h = reg.histograms[name];
+    if (!h) h.reset(new Histogram());
+    return *h;
+}
+
+std::string Metrics::destinationFromArgs(int &argc, char *argv[], double &intervalSeconds)
+{
+    std::string destination;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            destination = argv[++i];
+        } else if (std::strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+            intervalSeconds = std::atof(argv[++i]);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = NULL;
+    return destination;
+}
+
+void Metrics::startReporting(const std::string &destination, double intervalSeconds)
+{
+    // the registry has to be constructed first so it is destroyed after the reporter thread is joined
+    registry();
+    Reporter &rep = reporter();
+    if (rep.running) return;
+
+    if (destination == "-") {
+        rep.out = &std::cerr;
+    } else {
+        rep.file.reset(new std::ofstream(destination.c_str()));
+        if (!*rep.file) {
+            rep.file.reset();
+            throw std::runtime_error("Could not open metrics file " + destination);
+        }
+        rep.out = rep.file.get();
+    }
+
+    rep.interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(intervalSeconds > 0 ? intervalSeconds : 10));
+    rep.start = rep.lastReport = std::chrono::steady_clock::now();
+    rep.stop = false;
+    rep.running = true;
+    rep.thread = std::thread(reportLoop);
+}
+
+void Metrics::stopReporting()
+{
+    Reporter &rep = reporter();
+    if (!rep.running) return;
+
+    {
+        std::lock_guard<std::mutex> lock(rep.mutex);
+        rep.stop = true;
+    }
+    rep.wake.notify_one();
+    rep.thread.join();
+
+    writeLine(rep, true);
+    rep.file.reset();
+    rep.out = nullptr;
+    rep.running = false;
+}
+
+void Metrics::printSummary(std::ostream &out)
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    for (auto itr = reg.counters.begin(); itr != reg.counters.end(); ++itr) {
+        out << itr->first << ": " << itr->second->value() << std::endl;
+    }
+    for (auto itr = reg.histograms.begin(); itr != reg.histograms.end(); ++itr) {
+        const Histogram &h = *itr->second;
+        out << itr->first << ": count " << h.count() << ", mean " << h.mean() << ", p50 <= " << h.percentile(0.5)
+            << ", p99 <= " << h.percentile(0.99) << ", max " << h.max() << std::endl;
+    }
+}
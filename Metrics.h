@@ -0,0 +1,129 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_METRICS_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/**
+ * Process-wide counters and histograms for progress and throughput reporting.
+ *
+ * Counters and histograms are created by name on first use and live until the process exits, so call sites can
+ * keep a reference to them in a static local. Updates are relaxed atomics and take no lock.
+ *
+ * When reporting is started, a background thread writes one JSON line per interval with every counter's total
+ * and rate over the last interval, and the count, mean and percentiles of every histogram. stopReporting()
+ * writes a final summary line covering the whole run.
+ *
+ * Usage:
+ *     static Metrics::Counter &spectra = Metrics::counter("spectra");
+ *     spectra.add();
+ *
+ *     static Metrics::Histogram &spectrumTime = Metrics::histogram("spectrum_us");
+ *     Metrics::ScopedTimer timer(spectrumTime);
+ */
+class Metrics {
+
+public:
+
+    class Counter {
+
+    public:
+
+        Counter() : value_(0) {}
+
+        void add(std::uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+        std::uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+
+        Counter(const Counter&);
+        Counter& operator=(const Counter&);
+
+        std::atomic<std::uint64_t> value_;
+    };
+
+    // Bucket b > 0 counts values in [2^(b-1), 2^b), so percentiles are accurate to a factor of two
+    class Histogram {
+
+    public:
+
+        static const int NUM_BUCKETS = 64;
+
+        Histogram();
+
+        void record(std::uint64_t value);
+
+        std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+        std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+        double mean() const;
+
+        // upper bound of the bucket holding quantile q (0-1)
+        std::uint64_t percentile(double q) const;
+
+    private:
+
+        Histogram(const Histogram&);
+        Histogram& operator=(const Histogram&);
+
+        std::atomic<std::uint64_t> buckets_[NUM_BUCKETS];
+        std::atomic<std::uint64_t> count_;
+        std::atomic<std::uint64_t> sum_;
+        std::atomic<std::uint64_t> max_;
+    };
+
+    // Records the microseconds from construction to destruction
+    class ScopedTimer {
+
+    public:
+
+        explicit ScopedTimer(Histogram &histogram)
+                : histogram_(histogram), start_(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~ScopedTimer()
+        {
+            histogram_.record((std::uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start_).count());
+        }
+
+    private:
+
+        ScopedTimer(const ScopedTimer&);
+        ScopedTimer& operator=(const ScopedTimer&);
+
+        Histogram &histogram_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    static Counter& counter(const std::string &name);
+
+    static Histogram& histogram(const std::string &name);
+
+    /**
+     * Removes "--metrics destination" and "--metrics-interval seconds" options from the command line.
+     * @return the destination ("-" for stderr), empty if metrics were not requested
+     */
+    static std::string destinationFromArgs(int &argc, char *argv[], double &intervalSeconds);
+
+    /**
+     * Starts writing a progress line to destination ("-" for stderr) every intervalSeconds.
+     * @throws std::runtime_error if destination cannot be opened
+     */
+    static void startReporting(const std::string &destination, double intervalSeconds);
+
+    // Stops the reporting thread and writes the summary line, does nothing if reporting was not started
+    static void stopReporting();
+
+    // Writes a human-readable table of every counter and histogram
+    static void printSummary(std::ostream &out);
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_METRICS_H
@@ -0,0 +1,148 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_PERFCOUNTERS_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_PERFCOUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Hardware performance counters of the calling thread, read through Linux perf_event_open.
+ *
+ * Cycles, instructions, cache misses and branch misses are opened as one group so they count over the same
+ * interval. Counters the kernel or the machine do not provide (e.g. in a VM, or with a restrictive
+ * /proc/sys/kernel/perf_event_paranoid) are reported as unavailable instead of failing. On other platforms no
+ * counter is available.
+ *
+ * Usage:
+ *     PerfCounters counters;
+ *     counters.start();
+ *     ...
+ *     PerfCounters::Values v = counters.stop();
+ */
+class PerfCounters {
+
+public:
+
+    enum Event {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        NUM_EVENTS
+    };
+
+    struct Values {
+        double counts[NUM_EVENTS];  // scaled up if the kernel had to multiplex the counters
+        bool valid[NUM_EVENTS];
+
+        bool available(Event e) const { return valid[e]; }
+        double operator[](Event e) const { return counts[e]; }
+    };
+
+    PerfCounters()
+    {
+        for (int e = 0; e < NUM_EVENTS; ++e) fds_[e] = -1;
+
+#ifdef __linux__
+        const std::uint64_t configs[NUM_EVENTS] = {
+                PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        int leader = -1;
+        for (int e = 0; e < NUM_EVENTS; ++e) {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[e];
+            attr.disabled = leader == -1 ? 1 : 0;   // the whole group is enabled through its leader
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            fds_[e] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fds_[e] == -1 && leader != -1) {
+                // not every machine counts every event, keep the ones that open
+                continue;
+            }
+            if (fds_[e] == -1) break;
+            if (leader == -1) leader = fds_[e];
+        }
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (int e = 0; e < NUM_EVENTS; ++e) {
+            if (fds_[e] != -1) close(fds_[e]);
+        }
+#endif
+    }
+
+    /**
+     * @return true if at least the cycle counter could be opened
+     */
+    bool available() const { return fds_[CYCLES] != -1; }
+
+    static const char* name(Event e)
+    {
+        static const char *names[NUM_EVENTS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+        return names[e];
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        if (!available()) return;
+        ioctl(fds_[CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds_[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    Values stop()
+    {
+        Values values;
+        for (int e = 0; e < NUM_EVENTS; ++e) {
+            values.counts[e] = 0;
+            values.valid[e] = false;
+        }
+
+#ifdef __linux__
+        if (!available()) return values;
+        ioctl(fds_[CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        for (int e = 0; e < NUM_EVENTS; ++e) {
+            if (fds_[e] == -1) continue;
+
+            // value, time enabled, time running
+            std::uint64_t data[3];
+            if (::read(fds_[e], data, sizeof(data)) != (ssize_t) sizeof(data) || data[2] == 0) continue;
+
+            values.counts[e] = (double) data[0] * ((double) data[1] / (double) data[2]);
+            values.valid[e] = true;
+        }
+#endif
+        return values;
+    }
+
+private:
+
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+
+    int fds_[NUM_EVENTS];
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_PERFCOUNTERS_H
@@ -0,0 +1,352 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <OpenMS/FORMAT/MzMLFile.h>
+#include <OpenMS/CHEMISTRY/ElementDB.h>
+#include <OpenMS/CHEMISTRY/IsotopeDistribution.h>
+
+#include "Ion.h"
+#include "Stats.h"
+#include "SpectrumUtilities.h"
+#include "IsotopeDistributions.h"
+#include "ResultWriter.h"
+#include "Trace.h"
+
+static const OpenMS::IsotopeSplineDB* isotopeDB = OpenMS::IsotopeSplineDB::getInstance();
+
+// A peptide-spectrum match from the tab-separated PSM list
+struct PSM {
+    OpenMS::Size spectrumIndex;
+    std::string nativeID;
+    Ion precursorIon;
+};
+
+// Accumulated wall time and number of calls of each pipeline stage
+class StageTimes {
+
+public:
+
+    enum Stage {
+        LOAD_SPECTRA,
+        LOAD_PSMS,
+        SORT,
+        FRAGMENT_GENERATION,
+        PEAK_MATCHING,
+        ISOTOPE_DISTRIBUTIONS,
+        OUTPUT,
+        NUM_STAGES
+    };
+
+    StageTimes()
+    {
+        for (int s = 0; s < NUM_STAGES; ++s) {
+            ns[s] = 0;
+            calls[s] = 0;
+        }
+    }
+
+    static const char* name(Stage s)
+    {
+        static const char *names[NUM_STAGES] = {
+                "load spectra",
+                "load PSMs",
+                "sort",
+                "fragment generation",
+                "peak matching",
+                "isotope distributions",
+                "output"
+        };
+        return names[s];
+    }
+
+    double ns[NUM_STAGES];
+    long calls[NUM_STAGES];
+};
+
+// Adds the time between construction and destruction to one stage
+class ScopedStage {
+
+public:
+
+    ScopedStage(StageTimes &times, StageTimes::Stage stage)
+            : times_(times), stage_(stage), start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedStage()
+    {
+        times_.ns[stage_] += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_).count();
+        times_.calls[stage_]++;
+    }
+
+private:
+
+    StageTimes &times_;
+    StageTimes::Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Peak resident set size of the process in MiB
+double peakRSSMiB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);    // bytes
+#else
+    return usage.ru_maxrss / 1024.0;               // KiB
+#endif
+}
+
+void usage()
+{
+    std::cout << "usage: PipelineBenchmark input_mzML_spectra_file input_PSM_file output_directory [--repeat n] [--json path] [--trace path]" << std::endl;
+    std::cout << "\tinput_mzML_spectra_file: path to input .mzML file" << std::endl;
+    std::cout << "\tinput_PSM_file: tab-separated spectrum_index, native_id, sequence, charge with a header line" << std::endl;
+    std::cout << "\toutput_directory: path to output files" << std::endl;
+    std::cout << "\trepeat: number of passes over the PSMs after loading (default 1)" << std::endl;
+    std::cout << "\tjson: also write stage timings as JSON to path" << std::endl;
+    std::cout << "\ttrace: write a Chrome trace to path, which breaks the isotope distributions stage down by "
+              << "estimator (needs -DENABLE_TRACING=ON)" << std::endl;
+}
+
+/**
+ * Reads the PSM list.
+ * @throws std::runtime_error if the file cannot be read or a PSM does not point to an MS2 spectrum
+ */
+std::vector<PSM> loadPSMs(const std::string &path, const OpenMS::MSExperiment<OpenMS::Peak1D> &msExperiment)
+{
+    std::ifstream infile(path);
+    if (!infile) {
+        throw std::runtime_error("Unable to open PSM file: " + path);
+    }
+
+    std::vector<PSM> psms;
+    std::string line;
+    std::getline(infile, line);     // header
+
+    while (std::getline(infile, line)) {
+        if (line.empty()) continue;
+
+        std::istringstream fields(line);
+        std::string index, nativeID, sequence, charge;
+        std::getline(fields, index, '\t');
+        std::getline(fields, nativeID, '\t');
+        std::getline(fields, sequence, '\t');
+        std::getline(fields, charge, '\t');
+
+        PSM psm;
+        psm.spectrumIndex = std::stoul(index);
+        psm.nativeID = nativeID;
+        psm.precursorIon = Ion(OpenMS::AASequence::fromString(sequence), OpenMS::Residue::Full, std::stoi(charge));
+
+        if (psm.spectrumIndex >= msExperiment.getNrSpectra()
+            || msExperiment.getSpectrum(psm.spectrumIndex).getMSLevel() != 2) {
+            throw std::runtime_error("PSM does not point to an MS2 spectrum: " + line);
+        }
+        if (msExperiment.getSpectrum(psm.spectrumIndex).getNativeID() != nativeID) {
+            throw std::runtime_error("PSM native id does not match the spectrum: " + line);
+        }
+        psms.push_back(psm);
+    }
+    return psms;
+}
+
+/**
+ * Scores every PSM the way CompareToShotgun does, with each stage timed on its own.
+ */
+void scorePSMs(const OpenMS::MSExperiment<OpenMS::Peak1D> &msExperiment, std::vector<PSM> &psms,
+               ResultWriter &scoreFile, StageTimes &times, long &numFragments, long &numScored)
+{
+    const double offset = 0;
+    const double minMz = 0, maxMz = 10000;
+
+    for (PSM &psm : psms) {
+        // copied so every pass sorts the spectrum as loaded
+        OpenMS::MSSpectrum<OpenMS::Peak1D> currentSpectrum = msExperiment.getSpectrum(psm.spectrumIndex);
+        {
+            ScopedStage stage(times, StageTimes::SORT);
+            currentSpectrum.sortByPosition();
+        }
+
+        OpenMS::Precursor precursorInfo = currentSpectrum.getPrecursors()[0];
+        Ion &precursorIon = psm.precursorIon;
+        double width = precursorInfo.getIsolationWindowLowerOffset() + precursorInfo.getIsolationWindowUpperOffset();
+
+        std::vector<Ion> ionList;
+        {
+            ScopedStage stage(times, StageTimes::FRAGMENT_GENERATION);
+            ionList = precursorIon.generateFragmentIons(minMz, maxMz);
+        }
+        numFragments += ionList.size();
+
+        //the isolated precursor isotopes are the same for every fragment, as in CompareToShotgun
+        IsolationMask precursorIsotopes;
+        {
+            ScopedStage stage(times, StageTimes::PEAK_MATCHING);
+            precursorIsotopes = SpectrumUtilities::whichPrecursorIsotopes(precursorInfo, precursorIon, offset);
+        }
+        if (precursorIsotopes.empty()) continue;
+
+        for (int ionIndex = 0; ionIndex < ionList.size(); ++ionIndex) {
+            const Ion &ion = ionList[ionIndex];
+            {
+                ScopedStage stage(times, StageTimes::PEAK_MATCHING);
+                double tol = OpenMS::Math::ppmToMass(SpectrumUtilities::ERROR_PPM, ion.monoMz);
+                if (currentSpectrum.findNearest(ion.monoMz, tol) == -1) continue;
+            }
+
+            //the estimators, peak matching and scoring of CompareToShotgun's calcDistributions
+            std::unique_ptr<IsotopeDistributions> isotopeDistributions;
+            {
+                ScopedStage stage(times, StageTimes::ISOTOPE_DISTRIBUTIONS);
+                isotopeDistributions.reset(new IsotopeDistributions(precursorIsotopes, ion, precursorIon, isotopeDB,
+                                                                    currentSpectrum, precursorInfo, width));
+            }
+            if (!isotopeDistributions->isValid) continue;
+            ++numScored;
+
+            {
+                ScopedStage stage(times, StageTimes::OUTPUT);
+                scoreFile << psm.nativeID << ionIndex + 1 << precursorIon.monoWeight << ion.monoWeight << ion.charge
+                          << isotopeDistributions->completeFlag << isotopeDistributions->completeAtDepth
+                          << precursorIsotopes.size();
+                scoreFile << isotopeDistributions->exactCondFragmentX2
+                          << isotopeDistributions->approxFragmentFromWeightX2
+                          << isotopeDistributions->approxFragmentFromWeightAndSulfurX2
+                          << isotopeDistributions->approxFragmentSplineFromWeightX2
+                          << isotopeDistributions->approxFragmentSplineFromWeightAndSulfurX2
+                          << isotopeDistributions->exactPrecursorX2
+                          << isotopeDistributions->approxPrecursorX2;
+                scoreFile.endRow();
+            }
+        }
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    const std::string tracePath = Trace::pathFromArgs(argc, argv);
+    if (argc < 4) {
+        usage();
+        return 0;
+    }
+
+    const std::string mzMLFilePath = argv[1];
+    const std::string psmFilePath = argv[2];
+    const std::string outDir = argv[3];
+
+    int repeat = 1;
+    std::string jsonPath;
+    for (int i = 4; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--repeat") == 0) repeat = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--json") == 0) jsonPath = argv[++i];
+        else {
+            usage();
+            return 0;
+        }
+    }
+    if (repeat < 1) {
+        usage();
+        return 0;
+    }
+
+    StageTimes times;
+
+    OpenMS::MSExperiment<OpenMS::Peak1D> msExperiment;
+    std::vector<PSM> psms;
+    ResultWriter scoreFile;
+    try {
+        {
+            ScopedStage stage(times, StageTimes::LOAD_SPECTRA);
+            OpenMS::MzMLFile().load(mzMLFilePath, msExperiment);
+        }
+        {
+            ScopedStage stage(times, StageTimes::LOAD_PSMS);
+            psms = loadPSMs(psmFilePath, msExperiment);
+        }
+        scoreFile.open(outDir + "/pipelineScores.out");
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        usage();
+        return 0;
+    }
+    double loadRSS = peakRSSMiB();
+
+    scoreFile.writeHeader({"nativeID", "ionID", "precursorMonoWeight", "ionMonoWeight", "ionCharge",
+                           "completeFlag", "completeAtDepth", "numPrecursorIsotopes",
+                           "exactCondFragmentX2", "approxFragmentFromWeightX2", "approxFragmentFromWeightAndSX2",
+                           "approxFragmentSplineFromWeightX2", "approxFragmentSplineFromWeightAndSulfurX2",
+                           "exactPrecursorX2", "approxPrecursorX2"});
+
+    long numFragments = 0, numScored = 0;
+    auto scoringStart = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < repeat; ++pass) {
+        scorePSMs(msExperiment, psms, scoreFile, times, numFragments, numScored);
+    }
+    {
+        ScopedStage stage(times, StageTimes::OUTPUT);
+        scoreFile.close();
+    }
+    double scoringMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - scoringStart).count();
+
+    double totalNs = 0;
+    for (int s = 0; s < StageTimes::NUM_STAGES; ++s) totalNs += times.ns[s];
+
+    std::cout << "Spectra: " << msExperiment.getNrSpectra() << std::endl;
+    std::cout << "PSMs: " << psms.size() << " x " << repeat << " passes" << std::endl;
+    std::cout << "Fragments generated: " << numFragments << std::endl;
+    std::cout << "Fragments scored: " << numScored << std::endl;
+    std::cout << "Scoring wall time (ms): " << scoringMs << std::endl;
+    std::cout << "Peak RSS after loading (MiB): " << loadRSS << std::endl;
+    std::cout << "Peak RSS (MiB): " << peakRSSMiB() << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "stage\tcalls\ttotal_ms\tmean_us\tshare" << std::endl;
+    for (int s = 0; s < StageTimes::NUM_STAGES; ++s) {
+        StageTimes::Stage stage = (StageTimes::Stage) s;
+        std::cout << StageTimes::name(stage) << "\t" << times.calls[s] << "\t" << times.ns[s] / 1e6 << "\t"
+                  << (times.calls[s] > 0 ? times.ns[s] / times.calls[s] / 1e3 : 0) << "\t"
+                  << times.ns[s] / totalNs << std::endl;
+    }
+
+    if (!jsonPath.empty()) {
+        std::ofstream json(jsonPath);
+        if (!json) {
+            std::cout << "Unable to open JSON output file: " << jsonPath << std::endl;
+            return 1;
+        }
+        json << "{\n  \"spectra\": " << msExperiment.getNrSpectra() << ",\n";
+        json << "  \"psms\": " << psms.size() << ",\n";
+        json << "  \"repeat\": " << repeat << ",\n";
+        json << "  \"fragments_generated\": " << numFragments << ",\n";
+        json << "  \"fragments_scored\": " << numScored << ",\n";
+        json << "  \"scoring_ms\": " << scoringMs << ",\n";
+        json << "  \"peak_rss_after_load_mib\": " << loadRSS << ",\n";
+        json << "  \"peak_rss_mib\": " << peakRSSMiB() << ",\n";
+        json << "  \"stages\": [\n";
+        for (int s = 0; s < StageTimes::NUM_STAGES; ++s) {
+            json << "    {\"stage\": \"" << StageTimes::name((StageTimes::Stage) s) << "\", \"calls\": " << times.calls[s]
+                 << ", \"total_ms\": " << times.ns[s] / 1e6 << "}" << (s + 1 < StageTimes::NUM_STAGES ? "," : "") << "\n";
+        }
+        json << "  ]\n}" << std::endl;
+    }
+
+    if (!tracePath.empty() && Trace::writeChromeTrace(tracePath)) {
+        std::cout << "Trace written to: " << tracePath << std::endl;
+    }
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <sstream>
 #include <OpenMS/FORMAT/MzMLFile.h>
 #include "SpectrumUtilities.h"
+#include "ResultWriter.h"
 
 struct TargetDetails {
     double center;
@@ -56,11 +57,11 @@ int main(int argc, char * argv[])
     OpenMS::MSExperiment<OpenMS::Peak1D> msExperiment;
 
     mzMLDataFile.load(argv[1], msExperiment);
-    std::ofstream out(argv[3]);
+    ResultWriter out(argv[3]);
 
     double ppmTol = std::atof(argv[4]);
 
-    out << "intensity" << "\t" << "target" << "\t" << "offset" << "\t" << "width" << std::endl;
+    out.writeHeader({"intensity", "target", "offset", "width"});
 
     for (int specIndex = 0; specIndex < msExperiment.getNrSpectra(); ++specIndex) {
         //get copy of current spectrum
@@ -76,8 +77,9 @@ int main(int argc, char * argv[])
         //find nearest peak to ion mz within tolerance
         OpenMS::Int peakIndex = currentSpectrum.findNearest(targetDetails.target, tol);
 
-        double intensity = peakIndex == -1 ? 0 : currentSpectrum[peakIndex].getIntensity();
-        out << intensity << "\t" << targetDetails.target << "\t" << targetDetails.offset << "\t" << targetDetails.width << std::endl;
+        float intensity = peakIndex == -1 ? 0 : currentSpectrum[peakIndex].getIntensity();
+        out << intensity << targetDetails.target << targetDetails.offset << targetDetails.width;
+        out.endRow();
     }
 
     std::cout << "done" << std::endl;
@@ -0,0 +1,190 @@
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "EstimationProtocol.h"
+#include "ResultWriter.h"
+
+using namespace EstimationProtocol;
+
+void usage()
+{
+    std::cout << "usage: QueryIsotopeServer socket_path queries_tsv method [--batch n]" << std::endl;
+    std::cout << "\tsocket_path: socket of a running IsotopeServer" << std::endl;
+    std::cout << "\tqueries_tsv: precursor_average_mass, fragment_average_mass, precursor_sulfurs, fragment_sulfurs"
+              << " and isolated precursor isotopes (e.g. 0|1|2) per line" << std::endl;
+    std::cout << "\tmethod: spline_weight, spline_weight_sulfur, averagine_weight or averagine_weight_sulfur"
+              << std::endl;
+    std::cout << "\t--batch n: queries per request (default: 1000)" << std::endl;
+}
+
+std::vector<Query> readQueryFile(const std::string &path)
+{
+    std::ifstream in(path.c_str());
+    if (!in) throw std::runtime_error("Could not open " + path);
+
+    std::vector<Query> queries;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream fields(line);
+        Query q;
+        unsigned precursorSulfurs, fragmentSulfurs;
+        std::string isotopes;
+        if (!(fields >> q.precursorAverageMass >> q.fragmentAverageMass >> precursorSulfurs >> fragmentSulfurs
+                     >> isotopes)) {
+            throw std::runtime_error("Malformed query line: " + line);
+        }
+        q.precursorSulfurs = (std::uint8_t) precursorSulfurs;
+        q.fragmentSulfurs = (std::uint8_t) fragmentSulfurs;
+
+        q.isolatedIsotopes = 0;
+        std::istringstream isotopeList(isotopes);
+        std::string isotope;
+        while (std::getline(isotopeList, isotope, '|')) {
+            if (isotope.empty()) continue;
+            int i = std::atoi(isotope.c_str());
+            if (i < 0 || i > MAX_ISOTOPE) throw std::runtime_error("Isotope out of range: " + line);
+            q.isolatedIsotopes |= std::uint64_t(1) << i;
+        }
+        queries.push_back(q);
+    }
+    return queries;
+}
+
+int connectTo(const std::string &path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr *) &address, sizeof(address)) < 0) {
+        throw std::runtime_error("Could not connect to " + path + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+int main(int argc, char * argv[])
+{
+    // a server that goes away fails the write with EPIPE instead of killing the client
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::size_t batchSize = 1000;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchSize = std::max(1, std::atoi(argv[++i]));
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 3) {
+        usage();
+        return 0;
+    }
+
+    Method method = NUM_METHODS;
+    for (int m = 0; m < NUM_METHODS; ++m) {
+        if (args[2] == methodName((Method) m)) method = (Method) m;
+    }
+    if (method == NUM_METHODS) {
+        usage();
+        return 0;
+    }
+
+    try {
+        std::vector<Query> queries = readQueryFile(args[1]);
+        int fd = connectTo(args[0]);
+
+        std::size_t numRequests = (queries.size() + batchSize - 1) / batchSize;
+        std::vector<Response> responses(numRequests);
+        std::string readError;
+
+        // responses are read while requests are still being sent, so the server never waits on a full socket
+        std::thread reader([&] {
+            std::string in;
+            std::vector<char> buffer(1 << 16);
+            std::size_t received = 0;
+            try {
+                while (received < numRequests) {
+                    ssize_t n = read(fd, buffer.data(), buffer.size());
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) throw std::runtime_error("Connection closed by server");
+                    in.append(buffer.data(), n);
+
+                    std::size_t pos = 0;
+                    Response response;
+                    while (readResponse(in, pos, response)) {
+                        if (response.requestId >= numRequests) throw std::runtime_error("Unexpected request id");
+                        responses[response.requestId] = response;
+                        ++received;
+                    }
+                    in.erase(0, pos);
+                }
+            } catch (std::exception& e) {
+                readError = e.what();
+            }
+        });
+
+        std::string request, writeError;
+        for (std::size_t r = 0; r < numRequests && writeError.empty(); ++r) {
+            std::vector<Query> batch(queries.begin() + r * batchSize,
+                                     queries.begin() + std::min(queries.size(), (r + 1) * batchSize));
+            request.clear();
+            appendRequest(request, (std::uint32_t) r, method, batch);
+
+            std::size_t written = 0;
+            while (written < request.size()) {
+                ssize_t n = write(fd, request.data() + written, request.size() - written);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    writeError = std::string("Could not send request: ") + std::strerror(errno);
+                    break;
+                }
+                written += n;
+            }
+        }
+        shutdown(fd, SHUT_WR);
+        reader.join();
+        close(fd);
+
+        if (!writeError.empty()) throw std::runtime_error(writeError);
+        if (!readError.empty()) throw std::runtime_error(readError);
+
+        std::cout << "query\tisotope\tprobability\n";
+        char buf[32];
+        for (std::size_t r = 0; r < numRequests; ++r) {
+            if (responses[r].status != OK) {
+                throw std::runtime_error(std::string("Request failed: ") + statusName(responses[r].status));
+            }
+            for (std::size_t q = 0; q < responses[r].distributions.size(); ++q) {
+                const std::vector<double> &dist = responses[r].distributions[q];
+                for (std::size_t i = 0; i < dist.size(); ++i) {
+                    std::cout << r * batchSize + q << '\t' << i << '\t'
+                              << std::string(buf, ResultWriter::formatDouble(dist[i], buf)) << '\n';
+                }
+            }
+        }
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
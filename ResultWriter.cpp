@@ -0,0 +1,612 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "ResultWriter.h"
+
+namespace {
+
+    // Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010): the
+    // digits of a value that read back to it, found with 64-bit integer arithmetic. The digits are the shortest
+    // for all but a tiny fraction of values, which get one digit more. Unlike snprintf it never needs a
+    // strtod round trip to check itself.
+
+    // f * 2^e
+    struct DiyFp {
+        std::uint64_t f;
+        int e;
+
+        DiyFp(std::uint64_t f, int e) : f(f), e(e) {}
+    };
+
+    DiyFp minus(const DiyFp &x, const DiyFp &y)
+    {
+        return DiyFp(x.f - y.f, x.e);
+    }
+
+    // upper 64 bits of the 128-bit product, rounded
+    DiyFp times(const DiyFp &x, const DiyFp &y)
+    {
+        const std::uint64_t xLo = x.f & 0xFFFFFFFFu, xHi = x.f >> 32;
+        const std::uint64_t yLo = y.f & 0xFFFFFFFFu, yHi = y.f >> 32;
+        const std::uint64_t p0 = xLo * yLo, p1 = xLo * yHi, p2 = xHi * yLo, p3 = xHi * yHi;
+        std::uint64_t middle = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+        middle += std::uint64_t(1) << 31;
+        return DiyFp(p3 + (p1 >> 32) + (p2 >> 32) + (middle >> 32), x.e + y.e + 64);
+    }
+
+    DiyFp normalize(DiyFp x)
+    {
+        while ((x.f >> 63) == 0) {
+            x.f <<= 1;
+            --x.e;
+        }
+        return x;
+    }
+
+    // a value of at least the precision of T (> 0) and the midpoints to its neighbours, on the exponent of the
+    // upper midpoint
+    template <typename T>
+    void boundaries(T value, DiyFp &w, DiyFp &lower, DiyFp &upper)
+    {
+        const int precision = std::numeric_limits<T>::digits;
+        const int bias = std::numeric_limits<T>::max_exponent - 1 + (precision - 1);
+        const std::uint64_t hiddenBit = std::uint64_t(1) << (precision - 1);
+
+        std::uint64_t bits;
+        if (sizeof(T) == sizeof(std::uint64_t)) {
+            std::memcpy(&bits, &value, sizeof(bits));
+        } else {
+            std::uint32_t bits32;
+            std::memcpy(&bits32, &value, sizeof(bits32));
+            bits = bits32;
+        }
+        const std::uint64_t exponent = bits >> (precision - 1);
+        const std::uint64_t fraction = bits & (hiddenBit - 1);
+
+        const DiyFp v = exponent == 0 ? DiyFp(fraction, 1 - bias)
+                                      : DiyFp(fraction + hiddenBit, int(exponent) - bias);
+        // at a power of two the next smaller value is half as far away as the next larger one
+        const bool lowerCloser = fraction == 0 && exponent > 1;
+        upper = normalize(DiyFp(2 * v.f + 1, v.e - 1));
+        lower = lowerCloser ? DiyFp(4 * v.f - 1, v.e - 2) : DiyFp(2 * v.f - 1, v.e - 1);
+        lower = DiyFp(lower.f << (lower.e - upper.e), upper.e);
+        w = normalize(v);
+    }
+
+    // binary exponents of the scaled values, so the integral part of upper fits in 32 bits
+    const int ALPHA = -60;
+    const int GAMMA = -32;
+
+    struct CachedPower {
+        std::uint64_t f;
+        int e;
+        int k;
+    };
+
+    // 10^k rounded to 64 bits, for k = -300, -292, ..., 324
+    const CachedPower CACHED_POWERS[] = {
+            {0xAB70FE17C79AC6CA, -1060, -300},
+            {0xFF77B1FCBEBCDC4F, -1034, -292},
+            {0xBE5691EF416BD60C, -1007, -284},
+            {0x8DD01FAD907FFC3C,  -980, -276},
+            {0xD3515C2831559A83,  -954, -268},
+            {0x9D71AC8FADA6C9B5,  -927, -260},
+            {0xEA9C227723EE8BCB,  -901, -252},
+            {0xAECC49914078536D,  -874, -244},
+            {0x823C12795DB6CE57,  -847, -236},
+            {0xC21094364DFB5637,  -821, -228},
+            {0x9096EA6F3848984F,  -794, -220},
+            {0xD77485CB25823AC7,  -768, -212},
+            {0xA086CFCD97BF97F4,  -741, -204},
+            {0xEF340A98172AACE5,  -715, -196},
+            {0xB23867FB2A35B28E,  -688, -188},
+            {0x84C8D4DFD2C63F3B,  -661, -180},
+            {0xC5DD44271AD3CDBA,  -635, -172},
+            {0x936B9FCEBB25C996,  -608, -164},
+            {0xDBAC6C247D62A584,  -582, -156},
+            {0xA3AB66580D5FDAF6,  -555, -148},
+            {0xF3E2F893DEC3F126,  -529, -140},
+            {0xB5B5ADA8AAFF80B8,  -502, -132},
+            {0x87625F056C7C4A8B,  -475, -124},
+            {0xC9BCFF6034C13053,  -449, -116},
+            {0x964E858C91BA2655,  -422, -108},
+            {0xDFF9772470297EBD,  -396, -100},
+            {0xA6DFBD9FB8E5B88F,  -369,  -92},
+            {0xF8A95FCF88747D94,  -343,  -84},
+            {0xB94470938FA89BCF,  -316,  -76},
+            {0x8A08F0F8BF0F156B,  -289,  -68},
+            {0xCDB02555653131B6,  -263,  -60},
+            {0x993FE2C6D07B7FAC,  -236,  -52},
+            {0xE45C10C42A2B3B06,  -210,  -44},
+            {0xAA242499697392D3,  -183,  -36},
+            {0xFD87B5F28300CA0E,  -157,  -28},
+            {0xBCE5086492111AEB,  -130,  -20},
+            {0x8CBCCC096F5088CC,  -103,  -12},
+            {0xD1B71758E219652C,   -77,   -4},
+            {0x9C40000000000000,   -50,    4},
+            {0xE8D4A51000000000,   -24,   12},
+            {0xAD78EBC5AC620000,     3,   20},
+            {0x813F3978F8940984,    30,   28},
+            {0xC097CE7BC90715B3,    56,   36},
+            {0x8F7E32CE7BEA5C70,    83,   44},
+            {0xD5D238A4ABE98068,   109,   52},
+            {0x9F4F2726179A2245,   136,   60},
+            {0xED63A231D4C4FB27,   162,   68},
+            {0xB0DE65388CC8ADA8,   189,   76},
+            {0x83C7088E1AAB65DB,   216,   84},
+            {0xC45D1DF942711D9A,   242,   92},
+            {0x924D692CA61BE758,   269,  100},
+            {0xDA01EE641A708DEA,   295,  108},
+            {0xA26DA3999AEF774A,   322,  116},
+            {0xF209787BB47D6B85,   348,  124},
+            {0xB454E4A179DD1877,   375,  132},
+            {0x865B86925B9BC5C2,   402,  140},
+            {0xC83553C5C8965D3D,   428,  148},
+            {0x952AB45CFA97A0B3,   455,  156},
+            {0xDE469FBD99A05FE3,   481,  164},
+            {0xA59BC234DB398C25,   508,  172},
+            {0xF6C69A72A3989F5C,   534,  180},
+            {0xB7DCBF5354E9BECE,   561,  188},
+            {0x88FCF317F22241E2,   588,  196},
+            {0xCC20CE9BD35C78A5,   614,  204},
+            {0x98165AF37B2153DF,   641,  212},
+            {0xE2A0B5DC971F303A,   667,  220},
+            {0xA8D9D1535CE3B396,   694,  228},
+            {0xFB9B7CD9A4A7443C,   720,  236},
+            {0xBB764C4CA7A44410,   747,  244},
+            {0x8BAB8EEFB6409C1A,   774,  252},
+            {0xD01FEF10A657842C,   800,  260},
+            {0x9B10A4E5E9913129,   827,  268},
+            {0xE7109BFBA19C0C9D,   853,  276},
+            {0xAC2820D9623BF429,   880,  284},
+            {0x80444B5E7AA7CF85,   907,  292},
+            {0xBF21E44003ACDD2D,   933,  300},
+            {0x8E679C2F5E44FF8F,   960,  308},
+            {0xD433179D9C8CB841,   986,  316},
+            {0x9E19DB92B4E31BA9,  1013,  324},
+    };
+
+    // a power 10^-k that scales a value of binary exponent e into [ALPHA, GAMMA]
+    CachedPower cachedPower(int e)
+    {
+        const int f = ALPHA - e - 1;
+        const int k = (f * 78913) / (1 << 18) + (f > 0);    // ceil(f * log10(2))
+        return CACHED_POWERS[(300 + k + 7) / 8];
+    }
+
+    // the largest power of ten not above n, and its number of digits
+    int largestPow10(std::uint32_t n, std::uint32_t &pow10)
+    {
+        int digits = 10;
+        pow10 = 1000000000;
+        while (digits > 1 && n < pow10) {
+            pow10 /= 10;
+            --digits;
+        }
+        return digits;
+    }
+
+    // moves the last digit towards w while that stays inside the rounding interval
+    void roundWeed(char *digits, int length, std::uint64_t dist, std::uint64_t delta, std::uint64_t rest,
+                   std::uint64_t tenK)
+    {
+        while (rest < dist && delta - rest >= tenK && (rest + tenK < dist || dist - rest > rest + tenK - dist)) {
+            --digits[length - 1];
+            rest += tenK;
+        }
+    }
+
+    // digits * 10^decimalExponent is a value within (lower, upper), as close to w as Grisu2 gets
+    void generateDigits(char *digits, int &length, int &decimalExponent, DiyFp lower, DiyFp w, DiyFp upper)
+    {
+        std::uint64_t delta = minus(upper, lower).f;
+        std::uint64_t dist = minus(upper, w).f;
+
+        const DiyFp one(std::uint64_t(1) << -upper.e, upper.e);
+        std::uint32_t integral = std::uint32_t(upper.f >> -one.e);
+        std::uint64_t fractional = upper.f & (one.f - 1);
+
+        std::uint32_t pow10;
+        int n = largestPow10(integral, pow10);
+        while (n > 0) {
+            digits[length++] = char('0' + integral / pow10);
+            integral %= pow10;
+            --n;
+            const std::uint64_t rest = (std::uint64_t(integral) << -one.e) + fractional;
+            if (rest <= delta) {
+                decimalExponent += n;
+                roundWeed(digits, length, dist, delta, rest, std::uint64_t(pow10) << -one.e);
+                return;
+            }
+            pow10 /= 10;
+        }
+
+        int m = 0;
+        for (;;) {
+            fractional *= 10;
+            digits[length++] = char('0' + (fractional >> -one.e));
+            fractional &= one.f - 1;
+            ++m;
+            delta *= 10;
+            dist *= 10;
+            if (fractional <= delta) break;
+        }
+        decimalExponent -= m;
+        roundWeed(digits, length, dist, delta, fractional, one.f);
+    }
+
+    // writes value (> 0) the way "%g" would at the precision of its shortest digits, fixed notation for decimal
+    // exponents from -5 to 14 and scientific with a signed, at least two digit exponent otherwise
+    template <typename T>
+    int formatShortest(T value, char *buf)
+    {
+        DiyFp w(0, 0), lower(0, 0), upper(0, 0);
+        boundaries(value, w, lower, upper);
+
+        const CachedPower cached = cachedPower(upper.e);
+        const DiyFp c(cached.f, cached.e);
+        const DiyFp scaled = times(w, c);
+        DiyFp scaledLower = times(lower, c), scaledUpper = times(upper, c);
+        // one unit inwards, so the digits stay inside the interval despite the rounded products
+        ++scaledLower.f;
+        --scaledUpper.f;
+
+        char digits[24];
+        int length = 0;
+        int decimalExponent = -cached.k;
+        generateDigits(digits, length, decimalExponent, scaledLower, scaled, scaledUpper);
+
+        // value = 0.d1d2... * 10^point
+        const int point = length + decimalExponent;
+        char *out = buf;
+        if (length <= point && point <= 15) {
+            std::memcpy(out, digits, length);
+            std::memset(out + length, '0', point - length);
+            out += point;
+        } else if (0 < point && point <= 15) {
+            std::memcpy(out, digits, point);
+            out[point] = '.';
+            std::memcpy(out + point + 1, digits + point, length - point);
+            out += length + 1;
+        } else if (-4 <= point && point <= 0) {
+            out[0] = '0';
+            out[1] = '.';
+            std::memset(out + 2, '0', -point);
+            std::memcpy(out + 2 - point, digits, length);
+            out += 2 - point + length;
+        } else {
+            *out++ = digits[0];
+            if (length > 1) {
+                *out++ = '.';
+                std::memcpy(out, digits + 1, length - 1);
+                out += length - 1;
+            }
+            int exponent = point - 1;
+            *out++ = 'e';
+            *out++ = exponent < 0 ? '-' : '+';
+            if (exponent < 0) exponent = -exponent;
+            if (exponent >= 100) *out++ = char('0' + exponent / 100);
+            *out++ = char('0' + exponent / 10 % 10);
+            *out++ = char('0' + exponent % 10);
+        }
+        return int(out - buf);
+    }
+
+}
+
+ResultWriter::ResultWriter(Format format, std::size_t bufferSize)
+        : format_(format), file_(NULL), bufferSize_(bufferSize), fieldsInRow_(0), closing_(false), failed_(false)
+{
+}
+
+ResultWriter::ResultWriter(const std::string &path, Format format, std::size_t bufferSize)
+        : format_(format), file_(NULL), bufferSize_(bufferSize), fieldsInRow_(0), closing_(false), failed_(false)
+{
+    open(path);
+}
+
+ResultWriter::~ResultWriter()
+{
+    close();
+}
+
+void ResultWriter::open(const std::string &path)
+{
+    close();
+
+    file_ = std::fopen(path.c_str(), "wb");
+    if (file_ == NULL) {
+        throw std::runtime_error("Unable to open output file: " + path);
+    }
+
+    path_ = path;
+    closing_ = false;
+    failed_ = false;
+    fieldsInRow_ = 0;
+    buffer_.clear();
+    buffer_.reserve(bufferSize_);
+
+    if (format_ == COLUMNAR) {
+        columnar_.reset(new ColumnarFile::Encoder());
+        columnar_->start(buffer_);
+    }
+
+    writer_ = std::thread(&ResultWriter::writerLoop, this);
+}
+
+void ResultWriter::writeHeader(const std::vector<std::string> &columns)
+{
+    if (columnar_) {
+        columnar_->setColumnNames(columns);
+        return;
+    }
+
+    for (const std::string &column : columns) {
+        *this << column;
+    }
+    endRow();
+}
+
+void ResultWriter::nameColumns(const std::vector<std::string> &columns)
+{
+    if (columnar_) {
+        columnar_->setColumnNames(columns);
+    }
+}
+
+ResultWriter& ResultWriter::operator<<(double value)
+{
+    if (columnar_) {
+        columnar_->append(value);
+        return *this;
+    }
+    char buf[32];
+    beginField();
+    buffer_.append(buf, formatDouble(value, buf));
+    return *this;
+}
+
+ResultWriter& ResultWriter::operator<<(float value)
+{
+    if (columnar_) {
+        columnar_->append((double) value);
+        return *this;
+    }
+    char buf[32];
+    beginField();
+    buffer_.append(buf, formatFloat(value, buf));
+    return *this;
+}
+
+ResultWriter& ResultWriter::operator<<(bool value)
+{
+    // same as std::ostream without std::boolalpha
+    if (columnar_) {
+        columnar_->append(value ? 1LL : 0LL);
+        return *this;
+    }
+    beginField();
+    buffer_.push_back(value ? '1' : '0');
+    return *this;
+}
+
+ResultWriter& ResultWriter::operator<<(char value)
+{
+    // a character, as std::ostream writes it, not its code
+    if (columnar_) {
+        columnar_->append(std::string(1, value));
+        return *this;
+    }
+    beginField();
+    buffer_.push_back(value);
+    return *this;
+}
+
+ResultWriter& ResultWriter::operator<<(const std::string &value)
+{
+    if (columnar_) {
+        columnar_->append(value);
+        return *this;
+    }
+    beginField();
+    buffer_.append(value);
+    return *this;
+}
+
+ResultWriter& ResultWriter::operator<<(const char *value)
+{
+    if (columnar_) {
+        columnar_->append(std::string(value));
+        return *this;
+    }
+    beginField();
+    buffer_.append(value);
+    return *this;
+}
+
+void ResultWriter::endRow()
+{
+    if (columnar_) {
+        columnar_->endRow();
+        if (columnar_->rowGroupFull()) {
+            columnar_->flushRowGroup(buffer_);
+            submit();
+        }
+        return;
+    }
+
+    buffer_.push_back('\n');
+    fieldsInRow_ = 0;
+
+    if (buffer_.size() >= bufferSize_) {
+        submit();
+    }
+}
+
+void ResultWriter::close()
+{
+    if (file_ == NULL) return;
+
+    if (columnar_) {
+        columnar_->finish(buffer_);
+        columnar_.reset();
+    }
+
+    if (!buffer_.empty()) {
+        submit();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closing_ = true;
+    }
+    bufferReady_.notify_one();
+    writer_.join();
+
+    if (std::fclose(file_) != 0) failed_ = true;
+    file_ = NULL;
+
+    if (failed_) {
+        std::cerr << "Error writing output file: " << path_ << std::endl;
+    }
+
+    spare_.clear();
+}
+
+void ResultWriter::submit()
+{
+    // like std::ofstream, rows written to a writer that is not open are dropped
+    if (file_ == NULL) {
+        buffer_.clear();
+        return;
+    }
+
+    std::string next;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        bufferWritten_.wait(lock, [this] { return pending_.size() < MAX_PENDING_BUFFERS; });
+
+        pending_.push_back(std::move(buffer_));
+        if (!spare_.empty()) {
+            next = std::move(spare_.back());
+            spare_.pop_back();
+        }
+    }
+    bufferReady_.notify_one();
+
+    // reuse an already written buffer so its capacity is not reallocated
+    buffer_ = std::move(next);
+    buffer_.clear();
+    buffer_.reserve(bufferSize_);
+}
+
+void ResultWriter::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        bufferReady_.wait(lock, [this] { return closing_ || !pending_.empty(); });
+        if (pending_.empty()) break;
+
+        std::string data = std::move(pending_.front());
+        pending_.pop_front();
+
+        lock.unlock();
+        if (!failed_ && std::fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+            failed_ = true;
+        }
+        lock.lock();
+
+        spare_.push_back(std::move(data));
+        bufferWritten_.notify_one();
+    }
+}
+
+ResultWriter::Format ResultWriter::formatFromArgs(int &argc, char *argv[])
+{
+    Format format = TSV;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--columnar") == 0) {
+            format = COLUMNAR;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = NULL;
+    return format;
+}
+
+int ResultWriter::formatUnsigned(unsigned long long value, char *buf)
+{
+    char tmp[24];
+    int len = 0;
+    do {
+        tmp[len++] = char('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (int i = 0; i < len; ++i) buf[i] = tmp[len - 1 - i];
+    return len;
+}
+
+int ResultWriter::formatInteger(long long value, char *buf)
+{
+    if (value < 0) {
+        buf[0] = '-';
+        return 1 + formatUnsigned(0ULL - (unsigned long long) value, buf + 1);
+    }
+    return formatUnsigned((unsigned long long) value, buf);
+}
+
+int ResultWriter::formatDouble(double value, char *buf)
+{
+    // spelled the way std::ostream writes them, which the R scripts already read
+    if (std::isnan(value)) {
+        std::memcpy(buf, "nan", 3);
+        return 3;
+    }
+    if (std::isinf(value)) {
+        if (value < 0) {
+            std::memcpy(buf, "-inf", 4);
+            return 4;
+        }
+        std::memcpy(buf, "inf", 3);
+        return 3;
+    }
+
+    // integral values (ids, counts, bins) skip floating point formatting altogether
+    if (value == std::floor(value) && std::abs(value) < 1e15 && !(value == 0 && std::signbit(value))) {
+        return formatInteger((long long) value, buf);
+    }
+
+    // -0 included, Grisu2 needs a positive value
+    if (std::signbit(value)) {
+        buf[0] = '-';
+        return 1 + (value == 0 ? formatInteger(0, buf + 1) : formatShortest(-value, buf + 1));
+    }
+    return formatShortest(value, buf);
+}
+
+int ResultWriter::formatFloat(float value, char *buf)
+{
+    if (std::isnan(value) || std::isinf(value)) {
+        return formatDouble(value, buf);
+    }
+    if (value == std::floor(value) && std::abs(value) < 1e7f && !(value == 0 && std::signbit(value))) {
+        return formatInteger((long long) value, buf);
+    }
+
+    // -0 included, Grisu2 needs a positive value
+    if (std::signbit(value)) {
+        buf[0] = '-';
+        return 1 + (value == 0 ? formatInteger(0, buf + 1) : formatShortest(-value, buf + 1));
+    }
+    return formatShortest(value, buf);
+}
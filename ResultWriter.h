@@ -0,0 +1,154 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_RESULTWRITER_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_RESULTWRITER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <memory>
+
+#include "ColumnarFile.h"
+
+/**
+ * Result file that is filled one typed field at a time and written by a background thread.
+ *
+ * Rows are appended to a large in-memory buffer. Full buffers are handed to a writer thread, so the scoring
+ * thread never waits on the file system and no row is flushed on its own. Numbers are formatted with the
+ * shortest representation that reads back to the same value.
+ *
+ * In COLUMNAR format the same calls produce a binary columnar file instead (see ColumnarFile.h). Each full row
+ * group is encoded and handed to the writer thread like a text buffer.
+ *
+ * Usage:
+ *     ResultWriter out(path);
+ *     out.writeHeader({"scanDesc", "ionID"});
+ *     out << scanDesc << ionID;
+ *     out.endRow();
+ */
+class ResultWriter {
+
+public:
+
+    static const std::size_t DEFAULT_BUFFER_SIZE = 4 << 20;  // 4 MiB per buffer
+    static const std::size_t MAX_PENDING_BUFFERS = 4;        // buffers queued before the scoring thread waits
+
+    enum Format {
+        TSV,
+        COLUMNAR
+    };
+
+    ResultWriter(Format format = TSV, std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+    /**
+     * Opens path for writing.
+     * @throws std::runtime_error if the file cannot be opened
+     */
+    explicit ResultWriter(const std::string &path, Format format = TSV,
+                          std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+    ~ResultWriter();
+
+    /**
+     * Opens path for writing and starts the writer thread.
+     * @throws std::runtime_error if the file cannot be opened
+     */
+    void open(const std::string &path);
+
+    bool is_open() const { return file_ != NULL; }
+
+    Format format() const { return format_; }
+
+    /**
+     * Writes a row of column names. In columnar format the names become the column names instead.
+     */
+    void writeHeader(const std::vector<std::string> &columns);
+
+    /**
+     * Names the columns of a columnar file without writing a header row to a TSV file, for outputs that are
+     * read without a header.
+     */
+    void nameColumns(const std::vector<std::string> &columns);
+
+    // Each insertion appends one field to the current row
+    ResultWriter& operator<<(double value);
+    ResultWriter& operator<<(float value);
+    ResultWriter& operator<<(bool value);
+    ResultWriter& operator<<(char value);
+    ResultWriter& operator<<(const std::string &value);
+    ResultWriter& operator<<(const char *value);
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value, ResultWriter&>::type operator<<(T value)
+    {
+        if (columnar_) {
+            columnar_->append((long long) value);
+            return *this;
+        }
+        char buf[24];
+        beginField();
+        buffer_.append(buf, std::is_signed<T>::value ? formatInteger((long long) value, buf)
+                                                     : formatUnsigned((unsigned long long) value, buf));
+        return *this;
+    }
+
+    /**
+     * Terminates the current row. Hands the buffer to the writer thread once it is full.
+     */
+    void endRow();
+
+    /**
+     * Writes all buffered rows, stops the writer thread and closes the file.
+     */
+    void close();
+
+    // Shortest representation that parses back to the same value (Grisu2, rarely one digit longer). Return the
+    // number of characters written.
+    static int formatDouble(double value, char *buf);
+    static int formatFloat(float value, char *buf);
+
+    /**
+     * Removes a "--columnar" flag from the command line.
+     * @return COLUMNAR if the flag was given, TSV otherwise
+     */
+    static Format formatFromArgs(int &argc, char *argv[]);
+
+private:
+
+    ResultWriter(const ResultWriter&);
+    ResultWriter& operator=(const ResultWriter&);
+
+    inline void beginField()
+    {
+        if (fieldsInRow_++ > 0) buffer_.push_back('\t');
+    }
+
+    static int formatInteger(long long value, char *buf);
+    static int formatUnsigned(unsigned long long value, char *buf);
+
+    void submit();
+    void writerLoop();
+
+    std::string path_;
+    Format format_;
+    std::unique_ptr<ColumnarFile::Encoder> columnar_;
+    std::FILE *file_;
+    std::size_t bufferSize_;
+    std::string buffer_;
+    int fieldsInRow_;
+
+    std::thread writer_;
+    std::mutex mutex_;
+    std::condition_variable bufferReady_;
+    std::condition_variable bufferWritten_;
+    std::deque<std::string> pending_;
+    std::vector<std::string> spare_;
+    bool closing_;
+    bool failed_;
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_RESULTWRITER_H
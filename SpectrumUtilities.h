@@ -11,6 +11,10 @@
 #include <OpenMS/MATH/MISC/MathFunctions.h>
 
 #include "Ion.h"
+#include "IsolationMask.h"
+#include "IsotopeEnvelope.h"
+#include "IsotopeLookupTable.h"
+#include "Trace.h"
 
 
 
@@ -30,9 +34,8 @@ namespace SpectrumUtilities {
         }
     }
 
-    std::set<OpenMS::UInt> whichPrecursorIsotopes(const OpenMS::Precursor &precursorInfo,
-                                       const Ion &precursorIon, const double offset) {
-        std::set<OpenMS::UInt> precursorIsotopes;
+    static IsolationMask whichPrecursorIsotopes(const OpenMS::Precursor &precursorInfo,
+                                                const Ion &precursorIon, const double offset) {
         //isolation window lower cutoff
         double lowerCutoff = precursorInfo.getMZ() - precursorInfo.getIsolationWindowLowerOffset() + offset;
         //isolation window upper cutoff
@@ -44,14 +47,9 @@ namespace SpectrumUtilities {
         int smallestIsotope = std::max(0, int(std::ceil((lowerCutoff - precursorIon.monoMz) / isotopeStep)));
         int largestIsotope = int(std::floor((upperCutoff - precursorIon.monoMz) / isotopeStep));
 
-        //loop through each isotope of precursor ion
-        if (largestIsotope >= 0) {
-            for (OpenMS::UInt m = smallestIsotope; m <= largestIsotope; ++m) {
-                precursorIsotopes.insert(m);
-            }
-        }
-
-        return precursorIsotopes;
+        //every isotope of precursor ion inside the window
+        if (largestIsotope < smallestIsotope) return IsolationMask();
+        return IsolationMask::range(smallestIsotope, std::min(largestIsotope, int(IsolationMask::CAPACITY) - 1));
     }
 
     /**
@@ -67,34 +65,48 @@ namespace SpectrumUtilities {
                               std::vector<std::pair<double, double> > &theoDist,
                               const OpenMS::MSSpectrum<OpenMS::Peak1D> &spec)
     {
+        TRACE_SCOPE("observedDistribution");
+
+        //the theoretical peaks ascend in mz, so one binary search finds the first candidate peak and the others
+        //follow it: matching costs the window's peaks rather than a search of the whole spectrum per isotope
+        OpenMS::MSSpectrum<OpenMS::Peak1D>::ConstIterator candidate = spec.end();
+        double previousMZ = 0;
+
         //loop through each theoretical peak in isotopic distribution
         for (int i = 0; i < theoDist.size(); ++i) {
-        //for (int i = 0; i < 7; ++i) {
 
             //calculate search tolerance
             double tol =  OpenMS::Math::ppmToMass(ERROR_PPM, theoDist[i].first);
 
-            //find index of actual peak in spectrum
-            OpenMS::Int isoPeakIndex = spec.findNearest(theoDist[i].first, tol);
+            //skip to the first peak in tolerance, starting over if the distribution is not in mz order
+            if (i == 0 || theoDist[i].first < previousMZ) candidate = spec.MZBegin(theoDist[i].first - tol);
+            while (candidate != spec.end() && candidate->getMZ() < theoDist[i].first - tol) ++candidate;
+            previousMZ = theoDist[i].first;
+
+            //nearest actual peak in tolerance
+            OpenMS::MSSpectrum<OpenMS::Peak1D>::ConstIterator isoPeak = spec.end();
+            for (OpenMS::MSSpectrum<OpenMS::Peak1D>::ConstIterator peak = candidate;
+                 peak != spec.end() && peak->getMZ() <= theoDist[i].first + tol; ++peak) {
+                if (isoPeak == spec.end() || std::fabs(peak->getMZ() - theoDist[i].first)
+                                             < std::fabs(isoPeak->getMZ() - theoDist[i].first)) {
+                    isoPeak = peak;
+                }
+            }
 
             //observed isotope distribution pair
             std::pair<double, double> obs;
 
-            if (isoPeakIndex == -1 && i < theoDist.size()) {
+            if (isoPeak == spec.end()) {
                 //peak not found
                 obs.first = theoDist[i].first;
                 obs.second = 0;
-                obsDist.push_back(obs);
-            } else if (isoPeakIndex != -1) {
+            } else {
                 //peak found
-                obs.first = spec[isoPeakIndex].getMZ();
-                obs.second = spec[isoPeakIndex].getIntensity();
-                obsDist.push_back(obs);
+                obs.first = isoPeak->getMZ();
+                obs.second = isoPeak->getIntensity();
             }
+            obsDist.push_back(obs);
         }
-        /*if (obsDist.size() > theoDist.size()) {
-            std::cout << obsDist.size() << " " << theoDist.size() << std::endl;
-        }*/
     }
 
     /**
@@ -135,18 +147,21 @@ namespace SpectrumUtilities {
      * @param precursorCharge the charge of the precursor peptide that was fragmented.
      */
     static void exactConditionalFragmentIsotopeDist(std::vector<std::pair<double, double> > &condDist,
-                                             const std::set<OpenMS::UInt> &precursorIsotopes,
+                                             const IsolationMask &precursorIsotopes,
                                              const Ion &ion,
                                              const OpenMS::AASequence &precursorSequence,
                                              const OpenMS::Int &precursorCharge)
     {
+        TRACE_SCOPE("exactConditionalFragmentIsotopeDist");
+
         //clear vector for distribution
         condDist.clear();
 
         //compute conditional isotopic distribution and get vector of isotope peaks
         OpenMS::EmpiricalFormula precursorFormula = precursorSequence.getFormula(OpenMS::Residue::Full, precursorCharge);
         std::vector<std::pair<OpenMS::Size, double> > condPeakList =
-                ion.formula.getConditionalFragmentIsotopeDist(precursorFormula, precursorIsotopes).getContainer();
+                ion.formula.getConditionalFragmentIsotopeDist(precursorFormula,
+                                                              precursorIsotopes.cachedSet()).getContainer();
 
         //ion mz
         double ionMZ = ion.monoWeight / ion.charge;
@@ -166,14 +181,16 @@ namespace SpectrumUtilities {
     }
 
     static void approxPrecursorFromWeightIsotopeDist(std::vector<std::pair<double, double> > &approxDist,
-                                              const std::set<OpenMS::UInt> &precursorIsotopes,
+                                              const IsolationMask &precursorIsotopes,
                                               const Ion &fragmentIon)
     {
+        TRACE_SCOPE("approxPrecursorFromWeightIsotopeDist");
+
         OpenMS::UInt minIsotope = 7;
         //clear vector for distribution
         approxDist.clear();
 
-        OpenMS::UInt maxIsotope = *std::max_element(precursorIsotopes.begin(), precursorIsotopes.end());
+        OpenMS::UInt maxIsotope = precursorIsotopes.max();
         //construct distribution of depth at the maximum precursor isotope isolated
         OpenMS::IsotopeDistribution fragmentDist(minIsotope);
 
@@ -211,11 +228,13 @@ namespace SpectrumUtilities {
     }
 
     static void approxFragmentFromWeightIsotopeDist(std::vector<std::pair<double, double> > &approxDist,
-                                             const std::set<OpenMS::UInt> &precursorIsotopes,
+                                             const IsolationMask &precursorIsotopes,
                                              const Ion &fragmentIon,
                                              const OpenMS::AASequence &precursorSequence,
                                              const OpenMS::Int &precursorCharge)
     {
+        TRACE_SCOPE("approxFragmentFromWeightIsotopeDist");
+
         //clear vector for distribution
         approxDist.clear();
 
@@ -225,10 +244,11 @@ namespace SpectrumUtilities {
         double fragmentAvgWeight = fragmentIon.formula.getAverageWeight();
 
         //construct distribution
-        OpenMS::IsotopeDistribution fragmentDist(*std::max_element(precursorIsotopes.begin(), precursorIsotopes.end()) + 1);
+        OpenMS::IsotopeDistribution fragmentDist(precursorIsotopes.max() + 1);
 
         //estimate approx distribution from peptide weight
-        fragmentDist.estimateForFragmentFromPeptideWeight(precursorAvgWeight, fragmentAvgWeight, precursorIsotopes);
+        fragmentDist.estimateForFragmentFromPeptideWeight(precursorAvgWeight, fragmentAvgWeight,
+                                                          precursorIsotopes.cachedSet());
         //re-normalize distribution
         fragmentDist.renormalize();
 
@@ -253,11 +273,13 @@ namespace SpectrumUtilities {
     }
 
     static void approxFragmentFromWeightAndSIsotopeDist(std::vector<std::pair<double, double> > &approxDist,
-                                                 const std::set<OpenMS::UInt> &precursorIsotopes,
+                                                 const IsolationMask &precursorIsotopes,
                                                  const Ion &fragmentIon,
                                                  const OpenMS::AASequence &precursorSequence,
                                                  const OpenMS::Int &precursorCharge)
     {
+        TRACE_SCOPE("approxFragmentFromWeightAndSIsotopeDist");
+
         //clear vector for distribution
         approxDist.clear();
 
@@ -272,12 +294,12 @@ namespace SpectrumUtilities {
         int fragmentSulfurs = fragmentIon.formula.getNumberOf(ELEMENTS->getElement("Sulfur"));
 
         //construct distribution
-        OpenMS::IsotopeDistribution fragmentDist(*std::max_element(precursorIsotopes.begin(), precursorIsotopes.end()) + 1);
+        OpenMS::IsotopeDistribution fragmentDist(precursorIsotopes.max() + 1);
 
         //estimate approx distribution from peptide weight
         fragmentDist.estimateForFragmentFromPeptideWeightAndS(precursorAvgWeight, precursorSulfurs,
                                                               fragmentAvgWeight, fragmentSulfurs,
-                                                              precursorIsotopes);
+                                                              precursorIsotopes.cachedSet());
         //re-normalize distribution
         fragmentDist.renormalize();
 
@@ -302,12 +324,14 @@ namespace SpectrumUtilities {
     }
 
     static void approxFragmentSplineFromWeightIsotopeDist(std::vector<std::pair<double, double> > &approxDist,
-                                                    const std::set<OpenMS::UInt> &precursorIsotopes,
+                                                    const IsolationMask &precursorIsotopes,
                                                     const Ion &fragmentIon,
                                                     const OpenMS::AASequence &precursorSequence,
                                                     const OpenMS::Int &precursorCharge,
                                                     const OpenMS::IsotopeSplineDB* isotopeDB)
     {
+        TRACE_SCOPE("approxFragmentSplineFromWeightIsotopeDist");
+
         //clear vector for distribution
         approxDist.clear();
 
@@ -317,10 +341,11 @@ namespace SpectrumUtilities {
         double fragmentAvgWeight = fragmentIon.formula.getAverageWeight();
 
         //construct distribution
-        OpenMS::IsotopeDistribution fragmentDist(*std::max_element(precursorIsotopes.begin(), precursorIsotopes.end()) + 1);
+        OpenMS::IsotopeDistribution fragmentDist(precursorIsotopes.max() + 1);
 
         //estimate approx distribution from peptide weight
-        fragmentDist = isotopeDB->estimateForFragmentFromPeptideWeight(precursorAvgWeight, fragmentAvgWeight, precursorIsotopes);
+        fragmentDist = isotopeDB->estimateForFragmentFromPeptideWeight(precursorAvgWeight, fragmentAvgWeight,
+                                                                       precursorIsotopes.cachedSet());
         //re-normalize distribution
         fragmentDist.renormalize();
 
@@ -345,12 +370,14 @@ namespace SpectrumUtilities {
     }
 
     static void approxFragmentSplineFromWeightAndSIsotopeDist(std::vector<std::pair<double, double> > &approxDist,
-                                                        const std::set<OpenMS::UInt> &precursorIsotopes,
+                                                        const IsolationMask &precursorIsotopes,
                                                         const Ion &fragmentIon,
                                                         const OpenMS::AASequence &precursorSequence,
                                                         const OpenMS::Int &precursorCharge,
                                                         const OpenMS::IsotopeSplineDB* isotopeDB)
     {
+        TRACE_SCOPE("approxFragmentSplineFromWeightAndSIsotopeDist");
+
         //clear vector for distribution
         approxDist.clear();
 
@@ -365,12 +392,12 @@ namespace SpectrumUtilities {
         int fragmentSulfurs = fragmentIon.formula.getNumberOf(ELEMENTS->getElement("Sulfur"));
 
         //construct distribution
-        OpenMS::IsotopeDistribution fragmentDist(*std::max_element(precursorIsotopes.begin(), precursorIsotopes.end()) + 1);
+        OpenMS::IsotopeDistribution fragmentDist(precursorIsotopes.max() + 1);
 
         //estimate approx distribution from peptide weight
         fragmentDist = isotopeDB->estimateForFragmentFromPeptideWeightAndS(precursorAvgWeight, precursorSulfurs,
                                                               fragmentAvgWeight, fragmentSulfurs,
-                                                              precursorIsotopes);
+                                                              precursorIsotopes.cachedSet());
         //re-normalize distribution
         fragmentDist.renormalize();
 
@@ -394,6 +421,74 @@ namespace SpectrumUtilities {
         }
     }
 
+    /**
+     * Fragment isotopic distribution from a lookup table, renormalized. Leaves approxDist empty if the table does not
+     * cover the precursor, fragment or isolated isotopes.
+     * @param precursorSulfurs and fragmentSulfurs IsotopeLookupTable::AVERAGE for the sulfur-unaware table
+     */
+    static void approxFragmentTableIsotopeDist(std::vector<std::pair<double, double> > &approxDist,
+                                               const IsolationMask &precursorIsotopes,
+                                               const Ion &fragmentIon,
+                                               double precursorAvgWeight, int precursorSulfurs,
+                                               double fragmentAvgWeight, int fragmentSulfurs,
+                                               const IsotopeLookupTable* table)
+    {
+        //clear vector for distribution
+        approxDist.clear();
+
+        if (precursorIsotopes.empty()) return;
+
+        //estimate renormalized distribution
+        double probabilities[IsolationMask::CAPACITY];
+        if (!table->estimateFragment(precursorAvgWeight, fragmentAvgWeight, precursorIsotopes.bits(),
+                                     precursorSulfurs, fragmentSulfurs, probabilities)) {
+            return;
+        }
+
+        //ion mz
+        double ionMZ = fragmentIon.monoWeight / fragmentIon.charge;
+
+        //fill with actual mz values up to the highest isolated isotope
+        for (OpenMS::UInt i = 0; i <= precursorIsotopes.max(); ++i) {
+            double isoMZ = ionMZ + ( OpenMS::Constants::C13C12_MASSDIFF_U / fragmentIon.charge ) * i;
+            approxDist.push_back(std::make_pair(isoMZ, probabilities[i]));
+        }
+    }
+
+    static void approxFragmentTableFromWeightIsotopeDist(std::vector<std::pair<double, double> > &approxDist,
+                                                         const IsolationMask &precursorIsotopes,
+                                                         const Ion &fragmentIon,
+                                                         const OpenMS::AASequence &precursorSequence,
+                                                         const OpenMS::Int &precursorCharge,
+                                                         const IsotopeLookupTable* table)
+    {
+        approxFragmentTableIsotopeDist(approxDist, precursorIsotopes, fragmentIon,
+                                       precursorSequence.getAverageWeight(OpenMS::Residue::Full, precursorCharge),
+                                       IsotopeLookupTable::AVERAGE,
+                                       fragmentIon.formula.getAverageWeight(),
+                                       IsotopeLookupTable::AVERAGE,
+                                       table);
+    }
+
+    static void approxFragmentTableFromWeightAndSIsotopeDist(std::vector<std::pair<double, double> > &approxDist,
+                                                             const IsolationMask &precursorIsotopes,
+                                                             const Ion &fragmentIon,
+                                                             const OpenMS::AASequence &precursorSequence,
+                                                             const OpenMS::Int &precursorCharge,
+                                                             const IsotopeLookupTable* table)
+    {
+        int precursorSulfurs = precursorSequence.getFormula(OpenMS::Residue::Full,
+                                                            precursorCharge).getNumberOf(ELEMENTS->getElement("Sulfur"));
+        int fragmentSulfurs = fragmentIon.formula.getNumberOf(ELEMENTS->getElement("Sulfur"));
+
+        approxFragmentTableIsotopeDist(approxDist, precursorIsotopes, fragmentIon,
+                                       precursorSequence.getAverageWeight(OpenMS::Residue::Full, precursorCharge),
+                                       precursorSulfurs,
+                                       fragmentIon.formula.getAverageWeight(),
+                                       fragmentSulfurs,
+                                       table);
+    }
+
     /**
      * Compute the exact theoretical fragment isotopic distribution based on the precursor isotope distribution calculator.
      * @param theoDist a vector to be filled with the theoretical isotopic distribution. Composed of a vector of pairs
@@ -404,13 +499,15 @@ namespace SpectrumUtilities {
      * @param ion the Ion from which the monoisotopic peak will be based.
      */
     static void exactPrecursorIsotopeDist(std::vector<std::pair<double, double> > &theoDist,
-                                          const std::set<OpenMS::UInt> &precursorIsotopes, const Ion &ion)
+                                          const IsolationMask &precursorIsotopes, const Ion &ion)
     {
+        TRACE_SCOPE("exactPrecursorIsotopeDist");
+
         OpenMS::UInt minIsotope = 7;
 
-        OpenMS::UInt maxIsotope = *std::max_element(precursorIsotopes.begin(), precursorIsotopes.end());
+        OpenMS::UInt maxIsotope = precursorIsotopes.max();
         //construct distribution of depth at the maximum precursor isotope isolated
-        OpenMS::UInt searchDepth = 7;//std::min(minIsotope, *std::max_element(precursorIsotopes.begin(), precursorIsotopes.end()) + 1);
+        OpenMS::UInt searchDepth = 7;//std::min(minIsotope, precursorIsotopes.max() + 1);
 
         //clear vector for distribution
         theoDist.clear();
@@ -442,6 +539,73 @@ namespace SpectrumUtilities {
         normalizeDistribution(theoDist);
     }
 
+    /**
+     * Fills a theoretical distribution with the isotopes of an envelope, normalized to sum to 1. Isotope Mi is placed
+     * i isotope steps above the ion's monoisotopic mz, so the distribution and the peaks observedDistribution
+     * searches cover the envelope only.
+     * @param theoDist a vector to be filled with <mz, probability> pairs. Vector will be cleared before being filled.
+     * @param envelope the isotopes to report, e.g. from IsotopeSplineModel::estimateEnvelope
+     * @param ion the Ion from which the monoisotopic peak will be based.
+     */
+    static void envelopeIsotopeDist(std::vector<std::pair<double, double> > &theoDist,
+                                    const IsotopeEnvelope &envelope, const Ion &ion)
+    {
+        //clear vector for distribution
+        theoDist.clear();
+
+        //ion mz
+        double ionMZ = ion.monoWeight / ion.charge;
+
+        for (int i = envelope.start(); i < envelope.end(); ++i) {
+            //compute mz of isotope peak
+            double isoMZ = ionMZ + ( OpenMS::Constants::C13C12_MASSDIFF_U / ion.charge ) * i;
+            theoDist.push_back(std::make_pair(isoMZ, envelope.probability(i)));
+        }
+
+        normalizeDistribution(theoDist);
+    }
+
+    /**
+     * Compute the exact precursor isotope envelope: the isotopes with a probability of at least threshold. OpenMS
+     * still convolves the distribution up from M0, but only the envelope is matched and scored.
+     * @param theoDist a vector to be filled with the envelope as <mz, probability> pairs, see envelopeIsotopeDist.
+     * @param ion the Ion from which the monoisotopic peak will be based.
+     * @param threshold smallest probability of a reported isotope
+     */
+    static void exactPrecursorEnvelope(std::vector<std::pair<double, double> > &theoDist, const Ion &ion,
+                                       double threshold)
+    {
+        //all isotopes (a max depth of 0 keeps every one), trimmed to those above threshold
+        std::vector<std::pair<OpenMS::Size, double> > theoPeakList =
+                ion.formula.getIsotopeDistribution(0).getContainer();
+        std::vector<double> probabilities(theoPeakList.size());
+        for (int i = 0; i < theoPeakList.size(); ++i) probabilities[i] = theoPeakList[i].second;
+
+        envelopeIsotopeDist(theoDist, IsotopeEnvelope::trim(probabilities.data(), (int) probabilities.size(),
+                                                            threshold), ion);
+    }
+
+    /**
+     * Estimate the precursor isotope envelope from the spline model, evaluating only the isotopes of the envelope.
+     * @param theoDist a vector to be filled with the envelope as <mz, probability> pairs, see envelopeIsotopeDist.
+     * @param ion the Ion from which the monoisotopic peak will be based.
+     * @param threshold smallest probability of a reported isotope
+     * @param splines spline model covering the ion's average weight
+     * @return false if the model does not cover the envelope, theoDist is cleared
+     */
+    static bool splinePrecursorEnvelope(std::vector<std::pair<double, double> > &theoDist, const Ion &ion,
+                                        double threshold, const IsotopeSplineModel* splines)
+    {
+        IsotopeEnvelope envelope;
+        if (!splines->estimateEnvelope(ion.formula.getAverageWeight(), IsotopeSplineModel::AVERAGE, threshold,
+                                       envelope)) {
+            theoDist.clear();
+            return false;
+        }
+        envelopeIsotopeDist(theoDist, envelope, ion);
+        return true;
+    }
+
     /**
      * Check if a scaled isotope distribution is following a characteristic isotope distribution.
      * @param dist scaled distribution where peak intensities sum to 1
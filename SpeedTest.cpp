@@ -1,7 +1,9 @@
 #include <iostream>
-#include <chrono>
+#include <fstream>
 #include <random>
 #include <vector>
+#include <cstring>
+#include <memory>
 
 #include <OpenMS/CHEMISTRY/IsotopeDistribution.h>
 #include <OpenMS/CHEMISTRY/IsotopeSplineDB.h>
@@ -12,140 +14,361 @@
 #include <OpenMS/CHEMISTRY/EnzymaticDigestion.h>
 #include <OpenMS/MATH/STATISTICS/StatisticFunctions.h>
 
-using namespace OpenMS;
+#include "Benchmark.h"
+#include "EstimatorDispatcher.h"
+#include "IsotopeLookupTable.h"
+#include "IsotopeChebyshevModel.h"
+#include "CompressedSplineModel.h"
+#include "SplineModelRegistry.h"
+#include "SplineErrorMap.h"
 
-std::random_device rd;
-std::mt19937 gen(rd());
-std::uniform_real_distribution<> dis;
+using namespace OpenMS;
 
 static const OpenMS::IsotopeSplineDB* splineDB = OpenMS::IsotopeSplineDB::getInstance();
 
-void timePrecursorSpline(std::vector<double> &masses, UInt max_depth, bool print)
+static const double AVERAGE_RESIDUE_MASS = 111.1;
+static const std::string AMINO_ACIDS = "ACDEFGHIKLMNPQRSTVWY";
+
+// Precursor and fragment formulas of a random peptide, the input of the exact conditional estimator
+struct PeptideFragment {
+    EmpiricalFormula precursor;
+    EmpiricalFormula fragment;
+};
+
+std::vector<Benchmark::Result> results;
+bool with_counters = false;
+
+void report(const Benchmark::Result &result)
+{
+    Benchmark::writeTSV(std::cout, result, with_counters);
+    results.push_back(result);
+}
+
+void timePrecursorSpline(Benchmark &bench, const std::vector<double> &masses, UInt max_depth)
 {
     for (UInt depth = 1; depth <= max_depth; ++depth)
     {
-        auto time_start = std::chrono::high_resolution_clock::now();
-        for (int i = 0; i < masses.size()-1; ++i) {
-            IsotopeDistribution id = splineDB->estimateFromPeptideWeight(masses[i], depth);
-        }
-        auto time_end = std::chrono::high_resolution_clock::now();
-
-        std::chrono::milliseconds d = std::chrono::duration_cast<std::chrono::milliseconds>(time_end - time_start);
-
-        if (print) {
-            std::cout << "Spline" << "\t" << d.count() << "\t" << depth << "\t" << "Precursor masses" << std::endl;
-        }
+        report(bench.run("Spline", "Precursor masses", depth, masses.size(), [&](std::size_t i) {
+            return splineDB->estimateFromPeptideWeight(masses[i], depth);
+        }));
     }
 }
 
-void timePrecursorFFT(std::vector<double> &masses, UInt max_depth, bool print)
+void timePrecursorFFT(Benchmark &bench, const std::vector<double> &masses, UInt max_depth)
 {
     for (UInt depth = 1; depth <= max_depth; ++depth)
     {
-        auto time_start = std::chrono::high_resolution_clock::now();
-        for (int i = 0; i < masses.size()-1; ++i) {
+        report(bench.run("FFT", "Precursor masses", depth, masses.size(), [&](std::size_t i) {
             IsotopeDistribution id(depth);
             id.estimateFromPeptideWeight(masses[i]);
-        }
-        auto time_end = std::chrono::high_resolution_clock::now();
-
-        std::chrono::milliseconds d = std::chrono::duration_cast<std::chrono::milliseconds>(time_end - time_start);
+            return id;
+        }));
+    }
+}
 
-        if (print) {
-            std::cout << "FFT" << "\t" << d.count() << "\t" << depth << "\t" << "Precursor masses" << std::endl;
-        }
+void timePrecursorExact(Benchmark &bench, const std::vector<PeptideFragment> &peptides, UInt max_depth)
+{
+    for (UInt depth = 1; depth <= max_depth; ++depth)
+    {
+        report(bench.run("Exact", "Precursor masses", depth, peptides.size(), [&](std::size_t i) {
+            return peptides[i].precursor.getIsotopeDistribution(depth);
+        }));
     }
 }
 
-void timeFragmentFFTSingle(std::vector<double> &masses, UInt max_depth, bool print)
+// Fragment estimators are timed once with only precursor isotope i isolated and once with isotopes 0..i isolated
+void timeFragmentFFT(Benchmark &bench, const std::vector<double> &masses, UInt max_depth, bool combined)
 {
     std::set<UInt> precursor_isotopes;
-    for (UInt i = 0; i < max_depth; ++i) {
-        precursor_isotopes.clear();
-        precursor_isotopes.insert(i);
-        auto time_start = std::chrono::high_resolution_clock::now();
-        for (int i = 0; i < masses.size()-1; ++i) {
-            IsotopeDistribution id;
-            id.estimateForFragmentFromPeptideWeight(masses[i]+masses[i+1], masses[i], precursor_isotopes);
-        }
-        auto time_end = std::chrono::high_resolution_clock::now();
+    for (UInt iso = 0; iso < max_depth; ++iso)
+    {
+        if (!combined) precursor_isotopes.clear();
+        precursor_isotopes.insert(iso);
 
-        std::chrono::milliseconds d = std::chrono::duration_cast<std::chrono::milliseconds>(time_end - time_start);
+        report(bench.run("FFT", combined ? "Multiple fragment isotopes" : "Single fragment isotope", iso + 1,
+                         masses.size() - 1, [&](std::size_t i) {
+            IsotopeDistribution id;
+            id.estimateForFragmentFromPeptideWeight(masses[i] + masses[i + 1], masses[i], precursor_isotopes);
+            return id;
+        }));
+    }
+}
 
-        if (print) {
-            std::cout << "FFT" << "\t" << d.count() << "\t" << i+1 << "\t" << "Single fragment isotope" << std::endl;
-        }
+void timeFragmentSpline(Benchmark &bench, const std::vector<double> &masses, UInt max_depth, bool combined)
+{
+    std::set<UInt> precursor_isotopes;
+    for (UInt iso = 0; iso < max_depth; ++iso)
+    {
+        if (!combined) precursor_isotopes.clear();
+        precursor_isotopes.insert(iso);
+
+        report(bench.run("Spline", combined ? "Multiple fragment isotopes" : "Single fragment isotope", iso + 1,
+                         masses.size() - 1, [&](std::size_t i) {
+            return splineDB->estimateForFragmentFromPeptideWeight(masses[i] + masses[i + 1], masses[i],
+                                                                  precursor_isotopes);
+        }));
     }
 }
 
-void timeFragmentFFTCombined(std::vector<double> &masses, UInt max_depth, bool print)
+void timeFragmentExact(Benchmark &bench, const std::vector<PeptideFragment> &peptides, UInt max_depth, bool combined)
 {
     std::set<UInt> precursor_isotopes;
-    for (UInt i = 0; i < max_depth; ++i)
+    for (UInt iso = 0; iso < max_depth; ++iso)
     {
-        precursor_isotopes.insert(i);
-        auto time_start = std::chrono::high_resolution_clock::now();
-        for (int i = 0; i < masses.size()-1; ++i) {
-            IsotopeDistribution id;
-            id.estimateForFragmentFromPeptideWeight(masses[i]+masses[i+1], masses[i], precursor_isotopes);
-        }
-        auto time_end = std::chrono::high_resolution_clock::now();
+        if (!combined) precursor_isotopes.clear();
+        precursor_isotopes.insert(iso);
 
-        std::chrono::milliseconds d = std::chrono::duration_cast<std::chrono::milliseconds>(time_end - time_start);
+        report(bench.run("Exact", combined ? "Multiple fragment isotopes" : "Single fragment isotope", iso + 1,
+                         peptides.size(), [&](std::size_t i) {
+            return peptides[i].fragment.getConditionalFragmentIsotopeDist(peptides[i].precursor, precursor_isotopes);
+        }));
+    }
+}
 
-        if (print) {
-            std::cout << "FFT" << "\t" << d.count() << "\t" << i+1 << "\t" << "Multiple fragment isotopes" << std::endl;
-        }
+void timePrecursorTable(Benchmark &bench, const IsotopeLookupTable &table, const std::vector<double> &masses,
+                        UInt max_depth)
+{
+    std::vector<double> probabilities(table.maxIsotope() + 1);
+    for (UInt depth = 1; depth <= max_depth && (int) depth <= table.maxIsotope() + 1; ++depth)
+    {
+        report(bench.run("Table", "Precursor masses", depth, masses.size(), [&](std::size_t i) {
+            table.estimate(masses[i], depth - 1, IsotopeLookupTable::AVERAGE, probabilities.data());
+            return probabilities[0];
+        }));
     }
 }
 
-void timeFragmentSplineSingle(std::vector<double> &masses, UInt max_depth, bool print) {
-    std::set<UInt> precursor_isotopes;
-    for (UInt i = 0; i < max_depth; ++i) {
-        precursor_isotopes.clear();
-        precursor_isotopes.insert(i);
-        auto time_start = std::chrono::high_resolution_clock::now();
-        for (int i = 0; i < masses.size()-1; ++i) {
-            IsotopeDistribution id = splineDB->estimateForFragmentFromPeptideWeight(masses[i]+masses[i+1], masses[i], precursor_isotopes);
-        }
-        auto time_end = std::chrono::high_resolution_clock::now();
+void timeFragmentTable(Benchmark &bench, const IsotopeLookupTable &table, const std::vector<double> &masses,
+                       UInt max_depth, bool combined)
+{
+    std::uint64_t precursor_isotopes = 0;
+    double probabilities[64];
+    for (UInt iso = 0; iso < max_depth && iso < 64; ++iso)
+    {
+        if (!combined) precursor_isotopes = 0;
+        precursor_isotopes |= std::uint64_t(1) << iso;
+
+        report(bench.run("Table", combined ? "Multiple fragment isotopes" : "Single fragment isotope", iso + 1,
+                         masses.size() - 1, [&](std::size_t i) {
+            table.estimateFragment(masses[i] + masses[i + 1], masses[i], precursor_isotopes,
+                                   IsotopeLookupTable::AVERAGE, IsotopeLookupTable::AVERAGE, probabilities);
+            return probabilities[0];
+        }));
+    }
+}
 
-        std::chrono::milliseconds d = std::chrono::duration_cast<std::chrono::milliseconds>(time_end - time_start);
+void timePrecursorChebyshev(Benchmark &bench, const IsotopeChebyshevModel &chebyshev, const std::vector<double> &masses)
+{
+    double probabilities[32];
+    for (int depth = 1; depth <= chebyshev.maxIsotope() + 1; ++depth)
+    {
+        report(bench.run("Chebyshev", "Precursor masses", depth, masses.size(), [&](std::size_t i) {
+            chebyshev.estimate(masses[i], depth - 1, IsotopeChebyshevModel::AVERAGE, probabilities);
+            return probabilities[0];
+        }));
+    }
+}
 
-        if (print) {
-            std::cout << "Spline" << "\t" << d.count() << "\t" << i+1 << "\t" << "Single fragment isotope" << std::endl;
-        }
+void timeFragmentChebyshev(Benchmark &bench, const IsotopeChebyshevModel &chebyshev, const std::vector<double> &masses,
+                           bool combined)
+{
+    std::uint64_t precursor_isotopes = 0;
+    double probabilities[32];
+    for (int iso = 0; iso <= chebyshev.maxIsotope(); ++iso)
+    {
+        if (!combined) precursor_isotopes = 0;
+        precursor_isotopes |= std::uint64_t(1) << iso;
+
+        report(bench.run("Chebyshev", combined ? "Multiple fragment isotopes" : "Single fragment isotope", iso + 1,
+                         masses.size() - 1, [&](std::size_t i) {
+            chebyshev.estimateFragment(masses[i] + masses[i + 1], masses[i], precursor_isotopes,
+                                       IsotopeChebyshevModel::AVERAGE, IsotopeChebyshevModel::AVERAGE, probabilities);
+            return probabilities[0];
+        }));
     }
 }
 
-void timeFragmentSplineCombined(std::vector<double> &masses, UInt max_depth, bool print)
+void timePrecursorCompressed(Benchmark &bench, const CompressedSplineModel &compressed,
+                             const std::vector<double> &masses, UInt max_depth)
 {
-    std::set<UInt> precursor_isotopes;
-    for (UInt i = 0; i < max_depth; ++i)
+    double probabilities[1024];
+    for (UInt depth = 1; depth <= max_depth && (int) depth <= compressed.maxIsotope() + 1; ++depth)
     {
-        precursor_isotopes.insert(i);
-        auto time_start = std::chrono::high_resolution_clock::now();
-        for (int i = 0; i < masses.size()-1; ++i) {
-            IsotopeDistribution id = splineDB->estimateForFragmentFromPeptideWeight(masses[i]+masses[i+1], masses[i], precursor_isotopes);
-        }
-        auto time_end = std::chrono::high_resolution_clock::now();
+        report(bench.run("Compressed", "Precursor masses", depth, masses.size(), [&](std::size_t i) {
+            compressed.estimate(masses[i], depth - 1, CompressedSplineModel::AVERAGE, probabilities);
+            return probabilities[0];
+        }));
+    }
+}
 
-        std::chrono::milliseconds d = std::chrono::duration_cast<std::chrono::milliseconds>(time_end - time_start);
+void timeFragmentCompressed(Benchmark &bench, const CompressedSplineModel &compressed,
+                            const std::vector<double> &masses, UInt max_depth, bool combined)
+{
+    std::uint64_t precursor_isotopes = 0;
+    double probabilities[64];
+    for (UInt iso = 0; iso < max_depth && iso < 64 && (int) iso <= compressed.maxIsotope(); ++iso)
+    {
+        if (!combined) precursor_isotopes = 0;
+        precursor_isotopes |= std::uint64_t(1) << iso;
+
+        report(bench.run("Compressed", combined ? "Multiple fragment isotopes" : "Single fragment isotope", iso + 1,
+                         masses.size() - 1, [&](std::size_t i) {
+            compressed.estimateFragment(masses[i] + masses[i + 1], masses[i], precursor_isotopes,
+                                        CompressedSplineModel::AVERAGE, CompressedSplineModel::AVERAGE, probabilities);
+            return probabilities[0];
+        }));
+    }
+}
 
-        if (print) {
-            std::cout << "Spline" << "\t" << d.count() << "\t" << i+1 << "\t" << "Multiple fragment isotopes" << std::endl;
-        }
+// Each query goes to the smallest registered model that covers it, the rows time the routing with the estimate
+void timePrecursorRouted(Benchmark &bench, const SplineModelRegistry &registry, const std::vector<double> &masses,
+                         UInt max_depth)
+{
+    double probabilities[1024];
+    for (UInt depth = 1; depth <= max_depth && depth <= 1024; ++depth)
+    {
+        report(bench.run("Routed", "Precursor masses", depth, masses.size(), [&](std::size_t i) {
+            registry.estimate(masses[i], depth - 1, SplineModelRegistry::AVERAGE, probabilities);
+            return probabilities[0];
+        }));
     }
+}
 
+void timeFragmentRouted(Benchmark &bench, const SplineModelRegistry &registry, const std::vector<double> &masses,
+                        UInt max_depth, bool combined)
+{
+    std::uint64_t precursor_isotopes = 0;
+    double probabilities[64];
+    for (UInt iso = 0; iso < max_depth && iso < 64; ++iso)
+    {
+        if (!combined) precursor_isotopes = 0;
+        precursor_isotopes |= std::uint64_t(1) << iso;
+
+        report(bench.run("Routed", combined ? "Multiple fragment isotopes" : "Single fragment isotope", iso + 1,
+                         masses.size() - 1, [&](std::size_t i) {
+            registry.estimateFragment(masses[i] + masses[i + 1], masses[i], precursor_isotopes,
+                                      SplineModelRegistry::AVERAGE, SplineModelRegistry::AVERAGE, probabilities);
+            return probabilities[0];
+        }));
+    }
+}
 
+// Dispatched queries take the spline, averagine or exact path, the row times the mix the dispatcher chose
+void timeFragmentDispatch(Benchmark &bench, const EstimatorDispatcher &dispatcher,
+                          const std::vector<PeptideFragment> &peptides, UInt max_depth, bool combined)
+{
+    IsolationMask precursor_isotopes;
+    std::vector<double> probabilities;
+    for (UInt iso = 0; iso < max_depth; ++iso)
+    {
+        if (!combined) precursor_isotopes = IsolationMask();
+        precursor_isotopes.insert(iso);
+
+        report(bench.run("Dispatch", combined ? "Multiple fragment isotopes" : "Single fragment isotope", iso + 1,
+                         peptides.size(), [&](std::size_t i) {
+            dispatcher.estimate(peptides[i].precursor, peptides[i].fragment, precursor_isotopes, probabilities);
+            return probabilities[0];
+        }));
+    }
 }
 
-void usage()
+std::vector<Benchmark::ScalingResult> scaling;
+
+// Scales one estimator over threads that all read inputs[0], then over threads that each read their own inputs[t]
+template<typename Input, typename F>
+void scaleEstimator(Benchmark &bench, const std::string &method, const std::string &comparison, int max_threads,
+                    const std::vector<std::vector<Input> > &inputs, std::size_t num_inputs, F estimate)
 {
+    std::vector<Benchmark::ScalingResult> shared = bench.runScaling(method, comparison, "shared", max_threads,
+                                                                    num_inputs, [&](int t, std::size_t i) {
+        return estimate(inputs[0], i);
+    });
+    std::vector<Benchmark::ScalingResult> disjoint = bench.runScaling(method, comparison, "disjoint", max_threads,
+                                                                      num_inputs, [&](int t, std::size_t i) {
+        return estimate(inputs[t], i);
+    });
+
+    for (const Benchmark::ScalingResult &r : shared) Benchmark::writeScalingTSV(std::cout, r);
+    for (const Benchmark::ScalingResult &r : disjoint) Benchmark::writeScalingTSV(std::cout, r);
+    scaling.insert(scaling.end(), shared.begin(), shared.end());
+    scaling.insert(scaling.end(), disjoint.begin(), disjoint.end());
+}
+
+// All estimators at max_depth, fragments with precursor isotopes 0..max_depth-1 isolated
+void scaleEstimators(Benchmark &bench, const std::vector<std::vector<double> > &masses,
+                     const std::vector<std::vector<PeptideFragment> > &peptides, UInt max_depth, int max_threads)
+{
+    std::set<UInt> precursor_isotopes;
+    for (UInt iso = 0; iso < max_depth; ++iso) precursor_isotopes.insert(iso);
+
+    std::size_t num_masses = masses[0].size() - 1;
+    std::size_t num_peptides = peptides[0].size();
+
+    scaleEstimator(bench, "FFT", "Multiple fragment isotopes", max_threads, masses, num_masses,
+                   [&](const std::vector<double> &m, std::size_t i) {
+        IsotopeDistribution id;
+        id.estimateForFragmentFromPeptideWeight(m[i] + m[i + 1], m[i], precursor_isotopes);
+        return id;
+    });
+    scaleEstimator(bench, "Spline", "Multiple fragment isotopes", max_threads, masses, num_masses,
+                   [&](const std::vector<double> &m, std::size_t i) {
+        return splineDB->estimateForFragmentFromPeptideWeight(m[i] + m[i + 1], m[i], precursor_isotopes);
+    });
+    scaleEstimator(bench, "Exact", "Multiple fragment isotopes", max_threads, peptides, num_peptides,
+                   [&](const std::vector<PeptideFragment> &p, std::size_t i) {
+        return p[i].fragment.getConditionalFragmentIsotopeDist(p[i].precursor, precursor_isotopes);
+    });
+
+    scaleEstimator(bench, "FFT", "Precursor masses", max_threads, masses, num_masses,
+                   [&](const std::vector<double> &m, std::size_t i) {
+        IsotopeDistribution id(max_depth);
+        id.estimateFromPeptideWeight(m[i]);
+        return id;
+    });
+    scaleEstimator(bench, "Spline", "Precursor masses", max_threads, masses, num_masses,
+                   [&](const std::vector<double> &m, std::size_t i) {
+        return splineDB->estimateFromPeptideWeight(m[i], max_depth);
+    });
+    scaleEstimator(bench, "Exact", "Precursor masses", max_threads, peptides, num_peptides,
+                   [&](const std::vector<PeptideFragment> &p, std::size_t i) {
+        return p[i].precursor.getIsotopeDistribution(max_depth);
+    });
+}
 
+void usage()
+{
+    std::cout << "usage: SpeedTest min_mass max_mass max_depth num_tests [--trials n] [--warmup n] [--seed n] "
+              << "[--exact n] [--json path] [--counters] [--threads n] [--spline-model path] [--error-map path] [--tolerance x] [--table-step Da] "
+              << "[--chebyshev-error x] [--chebyshev-degree n] [--compressed-model path] "
+              << "[--routed-model path]... [--shared-grid]" << std::endl;
+    std::cout << "\ttrials: timed passes over the inputs (default 5)" << std::endl;
+    std::cout << "\twarmup: untimed passes before the trials (default 1)" << std::endl;
+    std::cout << "\tseed: random seed for masses and peptides (default 42)" << std::endl;
+    std::cout << "\texact: number of random peptides for the exact estimators (default min(num_tests, 10000))" << std::endl;
+    std::cout << "\tjson: also write all results as JSON to path" << std::endl;
+    std::cout << "\tcounters: count cycles, instructions, cache and branch misses per call (Linux only)" << std::endl;
+    std::cout << "\tthreads: instead of timing each depth, run every estimator at max_depth on 1..n threads, over the "
+              << "same and over separate inputs per thread" << std::endl;
+    std::cout << "\tspline-model: also time the estimator dispatcher with the spline model file at path "
+              << "(misc/IsotopeSplines_*.xml) on the exact estimator's peptides" << std::endl;
+    std::cout << "\ttable-step: with spline-model, also time lookup tables sampled from it at this mass step "
+              << "(default 0.5)" << std::endl;
+    std::cout << "\tchebyshev-error: with spline-model, also time its isotopes 0 to 4 recompiled into Chebyshev "
+              << "polynomials over min_mass to max_mass within this error (default 1e-6)" << std::endl;
+    std::cout << "\tchebyshev-degree: degree of the Chebyshev polynomials (default 3)" << std::endl;
+    std::cout << "\tcompressed-model: also time the CompressSplineModel output at path" << std::endl;
+    std::cout << "\trouted-model: spline model file to route queries to, repeat to time a registry of several models "
+              << "that answers each query from the smallest model covering it" << std::endl;
+    std::cout << "\tshared-grid: load the spline and routed models with all isotopes on one knot grid, which is "
+              << "faster for deep queries and takes about 10 times the memory" << std::endl;
+    std::cout << "\terror-map: let the dispatcher fall back to the exact estimator where this BuildSplineErrorMap "
+              << "output expects the approximations to be off by more than the tolerance" << std::endl;
+    std::cout << "\ttolerance: largest accepted isotope probability error of a dispatched query (default 0.01)" << std::endl;
 }
 
-std::vector<double> getRandomMasses(int num_tests) {
+std::vector<double> getRandomMasses(std::mt19937 &gen, double min_mass, double max_mass, int num_tests)
+{
+    std::uniform_real_distribution<> dis(min_mass, max_mass);
     std::vector<double> masses;
     for (int i = 0; i < num_tests; ++i) {
         masses.push_back(dis(gen));
@@ -153,41 +376,252 @@ std::vector<double> getRandomMasses(int num_tests) {
     return masses;
 }
 
+// Random peptides in the mass range, each with a random b-ion fragment
+std::vector<PeptideFragment> getRandomPeptides(std::mt19937 &gen, double min_mass, double max_mass, int num_tests)
+{
+    std::uniform_real_distribution<> mass_dis(min_mass, max_mass);
+    std::uniform_int_distribution<> aa_dis(0, AMINO_ACIDS.size() - 1);
+
+    std::vector<PeptideFragment> peptides;
+    for (int i = 0; i < num_tests; ++i) {
+        Size length = std::max<Size>(2, Size(mass_dis(gen) / AVERAGE_RESIDUE_MASS));
+        std::string sequence;
+        for (Size j = 0; j < length; ++j) {
+            sequence += AMINO_ACIDS[aa_dis(gen)];
+        }
+        AASequence peptide = AASequence::fromString(sequence);
+
+        std::uniform_int_distribution<Size> cut_dis(1, length - 1);
+        PeptideFragment pf;
+        pf.precursor = peptide.getFormula();
+        pf.fragment = peptide.getPrefix(cut_dis(gen)).getFormula(Residue::BIon);
+        peptides.push_back(pf);
+    }
+    return peptides;
+}
+
 int main(int argc, const char ** argv) {
 
-    float min_mass = atof(argv[1]);
-    float max_mass = atof(argv[2]);
+    if (argc < 5) {
+        usage();
+        return 0;
+    }
+
+    double min_mass = atof(argv[1]);
+    double max_mass = atof(argv[2]);
     UInt max_depth = atoi(argv[3]);
     int num_tests =  atoi(argv[4]);
 
-    dis = std::uniform_real_distribution<>(min_mass, max_mass);
+    int trials = 5;
+    int warmup = 1;
+    unsigned seed = 42;
+    int num_exact = std::min(num_tests, 10000);
+    std::string json_path;
+    int max_threads = 0;
+    std::string spline_path;
+    std::string error_map_path;
+    double tolerance = 0.01;
+    double table_step = 0.5;
+    double chebyshev_error = 1e-6;
+    int chebyshev_degree = 3;
+    std::string compressed_path;
+    std::vector<std::string> routed_paths;
+    IsotopeSplineModel::Layout layout = IsotopeSplineModel::SEPARATE;
+
+    for (int i = 5; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--counters") == 0) {
+            with_counters = true;
+            continue;
+        }
+        if (std::strcmp(argv[i], "--shared-grid") == 0) {
+            layout = IsotopeSplineModel::SHARED;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--trials") == 0) trials = atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--warmup") == 0) warmup = atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[++i], NULL, 10);
+        else if (std::strcmp(argv[i], "--exact") == 0) num_exact = atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--json") == 0) json_path = argv[++i];
+        else if (std::strcmp(argv[i], "--threads") == 0) max_threads = atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--spline-model") == 0) spline_path = argv[++i];
+        else if (std::strcmp(argv[i], "--error-map") == 0) error_map_path = argv[++i];
+        else if (std::strcmp(argv[i], "--tolerance") == 0) tolerance = atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--table-step") == 0) table_step = atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--chebyshev-error") == 0) chebyshev_error = atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--chebyshev-degree") == 0) chebyshev_degree = atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--compressed-model") == 0) compressed_path = argv[++i];
+        else if (std::strcmp(argv[i], "--routed-model") == 0) routed_paths.push_back(argv[++i]);
+        else {
+            usage();
+            return 0;
+        }
+    }
+
+    if (num_tests < 2 || num_exact < 1 || trials < 1 || warmup < 0 || max_threads < 0) {
+        usage();
+        return 0;
+    }
+
+    // inputs are fixed by the seed so runs of different builds time the same work
+    std::mt19937 gen(seed);
+    std::vector<double> masses = getRandomMasses(gen, min_mass, max_mass, num_tests);
+    std::vector<PeptideFragment> peptides = getRandomPeptides(gen, min_mass, max_mass, num_exact);
+
+    std::unique_ptr<IsotopeSplineModel> spline_model;
+    std::unique_ptr<SplineErrorMap> error_map;
+    std::unique_ptr<IsotopeLookupTable> table;
+    std::unique_ptr<IsotopeChebyshevModel> chebyshev;
+    std::unique_ptr<CompressedSplineModel> compressed;
+    if (!spline_path.empty()) {
+        try {
+            spline_model.reset(new IsotopeSplineModel(spline_path, layout));
+            if (!error_map_path.empty()) error_map.reset(new SplineErrorMap(error_map_path));
+            table.reset(new IsotopeLookupTable(*spline_model, table_step, max_depth - 1));
+            // the fast path is for the common depths 1 to 5
+            chebyshev.reset(new IsotopeChebyshevModel(*spline_model, std::min<int>(max_depth, 5) - 1, min_mass,
+                                                      max_mass, chebyshev_error, chebyshev_degree));
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (!compressed_path.empty()) {
+        try {
+            compressed.reset(new CompressedSplineModel(compressed_path));
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    SplineModelRegistry registry;
+    try {
+        for (const std::string &path : routed_paths) registry.add(path, layout);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    Benchmark bench(warmup, trials);
 
-    // Print header
-    std::cout << "method\t" << "time\t" << "isotope\t" << "comparison" << std::endl;
+    PerfCounters counters;
+    if (with_counters) {
+        if (counters.available()) {
+            bench.setCounters(&counters);
+        } else {
+            std::cerr << "Hardware counters are not available, check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+        }
+    }
 
-    std::vector<double> masses = getRandomMasses(num_tests);
-    // Time fragment FFT Single
-    timeFragmentFFTCombined(masses, max_depth, false);
-    timeFragmentFFTCombined(masses, max_depth, true);
-    // Time fragment spline Combined
-    timeFragmentSplineCombined(masses, max_depth, false);
-    timeFragmentSplineCombined(masses, max_depth, true);
+    if (max_threads > 0) {
+        // thread t > 0 gets its own inputs, drawn from the next seeds
+        std::vector<std::vector<double> > thread_masses(1, masses);
+        std::vector<std::vector<PeptideFragment> > thread_peptides(1, peptides);
+        for (int t = 1; t < max_threads; ++t) {
+            std::mt19937 thread_gen(seed + t);
+            thread_masses.push_back(getRandomMasses(thread_gen, min_mass, max_mass, num_tests));
+            thread_peptides.push_back(getRandomPeptides(thread_gen, min_mass, max_mass, num_exact));
+        }
 
+        Benchmark::writeScalingTSVHeader(std::cout);
+        scaleEstimators(bench, thread_masses, thread_peptides, max_depth, max_threads);
+    } else {
+        // Print header
+        Benchmark::writeTSVHeader(std::cout, with_counters);
 
-    // Time fragment FFT Combined
-    timeFragmentFFTSingle(masses, max_depth, false);
-    timeFragmentFFTSingle(masses, max_depth, true);
-    // Time fragment spline Single
-    timeFragmentSplineSingle(masses, max_depth, false);
-    timeFragmentSplineSingle(masses, max_depth, true);
+        timeFragmentFFT(bench, masses, max_depth, true);
+        timeFragmentSpline(bench, masses, max_depth, true);
+        timeFragmentExact(bench, peptides, max_depth, true);
 
+        timeFragmentFFT(bench, masses, max_depth, false);
+        timeFragmentSpline(bench, masses, max_depth, false);
+        timeFragmentExact(bench, peptides, max_depth, false);
 
-    // Time precursor FFT
-    timePrecursorFFT(masses, max_depth, false);
-    timePrecursorFFT(masses, max_depth, true);
-    // Time precursor spline
-    timePrecursorSpline(masses, max_depth, false);
-    timePrecursorSpline(masses, max_depth, true);
+        if (table) {
+            timeFragmentTable(bench, *table, masses, max_depth, true);
+            timeFragmentTable(bench, *table, masses, max_depth, false);
+            timePrecursorTable(bench, *table, masses, max_depth);
+        }
+
+        if (chebyshev) {
+            std::cerr << "Chebyshev model: " << chebyshev->numSegments(IsotopeChebyshevModel::AVERAGE)
+                      << " segments, largest error " << chebyshev->measuredError() << std::endl;
+            timeFragmentChebyshev(bench, *chebyshev, masses, true);
+            timeFragmentChebyshev(bench, *chebyshev, masses, false);
+            timePrecursorChebyshev(bench, *chebyshev, masses);
+        }
+
+        if (compressed) {
+            timeFragmentCompressed(bench, *compressed, masses, max_depth, true);
+            timeFragmentCompressed(bench, *compressed, masses, max_depth, false);
+            timePrecursorCompressed(bench, *compressed, masses, max_depth);
+        }
+
+        if (registry.size() > 0) {
+            timeFragmentRouted(bench, registry, masses, max_depth, true);
+            timeFragmentRouted(bench, registry, masses, max_depth, false);
+            timePrecursorRouted(bench, registry, masses, max_depth);
+
+            std::cerr << "Routed queries:";
+            for (std::size_t i = 0; i < registry.size(); ++i) {
+                std::cerr << " " << registry.path(i) << "=" << registry.hits(i);
+            }
+            std::cerr << " none=" << registry.misses() << std::endl;
+        }
+
+        if (spline_model) {
+            EstimatorDispatcher dispatcher(*spline_model, tolerance, error_map && error_map->sulfurSpecific());
+            dispatcher.setErrorBounds(error_map.get());
+            timeFragmentDispatch(bench, dispatcher, peptides, max_depth, true);
+            timeFragmentDispatch(bench, dispatcher, peptides, max_depth, false);
+
+            std::cerr << "Dispatched queries:";
+            for (int path = 0; path < EstimatorDispatcher::NUM_PATHS; ++path) {
+                EstimatorDispatcher::Path p = (EstimatorDispatcher::Path) path;
+                std::cerr << " " << EstimatorDispatcher::pathName(p) << "=" << dispatcher.count(p);
+            }
+            std::cerr << std::endl;
+        }
+
+        timePrecursorFFT(bench, masses, max_depth);
+        timePrecursorSpline(bench, masses, max_depth);
+        timePrecursorExact(bench, peptides, max_depth);
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream json(json_path);
+        if (!json) {
+            std::cerr << "Unable to open JSON output file: " << json_path << std::endl;
+            return 1;
+        }
+
+        std::vector<std::pair<std::string, std::string> > parameters;
+        parameters.push_back(std::make_pair("min_mass", std::string(argv[1])));
+        parameters.push_back(std::make_pair("max_mass", std::string(argv[2])));
+        parameters.push_back(std::make_pair("max_depth", std::to_string(max_depth)));
+        parameters.push_back(std::make_pair("num_tests", std::to_string(num_tests)));
+        parameters.push_back(std::make_pair("num_exact", std::to_string(num_exact)));
+        parameters.push_back(std::make_pair("seed", std::to_string(seed)));
+        parameters.push_back(std::make_pair("counters", counters.available() && with_counters ? "on" : "off"));
+        parameters.push_back(std::make_pair("threads", std::to_string(max_threads)));
+        parameters.push_back(std::make_pair("spline_model", spline_path));
+        parameters.push_back(std::make_pair("error_map", error_map_path));
+        parameters.push_back(std::make_pair("table_step", std::to_string(table_step)));
+        parameters.push_back(std::make_pair("tolerance", std::to_string(tolerance)));
+        parameters.push_back(std::make_pair("chebyshev_error", std::to_string(chebyshev_error)));
+        parameters.push_back(std::make_pair("chebyshev_degree", std::to_string(chebyshev_degree)));
+        parameters.push_back(std::make_pair("compressed_model", compressed_path));
+        std::string routed_models;
+        for (const std::string &path : routed_paths) routed_models += (routed_models.empty() ? "" : ",") + path;
+        parameters.push_back(std::make_pair("routed_models", routed_models));
+        parameters.push_back(std::make_pair("layout", layout == IsotopeSplineModel::SHARED ? "shared" : "separate"));
+        bench.writeJSON(json, parameters, results, scaling);
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,170 @@
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "SplineErrorMap.h"
+
+namespace {
+
+    const std::uint32_t MAGIC = 0x4D444946;     // "FIDM"
+    const std::uint32_t VERSION = 1;
+
+    // x86 and ARM hosts are little-endian, so values are copied as they are laid out in memory
+    template<typename T>
+    void put(std::ostream &out, T value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    T get(std::istream &in)
+    {
+        T value;
+        if (!in.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+            throw std::runtime_error("Invalid spline error map: truncated file");
+        }
+        return value;
+    }
+}
+
+SplineErrorMap::SplineErrorMap(double massStep, double maxMass, int maxIsotope, int maxSulfur, bool sulfurSpecific)
+        : massStep_(massStep), numBins_((std::uint32_t) std::ceil(maxMass / massStep)), maxIsotope_(maxIsotope),
+          maxSulfur_(sulfurSpecific ? maxSulfur : 0), sulfurSpecific_(sulfurSpecific)
+{
+    if (!(massStep > 0) || !(maxMass > 0) || maxIsotope < 0 || maxIsotope > 31 || maxSulfur_ < 0) {
+        throw std::invalid_argument("Invalid spline error map dimensions");
+    }
+    initialize();
+}
+
+SplineErrorMap::SplineErrorMap(const std::string &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) throw std::runtime_error("Could not open spline error map " + path);
+
+    if (get<std::uint32_t>(in) != MAGIC) throw std::runtime_error(path + " is not a spline error map");
+    if (get<std::uint32_t>(in) != VERSION) throw std::runtime_error("Unsupported spline error map version in " + path);
+    massStep_ = get<double>(in);
+    numBins_ = get<std::uint32_t>(in);
+    maxIsotope_ = get<std::int32_t>(in);
+    maxSulfur_ = get<std::int32_t>(in);
+    sulfurSpecific_ = get<std::uint32_t>(in) != 0;
+    if (!(massStep_ > 0) || numBins_ == 0 || numBins_ > 1000000 || maxIsotope_ < 0 || maxIsotope_ > 31
+        || maxSulfur_ < 0 || maxSulfur_ > 1000) {
+        throw std::runtime_error("Invalid spline error map dimensions in " + path);
+    }
+
+    // the errors must fill the rest of the file exactly, checked before a corrupt header can size a huge map
+    const std::uint64_t numWindows = std::uint64_t(maxIsotope_ + 1) * (maxIsotope_ + 2) / 2;
+    const std::uint64_t numCells = std::uint64_t(numBins_) * (numBins_ + 1) / 2;
+    const std::uint64_t expectedBytes = std::uint64_t(maxSulfur_ + 1) * numWindows * numCells * NUM_METHODS
+                                        * sizeof(float);
+    const std::streamoff dataStart = in.tellg();
+    in.seekg(0, std::ios::end);
+    const std::streamoff dataBytes = in.tellg() - dataStart;
+    in.seekg(dataStart);
+    if (dataBytes < 0 || (std::uint64_t) dataBytes != expectedBytes) {
+        throw std::runtime_error("Invalid spline error map: " + path + " does not match its dimensions");
+    }
+
+    initialize();
+    if (!in.read(reinterpret_cast<char *>(errors_.data()), errors_.size() * sizeof(float))) {
+        throw std::runtime_error("Invalid spline error map: truncated file");
+    }
+}
+
+void SplineErrorMap::initialize()
+{
+    windows_.assign((maxIsotope_ + 1) * (maxIsotope_ + 1), -1);
+    numWindows_ = 0;
+    for (int start = 0; start <= maxIsotope_; ++start) {
+        for (int end = start; end <= maxIsotope_; ++end) {
+            windows_[start * (maxIsotope_ + 1) + end] = (int) numWindows_++;
+        }
+    }
+    numCells_ = (std::size_t) numBins_ * (numBins_ + 1) / 2;
+    errors_.assign((maxSulfur_ + 1) * numWindows_ * numCells_ * NUM_METHODS,
+                   std::numeric_limits<float>::quiet_NaN());
+}
+
+void SplineErrorMap::save(const std::string &path) const
+{
+    std::ofstream out(path.c_str(), std::ios::binary);
+    if (!out) throw std::runtime_error("Could not open spline error map " + path + " for writing");
+
+    put<std::uint32_t>(out, MAGIC);
+    put<std::uint32_t>(out, VERSION);
+    put<double>(out, massStep_);
+    put<std::uint32_t>(out, numBins_);
+    put<std::int32_t>(out, maxIsotope_);
+    put<std::int32_t>(out, maxSulfur_);
+    put<std::uint32_t>(out, sulfurSpecific_ ? 1 : 0);
+    out.write(reinterpret_cast<const char *>(errors_.data()), errors_.size() * sizeof(float));
+    if (!out) throw std::runtime_error("Could not write spline error map " + path);
+}
+
+long SplineErrorMap::cell(const EstimatorDispatcher::Query &query) const
+{
+    // the map only answers the kind of query it was built for
+    int sulfur = 0;
+    if (sulfurSpecific_) {
+        if (query.fragmentSulfurs < 0 || query.fragmentSulfurs > maxSulfur_) return -1;
+        sulfur = query.fragmentSulfurs;
+    } else if (query.fragmentSulfurs != IsotopeSplineModel::AVERAGE) {
+        return -1;
+    }
+
+    const IsolationMask &isotopes = query.precursorIsotopes;
+    if (!isotopes.isWindow()) return -1;
+    unsigned start = isotopes.min();
+    unsigned end = isotopes.max();
+    if (end > (unsigned) maxIsotope_) return -1;
+    int window = windows_[start * (maxIsotope_ + 1) + end];
+
+    double precursorBin = std::floor(query.precursorAverageMass / massStep_);
+    double fragmentBin = std::floor(query.fragmentAverageMass / massStep_);
+    if (!(fragmentBin >= 0) || !(precursorBin < numBins_) || fragmentBin > precursorBin) return -1;
+    std::size_t p = (std::size_t) precursorBin;
+    std::size_t massCell = p * (p + 1) / 2 + (std::size_t) fragmentBin;
+
+    return (long) ((((std::size_t) sulfur * numWindows_ + window) * numCells_ + massCell) * NUM_METHODS);
+}
+
+void SplineErrorMap::record(const EstimatorDispatcher::Query &query, Method method, double error)
+{
+    long offset = cell(query);
+    if (offset < 0) return;
+
+    float &value = errors_[offset + method];
+    if (std::isnan(value) || error > value) value = (float) error;
+}
+
+void SplineErrorMap::merge(const SplineErrorMap &other)
+{
+    if (other.errors_.size() != errors_.size() || other.massStep_ != massStep_
+        || other.sulfurSpecific_ != sulfurSpecific_) {
+        throw std::invalid_argument("Spline error maps of different shapes cannot be merged");
+    }
+    for (std::size_t i = 0; i < errors_.size(); ++i) {
+        if (std::isnan(errors_[i]) || other.errors_[i] > errors_[i]) errors_[i] = other.errors_[i];
+    }
+}
+
+double SplineErrorMap::error(const EstimatorDispatcher::Query &query, Method method) const
+{
+    long offset = cell(query);
+    if (offset < 0) return std::numeric_limits<double>::infinity();
+
+    float value = errors_[offset + method];
+    return std::isnan(value) ? std::numeric_limits<double>::infinity() : value;
+}
+
+std::size_t SplineErrorMap::observedCells() const
+{
+    std::size_t observed = 0;
+    for (std::size_t i = 0; i < errors_.size(); i += NUM_METHODS) {
+        if (!std::isnan(errors_[i])) ++observed;
+    }
+    return observed;
+}
@@ -0,0 +1,88 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_SPLINEERRORMAP_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_SPLINEERRORMAP_H
+
+#include <string>
+#include <vector>
+
+#include "EstimatorDispatcher.h"
+
+/**
+ * Worst-case error of the spline and averagine fragment estimators, precomputed by BuildSplineErrorMap on a grid of
+ * precursor mass x fragment mass bins, per fragment sulfur count and isolation window. The error is the largest
+ * absolute difference of any isotope probability to the exact conditional distribution, as used by
+ * EstimatorDispatcher.
+ *
+ * Isolation windows are the contiguous precursor isotope ranges Mstart..Mend up to maxIsotope. Lookups are O(1).
+ * A query outside the grid, with non-contiguous isolated isotopes, or in a cell no training fragment fell into gets
+ * an infinite error, so a dispatcher computes it exactly.
+ *
+ * A map is built for either the average or the sulfur-specific estimators and only answers queries of that kind.
+ */
+class SplineErrorMap : public EstimatorDispatcher::ErrorBounds {
+
+public:
+
+    enum Method {
+        SPLINE,
+        AVERAGINE,
+        NUM_METHODS
+    };
+
+    /**
+     * An empty map, every cell unobserved.
+     * @param maxSulfur highest fragment sulfur count of the sulfur-specific map, ignored otherwise
+     */
+    SplineErrorMap(double massStep, double maxMass, int maxIsotope, int maxSulfur, bool sulfurSpecific);
+
+    /**
+     * @throws std::runtime_error if path cannot be read or is not an error map file
+     */
+    explicit SplineErrorMap(const std::string &path);
+
+    /**
+     * @throws std::runtime_error if path cannot be written
+     */
+    void save(const std::string &path) const;
+
+    // raises the error of the query's cell to error, queries outside the map are ignored
+    void record(const EstimatorDispatcher::Query &query, Method method, double error);
+
+    // cell-wise maximum with a map of the same shape
+    void merge(const SplineErrorMap &other);
+
+    double error(const EstimatorDispatcher::Query &query, Method method) const;
+
+    double splineError(const EstimatorDispatcher::Query &query) const override { return error(query, SPLINE); }
+
+    double averagineError(const EstimatorDispatcher::Query &query) const override { return error(query, AVERAGINE); }
+
+    double massStep() const { return massStep_; }
+
+    int maxIsotope() const { return maxIsotope_; }
+
+    bool sulfurSpecific() const { return sulfurSpecific_; }
+
+    // number of (mass, mass, sulfur, window) cells with an observed error
+    std::size_t observedCells() const;
+
+private:
+
+    void initialize();
+
+    // offset of the query's cell in errors_, -1 if the map does not cover it
+    long cell(const EstimatorDispatcher::Query &query) const;
+
+    double massStep_;
+    std::uint32_t numBins_;
+    int maxIsotope_;
+    int maxSulfur_;
+    bool sulfurSpecific_;
+
+    std::vector<int> windows_;      // start * (maxIsotope + 1) + end to window index
+    std::size_t numWindows_;
+    std::size_t numCells_;          // lower triangle of the mass grid, fragment bin <= precursor bin
+    std::vector<float> errors_;     // [sulfur][window][mass cell][method], NaN if unobserved
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_SPLINEERRORMAP_H
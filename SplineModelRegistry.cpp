@@ -0,0 +1,146 @@
+#include <algorithm>
+
+#include "SplineModelRegistry.h"
+#include "FragmentIsotopes.h"
+#include "IsolationMask.h"
+
+namespace {
+
+    // file name without directory and extension, for the Metrics counter
+    std::string modelName(const std::string &path)
+    {
+        std::size_t begin = path.find_last_of("/\\");
+        begin = begin == std::string::npos ? 0 : begin + 1;
+        std::size_t end = path.rfind('.');
+        if (end == std::string::npos || end < begin) end = path.size();
+        return path.substr(begin, end - begin);
+    }
+
+}
+
+void SplineModelRegistry::add(const std::string &path, IsotopeSplineModel::Layout layout)
+{
+    std::unique_ptr<Entry> entry(new Entry);
+    entry->path = path;
+    entry->splines.reset(new IsotopeSplineModel(path, layout));
+    entry->bytes = entry->splines->coefficientBytes();
+    entry->counter = &Metrics::counter("spline_hits_" + modelName(path));
+
+    // after the models of the same size, so equal models keep the order they were added in
+    auto position = std::upper_bound(models_.begin(), models_.end(), entry->bytes,
+                                     [](std::size_t bytes, const std::unique_ptr<Entry> &e) {
+                                         return bytes < e->bytes;
+                                     });
+    models_.insert(position, std::move(entry));
+}
+
+int SplineModelRegistry::route(double mass, int maxIsotope, int numSulfur) const
+{
+    for (std::size_t i = 0; i < models_.size(); ++i) {
+        if (models_[i]->splines->inBounds(mass, maxIsotope, numSulfur)) return (int) i;
+    }
+    return NONE;
+}
+
+int SplineModelRegistry::routeFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                                       int precursorSulfurs, int fragmentSulfurs) const
+{
+    int maxIsolated, complementSulfurs;
+    if (!FragmentIsotopes::prepare(precursorMass, fragmentMass, isolatedIsotopes, precursorSulfurs, fragmentSulfurs,
+                                   maxIsolated, complementSulfurs)) {
+        return NONE;
+    }
+
+    for (std::size_t i = 0; i < models_.size(); ++i) {
+        const IsotopeSplineModel &splines = *models_[i]->splines;
+        if (splines.inBounds(fragmentMass, maxIsolated, fragmentSulfurs)
+            && splines.inBounds(precursorMass - fragmentMass, maxIsolated, complementSulfurs)) {
+            return (int) i;
+        }
+    }
+    return NONE;
+}
+
+void SplineModelRegistry::count(int route) const
+{
+    static Metrics::Counter &missCounter = Metrics::counter("spline_misses");
+    if (route == NONE) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        missCounter.add();
+    } else {
+        models_[route]->hits.fetch_add(1, std::memory_order_relaxed);
+        models_[route]->counter->add();
+    }
+}
+
+bool SplineModelRegistry::estimate(double mass, int maxIsotope, int numSulfur, double *probabilities) const
+{
+    int i = route(mass, maxIsotope, numSulfur);
+    count(i);
+    return i != NONE && models_[i]->splines->estimate(mass, maxIsotope, numSulfur, probabilities);
+}
+
+bool SplineModelRegistry::estimateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                                           int precursorSulfurs, int fragmentSulfurs, double *probabilities) const
+{
+    int i = routeFragment(precursorMass, fragmentMass, isolatedIsotopes, precursorSulfurs, fragmentSulfurs);
+    count(i);
+    return i != NONE && models_[i]->splines->estimateFragment(precursorMass, fragmentMass, isolatedIsotopes,
+                                                              precursorSulfurs, fragmentSulfurs, probabilities);
+}
+
+std::size_t SplineModelRegistry::estimateFragments(double precursorMass, int precursorSulfurs,
+                                                   const double *fragmentMasses, const int *fragmentSulfurs,
+                                                   std::size_t n, std::uint64_t isolatedIsotopes,
+                                                   double *probabilities, bool *estimated) const
+{
+    // the fragments routed to each model
+    std::vector<std::vector<std::size_t> > routed(models_.size());
+    for (std::size_t q = 0; q < n; ++q) {
+        int fragmentSulfur = fragmentSulfurs == NULL ? AVERAGE : fragmentSulfurs[q];
+        int i = routeFragment(precursorMass, fragmentMasses[q], isolatedIsotopes, precursorSulfurs, fragmentSulfur);
+        count(i);
+        estimated[q] = false;
+        if (i != NONE) routed[i].push_back(q);
+    }
+
+    // gathered into a batch per model and scattered back
+    const std::size_t width = isolatedIsotopes == 0 ? 0 : IsolationMask(isolatedIsotopes).max() + 1;
+    std::vector<double> masses, rows;
+    std::vector<int> sulfurs;
+    std::unique_ptr<bool[]> done(new bool[n]);
+    std::size_t numEstimated = 0;
+    for (std::size_t i = 0; i < routed.size(); ++i) {
+        const std::vector<std::size_t> &members = routed[i];
+        if (members.empty()) continue;
+
+        masses.resize(members.size());
+        sulfurs.resize(members.size());
+        rows.resize(members.size() * width);
+        for (std::size_t m = 0; m < members.size(); ++m) {
+            masses[m] = fragmentMasses[members[m]];
+            sulfurs[m] = fragmentSulfurs == NULL ? AVERAGE : fragmentSulfurs[members[m]];
+        }
+        numEstimated += models_[i]->splines->estimateFragments(precursorMass, precursorSulfurs, masses.data(),
+                                                               sulfurs.data(), members.size(), isolatedIsotopes,
+                                                               rows.data(), done.get());
+        for (std::size_t m = 0; m < members.size(); ++m) {
+            if (!done[m]) continue;
+            estimated[members[m]] = true;
+            std::copy(rows.begin() + m * width, rows.begin() + (m + 1) * width, probabilities + members[m] * width);
+        }
+    }
+    return numEstimated;
+}
+
+bool SplineModelRegistry::estimateEnvelope(double mass, int numSulfur, double threshold,
+                                           IsotopeEnvelope &envelope) const
+{
+    int i = 0;
+    while (i < (int) models_.size() && !models_[i]->splines->estimateEnvelope(mass, numSulfur, threshold, envelope)) {
+        ++i;
+    }
+    if (i == (int) models_.size()) i = NONE;
+    count(i);
+    return i != NONE;
+}
@@ -0,0 +1,104 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_SPLINEMODELREGISTRY_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_SPLINEMODELREGISTRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "IsotopeSplineModel.h"
+#include "Metrics.h"
+
+/**
+ * Several spline model files loaded at once, e.g. the 10 kDa, 21 isotope and the 100 kDa, 101 isotope models, with
+ * every query routed to the smallest model that covers it. Bottom-up fragments then stay on the small model's
+ * coefficients, which fit in cache, and only top-down queries read the large ones.
+ *
+ * Models are ordered by coefficientBytes(). A query goes to the first model whose mass, isotope and sulfur range
+ * holds it, for a fragment query both the fragment and its complement at the highest isolated isotope. The
+ * queries each model answered are counted per registry and in the "spline_hits_<file name>" Metrics counters,
+ * queries no model covers in "spline_misses".
+ *
+ * Add every model before the first query; the queries are thread-safe.
+ */
+class SplineModelRegistry {
+
+public:
+
+    static const int AVERAGE = IsotopeSplineModel::AVERAGE;
+    static const int NONE = -1;     // route result when no model covers a query
+
+    SplineModelRegistry() : misses_(0) {}
+
+    /**
+     * Loads a spline model file in layout and inserts it by size.
+     * @throws std::runtime_error if path cannot be read or is not a spline model file
+     */
+    void add(const std::string &path, IsotopeSplineModel::Layout layout = IsotopeSplineModel::SEPARATE);
+
+    std::size_t size() const { return models_.size(); }
+
+    // the models in routing order, smallest first
+    const IsotopeSplineModel& model(std::size_t i) const { return *models_[i]->splines; }
+
+    const std::string& path(std::size_t i) const { return models_[i]->path; }
+
+    // queries answered by model i so far
+    std::uint64_t hits(std::size_t i) const { return models_[i]->hits.load(std::memory_order_relaxed); }
+
+    // queries no model covered
+    std::uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    // index of the smallest model covering isotopes 0 to maxIsotope at mass, NONE if there is none
+    int route(double mass, int maxIsotope, int numSulfur) const;
+
+    // index of the smallest model covering the fragment and its complement, NONE if none does or the query is invalid
+    int routeFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                      int precursorSulfurs, int fragmentSulfurs) const;
+
+    // IsotopeSplineModel::estimate on the routed model, false if no model covers the query
+    bool estimate(double mass, int maxIsotope, int numSulfur, double *probabilities) const;
+
+    // IsotopeSplineModel::estimateFragment on the routed model, false if no model covers the query
+    bool estimateFragment(double precursorMass, double fragmentMass, std::uint64_t isolatedIsotopes,
+                          int precursorSulfurs, int fragmentSulfurs, double *probabilities) const;
+
+    /**
+     * IsotopeSplineModel::estimateFragments with every fragment on its routed model, for the fragments of one
+     * precursor. Each model conditions the fragments routed to it as one batch. Rows of fragments no model covers
+     * are unchanged and their estimated[q] is false.
+     * @return the number of fragments estimated
+     */
+    std::size_t estimateFragments(double precursorMass, int precursorSulfurs, const double *fragmentMasses,
+                                  const int *fragmentSulfurs, std::size_t n, std::uint64_t isolatedIsotopes,
+                                  double *probabilities, bool *estimated) const;
+
+    /**
+     * IsotopeSplineModel::estimateEnvelope on the smallest model whose isotopes hold the whole envelope. A model
+     * with too few isotopes for the mass fails on its own, the query then moves on to the next one.
+     * @return false if no model holds the envelope, envelope is unchanged
+     */
+    bool estimateEnvelope(double mass, int numSulfur, double threshold, IsotopeEnvelope &envelope) const;
+
+private:
+
+    struct Entry {
+        std::string path;
+        std::unique_ptr<IsotopeSplineModel> splines;
+        std::size_t bytes;
+        Metrics::Counter *counter;
+        mutable std::atomic<std::uint64_t> hits;
+
+        Entry() : bytes(0), counter(NULL), hits(0) {}
+    };
+
+    // counts a routed query
+    void count(int route) const;
+
+    std::vector<std::unique_ptr<Entry> > models_;
+    mutable std::atomic<std::uint64_t> misses_;
+};
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_SPLINEMODELREGISTRY_H
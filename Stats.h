@@ -6,10 +6,24 @@
 #define EXAMPLE_PROJECT_USING_OPENMS_STATS_H
 
 #include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <algorithm>
 
 class Stats {
 
 public:
+    /**
+     * Statistics computed together in a single pass by scoreDistributions.
+     */
+    struct DistributionScores
+    {
+        double chiSquared;
+        double totalVariation;
+        double pearson;
+    };
+
     template <typename IteratorType1, typename IteratorType2>
     static double totalVariationDistance(IteratorType1 begin_a, IteratorType1 end_a, IteratorType2 begin_b, IteratorType2 end_b)
     {
@@ -40,57 +54,234 @@ public:
         return sum;
     }
 
-    static double computeX2(const std::vector<std::pair<double, double> > &obsDist,
-                     const std::vector<std::pair<double, double> > &theoDist)
+    /**
+     * Chi-squared statistic computed in place over two arrays of proportions or <mz, proportion> pairs.
+     * The shorter array is treated as if it were padded with zeros to the length of the longer one.
+     * @param obs observed proportions
+     * @param num_obs number of observed entries
+     * @param theo theoretical (expected) proportions
+     * @param num_theo number of theoretical entries
+     * @return chi-squared statistic, skipping entries with an expected value of 0. Sums in float if both arrays
+     * are float (the float spline estimates), in double otherwise.
+     */
+    template <typename T1, typename T2>
+    static double chiSquared(const T1 *obs, std::size_t num_obs, const T2 *theo, std::size_t num_theo)
     {
-        //vector to hold observed proportions
-        std::vector<double> obsProp;
-        //vector to hold theoretical proportions
-        std::vector<double> theoProp;
-
-        //fill proportions vectors from distribution parameters
-        for (int i = 0; i < obsDist.size() && i < theoDist.size(); ++i) {
-            obsProp.push_back(obsDist[i].second);
-            theoProp.push_back(theoDist[i].second);
+        typedef typename Accumulate<T1, T2>::type Real;
+        const std::size_t common = std::min(num_obs, num_theo);
+        Real sum = 0;
+        for (std::size_t i = 0; i < common; ++i)
+        {
+            sum += chiSquaredTerm<Real>(intensity(obs[i]), intensity(theo[i]));
         }
-        for (int i = obsProp.size(); i < theoDist.size(); i++) {
-            obsProp.push_back(0);
-            theoProp.push_back(theoDist[i].second);
+        // observed distribution is shorter, pad it with 0
+        for (std::size_t i = common; i < num_theo; ++i)
+        {
+            sum += chiSquaredTerm<Real>(0, intensity(theo[i]));
         }
-        for (int i = obsProp.size(); i < obsDist.size(); i++) {
-            obsProp.push_back(obsDist[i].second);
-            theoProp.push_back(0);
+        // theoretical entries beyond num_theo are 0 and contribute nothing
+        return sum;
+    }
+
+    /**
+     * Total variation distance computed in place over two arrays of proportions or <mz, proportion> pairs.
+     * The shorter array is treated as if it were padded with zeros.
+     */
+    template <typename T1, typename T2>
+    static double totalVariationDistance(const T1 *a, std::size_t num_a, const T2 *b, std::size_t num_b)
+    {
+        const std::size_t common = std::min(num_a, num_b);
+        typename Accumulate<T1, T2>::type sum = 0;
+        for (std::size_t i = 0; i < common; ++i)
+        {
+            sum += std::abs(intensity(a[i]) - intensity(b[i]));
+        }
+        for (std::size_t i = common; i < num_a; ++i)
+        {
+            sum += std::abs(intensity(a[i]));
         }
+        for (std::size_t i = common; i < num_b; ++i)
+        {
+            sum += std::abs(intensity(b[i]));
+        }
+        return sum;
+    }
 
-        //compute chi squared statistic
-        return Stats::chiSquared(obsProp.begin(), obsProp.end(),
-                                 theoProp.begin(), theoProp.end());
+    /**
+     * Computes chi-squared, total variation distance and the Pearson correlation coefficient of two
+     * distributions in one pass, without copying them. Unequal lengths are padded with zeros as in computeX2.
+     * @param obs observed proportions or <mz, proportion> pairs
+     * @param num_obs number of observed entries
+     * @param theo theoretical proportions or <mz, proportion> pairs
+     * @param num_theo number of theoretical entries
+     * @return the three statistics. pearson is NaN if either distribution has zero variance.
+     */
+    template <typename T1, typename T2>
+    static DistributionScores scoreDistributions(const T1 *obs, std::size_t num_obs, const T2 *theo, std::size_t num_theo)
+    {
+        const std::size_t common = std::min(num_obs, num_theo);
+        ScoreAccumulator<typename Accumulate<T1, T2>::type> acc;
+
+        for (std::size_t i = 0; i < common; ++i)
+        {
+            acc.add(intensity(obs[i]), intensity(theo[i]));
+        }
+        for (std::size_t i = common; i < num_theo; ++i)
+        {
+            acc.add(0, intensity(theo[i]));
+        }
+        for (std::size_t i = common; i < num_obs; ++i)
+        {
+            acc.add(intensity(obs[i]), 0);
+        }
+
+        DistributionScores scores;
+        scores.chiSquared = acc.chi;
+        scores.totalVariation = acc.tvd;
+        scores.pearson = acc.co_oe / std::sqrt(acc.m2_o * acc.m2_e);
+
+        return scores;
     }
 
-    static double computeVD(const std::vector<std::pair<double, double> > &obsDist,
+    static DistributionScores scoreDistributions(const std::vector<std::pair<double, double> > &obsDist,
+                                                 const std::vector<std::pair<double, double> > &theoDist)
+    {
+        return scoreDistributions(obsDist.data(), obsDist.size(), theoDist.data(), theoDist.size());
+    }
+
+    /**
+     * Scores one observed distribution against several theoretical distributions in a single pass over the
+     * isotopes. Shorter distributions are padded with zeros as in computeX2.
+     * @param obsDist the scaled observed distribution <mz, proportion>
+     * @param theoDists the theoretical distributions, one per model
+     * @param x2 destinations for the chi-squared statistic of each model, e.g. fields of the output record
+     * @param residuals filled with observed minus theoretical proportion for each observed isotope,
+     * N values per isotope (isotope-major)
+     * @param completeFlag set to true if every observed isotope was matched to a peak
+     * @param completeAtDepth set to the number of leading observed isotopes that were matched to a peak
+     */
+    template <std::size_t N>
+    static void scoreAgainstModels(const std::vector<std::pair<double, double> > &obsDist,
+                                   const std::vector<std::pair<double, double> > *const (&theoDists)[N],
+                                   double *const (&x2)[N],
+                                   std::vector<double> &residuals,
+                                   bool &completeFlag, int &completeAtDepth)
+    {
+        const std::size_t num_obs = obsDist.size();
+        std::size_t depth = num_obs;
+        for (std::size_t m = 0; m < N; ++m) depth = std::max(depth, theoDists[m]->size());
+
+        double sum[N] = {};
+        residuals.resize(num_obs * N);
+        completeFlag = true;
+        completeAtDepth = 0;
+
+        for (std::size_t i = 0; i < depth; ++i)
+        {
+            const double o = i < num_obs ? obsDist[i].second : 0.0;
+
+            double e[N];
+            for (std::size_t m = 0; m < N; ++m)
+            {
+                e[m] = i < theoDists[m]->size() ? (*theoDists[m])[i].second : 0.0;
+            }
+            for (std::size_t m = 0; m < N; ++m)
+            {
+                sum[m] += chiSquaredTerm(o, e[m]);
+            }
+
+            if (i < num_obs)
+            {
+                double *row = &residuals[i * N];
+                for (std::size_t m = 0; m < N; ++m)
+                {
+                    row[m] = o - e[m];
+                }
+
+                // a missing peak has an intensity of 0 (NaN if the whole distribution was missing)
+                if (o > 0) {
+                    if (completeFlag) {
+                        ++completeAtDepth;
+                    }
+                } else {
+                    completeFlag = false;
+                }
+            }
+        }
+
+        for (std::size_t m = 0; m < N; ++m)
+        {
+            *x2[m] = sum[m];
+        }
+    }
+
+    static double computeX2(const std::vector<std::pair<double, double> > &obsDist,
                      const std::vector<std::pair<double, double> > &theoDist)
     {
-        //vector to hold observed proportions
-        std::vector<double> obsProp;
-        //vector to hold theoretical proportions
-        std::vector<double> theoProp;
+        //compute chi squared statistic directly on the distribution intensities, padding the shorter one with 0
+        return Stats::chiSquared(obsDist.data(), obsDist.size(),
+                                 theoDist.data(), theoDist.size());
+    }
 
+    static double computeVD(const std::vector<std::pair<double, double> > &obsDist,
+                     const std::vector<std::pair<double, double> > &theoDist)
+    {
         //check they are both the same size
         if (obsDist.size() != theoDist.size()) {
             return -1;
         }
 
-        //fill proportions vectors from distribution parameters
-        for (int i = 0; i < obsDist.size(); ++i) {
-            obsProp.push_back(obsDist[i].second);
-            theoProp.push_back(theoDist[i].second);
+        //compute total variation distance
+        return Stats::totalVariationDistance(obsDist.data(), obsDist.size(),
+                                             theoDist.data(), theoDist.size());
+    }
+
+private:
+    // Running sums shared by the three loops of scoreDistributions
+    template <typename Real>
+    struct ScoreAccumulator
+    {
+        Real chi = 0, tvd = 0;
+        // Welford's running means and sums of squared deviations, as stable as the two-pass formula. Sums of
+        // squares (n * sum_oo - sum_o^2) would cancel for the near-equal proportions of good matches.
+        Real n = 0, mean_o = 0, mean_e = 0, m2_o = 0, m2_e = 0, co_oe = 0;
+
+        inline void add(Real o, Real e)
+        {
+            chi += chiSquaredTerm<Real>(o, e);
+            tvd += std::abs(o - e);
+            n += 1;
+            const Real delta_o = o - mean_o;
+            const Real delta_e = e - mean_e;
+            mean_o += delta_o / n;
+            mean_e += delta_e / n;
+            m2_o += delta_o * (o - mean_o);
+            m2_e += delta_e * (e - mean_e);
+            co_oe += delta_o * (e - mean_e);
         }
+    };
 
-        //compute total variation distance
-        return Stats::totalVariationDistance(obsProp.begin(), obsProp.end(),
-                                             theoProp.begin(), theoProp.end());
+    static inline double intensity(double value) { return value; }
+    static inline float intensity(float value) { return value; }
+    static inline double intensity(const std::pair<double, double> &peak) { return peak.second; }
+
+    // float only if both sides are float, so float lanes are used without losing precision on double input
+    template <typename T1, typename T2>
+    struct Accumulate { typedef double type; };
+
+    // Written without a branch so the loops above can be if-converted. An expected value of 0 contributes
+    // nothing: the divisor is bumped to 1 and the term multiplied by 0, so no division by zero occurs.
+    template <typename Real>
+    static inline Real chiSquaredTerm(Real o, Real e)
+    {
+        const Real diff = o - e;
+        const Real nonZero = e != 0;
+        return (diff * diff) / (e + (1 - nonZero)) * nonZero;
     }
 };
 
+template <>
+struct Stats::Accumulate<float, float> { typedef float type; };
+
 
 #endif //EXAMPLE_PROJECT_USING_OPENMS_STATS_H
@@ -0,0 +1,132 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+    struct ThreadBuffer {
+        std::vector<Trace::Event> events;
+        std::atomic<std::uint64_t> written;  // total events recorded, the ring holds the last RING_SIZE
+        int tid;
+
+        explicit ThreadBuffer(int tid) : events(Trace::RING_SIZE), written(0), tid(tid) {}
+    };
+
+    std::mutex &registryMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    // Buffers are never freed so the events of threads that have already finished can still be exported
+    std::vector<ThreadBuffer*> &registry()
+    {
+        static std::vector<ThreadBuffer*> buffers;
+        return buffers;
+    }
+
+    ThreadBuffer *threadBuffer()
+    {
+        static thread_local ThreadBuffer *buffer = nullptr;
+        if (buffer == nullptr) {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            buffer = new ThreadBuffer((int) registry().size() + 1);
+            registry().push_back(buffer);
+        }
+        return buffer;
+    }
+
+    void writeJSONString(std::ostream &out, const char *s)
+    {
+        out << '"';
+        for (; *s != '\0'; ++s) {
+            if (*s == '"' || *s == '\\') out << '\\';
+            out << *s;
+        }
+        out << '"';
+    }
+}
+
+void Trace::record(const char *name, std::int64_t id, std::uint64_t startNs, std::uint64_t durationNs)
+{
+    ThreadBuffer *buffer = threadBuffer();
+    std::uint64_t n = buffer->written.load(std::memory_order_relaxed);
+
+    Event &event = buffer->events[n & (RING_SIZE - 1)];
+    event.name = name;
+    event.id = id;
+    event.startNs = startNs;
+    event.durationNs = durationNs;
+
+    buffer->written.store(n + 1, std::memory_order_release);
+}
+
+bool Trace::writeChromeTrace(const std::string &path)
+{
+    std::ofstream out(path.c_str());
+    if (!out) {
+        std::cout << "Could not write trace to " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex());
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    std::uint64_t dropped = 0;
+    for (ThreadBuffer *buffer : registry()) {
+        std::uint64_t written = buffer->written.load(std::memory_order_acquire);
+        std::uint64_t begin = written > RING_SIZE ? written - RING_SIZE : 0;
+        dropped += begin;
+
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+
+        for (std::uint64_t i = begin; i < written; ++i) {
+            const Event &event = buffer->events[i & (RING_SIZE - 1)];
+
+            // trace-event timestamps are in microseconds
+            out << ",\n{\"name\":";
+            writeJSONString(out, event.name);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"ts\":" << event.startNs / 1000 << "." << (event.startNs % 1000) / 100
+                << ",\"dur\":" << event.durationNs / 1000 << "." << (event.durationNs % 1000) / 100;
+            if (event.id >= 0) {
+                out << ",\"args\":{\"id\":" << event.id << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+
+    if (dropped > 0) {
+        std::cout << "Trace ring buffers overflowed, the oldest " << dropped << " events were dropped" << std::endl;
+    }
+    return (bool) out;
+}
+
+std::string Trace::pathFromArgs(int &argc, char *argv[])
+{
+    std::string path;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
+    if (!path.empty() && !enabled()) {
+        std::cout << "Warning: built without ENABLE_TRACING, " << path << " will contain no events" << std::endl;
+    }
+    return path;
+}
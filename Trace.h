@@ -0,0 +1,111 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_TRACE_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * Scoped timers for the hot paths, exported as Chrome trace-event JSON (chrome://tracing or Perfetto).
+ *
+ * Every thread records into its own ring buffer, so recording takes no lock. When a buffer is full the oldest
+ * events are overwritten, and a long run keeps its last RING_SIZE events per thread.
+ *
+ * Scopes are only compiled in with -DENABLE_TRACING (cmake -DENABLE_TRACING=ON). Without it, TRACE_SCOPE and
+ * TRACE_SCOPE_ID expand to nothing and the hot paths carry no cost.
+ *
+ * Usage:
+ *     TRACE_SCOPE("observedDistribution");
+ *     TRACE_SCOPE_ID("spectrum", specIndex);    // id shows up as an argument, e.g. to find outlier scans
+ *     ...
+ *     Trace::writeChromeTrace(path);             // after all traced threads are done
+ */
+class Trace {
+
+public:
+
+    static const std::size_t RING_SIZE = 1 << 16;  // events kept per thread, must be a power of two
+
+    struct Event {
+        const char *name;       // string literal
+        std::int64_t id;        // -1 if none
+        std::uint64_t startNs;
+        std::uint64_t durationNs;
+    };
+
+    // Records the time from construction to destruction as one event
+    class Scope {
+
+    public:
+
+        explicit Scope(const char *name, std::int64_t id = -1)
+                : name_(name), id_(id), start_(now())
+        {
+        }
+
+        ~Scope()
+        {
+            record(name_, id_, start_, now() - start_);
+        }
+
+    private:
+
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+
+        const char *name_;
+        std::int64_t id_;
+        std::uint64_t start_;
+    };
+
+    // Nanoseconds since the first traced event of the process
+    static std::uint64_t now()
+    {
+        return (std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - epoch()).count();
+    }
+
+    static void record(const char *name, std::int64_t id, std::uint64_t startNs, std::uint64_t durationNs);
+
+    /**
+     * Writes the events of all threads to path as Chrome trace-event JSON.
+     * @return false if path cannot be written
+     */
+    static bool writeChromeTrace(const std::string &path);
+
+    /**
+     * Removes a "--trace path" option from the command line.
+     * @return the trace output path, empty if the option was not given
+     */
+    static std::string pathFromArgs(int &argc, char *argv[]);
+
+    static bool enabled()
+    {
+#ifdef ENABLE_TRACING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+
+    static std::chrono::steady_clock::time_point epoch()
+    {
+        static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        return start;
+    }
+};
+
+#ifdef ENABLE_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_ID(name, id) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name, (std::int64_t) (id))
+#else
+#define TRACE_SCOPE(name) ((void) 0)
+#define TRACE_SCOPE_ID(name, id) ((void) 0)
+#endif
+
+
+#endif //FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_TRACE_H
@@ -0,0 +1,173 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <string>
+
+#include "fragiso.h"
+#include "IsotopeSplineModel.h"
+
+// the C handle is the C++ model, nothing else is needed per model
+struct fragiso_model {
+    fragiso_model(const std::string &path, IsotopeSplineModel::Layout layout) : model(path, layout) {}
+
+    IsotopeSplineModel model;
+};
+
+namespace {
+
+    const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+    void copyError(const char *message, char *error, size_t errorSize)
+    {
+        if (error == NULL || errorSize == 0) return;
+        std::strncpy(error, message, errorSize - 1);
+        error[errorSize - 1] = '\0';
+    }
+
+    int highestIsotope(std::uint64_t isolatedIsotopes)
+    {
+        int isotope = -1;
+        for (int i = 0; i < 64; ++i) {
+            if (isolatedIsotopes & (std::uint64_t(1) << i)) isotope = i;
+        }
+        return isotope;
+    }
+
+    // fragiso_estimate_fragment for 32- or 64-bit masks
+    template <typename Mask>
+    long estimateFragments(const fragiso_model *model, const double *precursor_masses,
+                           const double *fragment_masses, const int *precursor_sulfurs,
+                           const int *fragment_sulfurs, const Mask *isolated_isotopes,
+                           size_t n, int depth, double *probabilities, int *status)
+    {
+        if (model == NULL || depth < 1 || (precursor_sulfurs == NULL) != (fragment_sulfurs == NULL)) return -1;
+        if (n > 0 && (precursor_masses == NULL || fragment_masses == NULL || isolated_isotopes == NULL
+                      || probabilities == NULL)) {
+            return -1;
+        }
+
+        const bool sulfur = precursor_sulfurs != NULL;
+        long failed = 0;
+        for (size_t q = 0; q < n; ++q) {
+            double *out = probabilities + q * (size_t) depth;
+            int maxIsolated = highestIsotope(isolated_isotopes[q]);
+            int precursorSulfurs = sulfur ? precursor_sulfurs[q] : IsotopeSplineModel::AVERAGE;
+            int fragmentSulfurs = sulfur ? fragment_sulfurs[q] : IsotopeSplineModel::AVERAGE;
+
+            int result = FRAGISO_OK;
+            if (maxIsolated < 0 || maxIsolated >= depth || !(fragment_masses[q] > 0)
+                || !(fragment_masses[q] < precursor_masses[q]) || !std::isfinite(precursor_masses[q])
+                || (sulfur && (fragmentSulfurs < 0 || fragmentSulfurs > precursorSulfurs))) {
+                result = FRAGISO_INVALID_QUERY;
+            } else if (!model->model.estimateFragment(precursor_masses[q], fragment_masses[q], isolated_isotopes[q],
+                                                      precursorSulfurs, fragmentSulfurs, out)) {
+                result = FRAGISO_OUT_OF_BOUNDS;
+            }
+
+            if (result == FRAGISO_OK) {
+                for (int i = maxIsolated + 1; i < depth; ++i) out[i] = 0;
+            } else {
+                for (int i = 0; i < depth; ++i) out[i] = NaN;
+                ++failed;
+            }
+            if (status != NULL) status[q] = result;
+        }
+        return failed;
+    }
+}
+
+extern "C" {
+
+const char *fragiso_version(void)
+{
+    return "1.1";
+}
+
+fragiso_model *fragiso_model_load(const char *path, char *error, size_t error_size)
+{
+    return fragiso_model_load_layout(path, FRAGISO_SEPARATE_SPLINES, error, error_size);
+}
+
+fragiso_model *fragiso_model_load_layout(const char *path, int layout, char *error, size_t error_size)
+{
+    if (path == NULL) {
+        copyError("No spline file path given", error, error_size);
+        return NULL;
+    }
+    if (layout != FRAGISO_SEPARATE_SPLINES && layout != FRAGISO_SHARED_GRID) {
+        copyError("Unknown model layout", error, error_size);
+        return NULL;
+    }
+    try {
+        return new fragiso_model(path, layout == FRAGISO_SHARED_GRID ? IsotopeSplineModel::SHARED
+                                                                     : IsotopeSplineModel::SEPARATE);
+    } catch (std::exception& e) {
+        copyError(e.what(), error, error_size);
+    } catch (...) {
+        copyError("Unknown error", error, error_size);
+    }
+    return NULL;
+}
+
+void fragiso_model_free(fragiso_model *model)
+{
+    delete model;
+}
+
+int fragiso_model_max_isotope(const fragiso_model *model)
+{
+    return model == NULL ? -1 : model->model.maxIsotope();
+}
+
+int fragiso_model_max_sulfur(const fragiso_model *model)
+{
+    return model == NULL ? -1 : model->model.maxSulfur();
+}
+
+long fragiso_estimate(const fragiso_model *model, const double *masses, const int *sulfurs,
+                      size_t n, int max_isotope, double *probabilities, int *status)
+{
+    if (model == NULL || (n > 0 && (masses == NULL || probabilities == NULL)) || max_isotope < 0) return -1;
+
+    const size_t width = (size_t) max_isotope + 1;
+    long failed = 0;
+    for (size_t q = 0; q < n; ++q) {
+        double *out = probabilities + q * width;
+        int numSulfur = sulfurs == NULL ? IsotopeSplineModel::AVERAGE : sulfurs[q];
+
+        int result = FRAGISO_OK;
+        if (numSulfur < IsotopeSplineModel::AVERAGE || !std::isfinite(masses[q])) {
+            result = FRAGISO_INVALID_QUERY;
+        } else if (!model->model.estimate(masses[q], max_isotope, numSulfur, out)) {
+            result = FRAGISO_OUT_OF_BOUNDS;
+        }
+
+        if (result != FRAGISO_OK) {
+            for (size_t i = 0; i < width; ++i) out[i] = NaN;
+            ++failed;
+        }
+        if (status != NULL) status[q] = result;
+    }
+    return failed;
+}
+
+long fragiso_estimate_fragment(const fragiso_model *model, const double *precursor_masses,
+                               const double *fragment_masses, const int *precursor_sulfurs,
+                               const int *fragment_sulfurs, const uint32_t *isolated_isotopes,
+                               size_t n, int depth, double *probabilities, int *status)
+{
+    return estimateFragments(model, precursor_masses, fragment_masses, precursor_sulfurs, fragment_sulfurs,
+                             isolated_isotopes, n, depth, probabilities, status);
+}
+
+long fragiso_estimate_fragment64(const fragiso_model *model, const double *precursor_masses,
+                                 const double *fragment_masses, const int *precursor_sulfurs,
+                                 const int *fragment_sulfurs, const uint64_t *isolated_isotopes,
+                                 size_t n, int depth, double *probabilities, int *status)
+{
+    return estimateFragments(model, precursor_masses, fragment_masses, precursor_sulfurs, fragment_sulfurs,
+                             isolated_isotopes, n, depth, probabilities, status);
+}
+
+}
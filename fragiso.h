@@ -0,0 +1,108 @@
+#ifndef FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_FRAGISO_H
+#define FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_FRAGISO_H
+
+/*
+ * libfragiso: fragment isotope distribution estimation from the spline models, with a C interface for use from
+ * other languages (Java through JNA/Panama, Python through ctypes/cffi, ...).
+ *
+ * A model is loaded once from a spline file (misc/IsotopeSplines_*.xml) and is read-only afterwards, so it can be
+ * shared by any number of threads. The estimate functions work on batches of plain arrays. A query that falls
+ * outside the masses, isotopes or sulfur counts the model was trained on gets NaN probabilities and a
+ * FRAGISO_OUT_OF_BOUNDS status.
+ *
+ *     fragiso_model *model = fragiso_model_load("IsotopeSplines_10kDa_21isotopes.xml", NULL, 0);
+ *     double probabilities[3 * n];
+ *     fragiso_estimate_fragment(model, precursorMasses, fragmentMasses, NULL, NULL, isolated, n, 3,
+ *                               probabilities, NULL);
+ *     fragiso_model_free(model);
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(FRAGISO_BUILD)
+#define FRAGISO_API __declspec(dllexport)
+#elif defined(_WIN32)
+#define FRAGISO_API __declspec(dllimport)
+#else
+#define FRAGISO_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAGISO_VERSION_MAJOR 1
+#define FRAGISO_VERSION_MINOR 1
+
+/* number of sulfur atoms that selects the average (sulfur-unaware) model */
+#define FRAGISO_AVERAGE_MODEL (-1)
+
+enum fragiso_status {
+    FRAGISO_OK = 0,
+    FRAGISO_OUT_OF_BOUNDS = 1,
+    FRAGISO_INVALID_QUERY = 2
+};
+
+/* how a loaded model keeps its splines in memory, see fragiso_model_load_layout */
+enum fragiso_layout {
+    FRAGISO_SEPARATE_SPLINES = 0,   /* one spline per isotope, as in the file */
+    FRAGISO_SHARED_GRID = 1         /* all isotopes of a sulfur count on one knot grid, about 3 times faster for 21
+                                       or more isotopes and 10 times the memory */
+};
+
+typedef struct fragiso_model fragiso_model;
+
+/* "major.minor" of the loaded library */
+FRAGISO_API const char *fragiso_version(void);
+
+/*
+ * Loads a spline model file. Returns NULL on failure and, if error is not NULL, writes a message of at most
+ * error_size bytes (including the terminating 0) to it.
+ */
+FRAGISO_API fragiso_model *fragiso_model_load(const char *path, char *error, size_t error_size);
+
+/* fragiso_model_load with a fragiso_layout, fragiso_model_load uses FRAGISO_SEPARATE_SPLINES (since 1.1) */
+FRAGISO_API fragiso_model *fragiso_model_load_layout(const char *path, int layout, char *error, size_t error_size);
+
+FRAGISO_API void fragiso_model_free(fragiso_model *model);
+
+/* highest isotope the model can estimate */
+FRAGISO_API int fragiso_model_max_isotope(const fragiso_model *model);
+
+/* highest sulfur count with a sulfur-specific model, -1 if there are none */
+FRAGISO_API int fragiso_model_max_sulfur(const fragiso_model *model);
+
+/*
+ * Isotope distributions of n molecules (e.g. precursors): probabilities of isotopes 0 to max_isotope of masses[q]
+ * are written to probabilities[q * (max_isotope + 1) ...]. sulfurs may be NULL to use the average model.
+ * status may be NULL, otherwise status[q] receives a fragiso_status.
+ * Returns the number of queries that were not FRAGISO_OK, or -1 if an argument is invalid.
+ */
+FRAGISO_API long fragiso_estimate(const fragiso_model *model, const double *masses, const int *sulfurs,
+                                  size_t n, int max_isotope, double *probabilities, int *status);
+
+/*
+ * Fragment isotope distributions conditioned on the isolated precursor isotopes: bit i of isolated_isotopes[q]
+ * is set if precursor isotope Mi was isolated. Probabilities of fragment isotopes 0 to depth - 1, renormalized
+ * to sum to 1, are written to probabilities[q * depth ...]. depth must be at least one more than the highest
+ * isolated isotope; entries beyond the highest isolated isotope are 0.
+ * precursor_sulfurs and fragment_sulfurs must both be NULL (average model) or both be given.
+ * Returns the number of queries that were not FRAGISO_OK, or -1 if an argument is invalid.
+ */
+FRAGISO_API long fragiso_estimate_fragment(const fragiso_model *model, const double *precursor_masses,
+                                           const double *fragment_masses, const int *precursor_sulfurs,
+                                           const int *fragment_sulfurs, const uint32_t *isolated_isotopes,
+                                           size_t n, int depth, double *probabilities, int *status);
+
+/* fragiso_estimate_fragment with 64-bit masks, for precursors isolated past M31 (since 1.1) */
+FRAGISO_API long fragiso_estimate_fragment64(const fragiso_model *model, const double *precursor_masses,
+                                             const double *fragment_masses, const int *precursor_sulfurs,
+                                             const int *fragment_sulfurs, const uint64_t *isolated_isotopes,
+                                             size_t n, int depth, double *probabilities, int *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAGMENT_ISOTOPE_DISTRIBUTION_PAPER_FRAGISO_H */
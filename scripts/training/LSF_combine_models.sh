@@ -10,4 +10,5 @@ module load python/2.7.1
 
 source ../config.sh
 
-python ${SOURCE_DIR}/scripts/training/combineModels.py $SPLINE_OUT_DIR $MAX_ISOTOPE_DEPTH $MAX_SULFUR > ${SPLINE_OUT_DIR}"/IsotopeSplines.xml"
\ No newline at end of file
+python ${SOURCE_DIR}/scripts/training/combineModels.py $SPLINE_OUT_DIR $MAX_ISOTOPE_DEPTH $MAX_SULFUR > ${SPLINE_OUT_DIR}"/IsotopeSplines.xml"
+${BUILD_DIR}/ConvertSplineModel ${SPLINE_OUT_DIR}"/IsotopeSplines.xml" ${SPLINE_OUT_DIR}"/IsotopeSplines_shared.xml"
\ No newline at end of file